@@ -0,0 +1,39 @@
+// Static lighting from the bake, see lightmapBaker.h and bakedLighting.h for the CPU side.
+// Holds the ambient and diffuse light of the directional light and the static point lights.
+// Needs lighting.glsl included first.
+
+uniform sampler2D lightmap;
+uniform sampler3D lightProbes;  // six texels per probe along x: +X, -X, +Y, -Y, +Z, -Z
+uniform vec3 probeCount;
+uniform vec3 probeMin;
+uniform vec3 probeMax;
+
+// ambient cube lookup, each axis weighted by how much the normal faces it
+vec3 fetchProbe(ivec3 probe, vec3 norm) {
+    ivec3 texel = ivec3(probe.x * 6, probe.y, probe.z);
+    ivec3 side = ivec3(lessThan(norm, vec3(0.0)));
+    vec3 weights = norm * norm;
+    return weights.x * texelFetch(lightProbes, texel + ivec3(side.x, 0, 0), 0).rgb +
+           weights.y * texelFetch(lightProbes, texel + ivec3(2 + side.y, 0, 0), 0).rgb +
+           weights.z * texelFetch(lightProbes, texel + ivec3(4 + side.z, 0, 0), 0).rgb;
+}
+
+// trilinear blend of the eight probes around worldPos
+vec3 sampleProbes(vec3 worldPos, vec3 norm) {
+    vec3 grid = clamp((worldPos - probeMin) / (probeMax - probeMin), 0.0, 1.0) * (probeCount - 1.0);
+    ivec3 base = min(ivec3(grid), ivec3(probeCount) - 2);
+    vec3 f = grid - vec3(base);
+    vec3 result = vec3(0.0);
+    for (int i = 0; i < 8; i++) {
+        ivec3 corner = ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+        vec3 w = mix(1.0 - f, f, vec3(corner));
+        result += w.x * w.y * w.z * fetchProbe(base + corner, norm);
+    }
+    return result;
+}
+
+// surfaces without lightmap coordinates fall back to the probes
+vec3 calcBakedLighting(vec2 lightmapCoords, vec3 worldPos, vec3 norm, Surface surface) {
+    vec3 irradiance = lightmapCoords.x < 0.0 ? sampleProbes(worldPos, norm) : texture(lightmap, lightmapCoords).rgb;
+    return irradiance * surface.albedo;
+}
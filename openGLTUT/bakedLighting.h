@@ -0,0 +1,154 @@
+//
+//  bakedLighting.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-28.
+//
+
+#ifndef bakedLighting_h
+#define bakedLighting_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "shader.h"
+#include "model.h"
+#include "lightmapBaker.h"
+
+// GPU side of a bake written by LightmapBaker: the lightmap as a 2D texture, the probe grid as
+// a 3D texture six texels wide per probe, and the lightmap coordinates pushed into the model's
+// vertices. Sampled by bakedLighting.glsl when the shader is built with BAKED_LIGHTING.
+// The spherical harmonics probes get a 3D texture of their own for shAmbient.glsl (SH_AMBIENT).
+class BakedLighting {
+public:
+    BakedLighting()
+        : mLightmap(0), mProbes(0), mSHProbes(0), mProbeCount(0.0f), mProbeMin(0.0f), mProbeMax(0.0f) {
+    }
+
+    ~BakedLighting() {
+        if (mLightmap != 0) {
+            glDeleteTextures(1, &mLightmap);
+            glDeleteTextures(1, &mProbes);
+            glDeleteTextures(1, &mSHProbes);
+        }
+    }
+
+    BakedLighting(const BakedLighting&) = delete;
+    BakedLighting& operator=(const BakedLighting&) = delete;
+
+    // read path and apply it to model, which must be the model it was baked from
+    bool load(const std::string& path, Model& model) {
+        LightmapBake bake;
+        if (!bake.load(path)) {
+            return false;
+        }
+        const std::vector<Mesh>& meshes = model.meshes();
+        bool matches = bake.meshCoords.size() == meshes.size();
+        for (size_t i = 0; matches && i < meshes.size(); i++) {
+            matches = bake.meshCoords[i].size() == meshes[i].mVerticies.size() + bake.meshSeamSources[i].size() &&
+                      bake.meshIndices[i].size() == meshes[i].mIndicies.size();
+        }
+        if (!matches) {
+            std::cerr << "ERROR::BAKE::MODEL_MISMATCH " << path << " was baked from a different model" << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < meshes.size(); i++) {
+            model.setLightmapCoords(i, bake.meshCoords[i], bake.meshSeamSources[i], bake.meshIndices[i]);
+        }
+
+        if (mLightmap == 0) {
+            glGenTextures(1, &mLightmap);
+            glGenTextures(1, &mProbes);
+            glGenTextures(1, &mSHProbes);
+        }
+        glBindTexture(GL_TEXTURE_2D, mLightmap);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, bake.resolution, bake.resolution, 0, GL_RGB, GL_FLOAT,
+                     bake.lightmap.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // the shader blends probes itself, the six faces of a probe must not be filtered together
+        glBindTexture(GL_TEXTURE_3D, mProbes);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, bake.probeCount.x * 6, bake.probeCount.y, bake.probeCount.z, 0,
+                     GL_RGB, GL_FLOAT, bake.probes.data());
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        uploadSHProbes(bake);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        mProbeCount = glm::vec3(bake.probeCount.x, bake.probeCount.y, bake.probeCount.z);
+        mProbeMin = bake.probeMin;
+        mProbeMax = bake.probeMax;
+        std::cout << "loaded bake " << path << ": " << bake.resolution << "x" << bake.resolution << " lightmap, "
+                  << bake.probeCount.x << "x" << bake.probeCount.y << "x" << bake.probeCount.z << " probes" << std::endl;
+        return true;
+    }
+
+    bool loaded() const {
+        return mLightmap != 0;
+    }
+
+    void bind(const Shader& shader, unsigned int lightmapUnit, unsigned int probeUnit, unsigned int shUnit) const {
+        glActiveTexture(GL_TEXTURE0 + lightmapUnit);
+        glBindTexture(GL_TEXTURE_2D, mLightmap);
+        shader.setInt("lightmap", lightmapUnit);
+        glActiveTexture(GL_TEXTURE0 + probeUnit);
+        glBindTexture(GL_TEXTURE_3D, mProbes);
+        shader.setInt("lightProbes", probeUnit);
+        glActiveTexture(GL_TEXTURE0 + shUnit);
+        glBindTexture(GL_TEXTURE_3D, mSHProbes);
+        shader.setInt("shProbes", shUnit);
+        glActiveTexture(GL_TEXTURE0);
+
+        shader.setVec3("probeCount", mProbeCount);
+        shader.setVec3("probeMin", mProbeMin);
+        shader.setVec3("probeMax", mProbeMax);
+        shader.setVec3("shProbeCount", mProbeCount);
+        shader.setVec3("shProbeMin", mProbeMin);
+        shader.setVec3("shProbeMax", mProbeMax);
+    }
+
+private:
+    unsigned int mLightmap;
+    unsigned int mProbes;
+    unsigned int mSHProbes;
+    glm::vec3 mProbeCount;
+    glm::vec3 mProbeMin;
+    glm::vec3 mProbeMax;
+
+    // Each probe's 27 coefficients are split over seven RGBA texels, texel i going into slab i.
+    // Filtering is linear, the shader keeps its lookups inside one slab.
+    void uploadSHProbes(const LightmapBake& bake) {
+        glm::ivec3 count = bake.probeCount;
+        size_t probeTotal = static_cast<size_t>(count.x) * count.y * count.z;
+        std::vector<float> texels(probeTotal * 7 * 4, 0.0f);
+        for (size_t probe = 0; probe < probeTotal; probe++) {
+            const float* coefficients = &bake.shProbes[probe * 9].x;
+            for (int i = 0; i < 27; i++) {
+                size_t slab = i / 4;
+                texels[(slab * probeTotal + probe) * 4 + i % 4] = coefficients[i];
+            }
+        }
+        glBindTexture(GL_TEXTURE_3D, mSHProbes);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, count.x, count.y, count.z * 7, 0, GL_RGBA, GL_FLOAT, texels.data());
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+};
+
+#endif /* bakedLighting_h */
@@ -0,0 +1,89 @@
+//
+//  binaryIO.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-08-02.
+//
+
+#ifndef binaryIO_h
+#define binaryIO_h
+
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+// Raw reads and writes for the offline tools' files (bakes, PVS and HLOD sets). Values are
+// written as they sit in memory, arrays as a 32 bit count followed by their elements, so the
+// files are only meant for the machine that wrote them.
+
+template <typename T>
+inline void writeBinary(std::ofstream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+inline void writeBinaryArray(std::ofstream& file, const std::vector<T>& values) {
+    writeBinary(file, static_cast<uint32_t>(values.size()));
+    file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+template <typename T>
+inline bool readBinary(std::ifstream& file, T& value) {
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+// bytes left after the read position, 0 once the stream has failed
+inline size_t binaryRemaining(std::ifstream& file) {
+    std::streampos position = file.tellg();
+    if (!file || position < 0) {
+        return 0;
+    }
+    file.seekg(0, std::ios::end);
+    std::streampos end = file.tellg();
+    file.seekg(position);
+    return end > position ? static_cast<size_t>(end - position) : 0;
+}
+
+// a count longer than what is left of the file fails the stream instead of allocating it
+template <typename T>
+inline bool readBinaryArray(std::ifstream& file, std::vector<T>& values) {
+    uint32_t count = 0;
+    if (!readBinary(file, count)) {
+        return false;
+    }
+    if (count > binaryRemaining(file) / sizeof(T)) {
+        values.clear();
+        file.setstate(std::ios::failbit);
+        return false;
+    }
+    values.resize(count);
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(T)));
+}
+
+// offsets that cut an array of total elements into consecutive ranges, range i being
+// [offsets[i], offsets[i + 1]): they start at 0, never go back and end at total
+inline bool validOffsets(const std::vector<uint32_t>& offsets, size_t total) {
+    if (offsets.empty() || offsets.front() != 0 || offsets.back() != total) {
+        return false;
+    }
+    for (size_t i = 1; i < offsets.size(); i++) {
+        if (offsets[i] < offsets[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a grid of x * y * z cells, at least one along every axis, holding exactly total cells.
+// Checked by division so counts from a bad file can't overflow into a match.
+inline bool validGrid(int x, int y, int z, size_t total) {
+    if (x <= 0 || y <= 0 || z <= 0) {
+        return false;
+    }
+    size_t row = static_cast<size_t>(x);
+    size_t slice = row * static_cast<size_t>(y);
+    return static_cast<size_t>(y) <= total / row && static_cast<size_t>(z) <= total / slice &&
+           slice * static_cast<size_t>(z) == total;
+}
+
+#endif /* binaryIO_h */
@@ -0,0 +1,602 @@
+//
+//  bvh.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-29.
+//
+
+#ifndef bvh_h
+#define bvh_h
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#include "threadPool.h"
+
+// Bounding volume hierarchy over a list of axis aligned boxes, e.g. a model's meshes or the
+// triangles of a scene. Needs no GL.
+//
+// Built top down with a binned surface area heuristic. The upper levels are split on the
+// calling thread with their binning spread over the thread pool, then every remaining subtree
+// is built as a job of its own. Nodes are flattened depth first into 32 byte records, a node's
+// left child is the next node and every subtree's items are contiguous in order().
+// refit() recomputes the bounds of the same tree after items move, which is much cheaper than a
+// rebuild but lets the tree degrade if they move far. Queries are read only and thread safe.
+class Bvh {
+public:
+    struct Node {
+        glm::vec3 min;
+        // leaves: first item in order(), inner nodes: index of the right child
+        unsigned int offset;
+        glm::vec3 max;
+        // items in a leaf, 0 for inner nodes
+        unsigned int count;
+    };
+
+    Bvh()
+        : mBuildMs(0.0) {
+    }
+
+    // one box per item, the queries report items by their index in these arrays
+    void build(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, bool parallel = true) {
+        auto start = std::chrono::high_resolution_clock::now();
+        mItemMin = mins;
+        mItemMax = maxs;
+        size_t count = mItemMin.size();
+        mOrder.resize(count);
+        mCentroids.resize(count);
+        mNodes.clear();
+        if (count > 0) {
+            forRange(count, parallel, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    mOrder[i] = static_cast<unsigned int>(i);
+                    mCentroids[i] = (mItemMin[i] + mItemMax[i]) * 0.5f;
+                }
+            });
+            buildTree(parallel);
+        }
+        mCentroids.clear();
+        mCentroids.shrink_to_fit();
+        auto end = std::chrono::high_resolution_clock::now();
+        mBuildMs = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    // new boxes for the same items, the tree keeps its shape and only its bounds are updated
+    void refit(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs) {
+        mItemMin = mins;
+        mItemMax = maxs;
+        // children always come after their parent
+        for (size_t i = mNodes.size(); i-- > 0;) {
+            Node& node = mNodes[i];
+            if (node.count > 0) {
+                node.min = glm::vec3(FLT_MAX);
+                node.max = glm::vec3(-FLT_MAX);
+                for (unsigned int j = node.offset; j < node.offset + node.count; j++) {
+                    node.min = glm::min(node.min, mItemMin[mOrder[j]]);
+                    node.max = glm::max(node.max, mItemMax[mOrder[j]]);
+                }
+            } else {
+                node.min = glm::min(mNodes[i + 1].min, mNodes[node.offset].min);
+                node.max = glm::max(mNodes[i + 1].max, mNodes[node.offset].max);
+            }
+        }
+    }
+
+    size_t itemCount() const {
+        return mOrder.size();
+    }
+
+    const std::vector<Node>& nodes() const {
+        return mNodes;
+    }
+
+    const std::vector<unsigned int>& order() const {
+        return mOrder;
+    }
+
+    // CPU milliseconds the last build() took
+    double buildMs() const {
+        return mBuildMs;
+    }
+
+    // Appends the items whose boxes aren't fully behind one of the planes, as extractFrustumPlanes
+    // returns them. Planes a node is fully in front of aren't tested again below it.
+    void frustum(const glm::vec4* planes, std::vector<unsigned int>& items) const {
+        if (mNodes.empty()) {
+            return;
+        }
+        struct Entry {
+            unsigned int node;
+            unsigned int planeMask;
+        };
+        Entry stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = { 0, 0x3f };
+        while (top > 0) {
+            Entry entry = stack[--top];
+            const Node& node = mNodes[entry.node];
+            unsigned int mask = entry.planeMask;
+            if (!boxInFrustum(node.min, node.max, planes, mask)) {
+                continue;
+            }
+            if (node.count > 0) {
+                for (unsigned int i = node.offset; i < node.offset + node.count; i++) {
+                    unsigned int itemMask = mask;
+                    if (mask == 0 || boxInFrustum(mItemMin[mOrder[i]], mItemMax[mOrder[i]], planes, itemMask)) {
+                        items.push_back(mOrder[i]);
+                    }
+                }
+                continue;
+            }
+            stack[top++] = { node.offset, mask };
+            stack[top++] = { entry.node + 1, mask };
+        }
+    }
+
+    // appends the items whose boxes overlap [min, max]
+    void overlap(const glm::vec3& min, const glm::vec3& max, std::vector<unsigned int>& items) const {
+        if (mNodes.empty()) {
+            return;
+        }
+        unsigned int stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            unsigned int index = stack[--top];
+            const Node& node = mNodes[index];
+            if (!boxesOverlap(node.min, node.max, min, max)) {
+                continue;
+            }
+            if (node.count > 0) {
+                for (unsigned int i = node.offset; i < node.offset + node.count; i++) {
+                    if (boxesOverlap(mItemMin[mOrder[i]], mItemMax[mOrder[i]], min, max)) {
+                        items.push_back(mOrder[i]);
+                    }
+                }
+                continue;
+            }
+            stack[top++] = node.offset;
+            stack[top++] = index + 1;
+        }
+    }
+
+    // Walks the nodes along the ray, nearer child first, and calls hitTest(item, distance) for
+    // every item in a leaf the ray reaches. hitTest returns true and shortens distance when it
+    // hits the item closer than distance. With anyHit the walk stops at the first hit.
+    // Returns true if any item was hit, distance is then the closest hit.
+    template <typename HitTest>
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, HitTest hitTest,
+                 bool anyHit = false) const {
+        if (mNodes.empty()) {
+            return false;
+        }
+        glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        float enter = 0.0f;
+        if (!rayHitsBox(mNodes[0].min, mNodes[0].max, origin, inverseDirection, distance, enter)) {
+            return false;
+        }
+        unsigned int stack[STACK_SIZE];
+        float stackEnter[STACK_SIZE];
+        int top = 0;
+        stack[top] = 0;
+        stackEnter[top++] = enter;
+        bool found = false;
+        while (top > 0) {
+            top--;
+            // the node may have been passed by a hit found since it was pushed
+            if (stackEnter[top] > distance) {
+                continue;
+            }
+            const Node& node = mNodes[stack[top]];
+            if (node.count > 0) {
+                for (unsigned int i = node.offset; i < node.offset + node.count; i++) {
+                    if (hitTest(mOrder[i], distance)) {
+                        found = true;
+                        if (anyHit) {
+                            return true;
+                        }
+                    }
+                }
+                continue;
+            }
+            unsigned int left = stack[top] + 1;
+            unsigned int right = node.offset;
+            float leftEnter = 0.0f;
+            float rightEnter = 0.0f;
+            bool hitsLeft = rayHitsBox(mNodes[left].min, mNodes[left].max, origin, inverseDirection, distance, leftEnter);
+            bool hitsRight = rayHitsBox(mNodes[right].min, mNodes[right].max, origin, inverseDirection, distance, rightEnter);
+            // push the further child first so the nearer one is popped first
+            if (hitsLeft && hitsRight && leftEnter < rightEnter) {
+                stack[top] = right;
+                stackEnter[top++] = rightEnter;
+                stack[top] = left;
+                stackEnter[top++] = leftEnter;
+            } else {
+                if (hitsLeft) {
+                    stack[top] = left;
+                    stackEnter[top++] = leftEnter;
+                }
+                if (hitsRight) {
+                    stack[top] = right;
+                    stackEnter[top++] = rightEnter;
+                }
+            }
+        }
+        return found;
+    }
+
+    // nearest item box along the ray within distance, for picking
+    bool raycastBoxes(const glm::vec3& origin, const glm::vec3& direction, float& distance, unsigned int& item) const {
+        glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        return raycast(origin, direction, distance, [&](unsigned int candidate, float& closest) {
+            float enter = 0.0f;
+            if (!rayHitsBox(mItemMin[candidate], mItemMax[candidate], origin, inverseDirection, closest, enter)) {
+                return false;
+            }
+            closest = enter;
+            item = candidate;
+            return true;
+        });
+    }
+
+    // the same box test the traversal uses, enter is where the ray goes into the box
+    static bool rayHitsBox(const glm::vec3& min, const glm::vec3& max, const glm::vec3& origin,
+                           const glm::vec3& inverseDirection, float maxDistance, float& enter) {
+        glm::vec3 t0 = (min - origin) * inverseDirection;
+        glm::vec3 t1 = (max - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        return enter <= exit;
+    }
+
+private:
+    static const unsigned int BIN_COUNT = 16;
+    // leaves hold at most this many items unless their centroids can't be told apart
+    static const unsigned int MAX_LEAF_SIZE = 8;
+    // deeper nodes become leaves so the traversal stacks can't overflow
+    static const unsigned int MAX_DEPTH = 60;
+    static const int STACK_SIZE = 64;
+    // ranges at least this big are binned across the thread pool
+    static const size_t PARALLEL_RANGE = 1 << 14;
+    // ranges smaller than this aren't split up further before handing them out as jobs
+    static const size_t MIN_JOB_SIZE = 1 << 10;
+    // cost of visiting a node relative to testing an item
+    static constexpr float TRAVERSAL_COST = 1.0f;
+
+    // a node while the tree is built, children are indices into the same vector
+    struct BuildNode {
+        glm::vec3 min;
+        glm::vec3 max;
+        unsigned int begin;
+        unsigned int end;
+        unsigned int depth;
+        int left;
+        int right;
+        // the subtree built by this job replaces the node, -1 if there is none
+        int job;
+    };
+
+    struct Bin {
+        glm::vec3 min;
+        glm::vec3 max;
+        unsigned int count;
+    };
+
+    struct Bins {
+        Bin bins[3][BIN_COUNT];
+        glm::vec3 centroidMin;
+        glm::vec3 centroidMax;
+    };
+
+    std::vector<glm::vec3> mItemMin;
+    std::vector<glm::vec3> mItemMax;
+    std::vector<glm::vec3> mCentroids;
+    std::vector<unsigned int> mOrder;
+    std::vector<Node> mNodes;
+    double mBuildMs;
+
+    template <typename Fn>
+    static void forRange(size_t count, bool parallel, const Fn& fn) {
+        if (parallel) {
+            ThreadPool::instance().parallelFor(count, 4096, fn);
+        } else {
+            fn(0, count);
+        }
+    }
+
+    static float halfArea(const glm::vec3& min, const glm::vec3& max) {
+        glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    static bool boxesOverlap(const glm::vec3& aMin, const glm::vec3& aMax, const glm::vec3& bMin, const glm::vec3& bMax) {
+        return aMin.x <= bMax.x && aMax.x >= bMin.x && aMin.y <= bMax.y && aMax.y >= bMin.y &&
+               aMin.z <= bMax.z && aMax.z >= bMin.z;
+    }
+
+    // false if the box is fully behind a plane in mask, clears the planes it is fully in front of
+    static bool boxInFrustum(const glm::vec3& min, const glm::vec3& max, const glm::vec4* planes, unsigned int& mask) {
+        glm::vec3 centre = (min + max) * 0.5f;
+        glm::vec3 extent = (max - min) * 0.5f;
+        for (int p = 0; p < 6; p++) {
+            if (!(mask & (1u << p))) {
+                continue;
+            }
+            glm::vec3 normal(planes[p]);
+            float distance = glm::dot(normal, centre) + planes[p].w;
+            float radius = glm::dot(glm::abs(normal), extent);
+            if (distance + radius < 0.0f) {
+                return false;
+            }
+            if (distance - radius >= 0.0f) {
+                mask &= ~(1u << p);
+            }
+        }
+        return true;
+    }
+
+    void buildTree(bool parallel) {
+        std::vector<BuildNode> top;
+        top.push_back(makeNode(0, static_cast<unsigned int>(mOrder.size()), 0, parallel));
+
+        // split breadth first on this thread until there is enough work to share out
+        size_t wantedJobs = parallel ? ThreadPool::instance().threadCount() * 4 : 0;
+        std::vector<size_t> open = { 0 };
+        std::vector<size_t> jobs;
+        for (size_t next = 0; next < open.size(); next++) {
+            size_t index = open[next];
+            size_t size = top[index].end - top[index].begin;
+            bool enoughJobs = open.size() - next + jobs.size() >= wantedJobs;
+            if (parallel && (size < MIN_JOB_SIZE || enoughJobs)) {
+                top[index].job = static_cast<int>(jobs.size());
+                jobs.push_back(index);
+                continue;
+            }
+            if (split(top, index, parallel && size >= PARALLEL_RANGE)) {
+                open.push_back(top[index].left);
+                open.push_back(top[index].right);
+            }
+        }
+
+        // each job finishes its subtree into a vector of its own, starting with a copy of its root
+        std::vector<std::vector<BuildNode>> subtrees(jobs.size());
+        ThreadPool::instance().parallelFor(jobs.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t j = begin; j < end; j++) {
+                subtrees[j].push_back(top[jobs[j]]);
+                subtrees[j][0].job = -1;
+                buildSubtree(subtrees[j], 0);
+            }
+        });
+
+        mNodes.reserve(mOrder.size() * 2 / MAX_LEAF_SIZE + 1);
+        flatten(top, 0, subtrees);
+    }
+
+    void buildSubtree(std::vector<BuildNode>& nodes, size_t index) {
+        if (split(nodes, index, false)) {
+            // split() may reallocate nodes, read the children by index
+            int left = nodes[index].left;
+            int right = nodes[index].right;
+            buildSubtree(nodes, left);
+            buildSubtree(nodes, right);
+        }
+    }
+
+    BuildNode makeNode(unsigned int begin, unsigned int end, unsigned int depth, bool parallel) const {
+        BuildNode node = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), begin, end, depth, -1, -1, -1 };
+        if (parallel && end - begin >= PARALLEL_RANGE) {
+            size_t chunks = (end - begin + 4095) / 4096;
+            std::vector<glm::vec3> chunkMin(chunks, glm::vec3(FLT_MAX));
+            std::vector<glm::vec3> chunkMax(chunks, glm::vec3(-FLT_MAX));
+            ThreadPool::instance().parallelFor(end - begin, 4096, [&](size_t from, size_t to) {
+                for (size_t i = begin + from; i < begin + to; i++) {
+                    chunkMin[from / 4096] = glm::min(chunkMin[from / 4096], mItemMin[mOrder[i]]);
+                    chunkMax[from / 4096] = glm::max(chunkMax[from / 4096], mItemMax[mOrder[i]]);
+                }
+            });
+            for (size_t c = 0; c < chunks; c++) {
+                node.min = glm::min(node.min, chunkMin[c]);
+                node.max = glm::max(node.max, chunkMax[c]);
+            }
+            return node;
+        }
+        for (unsigned int i = begin; i < end; i++) {
+            node.min = glm::min(node.min, mItemMin[mOrder[i]]);
+            node.max = glm::max(node.max, mItemMax[mOrder[i]]);
+        }
+        return node;
+    }
+
+    static void clearBins(Bins& bins) {
+        for (int axis = 0; axis < 3; axis++) {
+            for (unsigned int b = 0; b < BIN_COUNT; b++) {
+                bins.bins[axis][b] = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), 0 };
+            }
+        }
+    }
+
+    static void mergeBins(Bins& into, const Bins& from) {
+        for (int axis = 0; axis < 3; axis++) {
+            for (unsigned int b = 0; b < BIN_COUNT; b++) {
+                Bin& bin = into.bins[axis][b];
+                bin.min = glm::min(bin.min, from.bins[axis][b].min);
+                bin.max = glm::max(bin.max, from.bins[axis][b].max);
+                bin.count += from.bins[axis][b].count;
+            }
+        }
+    }
+
+    // bin of centroid along axis, for a range whose centroids span [min, min + BIN_COUNT / scale]
+    static unsigned int binOf(float centroid, float min, float scale) {
+        int bin = static_cast<int>((centroid - min) * scale);
+        return static_cast<unsigned int>(std::min(std::max(bin, 0), static_cast<int>(BIN_COUNT) - 1));
+    }
+
+    void centroidBounds(unsigned int begin, unsigned int end, bool parallel, glm::vec3& min, glm::vec3& max) const {
+        min = glm::vec3(FLT_MAX);
+        max = glm::vec3(-FLT_MAX);
+        if (!parallel) {
+            for (unsigned int i = begin; i < end; i++) {
+                min = glm::min(min, mCentroids[mOrder[i]]);
+                max = glm::max(max, mCentroids[mOrder[i]]);
+            }
+            return;
+        }
+        size_t chunks = (end - begin + 4095) / 4096;
+        std::vector<glm::vec3> chunkMin(chunks, glm::vec3(FLT_MAX));
+        std::vector<glm::vec3> chunkMax(chunks, glm::vec3(-FLT_MAX));
+        ThreadPool::instance().parallelFor(end - begin, 4096, [&](size_t from, size_t to) {
+            for (size_t i = begin + from; i < begin + to; i++) {
+                chunkMin[from / 4096] = glm::min(chunkMin[from / 4096], mCentroids[mOrder[i]]);
+                chunkMax[from / 4096] = glm::max(chunkMax[from / 4096], mCentroids[mOrder[i]]);
+            }
+        });
+        for (size_t c = 0; c < chunks; c++) {
+            min = glm::min(min, chunkMin[c]);
+            max = glm::max(max, chunkMax[c]);
+        }
+    }
+
+    void fillBins(Bins& bins, unsigned int begin, unsigned int end, const glm::vec3& scale) const {
+        for (unsigned int i = begin; i < end; i++) {
+            unsigned int item = mOrder[i];
+            for (int axis = 0; axis < 3; axis++) {
+                Bin& bin = bins.bins[axis][binOf(mCentroids[item][axis], bins.centroidMin[axis], scale[axis])];
+                bin.min = glm::min(bin.min, mItemMin[item]);
+                bin.max = glm::max(bin.max, mItemMax[item]);
+                bin.count++;
+            }
+        }
+    }
+
+    // Splits nodes[index] at the cheapest bin boundary and appends its two children, or leaves
+    // it a leaf if that is cheaper. Returns true if it was split.
+    bool split(std::vector<BuildNode>& nodes, size_t index, bool parallel) {
+        BuildNode node = nodes[index];
+        unsigned int count = node.end - node.begin;
+        if (count <= 1 || node.depth >= MAX_DEPTH) {
+            return false;
+        }
+
+        Bins bins;
+        centroidBounds(node.begin, node.end, parallel, bins.centroidMin, bins.centroidMax);
+        glm::vec3 extent = bins.centroidMax - bins.centroidMin;
+        glm::vec3 scale(0.0f);
+        for (int axis = 0; axis < 3; axis++) {
+            scale[axis] = extent[axis] > 0.0f ? BIN_COUNT / extent[axis] : 0.0f;
+        }
+        clearBins(bins);
+        if (parallel) {
+            size_t chunks = (count + 4095) / 4096;
+            std::vector<Bins> chunkBins(chunks);
+            ThreadPool::instance().parallelFor(count, 4096, [&](size_t from, size_t to) {
+                Bins& local = chunkBins[from / 4096];
+                clearBins(local);
+                local.centroidMin = bins.centroidMin;
+                fillBins(local, node.begin + static_cast<unsigned int>(from), node.begin + static_cast<unsigned int>(to), scale);
+            });
+            for (const Bins& local : chunkBins) {
+                mergeBins(bins, local);
+            }
+        } else {
+            fillBins(bins, node.begin, node.end, scale);
+        }
+
+        // sweep every axis from both ends, the cost of a split after bin b is
+        // TRAVERSAL_COST + (area(left) * count(left) + area(right) * count(right)) / area(node)
+        float parentArea = std::max(halfArea(node.min, node.max), FLT_MIN);
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        unsigned int bestBin = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (extent[axis] <= 0.0f) {
+                continue;
+            }
+            float rightCost[BIN_COUNT];
+            glm::vec3 min(FLT_MAX);
+            glm::vec3 max(-FLT_MAX);
+            unsigned int rightCount = 0;
+            for (unsigned int b = BIN_COUNT - 1; b > 0; b--) {
+                const Bin& bin = bins.bins[axis][b];
+                min = glm::min(min, bin.min);
+                max = glm::max(max, bin.max);
+                rightCount += bin.count;
+                rightCost[b - 1] = halfArea(min, max) * rightCount;
+            }
+            min = glm::vec3(FLT_MAX);
+            max = glm::vec3(-FLT_MAX);
+            unsigned int leftCount = 0;
+            for (unsigned int b = 0; b + 1 < BIN_COUNT; b++) {
+                const Bin& bin = bins.bins[axis][b];
+                min = glm::min(min, bin.min);
+                max = glm::max(max, bin.max);
+                leftCount += bin.count;
+                if (leftCount == 0 || leftCount == count) {
+                    continue;
+                }
+                float cost = TRAVERSAL_COST + (halfArea(min, max) * leftCount + rightCost[b]) / parentArea;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        unsigned int middle;
+        if (bestAxis >= 0) {
+            if (count <= MAX_LEAF_SIZE && bestCost >= static_cast<float>(count)) {
+                return false;
+            }
+            float min = bins.centroidMin[bestAxis];
+            float axisScale = scale[bestAxis];
+            unsigned int* first = &mOrder[0] + node.begin;
+            middle = node.begin + static_cast<unsigned int>(
+                std::partition(first, first + count, [&](unsigned int item) {
+                    return binOf(mCentroids[item][bestAxis], min, axisScale) <= bestBin;
+                }) - first);
+        } else if (count > MAX_LEAF_SIZE) {
+            // every centroid is in the same place, halve the range so leaves stay small
+            middle = node.begin + count / 2;
+        } else {
+            return false;
+        }
+
+        BuildNode left = makeNode(node.begin, middle, node.depth + 1, parallel);
+        BuildNode right = makeNode(middle, node.end, node.depth + 1, parallel);
+        nodes[index].left = static_cast<int>(nodes.size());
+        nodes.push_back(left);
+        nodes[index].right = static_cast<int>(nodes.size());
+        nodes.push_back(right);
+        return true;
+    }
+
+    // appends nodes[index] and everything below it to mNodes depth first, returns its index
+    unsigned int flatten(const std::vector<BuildNode>& nodes, size_t index,
+                         const std::vector<std::vector<BuildNode>>& subtrees) {
+        const BuildNode& node = nodes[index];
+        if (node.job >= 0) {
+            return flatten(subtrees[node.job], 0, subtrees);
+        }
+        unsigned int flat = static_cast<unsigned int>(mNodes.size());
+        Node out = { node.min, node.begin, node.max, node.end - node.begin };
+        mNodes.push_back(out);
+        if (node.left >= 0) {
+            flatten(nodes, node.left, subtrees);
+            unsigned int right = flatten(nodes, node.right, subtrees);
+            mNodes[flat].offset = right;
+            mNodes[flat].count = 0;
+        }
+        return flat;
+    }
+};
+
+#endif /* bvh_h */
@@ -0,0 +1,428 @@
+//
+//  cascadedShadows.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-25.
+//
+
+#ifndef cascadedShadows_h
+#define cascadedShadows_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <iostream>
+#include <algorithm>
+
+#include "shader.h"
+#include "model.h"
+#include "lights.h"
+#include "gpuTimer.h"
+
+// a model drawn into the shadow maps
+struct ShadowCaster {
+    const Model* model;
+    glm::mat4 modelMat;
+};
+
+// Cascaded shadow maps for the directional light.
+// The first shadowDistance units of the view frustum are split into cascades (a blend of
+// logarithmic and uniform splits), each rendered into one layer of a depth texture array.
+// Every cascade is fitted with a bounding sphere so its size doesn't change as the camera
+// turns, and its origin is snapped to whole shadow map texels so edges don't shimmer as the
+// camera moves. Casters are drawn from the meshes' position only stream and culled per cascade.
+// The matching lookup is in shadows.glsl.
+//
+// Static casters can be cached: their depth is kept in a second texture array and only
+// re-rendered when the light, a static caster or the cascade's placement changes. Each frame
+// the cached layer is copied into the sampled one and dynamic casters are drawn on top. To keep
+// the placement from changing every time the camera moves, cached cascades are snapped to a
+// grid a quarter of their radius and grown to still cover the slice, trading 25% resolution for
+// re-rendering only once the camera has moved a grid step.
+class CascadedShadowMap {
+public:
+    static const unsigned int MAX_CASCADES = 4;
+
+    CascadedShadowMap(const std::string& shaderDirectory, unsigned int cascadeCount = 4, int resolution = 2048,
+                      float shadowDistance = 400.0f, float splitLambda = 0.75f)
+        : mDepthShader((shaderDirectory + "shadowDepth.vert").c_str(), (shaderDirectory + "shadowDepth.frag").c_str(),
+                       { shaderInputsDefine<PositionVertex>() }),
+          mCascadeCount(std::max(1u, std::min(cascadeCount, MAX_CASCADES))), mResolution(resolution),
+          mShadowDistance(shadowDistance), mSplitLambda(splitLambda), mStaggerDistant(false), mCacheStatic(true),
+          mFrame(0), mLightDirection(0.0f), mStatFrames(0), mIssuedTotal(0), mSkippedTotal(0) {
+        if (cascadeCount != mCascadeCount) {
+            std::cerr << "WARNING::SHADOWS::CASCADE_COUNT clamped to " << mCascadeCount << std::endl;
+        }
+        for (unsigned int i = 0; i < MAX_CASCADES; i++) {
+            mSplits[i] = 0.0f;
+            mMatrices[i] = glm::mat4(1.0f);
+            mTexelWorldSize[i] = 0.0f;
+            mRendered[i] = false;
+            mCasterDraws[i] = 0;
+            mSkippedDraws[i] = 0;
+            mStaticMatrices[i] = glm::mat4(1.0f);
+            mStaticValid[i] = false;
+            mStaticDraws[i] = 0;
+            mHasDynamic[i] = true;
+        }
+
+        mDepthTexture = createDepthArray();
+        mStaticTexture = createDepthArray();
+        mFramebuffer = createFramebuffer(mDepthTexture);
+        mStaticFramebuffer = createFramebuffer(mStaticTexture);
+    }
+
+    CascadedShadowMap(const CascadedShadowMap&) = delete;
+    CascadedShadowMap& operator=(const CascadedShadowMap&) = delete;
+
+    ~CascadedShadowMap() {
+        glDeleteFramebuffers(1, &mFramebuffer);
+        glDeleteFramebuffers(1, &mStaticFramebuffer);
+        glDeleteTextures(1, &mDepthTexture);
+        glDeleteTextures(1, &mStaticTexture);
+    }
+
+    void enableHotReload() {
+        mDepthShader.enableHotReload();
+    }
+
+    void reloadIfChanged() {
+        mDepthShader.reloadIfChanged();
+    }
+
+    // Only re-render the cascades past the first two on alternate frames, halving their cost.
+    // A skipped cascade keeps the matrix it was rendered with, so it stays correct for static
+    // casters and only lags a frame behind for moving ones.
+    void setStaggerDistantCascades(bool stagger) {
+        mStaggerDistant = stagger;
+    }
+
+    // keep static caster depth between frames, on by default
+    void setCacheStatic(bool cache) {
+        mCacheStatic = cache;
+        invalidate();
+    }
+
+    // force the static casters to be rendered again, e.g. after editing a static model in place
+    void invalidate() {
+        for (unsigned int i = 0; i < MAX_CASCADES; i++) {
+            mStaticValid[i] = false;
+        }
+    }
+
+    unsigned int cascadeCount() const {
+        return mCascadeCount;
+    }
+
+    // Render the cascades that are due this frame. view and projection are the camera's; the
+    // framebuffer is left at 0 and the caller restores its own viewport.
+    void render(const std::vector<ShadowCaster>& staticCasters, const std::vector<ShadowCaster>& dynamicCasters,
+                const DirLight& light, const glm::mat4& view, const glm::mat4& projection, float nearPlane) {
+        glm::vec3 direction = glm::normalize(light.direction);
+        if (direction != mLightDirection || staticCastersMoved(staticCasters)) {
+            invalidate();
+        }
+        mLightDirection = direction;
+
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+        calcSplits(nearPlane);
+
+        glViewport(0, 0, mResolution, mResolution);
+        glEnable(GL_DEPTH_TEST);
+        // casters between the light and the cascade's near plane are clamped instead of clipped
+        glEnable(GL_DEPTH_CLAMP);
+        // slope scaled offset, the normal offset in shadows.glsl takes care of the rest
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+        mDepthShader.use();
+
+        glm::mat4 invView = glm::inverse(view);
+        float sliceNear = nearPlane;
+        for (unsigned int i = 0; i < mCascadeCount; i++) {
+            mCasterDraws[i] = 0;
+            mSkippedDraws[i] = 0;
+            bool due = !mStaggerDistant || i < 2 || (mFrame + i) % 2 == 0;
+            if (due || !mStaticValid[i] || !mRendered[i]) {
+                renderCascade(i, staticCasters, dynamicCasters, lightView, invView, projection, sliceNear, mSplits[i]);
+                mRendered[i] = true;
+            }
+            mIssuedTotal += mCasterDraws[i];
+            mSkippedTotal += mSkippedDraws[i];
+            sliceNear = mSplits[i];
+        }
+        mStatFrames++;
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_DEPTH_CLAMP);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        mFrame++;
+    }
+
+    // bind the shadow map to unit and set the uniforms shadows.glsl reads
+    void bind(const Shader& shader, unsigned int unit, const glm::mat4& view) const {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, mDepthTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        shader.setInt("shadowMap", static_cast<int>(unit));
+        shader.setInt("cascadeCount", static_cast<int>(mCascadeCount));
+        shader.setMat4("cascadeView", view);
+        shader.setFloat("shadowTexelSize", 1.0f / mResolution);
+        for (unsigned int i = 0; i < mCascadeCount; i++) {
+            std::string index = "[" + std::to_string(i) + "]";
+            shader.setFloat("cascadeSplits" + index, mSplits[i]);
+            shader.setFloat("cascadeTexelWorldSize" + index, mTexelWorldSize[i]);
+            shader.setMat4("cascadeMatrices" + index, mMatrices[i]);
+        }
+    }
+
+    // average GPU milliseconds per update of cascade i since resetStats()
+    double cascadeMs(unsigned int i) const {
+        return mTimers[i].averageMs();
+    }
+
+    // casters drawn into cascade i last frame
+    unsigned int casterDraws(unsigned int i) const {
+        return mCasterDraws[i];
+    }
+
+    // average shadow draw calls issued and skipped thanks to the static cache per frame since resetStats()
+    unsigned long long issuedDrawsPerFrame() const {
+        return mStatFrames == 0 ? 0 : mIssuedTotal / mStatFrames;
+    }
+
+    unsigned long long skippedDrawsPerFrame() const {
+        return mStatFrames == 0 ? 0 : mSkippedTotal / mStatFrames;
+    }
+
+    void resetStats() {
+        for (unsigned int i = 0; i < mCascadeCount; i++) {
+            mTimers[i].reset();
+        }
+        mStatFrames = 0;
+        mIssuedTotal = 0;
+        mSkippedTotal = 0;
+    }
+
+private:
+    Shader mDepthShader;
+
+    unsigned int mCascadeCount;
+    int mResolution;
+    float mShadowDistance;
+    float mSplitLambda;
+    bool mStaggerDistant;
+    bool mCacheStatic;
+    unsigned long long mFrame;
+    glm::vec3 mLightDirection;
+
+    // the sampled maps and the cached static caster depth
+    unsigned int mDepthTexture;
+    unsigned int mStaticTexture;
+    unsigned int mFramebuffer;
+    unsigned int mStaticFramebuffer;
+
+    // far view depth, light matrix and world size of one texel for every cascade
+    float mSplits[MAX_CASCADES];
+    glm::mat4 mMatrices[MAX_CASCADES];
+    float mTexelWorldSize[MAX_CASCADES];
+    bool mRendered[MAX_CASCADES];
+    unsigned int mCasterDraws[MAX_CASCADES];
+    unsigned int mSkippedDraws[MAX_CASCADES];
+    GpuTimer mTimers[MAX_CASCADES];
+
+    // what the static layer of every cascade was last rendered with
+    glm::mat4 mStaticMatrices[MAX_CASCADES];
+    bool mStaticValid[MAX_CASCADES];
+    unsigned int mStaticDraws[MAX_CASCADES];
+    // whether the sampled layer holds more than the static depth
+    bool mHasDynamic[MAX_CASCADES];
+    std::vector<ShadowCaster> mLastStatic;
+
+    unsigned long long mStatFrames;
+    unsigned long long mIssuedTotal;
+    unsigned long long mSkippedTotal;
+
+    unsigned int createDepthArray() const {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, mResolution, mResolution, mCascadeCount, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        // hardware depth comparison, linear filtering gives a free 2x2 PCF
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return texture;
+    }
+
+    static unsigned int createFramebuffer(unsigned int depthArray) {
+        unsigned int framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArray, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "ERROR FRAMEBUFFER INCOMPLETE: shadow cascades" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return framebuffer;
+    }
+
+    bool staticCastersMoved(const std::vector<ShadowCaster>& staticCasters) {
+        bool moved = staticCasters.size() != mLastStatic.size();
+        for (size_t i = 0; i < staticCasters.size() && !moved; i++) {
+            moved = staticCasters[i].model != mLastStatic[i].model ||
+                    staticCasters[i].modelMat != mLastStatic[i].modelMat;
+        }
+        mLastStatic = staticCasters;
+        return moved;
+    }
+
+    // practical split scheme, lambda 1 is fully logarithmic, 0 fully uniform
+    void calcSplits(float nearPlane) {
+        float range = mShadowDistance - nearPlane;
+        float ratio = mShadowDistance / nearPlane;
+        for (unsigned int i = 0; i < mCascadeCount; i++) {
+            float p = static_cast<float>(i + 1) / mCascadeCount;
+            float logSplit = nearPlane * std::pow(ratio, p);
+            float uniformSplit = nearPlane + range * p;
+            mSplits[i] = mSplitLambda * logSplit + (1.0f - mSplitLambda) * uniformSplit;
+        }
+    }
+
+    // draw every mesh whose light space bounds overlap the box, returns the number of draws
+    unsigned int drawCasters(const std::vector<ShadowCaster>& casters, const glm::mat4& lightView,
+                             const glm::mat4& lightViewProjection, const glm::vec3& boxMin, const glm::vec3& boxMax) {
+        unsigned int draws = 0;
+        for (const ShadowCaster& caster : casters) {
+            glm::mat4 lightModel = lightView * caster.modelMat;
+            bool matrixSet = false;
+            for (const Mesh& mesh : caster.model->meshes()) {
+                glm::vec3 lo(FLT_MAX);
+                glm::vec3 hi(-FLT_MAX);
+                for (int c = 0; c < 8; c++) {
+                    glm::vec3 corner((c & 1) ? mesh.mBoundsMax.x : mesh.mBoundsMin.x,
+                                     (c & 2) ? mesh.mBoundsMax.y : mesh.mBoundsMin.y,
+                                     (c & 4) ? mesh.mBoundsMax.z : mesh.mBoundsMin.z);
+                    glm::vec3 p = glm::vec3(lightModel * glm::vec4(corner, 1.0f));
+                    lo = glm::min(lo, p);
+                    hi = glm::max(hi, p);
+                }
+                // skip casters outside the cascade's box, anything closer to the light is kept
+                if (hi.x < boxMin.x || lo.x > boxMax.x || hi.y < boxMin.y || lo.y > boxMax.y || hi.z < boxMin.z) {
+                    continue;
+                }
+                if (!matrixSet) {
+                    mDepthShader.setMat4("lightMvp", lightViewProjection * caster.modelMat);
+                    matrixSet = true;
+                }
+                mesh.drawPositions();
+                draws++;
+            }
+        }
+        return draws;
+    }
+
+    void renderCascade(unsigned int i, const std::vector<ShadowCaster>& staticCasters,
+                       const std::vector<ShadowCaster>& dynamicCasters, const glm::mat4& lightView,
+                       const glm::mat4& invView, const glm::mat4& projection, float sliceNear, float sliceFar) {
+        // bounding sphere of the slice. The corners only depend on the projection, so the
+        // radius is the same every frame no matter where the camera looks
+        float tanX = 1.0f / projection[0][0];
+        float tanY = 1.0f / projection[1][1];
+        glm::vec3 corners[8];
+        glm::vec3 center(0.0f);
+        for (int c = 0; c < 8; c++) {
+            float depth = (c & 4) ? sliceFar : sliceNear;
+            glm::vec4 viewCorner((c & 1 ? 1.0f : -1.0f) * tanX * depth, (c & 2 ? 1.0f : -1.0f) * tanY * depth,
+                                 -depth, 1.0f);
+            corners[c] = glm::vec3(invView * viewCorner);
+            center += corners[c] / 8.0f;
+        }
+        float radius = 0.0f;
+        for (int c = 0; c < 8; c++) {
+            radius = std::max(radius, glm::length(corners[c] - center));
+        }
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // snap the origin to whole texels, or to a coarse grid when caching so the placement
+        // survives small camera movements. The box grows by one grid step to still hold the slice
+        glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+        float extent = radius;
+        float texel = 2.0f * radius / mResolution;
+        if (mCacheStatic) {
+            float step = radius * 0.25f;
+            extent = radius + step;
+            texel = 2.0f * extent / mResolution;
+            step = std::ceil(step / texel) * texel;
+            lightCenter = glm::floor(lightCenter / step) * step + step * 0.5f;
+        } else {
+            lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+            lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+        }
+
+        // the light looks down -z
+        glm::vec3 boxMin = lightCenter - extent;
+        glm::vec3 boxMax = lightCenter + extent;
+        glm::mat4 lightProjection = glm::ortho(boxMin.x, boxMax.x, boxMin.y, boxMax.y, -boxMax.z, -boxMin.z);
+        glm::mat4 lightViewProjection = lightProjection * lightView;
+        mMatrices[i] = lightViewProjection;
+        mTexelWorldSize[i] = texel;
+
+        mTimers[i].begin();
+        if (!mCacheStatic) {
+            glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepthTexture, 0, i);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            mCasterDraws[i] += drawCasters(staticCasters, lightView, lightViewProjection, boxMin, boxMax);
+            mCasterDraws[i] += drawCasters(dynamicCasters, lightView, lightViewProjection, boxMin, boxMax);
+            mTimers[i].end();
+            return;
+        }
+
+        bool staticRendered = false;
+        if (!mStaticValid[i] || lightViewProjection != mStaticMatrices[i]) {
+            glBindFramebuffer(GL_FRAMEBUFFER, mStaticFramebuffer);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mStaticTexture, 0, i);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            mStaticDraws[i] = drawCasters(staticCasters, lightView, lightViewProjection, boxMin, boxMax);
+            mCasterDraws[i] += mStaticDraws[i];
+            mStaticMatrices[i] = lightViewProjection;
+            mStaticValid[i] = true;
+            staticRendered = true;
+        } else {
+            mSkippedDraws[i] = mStaticDraws[i];
+        }
+
+        // copy the static depth into the sampled layer unless it is already there, then add
+        // the dynamic casters on top
+        glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mDepthTexture, 0, i);
+        if (staticRendered || mHasDynamic[i]) {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, mStaticFramebuffer);
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mStaticTexture, 0, i);
+            glBlitFramebuffer(0, 0, mResolution, mResolution, 0, 0, mResolution, mResolution,
+                              GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, mFramebuffer);
+        }
+        mCasterDraws[i] += drawCasters(dynamicCasters, lightView, lightViewProjection, boxMin, boxMax);
+        mHasDynamic[i] = !dynamicCasters.empty();
+        mTimers[i].end();
+    }
+};
+
+#endif /* cascadedShadows_h */
@@ -0,0 +1,229 @@
+//
+//  charts.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-08-02.
+//
+
+#ifndef charts_h
+#define charts_h
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#include "threadPool.h"
+
+// A group of triangles laid out together in an atlas, projected onto the axis plane they face
+struct Chart {
+    // what the triangles are numbered within, e.g. an HLOD proxy
+    size_t group;
+    std::vector<unsigned int> triangles;
+    // axis the chart is projected along
+    int axis;
+    glm::vec2 min;
+    glm::vec2 max;
+    // placement in the atlas in texels
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Charts shelf packed into a square atlas at one density, for the lightmap baker and the HLOD
+// builder. Callers group the triangles, add() a chart per group and grow() it around every
+// corner, then fit() places them all.
+class ChartAtlas {
+public:
+    ChartAtlas(unsigned int size, unsigned int padding)
+        : mSize(size), mPadding(padding), mDensity(0.0f) {
+    }
+
+    void clear() {
+        mCharts.clear();
+    }
+
+    Chart& add(size_t group, int axis) {
+        Chart chart;
+        chart.group = group;
+        chart.axis = axis;
+        chart.min = glm::vec2(FLT_MAX);
+        chart.max = glm::vec2(-FLT_MAX);
+        chart.x = 0;
+        chart.y = 0;
+        chart.width = 0;
+        chart.height = 0;
+        mCharts.push_back(chart);
+        return mCharts.back();
+    }
+
+    static void grow(Chart& chart, const glm::vec3& position) {
+        glm::vec2 projected = project(chart, position);
+        chart.min = glm::min(chart.min, projected);
+        chart.max = glm::max(chart.max, projected);
+    }
+
+    // Start from a density that would cover fill of the atlas and back off until everything
+    // fits. False if nothing does.
+    bool fit(double fill) {
+        double area = 0.0;
+        for (const Chart& chart : mCharts) {
+            glm::vec2 extent = chart.max - chart.min;
+            area += static_cast<double>(extent.x) * extent.y;
+        }
+        float density = static_cast<float>(std::sqrt(fill * mSize * mSize / std::max(area, 1.0e-12)));
+        for (int attempt = 0; attempt < 100; attempt++) {
+            if (pack(density)) {
+                mDensity = density;
+                return true;
+            }
+            density *= 0.9f;
+        }
+        return false;
+    }
+
+    // where position lands in the atlas in texels, once the charts are fitted
+    glm::vec2 texel(const Chart& chart, const glm::vec3& position) const {
+        glm::vec2 local = (project(chart, position) - chart.min) * mDensity + static_cast<float>(mPadding) + 0.5f;
+        return glm::vec2(chart.x, chart.y) + local;
+    }
+
+    // grow every chart by a texel, uncovered texels take the average of their covered neighbours
+    void dilate(std::vector<glm::vec3>& texels, std::vector<unsigned char>& covered) const {
+        std::vector<glm::vec3> grown = texels;
+        std::vector<unsigned char> grownCovered = covered;
+        int size = static_cast<int>(mSize);
+        ThreadPool::instance().parallelFor(mSize, 16, [&](size_t begin, size_t end) {
+            for (int y = static_cast<int>(begin); y < static_cast<int>(end); y++) {
+                for (int x = 0; x < size; x++) {
+                    size_t index = static_cast<size_t>(y) * size + x;
+                    if (covered[index]) {
+                        continue;
+                    }
+                    glm::vec3 sum(0.0f);
+                    int count = 0;
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            int nx = x + dx;
+                            int ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= size || ny >= size) {
+                                continue;
+                            }
+                            size_t neighbour = static_cast<size_t>(ny) * size + nx;
+                            if (covered[neighbour]) {
+                                sum += texels[neighbour];
+                                count++;
+                            }
+                        }
+                    }
+                    if (count > 0) {
+                        grown[index] = sum / static_cast<float>(count);
+                        grownCovered[index] = 1;
+                    }
+                }
+            }
+        });
+        texels.swap(grown);
+        covered.swap(grownCovered);
+    }
+
+    std::vector<Chart>& charts() {
+        return mCharts;
+    }
+
+    const std::vector<Chart>& charts() const {
+        return mCharts;
+    }
+
+    unsigned int size() const {
+        return mSize;
+    }
+
+    // texels per world unit, set by fit()
+    float density() const {
+        return mDensity;
+    }
+
+    // axis and sign a normal points along most, 0 to 5
+    static int facing(const glm::vec3& normal) {
+        glm::vec3 a = glm::abs(normal);
+        int axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+        return axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+    }
+
+    static glm::vec2 project(const Chart& chart, const glm::vec3& position) {
+        return glm::vec2(position[(chart.axis + 1) % 3], position[(chart.axis + 2) % 3]);
+    }
+
+    // union find for grouping triangles, every entry starts as its own parent
+    static unsigned int findRoot(std::vector<unsigned int>& parent, unsigned int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    static void join(std::vector<unsigned int>& parent, unsigned int a, unsigned int b) {
+        a = findRoot(parent, a);
+        b = findRoot(parent, b);
+        if (a != b) {
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    // z of the 2D cross product, twice the signed area of the triangle a, b spans
+    static float cross(const glm::vec2& a, const glm::vec2& b) {
+        return a.x * b.y - a.y * b.x;
+    }
+
+private:
+    unsigned int mSize;
+    unsigned int mPadding;
+    float mDensity;
+    std::vector<Chart> mCharts;
+
+    // size every chart at density texels per world unit and shelf pack them, tallest first
+    bool pack(float density) {
+        for (Chart& chart : mCharts) {
+            glm::vec2 extent = (chart.max - chart.min) * density;
+            chart.width = static_cast<int>(std::ceil(extent.x)) + 2 * mPadding + 1;
+            chart.height = static_cast<int>(std::ceil(extent.y)) + 2 * mPadding + 1;
+        }
+        std::vector<size_t> order(mCharts.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return mCharts[a].height > mCharts[b].height; });
+
+        int size = static_cast<int>(mSize);
+        int x = 0;
+        int y = 0;
+        int shelfHeight = 0;
+        for (size_t index : order) {
+            Chart& chart = mCharts[index];
+            if (chart.width > size) {
+                return false;
+            }
+            if (x + chart.width > size) {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (y + chart.height > size) {
+                return false;
+            }
+            chart.x = x;
+            chart.y = y;
+            x += chart.width;
+            shelfHeight = std::max(shelfHeight, chart.height);
+        }
+        return true;
+    }
+};
+
+#endif /* charts_h */
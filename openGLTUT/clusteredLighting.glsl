@@ -0,0 +1,55 @@
+// Point lights for the fragment's cluster, see clusteredLighting.h for the CPU side.
+// Needs lighting.glsl included first, and shadowAtlas.glsl when ATLAS_SHADOWS is defined.
+
+uniform samplerBuffer clusterLights;    // 5 texels per light
+uniform usamplerBuffer clusterGrid;     // (offset, count) into clusterIndices per cluster
+uniform usamplerBuffer clusterIndices;  // light indices
+
+uniform vec3 clusterDims;       // tiles in x and y, depth slices
+uniform vec3 clusterDepth;      // near plane, slices per unit of log depth
+uniform vec3 clusterScreen;     // framebuffer size in pixels
+uniform mat4 clusterView;
+
+PointLight fetchClusterLight(int index, out int shadowTile) {
+    int base = index * 5;
+    vec4 positionRange = texelFetch(clusterLights, base);
+    vec4 ambientConstant = texelFetch(clusterLights, base + 1);
+    vec4 diffuseLinear = texelFetch(clusterLights, base + 2);
+    vec4 specularQuadratic = texelFetch(clusterLights, base + 3);
+    shadowTile = int(texelFetch(clusterLights, base + 4).x);
+
+    PointLight light;
+    light.position = positionRange.xyz;
+    light.attenuation.constant = ambientConstant.w;
+    light.attenuation.linear = diffuseLinear.w;
+    light.attenuation.quadratic = specularQuadratic.w;
+    light.lightProp.ambient = ambientConstant.xyz;
+    light.lightProp.diffuse = diffuseLinear.xyz;
+    light.lightProp.specular = specularQuadratic.xyz;
+    return light;
+}
+
+vec3 calcClusteredPointLights(vec3 norm, vec3 fragPos, vec3 viewDir, Surface surface) {
+    float viewDepth = -(clusterView * vec4(fragPos, 1.0)).z;
+    ivec3 cluster;
+    cluster.xy = ivec2(gl_FragCoord.xy / clusterScreen.xy * clusterDims.xy);
+    cluster.z = int(log(viewDepth / clusterDepth.x) * clusterDepth.y);
+    cluster = clamp(cluster, ivec3(0), ivec3(clusterDims) - 1);
+
+    int clusterIndex = (cluster.z * int(clusterDims.y) + cluster.y) * int(clusterDims.x) + cluster.x;
+    uvec2 range = texelFetch(clusterGrid, clusterIndex).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++) {
+        int lightIndex = int(texelFetch(clusterIndices, int(range.x + i)).x);
+        int shadowTile;
+        PointLight light = fetchClusterLight(lightIndex, shadowTile);
+#ifdef ATLAS_SHADOWS
+        float shadow = calcPointShadow(shadowTile, fragPos, norm, light.position);
+        result += calcPointLight(light, norm, fragPos, viewDir, surface, shadow);
+#else
+        result += calcPointLight(light, norm, fragPos, viewDir, surface);
+#endif
+    }
+    return result;
+}
@@ -0,0 +1,324 @@
+//
+//  clusteredLighting.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-21.
+//
+
+#ifndef clusteredLighting_h
+#define clusteredLighting_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "shader.h"
+#include "lights.h"
+#include "threadPool.h"
+
+// Clustered forward lighting for point lights.
+// The view frustum is split into a gridX * gridY screen tiles * gridZ exponential depth slices.
+// Every frame the CPU assigns each light to the clusters its range overlaps, and the light
+// data, per cluster (offset, count) and the flat light index list are uploaded as buffer
+// textures (GL 3.3 has no SSBOs). The fragment shader then only walks its own cluster's lights,
+// see clusteredLighting.glsl.
+class ClusteredLighting {
+public:
+    ClusteredLighting(unsigned int gridX = 16, unsigned int gridY = 9, unsigned int gridZ = 24)
+        : mGridX(gridX), mGridY(gridY), mGridZ(gridZ), mNear(0.1f), mSliceScale(1.0f),
+          mView(1.0f), mAssignmentMs(0.0) {
+        mGrid.resize(gridX * gridY * gridZ * 2);
+        mSliceIndices.resize(gridZ);
+
+        glGenBuffers(3, mBuffers);
+        glGenTextures(3, mTextures);
+        const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+        for (int i = 0; i < 3; i++) {
+            glBindBuffer(GL_TEXTURE_BUFFER, mBuffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, mTextures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], mBuffers[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ClusteredLighting(const ClusteredLighting&) = delete;
+    ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+    // assign lights to clusters on the CPU and upload the result. shadowTiles optionally holds
+    // each light's shadow atlas tile
+    void update(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection,
+                float nearPlane, float farPlane, const std::vector<int>& shadowTiles = std::vector<int>()) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        mView = view;
+        mNear = nearPlane;
+        mSliceScale = mGridZ / std::log(farPlane / nearPlane);
+
+        assignLights(lights, view, projection, nearPlane, farPlane, shadowTiles);
+        buildClusters();
+
+        auto end = std::chrono::high_resolution_clock::now();
+        mAssignmentMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+        upload(mBuffers[0], mLightTexels.data(), mLightTexels.size() * sizeof(PackedPointLight));
+        upload(mBuffers[1], mGrid.data(), mGrid.size() * sizeof(unsigned int));
+        upload(mBuffers[2], mIndices.data(), mIndices.size() * sizeof(unsigned int));
+    }
+
+    // bind the buffer textures to three units starting at firstUnit and set the lookup uniforms
+    void bind(const Shader& shader, unsigned int firstUnit, int screenWidth, int screenHeight) const {
+        const char* samplers[3] = { "clusterLights", "clusterGrid", "clusterIndices" };
+        for (unsigned int i = 0; i < 3; i++) {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, mTextures[i]);
+            shader.setInt(samplers[i], firstUnit + i);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        shader.setVec3("clusterDims", glm::vec3(mGridX, mGridY, mGridZ));
+        shader.setVec3("clusterDepth", glm::vec3(mNear, mSliceScale, 0.0f));
+        shader.setVec3("clusterScreen", glm::vec3(screenWidth, screenHeight, 0.0f));
+        shader.setMat4("clusterView", mView);
+    }
+
+    // CPU time of the last assignment
+    double assignmentMs() const {
+        return mAssignmentMs;
+    }
+
+    // light references across all clusters in the last assignment
+    size_t indexCount() const {
+        return mIndices.size();
+    }
+
+private:
+    unsigned int mGridX;
+    unsigned int mGridY;
+    unsigned int mGridZ;
+    float mNear;
+    float mSliceScale;
+    glm::mat4 mView;
+    double mAssignmentMs;
+
+    // view space bounds of each light as cluster ranges, structure of arrays
+    std::vector<int> mMinTileX;
+    std::vector<int> mMaxTileX;
+    std::vector<int> mMinTileY;
+    std::vector<int> mMaxTileY;
+    std::vector<int> mMinSlice;
+    std::vector<int> mMaxSlice;
+
+    // five RGBA32F texels per light, the fifth holding its shadow atlas tile in x, must match
+    // clusteredLighting.glsl
+    std::vector<PackedPointLight> mLightTexels;
+    // offset and count for every cluster, x fastest then y then z
+    std::vector<unsigned int> mGrid;
+    std::vector<std::vector<unsigned int>> mSliceIndices;
+    std::vector<unsigned int> mIndices;
+
+    unsigned int mBuffers[3];
+    unsigned int mTextures[3];
+
+    // computes the cluster range each light touches, in parallel over lights
+    void assignLights(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection,
+                      float nearPlane, float farPlane, const std::vector<int>& shadowTiles) {
+        size_t count = lights.size();
+        mMinTileX.resize(count);
+        mMaxTileX.resize(count);
+        mMinTileY.resize(count);
+        mMaxTileY.resize(count);
+        mMinSlice.resize(count);
+        mMaxSlice.resize(count);
+        mLightTexels.resize(count);
+
+        ThreadPool::instance().parallelFor(count, 512, [&](size_t begin, size_t end) {
+            // view space centres and depths, four lights at a time with SSE where available
+            float viewX[512];
+            float viewY[512];
+            float depth[512];
+            float radius[512];
+            transformToView(lights, begin, end, view, viewX, viewY, depth, radius);
+
+            for (size_t i = begin; i < end; i++) {
+                size_t local = i - begin;
+                mLightTexels[i] = packPointLight(lights[i], radius[local], shadowTiles.empty() ? -1 : shadowTiles[i]);
+
+                float r = radius[local];
+                float nearDepth = depth[local] - r;
+                float farDepth = depth[local] + r;
+                if (farDepth < nearPlane || nearDepth > farPlane) {
+                    // entirely in front of the near plane or past the far plane
+                    mMinSlice[i] = 1;
+                    mMaxSlice[i] = 0;
+                    continue;
+                }
+                mMinSlice[i] = sliceOf(std::max(nearDepth, nearPlane));
+                mMaxSlice[i] = sliceOf(std::min(farDepth, farPlane));
+
+                if (nearDepth <= nearPlane) {
+                    // crosses the near plane so the projection is unbounded, take every tile
+                    mMinTileX[i] = 0;
+                    mMaxTileX[i] = mGridX - 1;
+                    mMinTileY[i] = 0;
+                    mMaxTileY[i] = mGridY - 1;
+                    continue;
+                }
+                // conservative screen bounds of the light's view space box, a negative edge is
+                // furthest out at the nearest depth and a positive one at the farthest
+                float lowX = viewX[local] - r;
+                float highX = viewX[local] + r;
+                float lowY = viewY[local] - r;
+                float highY = viewY[local] + r;
+                float ndcMinX = projection[0][0] * lowX / (lowX < 0.0f ? nearDepth : farDepth);
+                float ndcMaxX = projection[0][0] * highX / (highX > 0.0f ? nearDepth : farDepth);
+                float ndcMinY = projection[1][1] * lowY / (lowY < 0.0f ? nearDepth : farDepth);
+                float ndcMaxY = projection[1][1] * highY / (highY > 0.0f ? nearDepth : farDepth);
+                mMinTileX[i] = tileOf(ndcMinX, mGridX);
+                mMaxTileX[i] = tileOf(ndcMaxX, mGridX);
+                mMinTileY[i] = tileOf(ndcMinY, mGridY);
+                mMaxTileY[i] = tileOf(ndcMaxY, mGridY);
+            }
+        });
+    }
+
+    // writes every cluster's light list, in parallel over depth slices so no two threads
+    // ever touch the same cluster
+    void buildClusters() {
+        size_t lightCount = mMinSlice.size();
+        unsigned int tilesPerSlice = mGridX * mGridY;
+
+        ThreadPool::instance().parallelFor(mGridZ, 1, [&](size_t begin, size_t end) {
+            std::vector<unsigned int> counts(tilesPerSlice);
+            for (size_t z = begin; z < end; z++) {
+                int slice = static_cast<int>(z);
+                unsigned int* grid = &mGrid[z * tilesPerSlice * 2];
+
+                // count, prefix sum, then fill
+                std::fill(counts.begin(), counts.end(), 0);
+                for (size_t i = 0; i < lightCount; i++) {
+                    if (slice < mMinSlice[i] || slice > mMaxSlice[i]) {
+                        continue;
+                    }
+                    for (int y = mMinTileY[i]; y <= mMaxTileY[i]; y++) {
+                        for (int x = mMinTileX[i]; x <= mMaxTileX[i]; x++) {
+                            counts[y * mGridX + x]++;
+                        }
+                    }
+                }
+                unsigned int offset = 0;
+                for (unsigned int tile = 0; tile < tilesPerSlice; tile++) {
+                    grid[tile * 2] = offset;
+                    grid[tile * 2 + 1] = 0;
+                    offset += counts[tile];
+                }
+
+                std::vector<unsigned int>& indices = mSliceIndices[z];
+                indices.resize(offset);
+                for (size_t i = 0; i < lightCount; i++) {
+                    if (slice < mMinSlice[i] || slice > mMaxSlice[i]) {
+                        continue;
+                    }
+                    for (int y = mMinTileY[i]; y <= mMaxTileY[i]; y++) {
+                        for (int x = mMinTileX[i]; x <= mMaxTileX[i]; x++) {
+                            unsigned int* cluster = &grid[(y * mGridX + x) * 2];
+                            indices[cluster[0] + cluster[1]] = static_cast<unsigned int>(i);
+                            cluster[1]++;
+                        }
+                    }
+                }
+            }
+        });
+
+        // stitch the slices together, offsets so far were relative to their slice
+        size_t total = 0;
+        for (unsigned int z = 0; z < mGridZ; z++) {
+            total += mSliceIndices[z].size();
+        }
+        mIndices.resize(total);
+        size_t base = 0;
+        for (unsigned int z = 0; z < mGridZ; z++) {
+            unsigned int* grid = &mGrid[z * tilesPerSlice * 2];
+            for (unsigned int tile = 0; tile < tilesPerSlice; tile++) {
+                grid[tile * 2] += static_cast<unsigned int>(base);
+            }
+            std::copy(mSliceIndices[z].begin(), mSliceIndices[z].end(), mIndices.begin() + base);
+            base += mSliceIndices[z].size();
+        }
+    }
+
+    static void transformToView(const std::vector<PointLight>& lights, size_t begin, size_t end,
+                                const glm::mat4& view, float* viewX, float* viewY, float* depth, float* radius) {
+        size_t count = end - begin;
+        float worldX[512];
+        float worldY[512];
+        float worldZ[512];
+        for (size_t i = 0; i < count; i++) {
+            const PointLight& light = lights[begin + i];
+            worldX[i] = light.position.x;
+            worldY[i] = light.position.y;
+            worldZ[i] = light.position.z;
+            radius[i] = lightRange(light.attenuation, light.lightProp);
+        }
+
+        size_t i = 0;
+#if defined(__SSE2__)
+        const __m128 m00 = _mm_set1_ps(view[0][0]), m10 = _mm_set1_ps(view[1][0]);
+        const __m128 m20 = _mm_set1_ps(view[2][0]), m30 = _mm_set1_ps(view[3][0]);
+        const __m128 m01 = _mm_set1_ps(view[0][1]), m11 = _mm_set1_ps(view[1][1]);
+        const __m128 m21 = _mm_set1_ps(view[2][1]), m31 = _mm_set1_ps(view[3][1]);
+        const __m128 m02 = _mm_set1_ps(-view[0][2]), m12 = _mm_set1_ps(-view[1][2]);
+        const __m128 m22 = _mm_set1_ps(-view[2][2]), m32 = _mm_set1_ps(-view[3][2]);
+        for (; i + 4 <= count; i += 4) {
+            __m128 x = _mm_loadu_ps(&worldX[i]);
+            __m128 y = _mm_loadu_ps(&worldY[i]);
+            __m128 z = _mm_loadu_ps(&worldZ[i]);
+            __m128 vx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m10, y)), _mm_add_ps(_mm_mul_ps(m20, z), m30));
+            __m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m01, x), _mm_mul_ps(m11, y)), _mm_add_ps(_mm_mul_ps(m21, z), m31));
+            __m128 vz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m02, x), _mm_mul_ps(m12, y)), _mm_add_ps(_mm_mul_ps(m22, z), m32));
+            _mm_storeu_ps(&viewX[i], vx);
+            _mm_storeu_ps(&viewY[i], vy);
+            _mm_storeu_ps(&depth[i], vz);
+        }
+#endif
+        for (; i < count; i++) {
+            glm::vec4 p = view * glm::vec4(worldX[i], worldY[i], worldZ[i], 1.0f);
+            viewX[i] = p.x;
+            viewY[i] = p.y;
+            depth[i] = -p.z;
+        }
+    }
+
+    int sliceOf(float viewDepth) const {
+        int slice = static_cast<int>(std::log(viewDepth / mNear) * mSliceScale);
+        return std::min(std::max(slice, 0), static_cast<int>(mGridZ) - 1);
+    }
+
+    static int tileOf(float ndc, unsigned int tiles) {
+        int tile = static_cast<int>(std::floor((ndc * 0.5f + 0.5f) * tiles));
+        return std::min(std::max(tile, 0), static_cast<int>(tiles) - 1);
+    }
+
+    static void upload(unsigned int buffer, const void* data, size_t size) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        // orphan last frame's storage so the driver never waits on draws still reading it
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(size, 16), nullptr, GL_STREAM_DRAW);
+        if (size > 0) {
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+
+#endif /* clusteredLighting_h */
@@ -0,0 +1,28 @@
+#version 330 core
+// deferred pass for the lights that touch every pixel: the directional light and the spot light
+out vec4 FragColour;
+
+#include "lighting.glsl"
+#include "deferredGBuffer.glsl"
+#include "shadows.glsl"
+#include "shadowAtlas.glsl"
+
+uniform vec3 viewPos;
+uniform DirLight dirLight;
+uniform SpotLight spotLight;
+uniform int spotShadowTile;
+
+void main() {
+    vec3 fragPos;
+    vec3 norm;
+    Surface surface;
+    if (!readGBuffer(fragPos, norm, surface)) {
+        discard;
+    }
+    vec3 viewDir = normalize(viewPos - fragPos);
+
+    vec3 result = calcDirLight(dirLight, norm, viewDir, surface, calcDirShadow(fragPos, norm));
+    float spotShadow = calcSpotShadow(spotShadowTile, fragPos, norm, spotLight.position);
+    result += calcSpotLight(spotLight, norm, fragPos, viewDir, surface, spotShadow);
+    FragColour = vec4(result, 1.0);
+}
@@ -0,0 +1,39 @@
+// Reads back the G-buffer written by gbuffer.frag. Needs lighting.glsl included first.
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+uniform mat4 invView;
+uniform vec2 projScale;     // projection[0][0] and projection[1][1]
+uniform vec2 screenSize;    // G-buffer size
+uniform float gBufferScale; // G-buffer pixels per shaded pixel, above 1 when lighting runs at a lower resolution
+
+// false where no geometry was drawn
+bool readGBuffer(out vec3 worldPos, out vec3 norm, out Surface surface) {
+    // one G-buffer texel per shaded pixel, the same one the upsample expects
+    ivec2 texel = min(ivec2(gl_FragCoord.xy * gBufferScale), ivec2(screenSize) - 1);
+    vec2 uv = (vec2(texel) + 0.5) / screenSize;
+    float viewDepth = texelFetch(gDepth, texel, 0).r;
+    if (viewDepth <= 0.0) {
+        return false;
+    }
+    // rebuild the position from the view ray through this pixel
+    vec2 ndc = uv * 2.0 - 1.0;
+    vec3 viewPos = vec3(ndc / projScale, -1.0) * viewDepth;
+    worldPos = vec3(invView * vec4(viewPos, 1.0));
+
+    norm = texelFetch(gNormal, texel, 0).xyz;
+    vec4 specular = texelFetch(gSpecular, texel, 0);
+    surface.albedo = texelFetch(gAlbedo, texel, 0).rgb;
+    surface.specular = specular.rgb;
+    surface.shininess = specular.a * 256.0;
+#ifdef DEMODULATE_ALBEDO
+    // lower resolution lighting leaves the albedo out and the upsample multiplies the full
+    // resolution albedo back in. Specular is divided by it so that multiply cancels out.
+    surface.specular /= max(surface.albedo, vec3(0.02));
+    surface.albedo = vec3(1.0);
+#endif
+    return true;
+}
@@ -0,0 +1,37 @@
+#version 330 core
+// shades only the pixels covered by a point light's volume, blended additively
+out vec4 FragColour;
+
+flat in vec4 PositionRange;
+flat in vec4 AmbientConstant;
+flat in vec4 DiffuseLinear;
+flat in vec4 SpecularQuadratic;
+flat in int ShadowTile;
+
+#include "lighting.glsl"
+#include "deferredGBuffer.glsl"
+#include "shadowAtlas.glsl"
+
+uniform vec3 viewPos;
+
+void main() {
+    vec3 fragPos;
+    vec3 norm;
+    Surface surface;
+    if (!readGBuffer(fragPos, norm, surface) || length(PositionRange.xyz - fragPos) > PositionRange.w) {
+        discard;
+    }
+
+    PointLight light;
+    light.position = PositionRange.xyz;
+    light.attenuation.constant = AmbientConstant.w;
+    light.attenuation.linear = DiffuseLinear.w;
+    light.attenuation.quadratic = SpecularQuadratic.w;
+    light.lightProp.ambient = AmbientConstant.xyz;
+    light.lightProp.diffuse = DiffuseLinear.xyz;
+    light.lightProp.specular = SpecularQuadratic.xyz;
+
+    vec3 viewDir = normalize(viewPos - fragPos);
+    float shadow = calcPointShadow(ShadowTile, fragPos, norm, light.position);
+    FragColour = vec4(calcPointLight(light, norm, fragPos, viewDir, surface, shadow), 1.0);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+// a unit sphere scaled to each point light's range, one instance per light
+// declared from VertexFormat<PositionVertex> and VertexFormat<PackedPointLight>
+VERTEX_INPUTS
+INSTANCE_INPUTS
+
+flat out vec4 PositionRange;
+flat out vec4 AmbientConstant;
+flat out vec4 DiffuseLinear;
+flat out vec4 SpecularQuadratic;
+flat out int ShadowTile;
+
+uniform mat4 viewProjection;
+
+void main() {
+    gl_Position = viewProjection * vec4(aPositionRange.xyz + aPos * aPositionRange.w, 1.0);
+    PositionRange = aPositionRange;
+    AmbientConstant = aAmbientConstant;
+    DiffuseLinear = aDiffuseLinear;
+    SpecularQuadratic = aSpecularQuadratic;
+    ShadowTile = int(aShadow.x);
+}
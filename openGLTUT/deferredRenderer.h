@@ -0,0 +1,580 @@
+//
+//  deferredRenderer.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-24.
+//
+
+#ifndef deferredRenderer_h
+#define deferredRenderer_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include "shader.h"
+#include "lights.h"
+#include "model.h"
+#include "cascadedShadows.h"
+#include "shadowAtlas.h"
+#include "vertexLayout.h"
+#include "threadPool.h"
+#include "sampleCounter.h"
+#include "hiZCuller.h"
+#include "occlusionQueries.h"
+
+template <>
+struct VertexFormat<PackedPointLight> {
+    typedef VertexLayout<PackedPointLight,
+        VertexAttribute<1, glm::vec4, offsetof(PackedPointLight, positionRange), GL_FALSE, 1>,
+        VertexAttribute<2, glm::vec4, offsetof(PackedPointLight, ambientConstant), GL_FALSE, 1>,
+        VertexAttribute<3, glm::vec4, offsetof(PackedPointLight, diffuseLinear), GL_FALSE, 1>,
+        VertexAttribute<4, glm::vec4, offsetof(PackedPointLight, specularQuadratic), GL_FALSE, 1>,
+        VertexAttribute<5, glm::vec4, offsetof(PackedPointLight, shadow), GL_FALSE, 1>> Layout;
+    
+    static std::string shaderInputs() {
+        return Layout::shaderInputs({ "aPositionRange", "aAmbientConstant", "aDiffuseLinear", "aSpecularQuadratic",
+                                      "aShadow" });
+    }
+};
+
+// Deferred shading, an alternative to the forward path in main.cpp.
+// 1. geometry pass: albedo, specular, normal and linear depth are written once per pixel.
+//    Opaque meshes go first, alpha tested ones after with a program that discards. A G-buffer
+//    holds one surface per pixel so blended meshes are alpha tested here as well.
+// 2. the directional and spot light are applied with one full screen pass
+// 3. each point light draws a sphere the size of its range, only pixels inside it get shaded
+// The lit image is then blitted to the default framebuffer.
+// Steps 2 and 3 can run at a half or quarter of the resolution (setLightingScale). They then
+// shade one G-buffer texel per low resolution pixel without its albedo, and a bilateral
+// upsample guided by full resolution depth and normals multiplies the albedo back in.
+class DeferredRenderer {
+public:
+    DeferredRenderer(const std::string& shaderDirectory, int width, int height)
+        : mGeometryShader((shaderDirectory + "vertexShader.vert").c_str(), (shaderDirectory + "gbuffer.frag").c_str(),
+                          { shaderInputsDefine<Vertex>() }),
+          mAlphaTestGeometryShader((shaderDirectory + "vertexShader.vert").c_str(), (shaderDirectory + "gbuffer.frag").c_str(),
+                                   { shaderInputsDefine<Vertex>(), "ALPHA_TEST" }),
+          mDirectionalShader((shaderDirectory + "fullscreen.vert").c_str(), (shaderDirectory + "deferredDirectional.frag").c_str()),
+          mPointLightShader((shaderDirectory + "deferredPointLight.vert").c_str(), (shaderDirectory + "deferredPointLight.frag").c_str(),
+                            { shaderInputsDefine<PositionVertex>(), shaderInputsDefine<PackedPointLight>("INSTANCE_INPUTS") }),
+          mScaledDirectionalShader((shaderDirectory + "fullscreen.vert").c_str(), (shaderDirectory + "deferredDirectional.frag").c_str(),
+                                   { "DEMODULATE_ALBEDO" }),
+          mScaledPointLightShader((shaderDirectory + "deferredPointLight.vert").c_str(), (shaderDirectory + "deferredPointLight.frag").c_str(),
+                                  { shaderInputsDefine<PositionVertex>(),
+                                    shaderInputsDefine<PackedPointLight>("INSTANCE_INPUTS"), "DEMODULATE_ALBEDO" }),
+          mUpsampleShader((shaderDirectory + "fullscreen.vert").c_str(), (shaderDirectory + "upsampleLighting.frag").c_str()),
+          mWidth(0), mHeight(0), mGBuffer(0), mLightBuffer(0), mDepthBuffer(0), mLitTexture(0),
+          mLightingScale(1), mLowWidth(0), mLowHeight(0), mLowLightBuffer(0), mLowLitTexture(0),
+          mComparePending(false) {
+        for (int i = 0; i < GBUFFER_TARGETS; i++) {
+            mTargets[i] = 0;
+        }
+        glGenVertexArrays(1, &mEmptyVao);
+        setUpSphere();
+        resize(width, height);
+    }
+
+    DeferredRenderer(const DeferredRenderer&) = delete;
+    DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+    void enableHotReload() {
+        mGeometryShader.enableHotReload();
+        mAlphaTestGeometryShader.enableHotReload();
+        mDirectionalShader.enableHotReload();
+        mPointLightShader.enableHotReload();
+        mScaledDirectionalShader.enableHotReload();
+        mScaledPointLightShader.enableHotReload();
+        mUpsampleShader.enableHotReload();
+    }
+
+    void reloadIfChanged() {
+        mGeometryShader.reloadIfChanged();
+        mAlphaTestGeometryShader.reloadIfChanged();
+        mDirectionalShader.reloadIfChanged();
+        mPointLightShader.reloadIfChanged();
+        mScaledDirectionalShader.reloadIfChanged();
+        mScaledPointLightShader.reloadIfChanged();
+        mUpsampleShader.reloadIfChanged();
+    }
+
+    // shade lights at 1 / scale of the resolution, 1, 2 or 4
+    void setLightingScale(int scale) {
+        scale = scale >= 4 ? 4 : (scale >= 2 ? 2 : 1);
+        if (scale == mLightingScale) {
+            return;
+        }
+        mLightingScale = scale;
+        resizeLowTargets();
+    }
+
+    int lightingScale() const {
+        return mLightingScale;
+    }
+
+    // samples the geometry pass wrote for one material bucket
+    SampleCounter& bucketSamples(MaterialBucket bucket) {
+        return mBucketSamples[static_cast<int>(bucket)];
+    }
+
+    // on the next render, light the same G-buffer at full resolution as well and print how far
+    // the reduced resolution image is from it
+    void requestComparison() {
+        mComparePending = true;
+    }
+
+    // reallocates the G-buffer when the framebuffer size changes
+    void resize(int width, int height) {
+        if (width == mWidth && height == mHeight) {
+            return;
+        }
+        mWidth = width;
+        mHeight = height;
+        releaseTargets();
+
+        // G-buffer: albedo, specular + shininess, normal, linear depth
+        const GLenum internalFormats[GBUFFER_TARGETS] = { GL_RGBA8, GL_RGBA8, GL_RGBA16F, GL_R32F };
+        const GLenum formats[GBUFFER_TARGETS] = { GL_RGBA, GL_RGBA, GL_RGBA, GL_RED };
+        const GLenum types[GBUFFER_TARGETS] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_BYTE, GL_FLOAT, GL_FLOAT };
+        glGenFramebuffers(1, &mGBuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mGBuffer);
+        for (int i = 0; i < GBUFFER_TARGETS; i++) {
+            mTargets[i] = createTarget(internalFormats[i], formats[i], types[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, mTargets[i], 0);
+        }
+        const GLenum drawBuffers[GBUFFER_TARGETS] = {
+            GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3
+        };
+        glDrawBuffers(GBUFFER_TARGETS, drawBuffers);
+
+        // the depth buffer is shared with the light buffer so light volumes can depth test
+        // against the scene without sampling the texture being tested against
+        glGenRenderbuffers(1, &mDepthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, mDepthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, mDepthBuffer);
+        checkComplete("G-buffer");
+
+        glGenFramebuffers(1, &mLightBuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mLightBuffer);
+        mLitTexture = createTarget(GL_RGBA16F, GL_RGBA, GL_FLOAT);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mLitTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, mDepthBuffer);
+        checkComplete("light buffer");
+
+        resizeLowTargets();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // With hiZ the model's occlusion culling is two phase: the G-buffer depth of what was drawn
+    // builds the pyramid, then the meshes hidden by last frame's pyramid are tested against it
+    // and drawn as well if they came into view. With queries the big meshes' boxes are queried
+    // against the finished G-buffer depth for the coming frames.
+    void render(Model& model, const glm::mat4& modelMat, const glm::mat4& view, const glm::mat4& projection,
+                const glm::vec3& viewPos, const DirLight& dirLight, const SpotLight& spotLight,
+                const std::vector<PointLight>& pointLights, const CascadedShadowMap& shadows,
+                const ShadowAtlas& atlas, const std::vector<int>& pointShadowTiles, int spotShadowTile,
+                HiZCuller* hiZ = nullptr, OcclusionQueries* queries = nullptr) {
+        // 1. geometry pass
+        glBindFramebuffer(GL_FRAMEBUFFER, mGBuffer);
+        glViewport(0, 0, mWidth, mHeight);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+
+        geometryBuckets(model, modelMat, view, projection, true);
+        if (hiZ != nullptr) {
+            hiZ->build(mGBuffer, mWidth, mHeight, projection * view);
+            if (model.revealOccluded(*hiZ) > 0) {
+                glBindFramebuffer(GL_FRAMEBUFFER, mGBuffer);
+                glViewport(0, 0, mWidth, mHeight);
+                geometryBuckets(model, modelMat, view, projection, false);
+            }
+            model.finishOcclusion();
+        }
+        if (queries != nullptr) {
+            glBindFramebuffer(GL_FRAMEBUFFER, mGBuffer);
+            glViewport(0, 0, mWidth, mHeight);
+            queries->issue(model, projection * view, viewPos);
+        }
+
+        LightingInputs inputs = { view, projection, viewPos, dirLight, spotLight, shadows, atlas, spotShadowTile };
+        uploadLights(pointLights, pointShadowTiles);
+        lightingPass(inputs, mLightingScale);
+        if (mComparePending && mLightingScale > 1) {
+            compareWithFullResolution(inputs);
+        }
+        mComparePending = false;
+
+        // 4. show the result
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, mLightBuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+private:
+    static const int GBUFFER_TARGETS = 4;
+
+    Shader mGeometryShader;
+    Shader mAlphaTestGeometryShader;
+    Shader mDirectionalShader;
+    Shader mPointLightShader;
+    Shader mScaledDirectionalShader;
+    Shader mScaledPointLightShader;
+    Shader mUpsampleShader;
+
+    int mWidth;
+    int mHeight;
+    unsigned int mGBuffer;
+    unsigned int mTargets[GBUFFER_TARGETS];
+    unsigned int mLightBuffer;
+    unsigned int mDepthBuffer;
+    unsigned int mLitTexture;
+
+    int mLightingScale;
+    int mLowWidth;
+    int mLowHeight;
+    unsigned int mLowLightBuffer;
+    unsigned int mLowLitTexture;
+    bool mComparePending;
+
+    unsigned int mEmptyVao;
+    unsigned int mSphereVao;
+    unsigned int mSphereVbo;
+    unsigned int mSphereEbo;
+    unsigned int mInstanceVbo;
+    GLsizei mSphereIndexCount;
+    std::vector<PackedPointLight> mPackedLights;
+    SampleCounter mBucketSamples[MATERIAL_BUCKET_COUNT];
+
+    // every bucket into the bound G-buffer, blended meshes are alpha tested here
+    void geometryBuckets(const Model& model, const glm::mat4& modelMat, const glm::mat4& view,
+                         const glm::mat4& projection, bool countSamples) {
+        geometryBucket(mGeometryShader, model, MaterialBucket::OPAQUE, modelMat, view, projection, countSamples);
+        geometryBucket(mAlphaTestGeometryShader, model, MaterialBucket::ALPHA_TESTED, modelMat, view, projection,
+                       countSamples);
+        geometryBucket(mAlphaTestGeometryShader, model, MaterialBucket::BLENDED, modelMat, view, projection,
+                       countSamples);
+    }
+
+    // draws one material bucket into the bound G-buffer, optionally counting the samples it
+    // writes. Only the first draw of a frame is counted so the counters stay per frame.
+    void geometryBucket(Shader& shader, const Model& model, MaterialBucket bucket, const glm::mat4& modelMat,
+                        const glm::mat4& view, const glm::mat4& projection, bool countSamples) {
+        SampleCounter& counter = mBucketSamples[static_cast<int>(bucket)];
+        if (countSamples) {
+            counter.begin();
+        }
+        if (model.bucketSize(bucket) > 0) {
+            shader.use();
+            shader.setFloat("material.shininess", 32.0f);
+            shader.setMat4("view", view);
+            shader.setMat4("model", modelMat);
+            shader.setMat4("mvp", projection * view * modelMat);
+            shader.setMat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(modelMat))));
+            model.draw(shader, bucket);
+        }
+        if (countSamples) {
+            counter.end();
+        }
+    }
+
+    // everything the lighting passes read besides the G-buffer and point lights
+    struct LightingInputs {
+        const glm::mat4& view;
+        const glm::mat4& projection;
+        const glm::vec3& viewPos;
+        const DirLight& dirLight;
+        const SpotLight& spotLight;
+        const CascadedShadowMap& shadows;
+        const ShadowAtlas& atlas;
+        int spotShadowTile;
+    };
+
+    // steps 2 and 3, leaves the lit image in mLightBuffer
+    void lightingPass(const LightingInputs& in, int scale) {
+        Shader& directionalShader = scale > 1 ? mScaledDirectionalShader : mDirectionalShader;
+        Shader& pointLightShader = scale > 1 ? mScaledPointLightShader : mPointLightShader;
+        if (scale > 1) {
+            glBindFramebuffer(GL_FRAMEBUFFER, mLowLightBuffer);
+            glViewport(0, 0, mLowWidth, mLowHeight);
+        } else {
+            glBindFramebuffer(GL_FRAMEBUFFER, mLightBuffer);
+            glViewport(0, 0, mWidth, mHeight);
+        }
+
+        // 2. full screen lights, depth is left alone so the volumes can still test against it
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_DEPTH_TEST);
+        bindGBuffer();
+
+        glm::mat4 invView = glm::inverse(in.view);
+        glm::vec2 projScale(in.projection[0][0], in.projection[1][1]);
+
+        directionalShader.use();
+        setGBufferUniforms(directionalShader, invView, projScale, scale);
+        directionalShader.setVec3("viewPos", in.viewPos);
+        setLight(directionalShader, "dirLight", in.dirLight);
+        setLight(directionalShader, "spotLight", in.spotLight);
+        in.shadows.bind(directionalShader, GBUFFER_TARGETS, in.view);
+        in.atlas.bind(directionalShader, GBUFFER_TARGETS + 1, GBUFFER_TARGETS + 2);
+        directionalShader.setInt("spotShadowTile", in.spotShadowTile);
+        glBindVertexArray(mEmptyVao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        // 3. point light volumes. Back faces are drawn with a greater-or-equal test so a pixel is
+        // only shaded if the scene surface lies in front of the back of the sphere, this also
+        // works when the camera is inside the volume. The low resolution target has no depth
+        // buffer, there the range test in the shader does all the rejecting
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        if (scale == 1) {
+            glEnable(GL_DEPTH_TEST);
+        }
+        glDepthFunc(GL_GEQUAL);
+        glDepthMask(GL_FALSE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+
+        pointLightShader.use();
+        setGBufferUniforms(pointLightShader, invView, projScale, scale);
+        pointLightShader.setVec3("viewPos", in.viewPos);
+        pointLightShader.setMat4("viewProjection", in.projection * in.view);
+        in.atlas.bind(pointLightShader, GBUFFER_TARGETS + 1, GBUFFER_TARGETS + 2);
+        glBindVertexArray(mSphereVao);
+        glDrawElementsInstanced(GL_TRIANGLES, mSphereIndexCount, GL_UNSIGNED_INT, 0,
+                                static_cast<GLsizei>(mPackedLights.size()));
+        glBindVertexArray(0);
+
+        glCullFace(GL_BACK);
+        glDisable(GL_CULL_FACE);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+
+        if (scale > 1) {
+            upsample(scale);
+        }
+    }
+
+    // bilateral upsample of mLowLitTexture into mLightBuffer
+    void upsample(int scale) {
+        glBindFramebuffer(GL_FRAMEBUFFER, mLightBuffer);
+        glViewport(0, 0, mWidth, mHeight);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_DEPTH_TEST);
+        bindGBuffer();
+        glActiveTexture(GL_TEXTURE0 + GBUFFER_TARGETS);
+        glBindTexture(GL_TEXTURE_2D, mLowLitTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        mUpsampleShader.use();
+        mUpsampleShader.setInt("gAlbedo", 0);
+        mUpsampleShader.setInt("gNormal", 2);
+        mUpsampleShader.setInt("gDepth", 3);
+        mUpsampleShader.setInt("lowLight", GBUFFER_TARGETS);
+        mUpsampleShader.setInt("lightingScale", scale);
+        glBindVertexArray(mEmptyVao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // Reads back the reduced resolution result, lights the same G-buffer again at full
+    // resolution and prints the difference. This stalls the pipeline, it's a debugging aid.
+    void compareWithFullResolution(const LightingInputs& in) {
+        std::vector<float> reduced = readLitImage();
+        lightingPass(in, 1);
+        std::vector<float> full = readLitImage();
+
+        // colours are clamped to what the screen shows before comparing
+        size_t pixels = full.size() / 4;
+        std::vector<double> rowSquared(mHeight, 0.0);
+        std::vector<float> rowMax(mHeight, 0.0f);
+        ThreadPool::instance().parallelFor(mHeight, 16, [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++) {
+                for (size_t x = 0; x < static_cast<size_t>(mWidth); x++) {
+                    size_t index = (y * mWidth + x) * 4;
+                    for (int c = 0; c < 3; c++) {
+                        float a = std::min(std::max(full[index + c], 0.0f), 1.0f);
+                        float b = std::min(std::max(reduced[index + c], 0.0f), 1.0f);
+                        rowSquared[y] += (a - b) * (a - b);
+                        rowMax[y] = std::max(rowMax[y], std::abs(a - b));
+                    }
+                }
+            }
+        });
+        double squared = 0.0;
+        float maxError = 0.0f;
+        for (int y = 0; y < mHeight; y++) {
+            squared += rowSquared[y];
+            maxError = std::max(maxError, rowMax[y]);
+        }
+        double rmse = std::sqrt(squared / std::max<size_t>(pixels * 3, 1));
+        double psnr = rmse > 0.0 ? 20.0 * std::log10(1.0 / rmse) : 99.0;
+        std::cout << "lighting at 1/" << mLightingScale << " resolution vs full: RMSE " << rmse << ", PSNR "
+                  << psnr << " dB, largest channel error " << maxError << std::endl;
+
+        // put the reduced image back so this frame still shows the selected mode
+        lightingPass(in, mLightingScale);
+    }
+
+    std::vector<float> readLitImage() const {
+        std::vector<float> pixels(static_cast<size_t>(mWidth) * mHeight * 4);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, mLightBuffer);
+        glReadPixels(0, 0, mWidth, mHeight, GL_RGBA, GL_FLOAT, pixels.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        return pixels;
+    }
+
+    // (re)allocate the reduced resolution light buffer for the current size and scale
+    void resizeLowTargets() {
+        if (mLowLightBuffer != 0) {
+            glDeleteFramebuffers(1, &mLowLightBuffer);
+            glDeleteTextures(1, &mLowLitTexture);
+            mLowLightBuffer = 0;
+            mLowLitTexture = 0;
+        }
+        if (mLightingScale == 1 || mWidth == 0) {
+            return;
+        }
+        mLowWidth = std::max((mWidth + mLightingScale - 1) / mLightingScale, 1);
+        mLowHeight = std::max((mHeight + mLightingScale - 1) / mLightingScale, 1);
+        glGenTextures(1, &mLowLitTexture);
+        glBindTexture(GL_TEXTURE_2D, mLowLitTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, mLowWidth, mLowHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        GLint previous = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+        glGenFramebuffers(1, &mLowLightBuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mLowLightBuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mLowLitTexture, 0);
+        checkComplete("low resolution light buffer");
+        glBindFramebuffer(GL_FRAMEBUFFER, previous);
+    }
+
+    unsigned int createTarget(GLenum internalFormat, GLenum format, GLenum type) {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, mWidth, mHeight, 0, format, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void releaseTargets() {
+        if (mGBuffer == 0) {
+            return;
+        }
+        glDeleteFramebuffers(1, &mGBuffer);
+        glDeleteFramebuffers(1, &mLightBuffer);
+        glDeleteTextures(GBUFFER_TARGETS, mTargets);
+        glDeleteTextures(1, &mLitTexture);
+        glDeleteRenderbuffers(1, &mDepthBuffer);
+    }
+
+    static void checkComplete(const char* name) {
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "ERROR FRAMEBUFFER INCOMPLETE: " << name << std::endl;
+        }
+    }
+
+    void bindGBuffer() const {
+        for (int i = 0; i < GBUFFER_TARGETS; i++) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, mTargets[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void setGBufferUniforms(const Shader& shader, const glm::mat4& invView, const glm::vec2& projScale, int scale) const {
+        shader.setInt("gAlbedo", 0);
+        shader.setInt("gSpecular", 1);
+        shader.setInt("gNormal", 2);
+        shader.setInt("gDepth", 3);
+        shader.setMat4("invView", invView);
+        shader.setVec2("projScale", projScale);
+        shader.setVec2("screenSize", glm::vec2(mWidth, mHeight));
+        shader.setFloat("gBufferScale", static_cast<float>(scale));
+    }
+
+    void uploadLights(const std::vector<PointLight>& pointLights, const std::vector<int>& shadowTiles) {
+        mPackedLights.resize(pointLights.size());
+        for (size_t i = 0; i < pointLights.size(); i++) {
+            const PointLight& light = pointLights[i];
+            mPackedLights[i] = packPointLight(light, lightRange(light.attenuation, light.lightProp),
+                                              shadowTiles.empty() ? -1 : shadowTiles[i]);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, mInstanceVbo);
+        glBufferData(GL_ARRAY_BUFFER, mPackedLights.size() * sizeof(PackedPointLight), nullptr, GL_STREAM_DRAW);
+        if (!mPackedLights.empty()) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, mPackedLights.size() * sizeof(PackedPointLight), &mPackedLights[0]);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // a low poly UV sphere, pushed out so its flat faces still enclose the unit sphere. Faces
+    // cut inside the vertices both around (segments) and between rings, so both count.
+    void setUpSphere() {
+        const unsigned int rings = 8;
+        const unsigned int segments = 12;
+        const float pi = 3.14159265358979f;
+        const float enclose = 1.0f / (std::cos(pi / segments) * std::cos(pi / (2 * rings)));
+
+        std::vector<PositionVertex> vertices;
+        for (unsigned int ring = 0; ring <= rings; ring++) {
+            float phi = pi * ring / rings;
+            for (unsigned int segment = 0; segment <= segments; segment++) {
+                float theta = 2.0f * pi * segment / segments;
+                PositionVertex vertex;
+                vertex.position = glm::vec3(std::sin(phi) * std::cos(theta), std::cos(phi),
+                                            std::sin(phi) * std::sin(theta)) * enclose;
+                vertices.push_back(vertex);
+            }
+        }
+        std::vector<unsigned int> indices;
+        for (unsigned int ring = 0; ring < rings; ring++) {
+            for (unsigned int segment = 0; segment < segments; segment++) {
+                unsigned int a = ring * (segments + 1) + segment;
+                unsigned int b = a + segments + 1;
+                // counter clockwise seen from outside
+                indices.insert(indices.end(), { a, a + 1, b, b, a + 1, b + 1 });
+            }
+        }
+        mSphereIndexCount = static_cast<GLsizei>(indices.size());
+
+        glGenVertexArrays(1, &mSphereVao);
+        glGenBuffers(1, &mSphereVbo);
+        glGenBuffers(1, &mSphereEbo);
+        glGenBuffers(1, &mInstanceVbo);
+
+        glBindVertexArray(mSphereVao);
+        glBindBuffer(GL_ARRAY_BUFFER, mSphereVbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(PositionVertex), &vertices[0], GL_STATIC_DRAW);
+        VertexFormat<PositionVertex>::Layout::enable();
+        glBindBuffer(GL_ARRAY_BUFFER, mInstanceVbo);
+        VertexFormat<PackedPointLight>::Layout::enable();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mSphereEbo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBindVertexArray(0);
+    }
+};
+
+#endif /* deferredRenderer_h */
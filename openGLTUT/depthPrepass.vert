@@ -0,0 +1,12 @@
+#version 330 core
+// depth pre-pass, fed from the meshes' position only stream. The shading pass tests its depth
+// for equality, so both must compute gl_Position the same way
+VERTEX_INPUTS
+
+uniform mat4 mvp;
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = mvp * vec4(aPos, 1.0f);
+}
@@ -0,0 +1,142 @@
+//
+//  fileWatcher.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-14.
+//
+
+#ifndef fileWatcher_h
+#define fileWatcher_h
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Watches a set of files from a background thread and calls onChange (on that thread)
+// whenever one of them is written. Uses inotify on linux and falls back to polling
+// modification times elsewhere (macOS has no inotify).
+class FileWatcher {
+public:
+    FileWatcher(const std::vector<std::string>& paths, std::function<void()> onChange)
+        : mPaths(paths), mOnChange(onChange), mRunning(true) {
+        mThread = std::thread(&FileWatcher::run, this);
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    ~FileWatcher() {
+        mRunning = false;
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+    }
+
+    // nanosecond modification time of a file, 0 if it doesn't exist
+    static long long modifiedTime(const std::string& path) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            return 0;
+        }
+#ifdef __APPLE__
+        return info.st_mtimespec.tv_sec * 1000000000LL + info.st_mtimespec.tv_nsec;
+#else
+        return info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+#endif
+    }
+
+private:
+    std::vector<std::string> mPaths;
+    std::function<void()> mOnChange;
+    std::atomic<bool> mRunning;
+    std::thread mThread;
+
+    static std::string directoryOf(const std::string& path) {
+        size_t slash = path.find_last_of('/');
+        return slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+    }
+
+    static std::string fileNameOf(const std::string& path) {
+        size_t slash = path.find_last_of('/');
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+
+#ifdef __linux__
+    void run() {
+        int fd = inotify_init1(IN_NONBLOCK);
+        if (fd < 0) {
+            runPolling();
+            return;
+        }
+        // watch the directories rather than the files, editors usually save by
+        // writing a temp file and renaming it over the original
+        for (const std::string& path : mPaths) {
+            inotify_add_watch(fd, directoryOf(path).c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        while (mRunning) {
+            pollfd pfd = { fd, POLLIN, 0 };
+            // wake up periodically so the destructor never waits long
+            if (poll(&pfd, 1, 100) <= 0) {
+                continue;
+            }
+            ssize_t len = read(fd, buffer, sizeof(buffer));
+            bool changed = false;
+            for (ssize_t i = 0; i < len; ) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + i);
+                if (event->len > 0) {
+                    for (const std::string& path : mPaths) {
+                        if (fileNameOf(path) == event->name) {
+                            changed = true;
+                        }
+                    }
+                }
+                i += sizeof(inotify_event) + event->len;
+            }
+            if (changed) {
+                mOnChange();
+            }
+        }
+        close(fd);
+    }
+#else
+    void run() {
+        runPolling();
+    }
+#endif
+
+    void runPolling() {
+        std::vector<long long> lastModified;
+        for (const std::string& path : mPaths) {
+            lastModified.push_back(modifiedTime(path));
+        }
+        while (mRunning) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            bool changed = false;
+            for (size_t i = 0; i < mPaths.size(); i++) {
+                long long modified = modifiedTime(mPaths[i]);
+                if (modified != lastModified[i]) {
+                    lastModified[i] = modified;
+                    changed = true;
+                }
+            }
+            if (changed) {
+                mOnChange();
+            }
+        }
+    }
+};
+
+#endif /* fileWatcher_h */
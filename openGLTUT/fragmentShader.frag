@@ -4,8 +4,9 @@ out vec4 FragColour;
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
-in vec3 Tangents;
-in vec3 Bitangents;
+#ifdef BAKED_LIGHTING
+in vec2 LightmapCoords;
+#endif
 
 
 uniform float alpha;
@@ -28,121 +29,95 @@ struct Material {
 };
 uniform Material material;
 
-struct LightProperties {
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct Attenuation {
-    float constant;
-    float linear;
-    float quadratic;
-};
+#include "lighting.glsl"
 
-struct DirLight {
-    vec3 direction;
-    LightProperties lightProp;
-};
 uniform DirLight dirLight;
 
-struct PointLight {
-    vec3 position;
-    Attenuation attenuation;
-    LightProperties lightProp;
-};
+#ifdef BAKED_LIGHTING
+// the directional light and static point lights come from the bake
+#include "bakedLighting.glsl"
+#endif
+
+#ifdef SH_AMBIENT
+#include "shAmbient.glsl"
+#endif
+
+#ifdef DIR_SHADOWS
+#include "shadows.glsl"
+#endif
+
+#ifdef ATLAS_SHADOWS
+#include "shadowAtlas.glsl"
+uniform int spotShadowTile;
+#endif
+
+#ifdef CLUSTERED_LIGHTING
+// any number of point lights, looked up per cluster
+#include "clusteredLighting.glsl"
+#else
+// can be overridden with a define passed to Shader
+#ifndef NR_POINT_LIGHTS
 #define NR_POINT_LIGHTS 2
+#endif
 uniform PointLight pointLights[NR_POINT_LIGHTS];
+#endif
 
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutoff;
-    float outerCutoff;
-    Attenuation attenuation;
-    LightProperties lightProp;
-};
 uniform SpotLight spotLight;
 
-vec3 calcDirLight(DirLight light, vec3 norm, vec3 viewDir) {
-    vec3 lightDir = normalize(-light.direction);
-    // diffuse
-    float diff = max(dot(norm, lightDir), 0.0);
-    // specular
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    // combine effects
-    vec3 ambient = light.lightProp.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.lightProp.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.lightProp.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
-
-    return (ambient + diffuse + specular);
-}
-
-vec3 calcPointLight(PointLight light, vec3 norm, vec3 fragPos, vec3 viewDir) {
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse
-    float diff = max(dot(norm, lightDir), 0.0);
-    // specular
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attentuation = 1.0f / (light.attenuation.constant +
-                                 light.attenuation.linear * distance +
-                                 light.attenuation.quadratic * (distance * distance));
-    // combine effects
-    vec3 ambient = light.lightProp.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.lightProp.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.lightProp.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
-    ambient *= attentuation;
-    diffuse *= attentuation;
-    specular *= attentuation;
-
-    return (ambient + diffuse + specular);
-}
-
-vec3 calcSpotLight(SpotLight light, vec3 norm, vec3 fragPos, vec3 viewDir) {
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse
-    float diff = max(dot(norm, lightDir), 0.0);
-    // specular
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attentuation = 1.0f / (light.attenuation.constant +
-                                 light.attenuation.linear * distance +
-                                 light.attenuation.quadratic * (distance * distance));
-    // spotlight calc
-    float theta = dot(lightDir, normalize(-light.direction));
-    float epsilon = light.cutoff - light.outerCutoff;
-    float intensity = clamp((theta - light.outerCutoff) / epsilon, 0.0, 1.0);
-    // combine effects
-    vec3 ambient = light.lightProp.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.lightProp.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.lightProp.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
-    ambient *= attentuation;
-    diffuse *= attentuation;
-    specular *= attentuation;
-    diffuse *= intensity;
-    specular *= intensity;
-
-    return (ambient + diffuse + specular);
-}
+#ifndef ALPHA_CUTOFF
+#define ALPHA_CUTOFF 0.5
+#endif
 
 void main() {
+    vec4 diffuse = texture(material.texture_diffuse1, TexCoords);
+#ifdef ALPHA_TEST
+    // only the alpha tested bucket is built with this, a discard anywhere in a program turns
+    // off early depth rejection for everything it draws
+    if (diffuse.a < ALPHA_CUTOFF) {
+        discard;
+    }
+#endif
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
 
-    // 1. directional lighting
-    vec3 result = calcDirLight(dirLight, norm, viewDir);
+    // sample the material once for every light
+    Surface surface;
+    surface.albedo = diffuse.rgb;
+    surface.specular = vec3(texture(material.texture_specular1, TexCoords));
+    surface.shininess = material.shininess;
+
+    // 1. directional lighting, with the static point lights when they are baked
+#if defined(BAKED_LIGHTING)
+    vec3 result = calcBakedLighting(LightmapCoords, FragPos, norm, surface);
+#elif defined(DIR_SHADOWS)
+    vec3 result = calcDirLight(dirLight, norm, viewDir, surface, calcDirShadow(FragPos, norm));
+#else
+    vec3 result = calcDirLight(dirLight, norm, viewDir, surface);
+#endif
     // 2. point lights
+#ifdef CLUSTERED_LIGHTING
+    result += calcClusteredPointLights(norm, FragPos, viewDir, surface);
+#else
     for (int i = 0; i < NR_POINT_LIGHTS; i++) {
-        result += calcPointLight(pointLights[i], norm, FragPos, viewDir);
+        result += calcPointLight(pointLights[i], norm, FragPos, viewDir, surface);
     }
+#endif
     // 3. spot light
-    result += calcSpotLight(spotLight, norm, FragPos, viewDir);
-
+#ifdef ATLAS_SHADOWS
+    float spotShadow = calcSpotShadow(spotShadowTile, FragPos, norm, spotLight.position);
+    result += calcSpotLight(spotLight, norm, FragPos, viewDir, surface, spotShadow);
+#else
+    result += calcSpotLight(spotLight, norm, FragPos, viewDir, surface);
+#endif
+
+#ifdef SH_AMBIENT
+    // 4. ambient, once for every light
+    result += calcSHAmbient(FragPos, norm, surface);
+#endif
+
+#ifdef BLENDED
+    FragColour = vec4(result, alpha * diffuse.a);
+#else
     FragColour = vec4(result, alpha);
+#endif
 }
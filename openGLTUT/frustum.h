@@ -0,0 +1,129 @@
+//
+//  frustum.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-29.
+//
+
+#ifndef frustum_h
+#define frustum_h
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// the six planes of the frustum pointing inwards, normalised so w is a distance
+inline void extractFrustumPlanes(const glm::mat4& m, glm::vec4* planes) {
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = row3 + row0;
+    planes[1] = row3 - row0;
+    planes[2] = row3 + row1;
+    planes[3] = row3 - row1;
+    planes[4] = row3 + row2;
+    planes[5] = row3 - row2;
+    for (int p = 0; p < 6; p++) {
+        planes[p] /= glm::length(glm::vec3(planes[p]));
+    }
+}
+
+// Axis aligned boxes as centres and half extents in structure of arrays form, so they can be
+// tested against planes four at a time.
+struct BoxList {
+    std::vector<float> centreX;
+    std::vector<float> centreY;
+    std::vector<float> centreZ;
+    std::vector<float> extentX;
+    std::vector<float> extentY;
+    std::vector<float> extentZ;
+
+    size_t size() const {
+        return centreX.size();
+    }
+
+    void resize(size_t count) {
+        centreX.resize(count);
+        centreY.resize(count);
+        centreZ.resize(count);
+        extentX.resize(count);
+        extentY.resize(count);
+        extentZ.resize(count);
+    }
+
+    void set(size_t i, const glm::vec3& min, const glm::vec3& max) {
+        glm::vec3 centre = (min + max) * 0.5f;
+        glm::vec3 extent = (max - min) * 0.5f;
+        centreX[i] = centre.x;
+        centreY[i] = centre.y;
+        centreZ[i] = centre.z;
+        extentX[i] = extent.x;
+        extentY[i] = extent.y;
+        extentZ[i] = extent.z;
+    }
+};
+
+// Sets visible[i] to 1 for every box that isn't fully behind one of the planes, 0 otherwise.
+// A box is behind a plane when its centre is further behind it than the box's extent projected
+// onto the plane normal. Returns the number of visible boxes.
+inline size_t cullBoxes(const glm::vec4* planes, const BoxList& boxes, unsigned char* visible) {
+    size_t count = boxes.size();
+    size_t visibleCount = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+    for (int p = 0; p < 6; p++) {
+        planeX[p] = _mm_set1_ps(planes[p].x);
+        planeY[p] = _mm_set1_ps(planes[p].y);
+        planeZ[p] = _mm_set1_ps(planes[p].z);
+        planeW[p] = _mm_set1_ps(planes[p].w);
+        absX[p] = _mm_set1_ps(std::abs(planes[p].x));
+        absY[p] = _mm_set1_ps(std::abs(planes[p].y));
+        absZ[p] = _mm_set1_ps(std::abs(planes[p].z));
+    }
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(&boxes.centreX[i]);
+        __m128 y = _mm_loadu_ps(&boxes.centreY[i]);
+        __m128 z = _mm_loadu_ps(&boxes.centreZ[i]);
+        __m128 ex = _mm_loadu_ps(&boxes.extentX[i]);
+        __m128 ey = _mm_loadu_ps(&boxes.extentY[i]);
+        __m128 ez = _mm_loadu_ps(&boxes.extentZ[i]);
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], ex), _mm_mul_ps(absY[p], ey)),
+                                       _mm_mul_ps(absZ[p], ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; lane++) {
+            visible[i + lane] = (mask >> lane) & 1;
+            visibleCount += visible[i + lane];
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++) {
+            float distance = planes[p].x * boxes.centreX[i] + planes[p].y * boxes.centreY[i] +
+                             planes[p].z * boxes.centreZ[i] + planes[p].w;
+            float radius = std::abs(planes[p].x) * boxes.extentX[i] + std::abs(planes[p].y) * boxes.extentY[i] +
+                           std::abs(planes[p].z) * boxes.extentZ[i];
+            inside = distance + radius >= 0.0f;
+        }
+        visible[i] = inside ? 1 : 0;
+        visibleCount += visible[i];
+    }
+    return visibleCount;
+}
+
+#endif /* frustum_h */
@@ -0,0 +1,39 @@
+#version 330 core
+// deferred geometry pass, everything the light passes need, written once per pixel
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec4 gSpecular;
+layout (location = 2) out vec4 gNormal;
+layout (location = 3) out float gDepth;
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;
+    float shininess;
+};
+uniform Material material;
+
+uniform mat4 view;
+
+#ifndef ALPHA_CUTOFF
+#define ALPHA_CUTOFF 0.5
+#endif
+
+void main() {
+    vec4 diffuse = texture(material.texture_diffuse1, TexCoords);
+#ifdef ALPHA_TEST
+    // kept out of the opaque program so it keeps early depth rejection
+    if (diffuse.a < ALPHA_CUTOFF) {
+        discard;
+    }
+#endif
+    gAlbedo = vec4(diffuse.rgb, 1.0);
+    // shininess is stored scaled down to fit the 8 bit alpha channel
+    gSpecular = vec4(texture(material.texture_specular1, TexCoords).rgb, material.shininess / 256.0);
+    gNormal = vec4(normalize(Normal), 0.0);
+    // linear view depth, 0 where nothing was drawn
+    gDepth = -(view * vec4(FragPos, 1.0)).z;
+}
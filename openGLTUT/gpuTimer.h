@@ -0,0 +1,80 @@
+//
+//  gpuTimer.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-15.
+//
+
+#ifndef gpuTimer_h
+#define gpuTimer_h
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+// Measures GPU time spent between begin() and end() with GL_TIME_ELAPSED queries.
+// Queries are kept in a small ring and only read back once the GPU reports them as
+// available, so measuring never stalls the pipeline. Results lag a few frames behind.
+class GpuTimer {
+public:
+    GpuTimer()
+        : mFrame(0), mSamples(0), mTotalNs(0), mLastNs(0) {
+        glGenQueries(QUERY_COUNT, mQueries);
+    }
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    void begin() {
+        glBeginQuery(GL_TIME_ELAPSED, mQueries[mFrame % QUERY_COUNT]);
+    }
+
+    void end() {
+        glEndQuery(GL_TIME_ELAPSED);
+        mFrame++;
+        collect();
+    }
+
+    // milliseconds of the most recent finished measurement
+    double lastMs() const {
+        return mLastNs / 1.0e6;
+    }
+
+    // average milliseconds since the last reset()
+    double averageMs() const {
+        return mSamples == 0 ? 0.0 : (mTotalNs / 1.0e6) / mSamples;
+    }
+
+    void reset() {
+        mSamples = 0;
+        mTotalNs = 0;
+    }
+
+private:
+    static const unsigned int QUERY_COUNT = 4;
+    unsigned int mQueries[QUERY_COUNT];
+    unsigned int mFrame;
+    unsigned int mSamples;
+    uint64_t mTotalNs;
+    uint64_t mLastNs;
+
+    void collect() {
+        // the oldest query in the ring is the one most likely to be ready
+        if (mFrame < QUERY_COUNT) {
+            return;
+        }
+        unsigned int query = mQueries[mFrame % QUERY_COUNT];
+        int available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return;
+        }
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        mLastNs = elapsed;
+        mTotalNs += elapsed;
+        mSamples++;
+    }
+};
+
+#endif /* gpuTimer_h */
@@ -0,0 +1,354 @@
+//
+//  hiZCuller.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-31.
+//
+
+#ifndef hiZCuller_h
+#define hiZCuller_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "shader.h"
+#include "frustum.h"
+
+// Occlusion culling on the GPU against a hierarchical Z pyramid. build() copies a depth buffer
+// and reduces it into a mip chain where every texel holds the farthest depth under it, then
+// testBoxes() projects boxes with the matrix that depth was rendered with and compares each
+// box's nearest depth against at most 2x2 texels of the right level.
+//
+// GL 3.3 has no compute shaders or indirect draws, so the test is a vertex shader run over one
+// point per box with transform feedback capturing the results, which are read back for the
+// CPU to skip draws. The read back waits for the GPU to finish the test.
+//
+// Used in two phases: meshes are tested against the pyramid of the previous frame and only
+// the visible ones drawn, then the pyramid is built from that depth and the meshes hidden in
+// the first phase are tested again, catching the ones that just came into view.
+class HiZCuller {
+public:
+    HiZCuller(const std::string& shaderDirectory)
+        : mCopyShader((shaderDirectory + "fullscreen.vert").c_str(), (shaderDirectory + "hiZReduce.frag").c_str(),
+                      { "COPY_DEPTH" }),
+          mReduceShader((shaderDirectory + "fullscreen.vert").c_str(), (shaderDirectory + "hiZReduce.frag").c_str()),
+          mTestShader((shaderDirectory + "hiZTest.vert").c_str(), (shaderDirectory + "hiZTest.frag").c_str(), {},
+                      { "visible" }),
+          mDebugShader((shaderDirectory + "debugBoxes.vert").c_str(), (shaderDirectory + "debugBoxes.frag").c_str()),
+          mWidth(0), mHeight(0), mLevels(0), mDepthTexture(0), mDepthFramebuffer(0), mPyramid(0),
+          mPyramidFramebuffer(0), mViewProjection(1.0f), mValid(false), mTested(0), mHidden(0), mTestMs(0.0) {
+        glGenVertexArrays(1, &mEmptyVao);
+
+        glGenVertexArrays(1, &mBoxVao);
+        glGenBuffers(1, &mBoxVbo);
+        glBindVertexArray(mBoxVao);
+        glBindBuffer(GL_ARRAY_BUFFER, mBoxVbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)sizeof(glm::vec3));
+        glGenBuffers(1, &mResultBuffer);
+
+        glGenVertexArrays(1, &mLineVao);
+        glGenBuffers(1, &mLineVbo);
+        glBindVertexArray(mLineVao);
+        glBindBuffer(GL_ARRAY_BUFFER, mLineVbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    ~HiZCuller() {
+        releaseTargets();
+        glDeleteVertexArrays(1, &mEmptyVao);
+        glDeleteVertexArrays(1, &mBoxVao);
+        glDeleteBuffers(1, &mBoxVbo);
+        glDeleteBuffers(1, &mResultBuffer);
+        glDeleteVertexArrays(1, &mLineVao);
+        glDeleteBuffers(1, &mLineVbo);
+    }
+
+    HiZCuller(const HiZCuller&) = delete;
+    HiZCuller& operator=(const HiZCuller&) = delete;
+
+    void enableHotReload() {
+        mCopyShader.enableHotReload();
+        mReduceShader.enableHotReload();
+        mTestShader.enableHotReload();
+        mDebugShader.enableHotReload();
+    }
+
+    void reloadIfChanged() {
+        mCopyShader.reloadIfChanged();
+        mReduceShader.reloadIfChanged();
+        mTestShader.reloadIfChanged();
+        mDebugShader.reloadIfChanged();
+    }
+
+    // Builds the pyramid from the depth of sourceFramebuffer, which has to be width x height with
+    // a 24 bit depth and 8 bit stencil buffer, e.g. the G-buffer or the default framebuffer.
+    // viewProjection is what that depth was rendered with, boxes are tested with it until the
+    // next build. Leaves the default framebuffer bound and the viewport changed.
+    void build(unsigned int sourceFramebuffer, int width, int height, const glm::mat4& viewProjection) {
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+        if (width != mWidth || height != mHeight) {
+            resize(width, height);
+        }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sourceFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mDepthFramebuffer);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+        glDisable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, mPyramidFramebuffer);
+        glBindVertexArray(mEmptyVao);
+        glActiveTexture(GL_TEXTURE0);
+        for (int level = 0; level < mLevels; level++) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mPyramid, level);
+            glViewport(0, 0, std::max(width >> level, 1), std::max(height >> level, 1));
+            Shader& shader = level == 0 ? mCopyShader : mReduceShader;
+            shader.use();
+            shader.setInt("source", 0);
+            if (level == 0) {
+                glBindTexture(GL_TEXTURE_2D, mDepthTexture);
+            } else {
+                // only the level read is visible to the shader, so it never samples the one written
+                glBindTexture(GL_TEXTURE_2D, mPyramid);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+            }
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glBindTexture(GL_TEXTURE_2D, mPyramid);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mLevels - 1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glEnable(GL_DEPTH_TEST);
+
+        mViewProjection = viewProjection;
+        mValid = true;
+    }
+
+    // forget the pyramid, e.g. after a cut where last frame's depth says nothing
+    void invalidate() {
+        mValid = false;
+    }
+
+    // Same contract as OcclusionCuller::testBoxes: clears visible[i] for visible boxes the
+    // pyramid hides and returns how many it hid. Before the first build() nothing is hidden.
+    size_t testBoxes(const BoxList& boxes, unsigned char* visible) {
+        auto start = std::chrono::high_resolution_clock::now();
+        mTested = 0;
+        mHidden = 0;
+        if (!mValid) {
+            return 0;
+        }
+        mCandidates.clear();
+        mBoxData.clear();
+        for (size_t i = 0; i < boxes.size(); i++) {
+            if (!visible[i]) {
+                continue;
+            }
+            glm::vec3 centre(boxes.centreX[i], boxes.centreY[i], boxes.centreZ[i]);
+            glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+            mCandidates.push_back(i);
+            mBoxData.push_back(centre - extent);
+            mBoxData.push_back(centre + extent);
+        }
+        mTested = mCandidates.size();
+        if (mCandidates.empty()) {
+            return 0;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, mBoxVbo);
+        glBufferData(GL_ARRAY_BUFFER, mBoxData.size() * sizeof(glm::vec3), mBoxData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, mResultBuffer);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, mCandidates.size() * sizeof(float), nullptr, GL_STREAM_READ);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, mResultBuffer);
+
+        mTestShader.use();
+        mTestShader.setMat4("viewProjection", mViewProjection);
+        mTestShader.setInt("hiZ", 0);
+        mTestShader.setInt("hiZLevels", mLevels);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, mPyramid);
+        glBindVertexArray(mBoxVao);
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(mCandidates.size()));
+        glEndTransformFeedback();
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(0);
+
+        mResults.resize(mCandidates.size());
+        glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, mResults.size() * sizeof(float), mResults.data());
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        for (size_t i = 0; i < mCandidates.size(); i++) {
+            if (mResults[i] < 0.5f) {
+                visible[mCandidates[i]] = 0;
+                mHidden++;
+            }
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        mTestMs = std::chrono::duration<double, std::milli>(end - start).count();
+        return mHidden;
+    }
+
+    // Debug overlay: outlines the boxes with flags[i] set, drawn over everything into whatever
+    // framebuffer is bound.
+    void drawBoxes(const BoxList& boxes, const unsigned char* flags, const glm::mat4& viewProjection,
+                   const glm::vec3& colour) {
+        std::vector<glm::vec3> lines;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            if (!flags[i]) {
+                continue;
+            }
+            glm::vec3 centre(boxes.centreX[i], boxes.centreY[i], boxes.centreZ[i]);
+            glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+            // the 12 edges, each between two corners that differ in one axis
+            for (int corner = 0; corner < 8; corner++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    if (corner & (1 << axis)) {
+                        continue;
+                    }
+                    lines.push_back(centre + extent * cornerSigns(corner));
+                    lines.push_back(centre + extent * cornerSigns(corner | (1 << axis)));
+                }
+            }
+        }
+        if (lines.empty()) {
+            return;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, mLineVbo);
+        glBufferData(GL_ARRAY_BUFFER, lines.size() * sizeof(glm::vec3), lines.data(), GL_STREAM_DRAW);
+        mDebugShader.use();
+        mDebugShader.setMat4("viewProjection", viewProjection);
+        mDebugShader.setVec3("colour", colour);
+        glDisable(GL_DEPTH_TEST);
+        glBindVertexArray(mLineVao);
+        glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(lines.size()));
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // boxes sent to and hidden by the last testBoxes(), and the CPU milliseconds it took
+    // including the wait for the result
+    size_t testedBoxes() const {
+        return mTested;
+    }
+
+    size_t hiddenBoxes() const {
+        return mHidden;
+    }
+
+    double testMs() const {
+        return mTestMs;
+    }
+
+private:
+    Shader mCopyShader;
+    Shader mReduceShader;
+    Shader mTestShader;
+    Shader mDebugShader;
+
+    int mWidth;
+    int mHeight;
+    int mLevels;
+    unsigned int mDepthTexture;
+    unsigned int mDepthFramebuffer;
+    unsigned int mPyramid;
+    unsigned int mPyramidFramebuffer;
+    unsigned int mEmptyVao;
+    unsigned int mBoxVao;
+    unsigned int mBoxVbo;
+    unsigned int mResultBuffer;
+    unsigned int mLineVao;
+    unsigned int mLineVbo;
+
+    glm::mat4 mViewProjection;
+    bool mValid;
+    std::vector<size_t> mCandidates;
+    std::vector<glm::vec3> mBoxData;
+    std::vector<float> mResults;
+    size_t mTested;
+    size_t mHidden;
+    double mTestMs;
+
+    static glm::vec3 cornerSigns(int corner) {
+        return glm::vec3((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f);
+    }
+
+    void resize(int width, int height) {
+        releaseTargets();
+        mWidth = width;
+        mHeight = height;
+        mLevels = 1;
+        while ((width >> mLevels) > 0 || (height >> mLevels) > 0) {
+            mLevels++;
+        }
+
+        // same format as the G-buffer's and the default framebuffer's depth so it can be blitted
+        glGenTextures(1, &mDepthTexture);
+        glBindTexture(GL_TEXTURE_2D, mDepthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8,
+                     nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenFramebuffers(1, &mDepthFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mDepthFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, mDepthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        checkComplete("hi-z depth");
+
+        glGenTextures(1, &mPyramid);
+        glBindTexture(GL_TEXTURE_2D, mPyramid);
+        for (int level = 0; level < mLevels; level++) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, std::max(width >> level, 1), std::max(height >> level, 1), 0,
+                         GL_RED, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mLevels - 1);
+        glGenFramebuffers(1, &mPyramidFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mPyramidFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mPyramid, 0);
+        checkComplete("hi-z pyramid");
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        mValid = false;
+    }
+
+    void releaseTargets() {
+        if (mPyramid == 0) {
+            return;
+        }
+        glDeleteFramebuffers(1, &mDepthFramebuffer);
+        glDeleteTextures(1, &mDepthTexture);
+        glDeleteFramebuffers(1, &mPyramidFramebuffer);
+        glDeleteTextures(1, &mPyramid);
+        mPyramid = 0;
+    }
+
+    static void checkComplete(const char* name) {
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "ERROR FRAMEBUFFER INCOMPLETE: " << name << std::endl;
+        }
+    }
+};
+
+#endif /* hiZCuller_h */
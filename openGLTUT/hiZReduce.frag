@@ -0,0 +1,26 @@
+#version 330 core
+// One level of the Hi-Z pyramid from the level above it. Each texel keeps the farthest depth
+// of the texels it covers, so nothing behind it can be mistaken for hidden. The source is
+// bound with its base and max level set to the level read, so level 0 here is that level.
+out float farthest;
+
+uniform sampler2D source;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+#ifdef COPY_DEPTH
+    farthest = texelFetch(source, texel, 0).r;
+#else
+    ivec2 size = textureSize(source, 0);
+    // odd sized sources fold their last row and column into the last texel
+    ivec2 last = max(size / 2 - 1, 0);
+    ivec2 span = ivec2(texel.x == last.x && (size.x & 1) == 1 ? 3 : 2, texel.y == last.y && (size.y & 1) == 1 ? 3 : 2);
+    float depth = 0.0;
+    for (int y = 0; y < span.y; y++) {
+        for (int x = 0; x < span.x; x++) {
+            depth = max(depth, texelFetch(source, min(texel * 2 + ivec2(x, y), size - 1), 0).r);
+        }
+    }
+    farthest = depth;
+#endif
+}
@@ -0,0 +1,8 @@
+#version 330 core
+// never runs, the test draws with GL_RASTERIZER_DISCARD and only captures hiZTest.vert's
+// visible output through transform feedback
+out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(0.0);
+}
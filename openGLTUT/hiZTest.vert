@@ -0,0 +1,58 @@
+#version 330 core
+// One box per vertex, tested against the Hi-Z pyramid and captured with transform feedback.
+// The level is picked so the box's screen rectangle covers at most 2x2 texels of it.
+layout (location = 0) in vec3 boxMin;
+layout (location = 1) in vec3 boxMax;
+
+// world to clip space of the depth the pyramid was built from
+uniform mat4 viewProjection;
+uniform sampler2D hiZ;
+uniform int hiZLevels;
+
+flat out float visible;
+
+float testBox() {
+    vec2 rectMin = vec2(1.0);
+    vec2 rectMax = vec2(0.0);
+    float nearest = 1.0;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = vec3((i & 1) != 0 ? boxMax.x : boxMin.x, (i & 2) != 0 ? boxMax.y : boxMin.y,
+                           (i & 4) != 0 ? boxMax.z : boxMin.z);
+        vec4 clip = viewProjection * vec4(corner, 1.0);
+        // boxes reaching past the near plane are next to the camera
+        if (clip.w <= 0.0 || clip.z < -clip.w) {
+            return 1.0;
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        rectMin = min(rectMin, ndc.xy * 0.5 + 0.5);
+        rectMax = max(rectMax, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    rectMin = clamp(rectMin, 0.0, 1.0);
+    rectMax = clamp(rectMax, 0.0, 1.0);
+    // off screen, that's for frustum culling to decide
+    if (rectMin.x >= rectMax.x || rectMin.y >= rectMax.y) {
+        return 1.0;
+    }
+
+    ivec2 size = textureSize(hiZ, 0);
+    vec2 extent = (rectMax - rectMin) * vec2(size);
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, hiZLevels - 1);
+    // a level 0 texel t lands in texel min(t >> level, size - 1) of the level, see hiZReduce.frag
+    ivec2 levelSize = textureSize(hiZ, level);
+    ivec2 lo = min(ivec2(rectMin * vec2(size)) >> level, levelSize - 1);
+    ivec2 hi = min(min(ivec2(rectMax * vec2(size)), size - 1) >> level, levelSize - 1);
+    float farthest = 0.0;
+    for (int y = lo.y; y <= hi.y; y++) {
+        for (int x = lo.x; x <= hi.x; x++) {
+            farthest = max(farthest, texelFetch(hiZ, ivec2(x, y), level).r);
+        }
+    }
+    // a little slack for the depth buffer's 24 bit rounding
+    return nearest <= farthest + 1.0e-6 ? 1.0 : 0.0;
+}
+
+void main() {
+    visible = testBox();
+    gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+}
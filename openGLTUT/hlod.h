@@ -0,0 +1,622 @@
+//
+//  hlod.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-08-02.
+//
+
+#ifndef hlod_h
+#define hlod_h
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <array>
+#include <set>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+
+#include "lightmapBaker.h"
+#include "rayTracer.h"
+#include "threadPool.h"
+#include "binaryIO.h"
+#include "charts.h"
+#include "meshChunks.h"
+#include "stb_image.h"
+
+// Hierarchical LOD proxies, written by HlodBuilder and read back by HlodProxies. Every proxy is
+// one simplified mesh standing in for a cluster of the model's meshes, textured from a colour
+// atlas they all share. Positions are in the model's own space, like its meshes.
+// The file is a magic number and version followed by these fields in order.
+struct HlodSet {
+    uint32_t meshCount;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> texCoords;
+    std::vector<uint32_t> indices;
+    // proxy p has vertices [vertexOffsets[p], vertexOffsets[p + 1]), indices [indexOffsets[p],
+    // indexOffsets[p + 1]) counting from its first vertex, and stands in for the meshes
+    // members[memberOffsets[p], memberOffsets[p + 1])
+    std::vector<uint32_t> vertexOffsets;
+    std::vector<uint32_t> indexOffsets;
+    std::vector<uint32_t> members;
+    std::vector<uint32_t> memberOffsets;
+    // RGBA, atlasSize texels square
+    uint32_t atlasSize;
+    std::vector<unsigned char> atlas;
+
+    HlodSet()
+        : meshCount(0), atlasSize(0) {
+    }
+
+    size_t proxyCount() const {
+        return vertexOffsets.empty() ? 0 : vertexOffsets.size() - 1;
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR::HLOD::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        const uint32_t header[2] = { MAGIC, VERSION };
+        writeBinary(file, header);
+        writeBinary(file, meshCount);
+        writeBinaryArray(file, positions);
+        writeBinaryArray(file, normals);
+        writeBinaryArray(file, texCoords);
+        writeBinaryArray(file, indices);
+        writeBinaryArray(file, vertexOffsets);
+        writeBinaryArray(file, indexOffsets);
+        writeBinaryArray(file, members);
+        writeBinaryArray(file, memberOffsets);
+        writeBinary(file, atlasSize);
+        writeBinaryArray(file, atlas);
+        return static_cast<bool>(file);
+    }
+
+    bool load(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        if (!file || !readBinary(file, magic) || !readBinary(file, version) || magic != MAGIC || version != VERSION) {
+            std::cerr << "ERROR::HLOD::NOT_AN_HLOD_FILE " << path << std::endl;
+            return false;
+        }
+        readBinary(file, meshCount);
+        readBinaryArray(file, positions);
+        readBinaryArray(file, normals);
+        readBinaryArray(file, texCoords);
+        readBinaryArray(file, indices);
+        readBinaryArray(file, vertexOffsets);
+        readBinaryArray(file, indexOffsets);
+        readBinaryArray(file, members);
+        readBinaryArray(file, memberOffsets);
+        readBinary(file, atlasSize);
+        readBinaryArray(file, atlas);
+        if (!file || !valid()) {
+            std::cerr << "ERROR::HLOD::CORRUPT " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x444f4c48; // "HLOD"
+    static const uint32_t VERSION = 1;
+
+    // every range HlodProxies copies out of the arrays is inside them
+    bool valid() const {
+        if (vertexOffsets.size() != indexOffsets.size() || vertexOffsets.size() != memberOffsets.size() ||
+            normals.size() != positions.size() || texCoords.size() != positions.size() ||
+            !validOffsets(vertexOffsets, positions.size()) || !validOffsets(indexOffsets, indices.size()) ||
+            !validOffsets(memberOffsets, members.size())) {
+            return false;
+        }
+        for (size_t p = 0; p < proxyCount(); p++) {
+            uint32_t vertexCount = vertexOffsets[p + 1] - vertexOffsets[p];
+            if ((indexOffsets[p + 1] - indexOffsets[p]) % 3 != 0) {
+                return false;
+            }
+            for (uint32_t i = indexOffsets[p]; i < indexOffsets[p + 1]; i++) {
+                if (indices[i] >= vertexCount) {
+                    return false;
+                }
+            }
+        }
+        for (uint32_t mesh : members) {
+            if (mesh >= meshCount) {
+                return false;
+            }
+        }
+        size_t row = 4 * static_cast<size_t>(atlasSize);
+        return atlasSize > 0 && atlas.size() % row == 0 && atlas.size() / row == atlasSize;
+    }
+};
+
+// Offline HLOD build, from a BakeScene loaded in the model's own space:
+// 1. The scene's bounds are cut into cubic cells. Every opaque mesh that fits in a cell joins
+//    the cluster of the cell its centre is in, clusters of one mesh are dropped.
+// 2. Each cluster is merged and simplified by vertex clustering: corners are snapped to a
+//    grid of simplifyResolution cells across the cluster, triangles that collapse are dropped.
+//    Corners in the same grid cell share a position but keep one vertex per direction the
+//    triangles face, so hard edges stay hard.
+// 3. Triangles sharing a vertex form a chart projected along the direction they face, the
+//    charts are shelf packed into one atlas like the lightmap's.
+// 4. Every atlas texel casts a short ray along the proxy's normal back onto the cluster's own
+//    triangles and takes the colour of their diffuse texture where it lands, prefiltered
+//    since proxies are only seen from far away.
+class HlodBuilder {
+public:
+    HlodBuilder(int cellsAlongLongestAxis = 8, int simplifyResolution = 16, unsigned int atlasSize = 1024)
+        : mCells(std::max(cellsAlongLongestAxis, 1)), mResolution(std::max(simplifyResolution, 2)),
+          mAtlasSize(atlasSize), mAtlas(atlasSize, PADDING) {
+    }
+
+    bool build(const BakeScene& scene, HlodSet& set) {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::vector<size_t>> clusters = findClusters(scene);
+        if (clusters.empty()) {
+            std::cerr << "ERROR::HLOD::NO_CLUSTERS" << std::endl;
+            return false;
+        }
+
+        mProxies.assign(clusters.size(), Proxy());
+        ThreadPool::instance().parallelFor(clusters.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                simplify(scene, clusters[c], mProxies[c]);
+            }
+        });
+        mAtlas.clear();
+        for (size_t p = 0; p < mProxies.size(); p++) {
+            buildCharts(p);
+        }
+        if (!fitCharts()) {
+            std::cerr << "ERROR::HLOD::CHARTS_DONT_FIT " << mAtlas.charts().size() << " charts in " << mAtlasSize
+                      << "x" << mAtlasSize << std::endl;
+            return false;
+        }
+        loadTextures(scene);
+        bakeAtlas(scene, set.atlas);
+        set.atlasSize = mAtlasSize;
+
+        set.meshCount = static_cast<uint32_t>(scene.meshes.size());
+        set.positions.clear();
+        set.normals.clear();
+        set.texCoords.clear();
+        set.indices.clear();
+        set.members.clear();
+        set.vertexOffsets.assign(1, 0);
+        set.indexOffsets.assign(1, 0);
+        set.memberOffsets.assign(1, 0);
+        size_t sourceTriangles = 0;
+        size_t memberCount = 0;
+        for (const Proxy& proxy : mProxies) {
+            set.positions.insert(set.positions.end(), proxy.positions.begin(), proxy.positions.end());
+            set.normals.insert(set.normals.end(), proxy.normals.begin(), proxy.normals.end());
+            set.texCoords.insert(set.texCoords.end(), proxy.texCoords.begin(), proxy.texCoords.end());
+            set.indices.insert(set.indices.end(), proxy.indices.begin(), proxy.indices.end());
+            for (size_t mesh : proxy.members) {
+                set.members.push_back(static_cast<uint32_t>(mesh));
+            }
+            set.vertexOffsets.push_back(static_cast<uint32_t>(set.positions.size()));
+            set.indexOffsets.push_back(static_cast<uint32_t>(set.indices.size()));
+            set.memberOffsets.push_back(static_cast<uint32_t>(set.members.size()));
+            sourceTriangles += proxy.sourceTriangles.size();
+            memberCount += proxy.members.size();
+        }
+        std::cout << "hlod: " << mProxies.size() << " proxies for " << memberCount << " of " << scene.meshes.size()
+                  << " meshes, " << sourceTriangles << " triangles simplified to " << set.indices.size() / 3
+                  << ", " << mAtlas.charts().size() << " charts at " << mAtlas.density() << " texels per unit, "
+                  << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count()
+                  << " s" << std::endl;
+        return true;
+    }
+
+    // Draw calls for a camera the same distance from every cluster, with and without proxies.
+    // A cluster switches to its proxy where its bounding sphere covers fewer than pixels of a
+    // viewport viewportHeight tall with a vertical field of view of fovY, measured the way
+    // Model measures it. Reported from where the first proxy switches in to where the last
+    // does, distances are in the model's own units. Model draws a call per chunk, so every mesh
+    // of scene, the one set was built from, is split with Model's limits and counted by chunk.
+    static void reportDrawCalls(const BakeScene& scene, const HlodSet& set, size_t maxChunkTriangles,
+                                float maxChunkExtent, float pixels, float viewportHeight, float fovY) {
+        std::vector<size_t> meshChunks(scene.meshes.size());
+        size_t chunkTotal = 0;
+        for (size_t m = 0; m < scene.meshes.size(); m++) {
+            const BakeScene::MeshData& mesh = scene.meshes[m];
+            std::vector<ChunkVertex> vertices(mesh.positions.size());
+            for (size_t v = 0; v < vertices.size(); v++) {
+                vertices[v].position = mesh.positions[v];
+            }
+            std::vector<unsigned int> indices = mesh.indices;
+            meshChunks[m] = splitMesh(m, vertices, indices, maxChunkTriangles, maxChunkExtent).size();
+            chunkTotal += meshChunks[m];
+        }
+        float pixelsPerUnit = viewportHeight * 0.5f / std::tan(fovY * 0.5f);
+        std::vector<float> switchDistances;
+        for (size_t p = 0; p < set.proxyCount(); p++) {
+            glm::vec3 low(FLT_MAX);
+            glm::vec3 high(-FLT_MAX);
+            for (uint32_t v = set.vertexOffsets[p]; v < set.vertexOffsets[p + 1]; v++) {
+                low = glm::min(low, set.positions[v]);
+                high = glm::max(high, set.positions[v]);
+            }
+            float radius = glm::length(high - low) * 0.5f;
+            // where 2 * radius * pixelsPerUnit / (distance - radius) falls to pixels
+            switchDistances.push_back(radius + 2.0f * radius * pixelsPerUnit / pixels);
+        }
+        if (switchDistances.empty()) {
+            return;
+        }
+        std::vector<float> sorted = switchDistances;
+        std::sort(sorted.begin(), sorted.end());
+        std::cout << "hlod draw calls: " << chunkTotal << " chunks of " << set.meshCount
+                  << " meshes without proxies, with them from a distance of";
+        for (float fraction : { 0.0f, 0.25f, 0.5f, 0.75f, 1.0f }) {
+            float distance = sorted[static_cast<size_t>(fraction * (sorted.size() - 1))] * 1.001f;
+            size_t draws = chunkTotal;
+            size_t switched = 0;
+            for (size_t p = 0; p < set.proxyCount(); p++) {
+                if (distance > switchDistances[p]) {
+                    // every chunk of the members goes, the proxy's one chunk comes in
+                    for (uint32_t i = set.memberOffsets[p]; i < set.memberOffsets[p + 1]; i++) {
+                        draws -= meshChunks[set.members[i]];
+                    }
+                    draws++;
+                    switched++;
+                }
+            }
+            std::cout << " " << distance << ": " << draws << " (" << switched << " proxies, "
+                      << 100.0 * (static_cast<double>(chunkTotal) - draws) / chunkTotal << "% fewer)";
+        }
+        std::cout << std::endl;
+    }
+
+private:
+    static const size_t MIN_MEMBERS = 2;
+
+    // all splitMesh() needs of a vertex
+    struct ChunkVertex {
+        glm::vec3 position;
+    };
+    // sampled textures are box filtered down to at most this size first
+    static const int TEXTURE_SIZE = 128;
+    static const unsigned int PADDING = 1;
+
+    struct Proxy {
+        std::vector<size_t> members;
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+        std::vector<glm::vec2> texCoords;
+        std::vector<uint32_t> indices;
+        std::vector<int> facings;
+        // the cluster's own triangles for the atlas rays, their mesh and first index
+        RayTracer tracer;
+        std::vector<unsigned int> sourceTriangles;
+        std::vector<unsigned int> sourceMeshes;
+        glm::vec3 albedo;
+        float cellSize;
+    };
+
+    struct Texture {
+        int width;
+        int height;
+        std::vector<glm::vec3> texels;
+    };
+
+    int mCells;
+    int mResolution;
+    unsigned int mAtlasSize;
+    std::vector<Proxy> mProxies;
+    ChartAtlas mAtlas;
+    std::unordered_map<std::string, Texture> mTextures;
+
+    std::vector<std::vector<size_t>> findClusters(const BakeScene& scene) const {
+        glm::vec3 sceneMin(FLT_MAX);
+        glm::vec3 sceneMax(-FLT_MAX);
+        std::vector<glm::vec3> meshMin(scene.meshes.size(), glm::vec3(FLT_MAX));
+        std::vector<glm::vec3> meshMax(scene.meshes.size(), glm::vec3(-FLT_MAX));
+        for (size_t m = 0; m < scene.meshes.size(); m++) {
+            for (const glm::vec3& position : scene.meshes[m].positions) {
+                meshMin[m] = glm::min(meshMin[m], position);
+                meshMax[m] = glm::max(meshMax[m], position);
+            }
+            sceneMin = glm::min(sceneMin, meshMin[m]);
+            sceneMax = glm::max(sceneMax, meshMax[m]);
+        }
+        std::vector<std::vector<size_t>> clusters;
+        if (sceneMin.x > sceneMax.x) {
+            return clusters;
+        }
+        glm::vec3 extent = sceneMax - sceneMin;
+        float size = std::max(std::max(extent.x, extent.y), extent.z) / mCells;
+        glm::ivec3 count = glm::max(glm::ivec3(glm::ceil(extent / size)), glm::ivec3(1));
+        std::vector<std::vector<size_t>> cells(static_cast<size_t>(count.x) * count.y * count.z);
+        for (size_t m = 0; m < scene.meshes.size(); m++) {
+            glm::vec3 meshExtent = meshMax[m] - meshMin[m];
+            if (scene.meshes[m].bucket != MaterialBucket::OPAQUE || scene.meshes[m].indices.empty() ||
+                std::max(std::max(meshExtent.x, meshExtent.y), meshExtent.z) > size) {
+                continue;
+            }
+            glm::ivec3 cell = glm::ivec3(glm::floor(((meshMin[m] + meshMax[m]) * 0.5f - sceneMin) / size));
+            cell = glm::min(glm::max(cell, glm::ivec3(0)), count - glm::ivec3(1));
+            cells[(static_cast<size_t>(cell.z) * count.y + cell.y) * count.x + cell.x].push_back(m);
+        }
+        for (std::vector<size_t>& members : cells) {
+            if (members.size() >= MIN_MEMBERS) {
+                clusters.push_back(members);
+            }
+        }
+        return clusters;
+    }
+
+    // vertex clustering of the members' triangles into proxy
+    void simplify(const BakeScene& scene, const std::vector<size_t>& members, Proxy& proxy) const {
+        proxy.members = members;
+        std::vector<glm::vec3> triangles;
+        glm::vec3 low(FLT_MAX);
+        glm::vec3 high(-FLT_MAX);
+        glm::vec3 albedo(0.0f);
+        for (size_t m : members) {
+            const BakeScene::MeshData& mesh = scene.meshes[m];
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                for (int k = 0; k < 3; k++) {
+                    triangles.push_back(mesh.positions[mesh.indices[i + k]]);
+                    low = glm::min(low, triangles.back());
+                    high = glm::max(high, triangles.back());
+                }
+                proxy.sourceMeshes.push_back(static_cast<unsigned int>(m));
+                proxy.sourceTriangles.push_back(static_cast<unsigned int>(i));
+            }
+            albedo += mesh.albedo;
+        }
+        proxy.albedo = albedo / static_cast<float>(members.size());
+        proxy.tracer.build(triangles);
+        glm::vec3 extent = high - low;
+        proxy.cellSize = std::max(std::max(std::max(extent.x, extent.y), extent.z) / mResolution, 1.0e-6f);
+
+        // corners sum into their grid cell, every cell's position is the average
+        size_t triangleCount = triangles.size() / 3;
+        std::vector<uint32_t> cornerCells(triangles.size());
+        std::unordered_map<uint32_t, std::pair<glm::vec3, float>> cells;
+        for (size_t i = 0; i < triangles.size(); i++) {
+            glm::ivec3 cell = glm::ivec3(glm::floor((triangles[i] - low) / proxy.cellSize));
+            cell = glm::min(glm::max(cell, glm::ivec3(0)), glm::ivec3(mResolution - 1));
+            cornerCells[i] = static_cast<uint32_t>((cell.z * mResolution + cell.y) * mResolution + cell.x);
+            std::pair<glm::vec3, float>& sum = cells[cornerCells[i]];
+            sum.first += triangles[i];
+            sum.second += 1.0f;
+        }
+
+        std::unordered_map<uint64_t, uint32_t> vertices;
+        std::set<std::array<uint32_t, 3>> kept;
+        for (size_t t = 0; t < triangleCount; t++) {
+            const uint32_t* corner = &cornerCells[3 * t];
+            if (corner[0] == corner[1] || corner[1] == corner[2] || corner[0] == corner[2]) {
+                continue;
+            }
+            glm::vec3 normal = glm::cross(triangles[3 * t + 1] - triangles[3 * t], triangles[3 * t + 2] - triangles[3 * t]);
+            if (glm::dot(normal, normal) <= 0.0f) {
+                continue;
+            }
+            int direction = ChartAtlas::facing(normal);
+            uint32_t triangle[3];
+            for (int k = 0; k < 3; k++) {
+                uint64_t key = static_cast<uint64_t>(corner[k]) * 6 + direction;
+                auto it = vertices.find(key);
+                if (it == vertices.end()) {
+                    const std::pair<glm::vec3, float>& sum = cells[corner[k]];
+                    it = vertices.emplace(key, static_cast<uint32_t>(proxy.positions.size())).first;
+                    proxy.positions.push_back(sum.first / sum.second);
+                    proxy.normals.push_back(glm::vec3(0.0f));
+                }
+                triangle[k] = it->second;
+                // face normals are area weighted already
+                proxy.normals[it->second] += normal;
+            }
+            std::array<uint32_t, 3> sorted = { { triangle[0], triangle[1], triangle[2] } };
+            std::sort(sorted.begin(), sorted.end());
+            if (!kept.insert(sorted).second) {
+                continue;
+            }
+            proxy.indices.insert(proxy.indices.end(), triangle, triangle + 3);
+            proxy.facings.push_back(direction);
+        }
+        for (glm::vec3& normal : proxy.normals) {
+            normal = glm::normalize(normal);
+        }
+        proxy.texCoords.assign(proxy.positions.size(), glm::vec2(0.0f));
+    }
+
+    // triangles sharing a vertex face the same way, so every connected piece is one chart
+    void buildCharts(size_t p) {
+        const Proxy& proxy = mProxies[p];
+        size_t triangleCount = proxy.indices.size() / 3;
+        std::vector<unsigned int> parent(proxy.positions.size());
+        for (size_t v = 0; v < parent.size(); v++) {
+            parent[v] = static_cast<unsigned int>(v);
+        }
+        for (size_t t = 0; t < triangleCount; t++) {
+            ChartAtlas::join(parent, proxy.indices[3 * t], proxy.indices[3 * t + 1]);
+            ChartAtlas::join(parent, proxy.indices[3 * t], proxy.indices[3 * t + 2]);
+        }
+        std::vector<Chart>& charts = mAtlas.charts();
+        std::vector<int> chartOf(parent.size(), -1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            unsigned int root = ChartAtlas::findRoot(parent, proxy.indices[3 * t]);
+            if (chartOf[root] < 0) {
+                chartOf[root] = static_cast<int>(charts.size());
+                mAtlas.add(p, proxy.facings[t] / 2);
+            }
+            Chart& chart = charts[chartOf[root]];
+            chart.triangles.push_back(static_cast<unsigned int>(t));
+            for (int k = 0; k < 3; k++) {
+                ChartAtlas::grow(chart, proxy.positions[proxy.indices[3 * t + k]]);
+            }
+        }
+    }
+
+    // fit the charts at half the atlas' area or less, then give every proxy vertex its coordinates
+    bool fitCharts() {
+        if (!mAtlas.fit(0.5)) {
+            return false;
+        }
+        for (const Chart& chart : mAtlas.charts()) {
+            Proxy& proxy = mProxies[chart.group];
+            for (unsigned int triangle : chart.triangles) {
+                for (int k = 0; k < 3; k++) {
+                    uint32_t vertex = proxy.indices[3 * triangle + k];
+                    proxy.texCoords[vertex] = mAtlas.texel(chart, proxy.positions[vertex]) / static_cast<float>(mAtlasSize);
+                }
+            }
+        }
+        return true;
+    }
+
+    // every member's diffuse texture, box filtered down to TEXTURE_SIZE
+    void loadTextures(const BakeScene& scene) {
+        for (const Proxy& proxy : mProxies) {
+            for (size_t m : proxy.members) {
+                const std::string& path = scene.meshes[m].diffusePath;
+                if (path.empty() || mTextures.count(path) > 0) {
+                    continue;
+                }
+                Texture& texture = mTextures[path];
+                int width;
+                int height;
+                int components;
+                unsigned char* data = stbi_load(path.c_str(), &width, &height, &components, 4);
+                if (!data) {
+                    std::cerr << "hlod: can't read " << path << ", using the mesh's albedo" << std::endl;
+                    texture.width = 0;
+                    texture.height = 0;
+                    continue;
+                }
+                int step = 1;
+                while (width / step > TEXTURE_SIZE || height / step > TEXTURE_SIZE) {
+                    step *= 2;
+                }
+                texture.width = std::max(width / step, 1);
+                texture.height = std::max(height / step, 1);
+                texture.texels.assign(static_cast<size_t>(texture.width) * texture.height, glm::vec3(0.0f));
+                for (int y = 0; y < texture.height * step && y < height; y++) {
+                    for (int x = 0; x < texture.width * step && x < width; x++) {
+                        const unsigned char* texel = data + 4 * (static_cast<size_t>(y) * width + x);
+                        texture.texels[static_cast<size_t>(y / step) * texture.width + x / step] +=
+                            glm::vec3(texel[0], texel[1], texel[2]) / (255.0f * step * step);
+                    }
+                }
+                stbi_image_free(data);
+            }
+        }
+    }
+
+    glm::vec3 sampleSource(const BakeScene& scene, const Proxy& proxy, const glm::vec3& position,
+                           const glm::vec3& normal) const {
+        // from just outside the proxy back through it. Averaged corners can be a cell's diagonal
+        // off the surfaces they came from.
+        float reach = 2.0f * proxy.cellSize;
+        RayTracer::Hit hit;
+        if (!proxy.tracer.intersect(position + normal * reach, -normal, 2.0f * reach, hit)) {
+            return proxy.albedo;
+        }
+        const BakeScene::MeshData& mesh = scene.meshes[proxy.sourceMeshes[hit.triangle]];
+        auto it = mTextures.find(mesh.diffusePath);
+        if (it == mTextures.end() || it->second.texels.empty()) {
+            return mesh.albedo;
+        }
+        const Texture& texture = it->second;
+        const unsigned int* corners = &mesh.indices[proxy.sourceTriangles[hit.triangle]];
+        glm::vec2 uv = mesh.texCoords[corners[0]] * (1.0f - hit.u - hit.v) + mesh.texCoords[corners[1]] * hit.u +
+                       mesh.texCoords[corners[2]] * hit.v;
+        // repeating, and rows are stored top first like the flipped coordinates expect
+        int x = static_cast<int>((uv.x - std::floor(uv.x)) * texture.width);
+        int y = static_cast<int>((uv.y - std::floor(uv.y)) * texture.height);
+        x = std::min(std::max(x, 0), texture.width - 1);
+        y = std::min(std::max(y, 0), texture.height - 1);
+        return texture.texels[static_cast<size_t>(y) * texture.width + x];
+    }
+
+    // every chart's texels from the cluster's textures, 2x2 samples per texel. Charts don't
+    // overlap so each one can be baked on its own thread.
+    void bakeAtlas(const BakeScene& scene, std::vector<unsigned char>& atlas) const {
+        size_t texelCount = static_cast<size_t>(mAtlasSize) * mAtlasSize;
+        std::vector<glm::vec3> colours(texelCount, glm::vec3(0.0f));
+        std::vector<unsigned char> covered(texelCount, 0);
+        const std::vector<Chart>& charts = mAtlas.charts();
+        ThreadPool::instance().parallelFor(charts.size(), 16, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                const Chart& chart = charts[c];
+                const Proxy& proxy = mProxies[chart.group];
+                for (unsigned int triangle : chart.triangles) {
+                    const uint32_t* corners = &proxy.indices[3 * triangle];
+                    glm::vec3 world[3];
+                    glm::vec2 texel[3];
+                    for (int k = 0; k < 3; k++) {
+                        world[k] = proxy.positions[corners[k]];
+                        texel[k] = mAtlas.texel(chart, world[k]);
+                    }
+                    float area = ChartAtlas::cross(texel[1] - texel[0], texel[2] - texel[0]);
+                    if (std::abs(area) < 1.0e-12f) {
+                        continue;
+                    }
+                    // the way the source triangles faced, snapping can flip the winding
+                    glm::vec3 normal = glm::normalize(proxy.normals[corners[0]] + proxy.normals[corners[1]] +
+                                                      proxy.normals[corners[2]]);
+                    glm::vec2 low = glm::min(texel[0], glm::min(texel[1], texel[2]));
+                    glm::vec2 high = glm::max(texel[0], glm::max(texel[1], texel[2]));
+                    int minX = std::max(static_cast<int>(std::floor(low.x)), chart.x);
+                    int minY = std::max(static_cast<int>(std::floor(low.y)), chart.y);
+                    int maxX = std::min(static_cast<int>(std::ceil(high.x)), chart.x + chart.width - 1);
+                    int maxY = std::min(static_cast<int>(std::ceil(high.y)), chart.y + chart.height - 1);
+                    for (int y = minY; y <= maxY; y++) {
+                        for (int x = minX; x <= maxX; x++) {
+                            glm::vec3 sum(0.0f);
+                            int samples = 0;
+                            for (int s = 0; s < 4; s++) {
+                                glm::vec2 point(x + 0.25f + 0.5f * (s & 1), y + 0.25f + 0.5f * (s >> 1));
+                                glm::vec3 weights(ChartAtlas::cross(texel[2] - texel[1], point - texel[1]),
+                                                  ChartAtlas::cross(texel[0] - texel[2], point - texel[2]),
+                                                  ChartAtlas::cross(texel[1] - texel[0], point - texel[0]));
+                                weights /= area;
+                                if (weights.x < -1.0e-4f || weights.y < -1.0e-4f || weights.z < -1.0e-4f) {
+                                    continue;
+                                }
+                                glm::vec3 position = world[0] * weights.x + world[1] * weights.y + world[2] * weights.z;
+                                sum += sampleSource(scene, proxy, position, normal);
+                                samples++;
+                            }
+                            if (samples > 0) {
+                                size_t index = static_cast<size_t>(y) * mAtlasSize + x;
+                                colours[index] = sum / static_cast<float>(samples);
+                                covered[index] = 1;
+                            }
+                        }
+                    }
+                }
+            }
+        });
+        // grow the charts by a texel twice so filtering at their edges doesn't pull in black
+        for (int pass = 0; pass < 2; pass++) {
+            mAtlas.dilate(colours, covered);
+        }
+        atlas.resize(texelCount * 4);
+        for (size_t i = 0; i < texelCount; i++) {
+            for (int k = 0; k < 3; k++) {
+                atlas[4 * i + k] = static_cast<unsigned char>(std::min(std::max(colours[i][k], 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+            atlas[4 * i + 3] = 255;
+        }
+    }
+};
+
+#endif /* hlod_h */
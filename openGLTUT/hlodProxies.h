@@ -0,0 +1,111 @@
+//
+//  hlodProxies.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-08-02.
+//
+
+#ifndef hlodProxies_h
+#define hlodProxies_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+#include "model.h"
+#include "hlod.h"
+
+// GPU side of the proxies written by HlodBuilder: the colour atlas as a mipmapped texture and
+// every proxy handed to the model as a mesh textured from it, with a black specular map since
+// the atlas has no highlights baked in.
+class HlodProxies {
+public:
+    HlodProxies()
+        : mAtlas(0), mBlack(0) {
+    }
+
+    ~HlodProxies() {
+        if (mAtlas != 0) {
+            glDeleteTextures(1, &mAtlas);
+            glDeleteTextures(1, &mBlack);
+        }
+    }
+
+    HlodProxies(const HlodProxies&) = delete;
+    HlodProxies& operator=(const HlodProxies&) = delete;
+
+    // read path and add its proxies to model, which must be the model they were built from
+    bool load(const std::string& path, Model& model) {
+        HlodSet set;
+        if (!set.load(path)) {
+            return false;
+        }
+        if (set.meshCount != model.meshes().size()) {
+            std::cerr << "ERROR::HLOD::MODEL_MISMATCH " << path << " was built from a different model" << std::endl;
+            return false;
+        }
+
+        if (mAtlas == 0) {
+            glGenTextures(1, &mAtlas);
+            glGenTextures(1, &mBlack);
+        }
+        glBindTexture(GL_TEXTURE_2D, mAtlas);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, set.atlasSize, set.atlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     set.atlas.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        const unsigned char black[4] = { 0, 0, 0, 255 };
+        glBindTexture(GL_TEXTURE_2D, mBlack);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, black);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        std::vector<Texture> textures = { { mAtlas, TextureType::DIFFUSE, path }, { mBlack, TextureType::SPECULAR, "" } };
+        size_t triangles = 0;
+        for (size_t p = 0; p < set.proxyCount(); p++) {
+            std::vector<Vertex> vertices;
+            for (uint32_t v = set.vertexOffsets[p]; v < set.vertexOffsets[p + 1]; v++) {
+                Vertex vertex;
+                vertex.position = set.positions[v];
+                vertex.normal = set.normals[v];
+                vertex.texCoords = set.texCoords[v];
+                // nothing samples a normal map on proxies, any frame around the normal will do
+                glm::vec3 up = std::abs(vertex.normal.y) < 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                vertex.tangent = glm::normalize(glm::cross(up, vertex.normal));
+                vertex.bitangent = glm::cross(vertex.normal, vertex.tangent);
+                vertex.lightmapCoords = glm::vec2(-1.0f);
+                vertices.push_back(vertex);
+            }
+            std::vector<unsigned int> indices(set.indices.begin() + set.indexOffsets[p],
+                                              set.indices.begin() + set.indexOffsets[p + 1]);
+            std::vector<size_t> members(set.members.begin() + set.memberOffsets[p],
+                                        set.members.begin() + set.memberOffsets[p + 1]);
+            triangles += indices.size() / 3;
+            model.addProxy(Mesh(vertices, indices, textures, MaterialBucket::OPAQUE), members);
+        }
+        std::cout << "loaded " << set.proxyCount() << " hlod proxies from " << path << ": " << set.members.size()
+                  << " meshes as " << triangles << " triangles, " << set.atlasSize << "x" << set.atlasSize
+                  << " atlas" << std::endl;
+        return true;
+    }
+
+    bool loaded() const {
+        return mAtlas != 0;
+    }
+
+private:
+    unsigned int mAtlas;
+    unsigned int mBlack;
+};
+
+#endif /* hlodProxies_h */
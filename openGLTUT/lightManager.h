@@ -0,0 +1,273 @@
+//
+//  lightManager.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-26.
+//
+
+#ifndef lightManager_h
+#define lightManager_h
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <chrono>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "lights.h"
+#include "frustum.h"
+
+// Owns the scene's point and spot lights and culls them against the camera frustum every frame.
+// Positions, directions and ranges are kept in structure of arrays form next to the full light
+// structs so the culling loops test four lights per instruction. Ranges come from the
+// attenuation constants and are only recomputed when a light is added or replaced.
+// cull() leaves a compact list of the lights that can touch a visible pixel.
+class LightManager {
+public:
+    LightManager()
+        : mCullMs(0.0) {
+    }
+
+    size_t addPointLight(const PointLight& light) {
+        mPointLights.push_back(light);
+        mPointX.push_back(light.position.x);
+        mPointY.push_back(light.position.y);
+        mPointZ.push_back(light.position.z);
+        mPointRange.push_back(lightRange(light.attenuation, light.lightProp));
+        return mPointLights.size() - 1;
+    }
+
+    size_t addSpotLight(const SpotLight& light) {
+        mSpotLights.push_back(light);
+        mSpotX.push_back(0.0f);
+        mSpotY.push_back(0.0f);
+        mSpotZ.push_back(0.0f);
+        mSpotDirX.push_back(0.0f);
+        mSpotDirY.push_back(0.0f);
+        mSpotDirZ.push_back(0.0f);
+        mSpotRange.push_back(0.0f);
+        mSpotRadius.push_back(0.0f);
+        setSpotLight(mSpotLights.size() - 1, light);
+        return mSpotLights.size() - 1;
+    }
+
+    void setPointLight(size_t index, const PointLight& light) {
+        mPointLights[index] = light;
+        mPointRange[index] = lightRange(light.attenuation, light.lightProp);
+        setPointPosition(index, light.position);
+    }
+
+    // moving a light doesn't change its range
+    void setPointPosition(size_t index, const glm::vec3& position) {
+        mPointLights[index].position = position;
+        mPointX[index] = position.x;
+        mPointY[index] = position.y;
+        mPointZ[index] = position.z;
+    }
+
+    void setSpotLight(size_t index, const SpotLight& light) {
+        mSpotLights[index] = light;
+        float range = lightRange(light.attenuation, light.lightProp);
+        setSpotTransform(index, light.position, light.direction);
+        mSpotRange[index] = range;
+        // radius of the cone's base, cones wider than a hemisphere are treated as one
+        float cosOuter = std::max(light.outerCutoff, 0.0f);
+        float sinOuter = std::sqrt(1.0f - cosOuter * cosOuter);
+        mSpotRadius[index] = cosOuter > 0.0f ? range * sinOuter / cosOuter : FLT_MAX;
+    }
+
+    void setSpotTransform(size_t index, const glm::vec3& position, const glm::vec3& direction) {
+        glm::vec3 axis = glm::normalize(direction);
+        mSpotLights[index].position = position;
+        mSpotLights[index].direction = direction;
+        mSpotX[index] = position.x;
+        mSpotY[index] = position.y;
+        mSpotZ[index] = position.z;
+        mSpotDirX[index] = axis.x;
+        mSpotDirY[index] = axis.y;
+        mSpotDirZ[index] = axis.z;
+    }
+
+    const std::vector<PointLight>& pointLights() const {
+        return mPointLights;
+    }
+
+    const std::vector<SpotLight>& spotLights() const {
+        return mSpotLights;
+    }
+
+    // cull every light against the frustum of viewProjection
+    void cull(const glm::mat4& viewProjection) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        glm::vec4 planes[6];
+        extractFrustumPlanes(viewProjection, planes);
+        cullPoints(planes);
+        cullSpots(planes);
+
+        mVisiblePointLights.resize(mVisiblePoints.size());
+        for (size_t i = 0; i < mVisiblePoints.size(); i++) {
+            mVisiblePointLights[i] = mPointLights[mVisiblePoints[i]];
+        }
+        mVisibleSpotLights.resize(mVisibleSpots.size());
+        for (size_t i = 0; i < mVisibleSpots.size(); i++) {
+            mVisibleSpotLights[i] = mSpotLights[mVisibleSpots[i]];
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        mCullMs = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    // results of the last cull(), as indices and as lights ready to upload
+    const std::vector<unsigned int>& visiblePointIndices() const {
+        return mVisiblePoints;
+    }
+
+    const std::vector<unsigned int>& visibleSpotIndices() const {
+        return mVisibleSpots;
+    }
+
+    const std::vector<PointLight>& visiblePointLights() const {
+        return mVisiblePointLights;
+    }
+
+    const std::vector<SpotLight>& visibleSpotLights() const {
+        return mVisibleSpotLights;
+    }
+
+    // CPU milliseconds the last cull() took
+    double cullMs() const {
+        return mCullMs;
+    }
+
+private:
+    std::vector<PointLight> mPointLights;
+    std::vector<float> mPointX;
+    std::vector<float> mPointY;
+    std::vector<float> mPointZ;
+    std::vector<float> mPointRange;
+
+    std::vector<SpotLight> mSpotLights;
+    std::vector<float> mSpotX;
+    std::vector<float> mSpotY;
+    std::vector<float> mSpotZ;
+    std::vector<float> mSpotDirX;
+    std::vector<float> mSpotDirY;
+    std::vector<float> mSpotDirZ;
+    std::vector<float> mSpotRange;
+    std::vector<float> mSpotRadius;
+
+    std::vector<unsigned int> mVisiblePoints;
+    std::vector<unsigned int> mVisibleSpots;
+    std::vector<PointLight> mVisiblePointLights;
+    std::vector<SpotLight> mVisibleSpotLights;
+    double mCullMs;
+
+    // a sphere is visible unless it lies fully behind one of the planes
+    void cullPoints(const glm::vec4* planes) {
+        size_t count = mPointLights.size();
+        mVisiblePoints.clear();
+
+        size_t i = 0;
+#if defined(__SSE2__)
+        __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+        for (int p = 0; p < 6; p++) {
+            planeX[p] = _mm_set1_ps(planes[p].x);
+            planeY[p] = _mm_set1_ps(planes[p].y);
+            planeZ[p] = _mm_set1_ps(planes[p].z);
+            planeW[p] = _mm_set1_ps(planes[p].w);
+        }
+        const __m128 zero = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4) {
+            __m128 x = _mm_loadu_ps(&mPointX[i]);
+            __m128 y = _mm_loadu_ps(&mPointY[i]);
+            __m128 z = _mm_loadu_ps(&mPointZ[i]);
+            __m128 negRange = _mm_sub_ps(zero, _mm_loadu_ps(&mPointRange[i]));
+            __m128 inside = _mm_cmpeq_ps(zero, zero);
+            for (int p = 0; p < 6; p++) {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                                             _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRange));
+            }
+            appendMask(mVisiblePoints, i, _mm_movemask_ps(inside));
+        }
+#endif
+        for (; i < count; i++) {
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; p++) {
+                float distance = planes[p].x * mPointX[i] + planes[p].y * mPointY[i] + planes[p].z * mPointZ[i] + planes[p].w;
+                inside = distance >= -mPointRange[i];
+            }
+            if (inside) {
+                mVisiblePoints.push_back(static_cast<unsigned int>(i));
+            }
+        }
+    }
+
+    // A cone is fully behind a plane when its apex and the point of its base disk furthest
+    // along the plane normal both are. That point is the base centre plus radius times the
+    // part of the normal perpendicular to the axis.
+    void cullSpots(const glm::vec4* planes) {
+        size_t count = mSpotLights.size();
+        mVisibleSpots.clear();
+
+        size_t i = 0;
+#if defined(__SSE2__)
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; i + 4 <= count; i += 4) {
+            __m128 x = _mm_loadu_ps(&mSpotX[i]);
+            __m128 y = _mm_loadu_ps(&mSpotY[i]);
+            __m128 z = _mm_loadu_ps(&mSpotZ[i]);
+            __m128 dirX = _mm_loadu_ps(&mSpotDirX[i]);
+            __m128 dirY = _mm_loadu_ps(&mSpotDirY[i]);
+            __m128 dirZ = _mm_loadu_ps(&mSpotDirZ[i]);
+            __m128 range = _mm_loadu_ps(&mSpotRange[i]);
+            __m128 radius = _mm_loadu_ps(&mSpotRadius[i]);
+            __m128 inside = _mm_cmpeq_ps(zero, zero);
+            for (int p = 0; p < 6; p++) {
+                __m128 nx = _mm_set1_ps(planes[p].x);
+                __m128 ny = _mm_set1_ps(planes[p].y);
+                __m128 nz = _mm_set1_ps(planes[p].z);
+                __m128 apex = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, x), _mm_mul_ps(ny, y)),
+                                         _mm_add_ps(_mm_mul_ps(nz, z), _mm_set1_ps(planes[p].w)));
+                __m128 alongAxis = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dirX), _mm_mul_ps(ny, dirY)), _mm_mul_ps(nz, dirZ));
+                __m128 across = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(alongAxis, alongAxis)), zero));
+                __m128 base = _mm_add_ps(apex, _mm_add_ps(_mm_mul_ps(range, alongAxis), _mm_mul_ps(radius, across)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_max_ps(apex, base), zero));
+            }
+            appendMask(mVisibleSpots, i, _mm_movemask_ps(inside));
+        }
+#endif
+        for (; i < count; i++) {
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; p++) {
+                float apex = planes[p].x * mSpotX[i] + planes[p].y * mSpotY[i] + planes[p].z * mSpotZ[i] + planes[p].w;
+                float alongAxis = planes[p].x * mSpotDirX[i] + planes[p].y * mSpotDirY[i] + planes[p].z * mSpotDirZ[i];
+                float across = std::sqrt(std::max(1.0f - alongAxis * alongAxis, 0.0f));
+                float base = apex + mSpotRange[i] * alongAxis + mSpotRadius[i] * across;
+                inside = std::max(apex, base) >= 0.0f;
+            }
+            if (inside) {
+                mVisibleSpots.push_back(static_cast<unsigned int>(i));
+            }
+        }
+    }
+
+    static void appendMask(std::vector<unsigned int>& out, size_t first, int mask) {
+        for (int lane = 0; lane < 4; lane++) {
+            if (mask & (1 << lane)) {
+                out.push_back(static_cast<unsigned int>(first + lane));
+            }
+        }
+    }
+};
+
+#endif /* lightManager_h */
@@ -0,0 +1,114 @@
+// Shared light types and lighting functions, pulled in with #include "lighting.glsl".
+// Materials are sampled once by the caller and passed in instead of every light
+// function sampling the same textures again.
+
+struct LightProperties {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct Attenuation {
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+struct DirLight {
+    vec3 direction;
+    LightProperties lightProp;
+};
+
+struct PointLight {
+    vec3 position;
+    Attenuation attenuation;
+    LightProperties lightProp;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutoff;
+    float outerCutoff;
+    Attenuation attenuation;
+    LightProperties lightProp;
+};
+
+// material values at the current fragment
+struct Surface {
+    vec3 albedo;
+    vec3 specular;
+    float shininess;
+};
+
+float calcAttenuation(Attenuation attenuation, float distance) {
+    return 1.0f / (attenuation.constant +
+                   attenuation.linear * distance +
+                   attenuation.quadratic * (distance * distance));
+}
+
+// ambient + diffuse + specular for a light arriving from lightDir, before attenuation
+vec3 shadeLight(LightProperties lightProp, vec3 lightDir, vec3 norm, vec3 viewDir, Surface surface) {
+    // diffuse
+    float diff = max(dot(norm, lightDir), 0.0);
+    // specular
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+    // combine effects
+    vec3 diffuse = lightProp.diffuse * diff * surface.albedo;
+    vec3 specular = lightProp.specular * spec * surface.specular;
+#ifdef SH_AMBIENT
+    // ambient comes from the probe volume once per fragment, see shAmbient.glsl
+    return (diffuse + specular);
+#else
+    vec3 ambient = lightProp.ambient * surface.albedo;
+    return (ambient + diffuse + specular);
+#endif
+}
+
+vec3 calcDirLight(DirLight light, vec3 norm, vec3 viewDir, Surface surface) {
+    vec3 lightDir = normalize(-light.direction);
+    return shadeLight(light.lightProp, lightDir, norm, viewDir, surface);
+}
+
+// shadow scales diffuse and specular, ambient still fills the area
+vec3 calcDirLight(DirLight light, vec3 norm, vec3 viewDir, Surface surface, float shadow) {
+    DirLight lit = light;
+    lit.lightProp.diffuse *= shadow;
+    lit.lightProp.specular *= shadow;
+    return calcDirLight(lit, norm, viewDir, surface);
+}
+
+vec3 calcPointLight(PointLight light, vec3 norm, vec3 fragPos, vec3 viewDir, Surface surface) {
+    vec3 lightDir = normalize(light.position - fragPos);
+    float attenuation = calcAttenuation(light.attenuation, length(light.position - fragPos));
+    return shadeLight(light.lightProp, lightDir, norm, viewDir, surface) * attenuation;
+}
+
+vec3 calcPointLight(PointLight light, vec3 norm, vec3 fragPos, vec3 viewDir, Surface surface, float shadow) {
+    PointLight lit = light;
+    lit.lightProp.diffuse *= shadow;
+    lit.lightProp.specular *= shadow;
+    return calcPointLight(lit, norm, fragPos, viewDir, surface);
+}
+
+vec3 calcSpotLight(SpotLight light, vec3 norm, vec3 fragPos, vec3 viewDir, Surface surface) {
+    vec3 lightDir = normalize(light.position - fragPos);
+    float attenuation = calcAttenuation(light.attenuation, length(light.position - fragPos));
+    // spotlight calc
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutoff - light.outerCutoff;
+    float intensity = clamp((theta - light.outerCutoff) / epsilon, 0.0, 1.0);
+    // the cone only limits diffuse and specular, ambient still fills the area
+    LightProperties lit = light.lightProp;
+    lit.diffuse *= intensity;
+    lit.specular *= intensity;
+    return shadeLight(lit, lightDir, norm, viewDir, surface) * attenuation;
+}
+
+vec3 calcSpotLight(SpotLight light, vec3 norm, vec3 fragPos, vec3 viewDir, Surface surface, float shadow) {
+    SpotLight lit = light;
+    lit.lightProp.diffuse *= shadow;
+    lit.lightProp.specular *= shadow;
+    return calcSpotLight(lit, norm, fragPos, viewDir, surface);
+}
@@ -0,0 +1,752 @@
+//
+//  lightmapBaker.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-28.
+//
+
+#ifndef lightmapBaker_h
+#define lightmapBaker_h
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+
+#include "lights.h"
+#include "rayTracer.h"
+#include "threadPool.h"
+#include "materialBucket.h"
+#include "binaryIO.h"
+#include "charts.h"
+#include "stb_image.h"
+
+// Everything a bake produces, written by LightmapBaker and read back by BakedLighting.
+// The file is a magic number and version followed by these fields in order.
+struct LightmapBake {
+    // lightmap coordinates of every vertex, per mesh in Model's mesh order, -1 where unbaked.
+    // A vertex on the seam between two charts needs a coordinate in each, so the mesh's own
+    // vertices are followed by copies, one per extra chart, of the vertices in meshSeamSources.
+    std::vector<std::vector<glm::vec2>> meshCoords;
+    std::vector<std::vector<uint32_t>> meshSeamSources;
+    // each mesh's triangles in load order, corners on a seam pointing at their chart's copy
+    std::vector<std::vector<uint32_t>> meshIndices;
+    unsigned int resolution;
+    // linear RGB irradiance per texel, row 0 is v = 0
+    std::vector<glm::vec3> lightmap;
+    // ambient cube probes, six RGB values (+X, -X, +Y, -Y, +Z, -Z) per probe, x fastest
+    glm::ivec3 probeCount;
+    glm::vec3 probeMin;
+    glm::vec3 probeMax;
+    std::vector<glm::vec3> probes;
+    // L2 spherical harmonics of the ambient light on the same grid, nine RGB coefficients per
+    // probe. Already convolved with the cosine lobe and divided by pi, so evaluating them at a
+    // normal gives the value to multiply the albedo by.
+    std::vector<glm::vec3> shProbes;
+
+    LightmapBake()
+        : resolution(0), probeCount(0, 0, 0), probeMin(0.0f), probeMax(0.0f) {
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR::BAKE::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        const uint32_t header[2] = { MAGIC, VERSION };
+        writeBinary(file, header);
+        writeBinary(file, static_cast<uint32_t>(meshCoords.size()));
+        for (size_t m = 0; m < meshCoords.size(); m++) {
+            writeBinaryArray(file, meshCoords[m]);
+            writeBinaryArray(file, meshSeamSources[m]);
+            writeBinaryArray(file, meshIndices[m]);
+        }
+        writeBinary(file, static_cast<uint32_t>(resolution));
+        writeBinaryArray(file, lightmap);
+        writeBinary(file, probeCount);
+        writeBinary(file, probeMin);
+        writeBinary(file, probeMax);
+        writeBinaryArray(file, probes);
+        writeBinaryArray(file, shProbes);
+        return static_cast<bool>(file);
+    }
+
+    bool load(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        if (!file || !readBinary(file, magic) || !readBinary(file, version) || magic != MAGIC || version != VERSION) {
+            std::cerr << "ERROR::BAKE::NOT_A_BAKE_FILE " << path << std::endl;
+            return false;
+        }
+        // every mesh takes at least its three array counts
+        uint32_t meshCount = 0;
+        if (!readBinary(file, meshCount) || meshCount > binaryRemaining(file) / (3 * sizeof(uint32_t))) {
+            std::cerr << "ERROR::BAKE::CORRUPT " << path << std::endl;
+            return false;
+        }
+        meshCoords.resize(meshCount);
+        meshSeamSources.resize(meshCount);
+        meshIndices.resize(meshCount);
+        for (uint32_t m = 0; m < meshCount; m++) {
+            readBinaryArray(file, meshCoords[m]);
+            readBinaryArray(file, meshSeamSources[m]);
+            readBinaryArray(file, meshIndices[m]);
+            if (!file || !seamsValid(m)) {
+                std::cerr << "ERROR::BAKE::CORRUPT " << path << std::endl;
+                return false;
+            }
+        }
+        uint32_t size = 0;
+        readBinary(file, size);
+        resolution = size;
+        readBinaryArray(file, lightmap);
+        readBinary(file, probeCount);
+        readBinary(file, probeMin);
+        readBinary(file, probeMax);
+        readBinaryArray(file, probes);
+        readBinaryArray(file, shProbes);
+        size_t probeTotal = probes.size() / 6;
+        if (!file || lightmap.size() != static_cast<size_t>(resolution) * resolution || probes.size() % 6 != 0 ||
+            !validGrid(probeCount.x, probeCount.y, probeCount.z, probeTotal) || shProbes.size() != probeTotal * 9) {
+            std::cerr << "ERROR::BAKE::CORRUPT " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x4b424d4c; // "LMBK"
+    static const uint32_t VERSION = 3;
+
+    // copies come from the mesh's own vertices and indices stay inside the copies
+    bool seamsValid(size_t mesh) const {
+        size_t vertexCount = meshCoords[mesh].size();
+        if (meshSeamSources[mesh].size() > vertexCount || meshIndices[mesh].size() % 3 != 0) {
+            return false;
+        }
+        size_t ownCount = vertexCount - meshSeamSources[mesh].size();
+        for (uint32_t source : meshSeamSources[mesh]) {
+            if (source >= ownCount) {
+                return false;
+            }
+        }
+        for (uint32_t index : meshIndices[mesh]) {
+            if (index >= vertexCount) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// World space copy of a model's geometry for the baker. It is read the same way Model reads it,
+// same post processing and node order, so mesh and vertex indices line up with what the
+// renderer uploads. Only assimp and stb_image are needed, no GL context.
+struct BakeScene {
+    struct MeshData {
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+        std::vector<glm::vec2> texCoords;
+        std::vector<unsigned int> indices;
+        // the diffuse texture's file, empty if the material has none
+        std::string diffusePath;
+        // average colour of the diffuse texture, for light bouncing off the mesh
+        glm::vec3 albedo;
+        // from the diffuse texture's alpha the same way Model sorts meshes
+        MaterialBucket bucket;
+    };
+
+    std::vector<MeshData> meshes;
+
+    bool load(const std::string& path, const glm::mat4& modelMat) {
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path,
+                                                 aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+            std::cerr << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
+            return false;
+        }
+        meshes.clear();
+        mDirectory = path.substr(0, path.find_last_of('/'));
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMat)));
+        addNode(scene->mRootNode, scene, modelMat, normalMatrix);
+        return true;
+    }
+
+private:
+    std::string mDirectory;
+    std::unordered_map<std::string, glm::vec3> mAlbedos;
+    std::unordered_map<std::string, MaterialBucket> mBuckets;
+
+    void addNode(const aiNode* node, const aiScene* scene, const glm::mat4& modelMat, const glm::mat3& normalMatrix) {
+        for (unsigned int i = 0; i < node->mNumMeshes; i++) {
+            const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            MeshData data;
+            data.albedo = meshAlbedo(scene->mMaterials[mesh->mMaterialIndex], data.bucket, data.diffusePath);
+            data.positions.resize(mesh->mNumVertices);
+            data.normals.resize(mesh->mNumVertices);
+            data.texCoords.assign(mesh->mNumVertices, glm::vec2(0.0f));
+            for (unsigned int v = 0; v < mesh->mNumVertices; v++) {
+                glm::vec3 position(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z);
+                glm::vec3 normal(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z);
+                data.positions[v] = glm::vec3(modelMat * glm::vec4(position, 1.0f));
+                data.normals[v] = normalMatrix * normal;
+                if (mesh->mTextureCoords[0]) {
+                    data.texCoords[v] = glm::vec2(mesh->mTextureCoords[0][v].x, mesh->mTextureCoords[0][v].y);
+                }
+            }
+            for (unsigned int f = 0; f < mesh->mNumFaces; f++) {
+                // Triangulate leaves only triangles, lines and points are skipped
+                if (mesh->mFaces[f].mNumIndices != 3) {
+                    continue;
+                }
+                for (unsigned int j = 0; j < 3; j++) {
+                    data.indices.push_back(mesh->mFaces[f].mIndices[j]);
+                }
+            }
+            meshes.push_back(data);
+        }
+        for (unsigned int i = 0; i < node->mNumChildren; i++) {
+            addNode(node->mChildren[i], scene, modelMat, normalMatrix);
+        }
+    }
+
+    // materials without a diffuse texture count as mid grey, fileName is left empty for them
+    glm::vec3 meshAlbedo(const aiMaterial* material, MaterialBucket& bucket, std::string& fileName) {
+        bucket = MaterialBucket::OPAQUE;
+        fileName.clear();
+        if (material->GetTextureCount(aiTextureType_DIFFUSE) == 0) {
+            return glm::vec3(0.5f);
+        }
+        aiString name;
+        material->GetTexture(aiTextureType_DIFFUSE, 0, &name);
+        fileName = mDirectory + '/' + name.C_Str();
+        std::replace(fileName.begin(), fileName.end(), '\\', '/');
+        auto it = mAlbedos.find(name.C_Str());
+        if (it != mAlbedos.end()) {
+            bucket = mBuckets[name.C_Str()];
+            return it->second;
+        }
+
+        glm::vec3 albedo(0.5f);
+        int width;
+        int height;
+        int components;
+        unsigned char* data = stbi_load(fileName.c_str(), &width, &height, &components, 4);
+        if (data) {
+            glm::vec3 sum(0.0f);
+            size_t texels = static_cast<size_t>(width) * height;
+            for (size_t i = 0; i < texels; i++) {
+                sum += glm::vec3(data[4 * i], data[4 * i + 1], data[4 * i + 2]);
+            }
+            albedo = sum / (255.0f * texels);
+            // images without alpha are expanded with an opaque one
+            bucket = classifyAlpha(data, width, height);
+            stbi_image_free(data);
+        } else {
+            std::cerr << "bake: can't read " << fileName << ", using grey" << std::endl;
+        }
+        mAlbedos.emplace(name.C_Str(), albedo);
+        mBuckets.emplace(name.C_Str(), bucket);
+        return albedo;
+    }
+};
+
+// Offline baker for the static lights. Runs entirely on the CPU:
+// 1. Lightmap UVs. Edge neighbours facing the same way are grouped into charts, and each
+//    chart is projected onto the axis plane it faces. Vertices on a seam between charts are
+//    copied so every chart has its own. Charts are shelf packed into the atlas at a density
+//    fitted to it.
+// 2. Every covered texel is traced against the directional and point lights through a BVH,
+//    rows are shared out over the thread pool. Texels just outside the charts are dilated
+//    so bilinear filtering doesn't pull in black.
+// 3. A grid of ambient cube probes over the scene bounds is traced the same way, for surfaces
+//    with no lightmap coordinates.
+// 4. The same grid gets L2 spherical harmonics of the ambient light: rays from each probe pick
+//    up the lightmap, times the mesh's albedo, where they hit and the sun's ambient colour
+//    where they escape. That is one bounce of the baked light plus the sky.
+// Only ambient and diffuse are baked, specular depends on the viewer.
+class LightmapBaker {
+public:
+    LightmapBaker(unsigned int resolution = 2048, unsigned int padding = 1, int maxProbesPerAxis = 24,
+                  unsigned int shRaysPerProbe = 256)
+        : mResolution(resolution), mMaxProbesPerAxis(std::max(maxProbesPerAxis, 2)),
+          mSHRays(std::max(shRaysPerProbe, 1u)), mAtlas(resolution, padding) {
+    }
+
+    bool bake(const BakeScene& scene, const DirLight& dirLight, const std::vector<PointLight>& pointLights,
+              LightmapBake& out) {
+        auto start = std::chrono::high_resolution_clock::now();
+        mDirLight = dirLight;
+        mPointLights = pointLights;
+        mPointRanges.resize(pointLights.size());
+        for (size_t i = 0; i < pointLights.size(); i++) {
+            mPointRanges[i] = lightRange(pointLights[i].attenuation, pointLights[i].lightProp);
+        }
+
+        flatten(scene);
+        if (mTriangleMesh.empty()) {
+            std::cerr << "ERROR::BAKE::EMPTY_SCENE" << std::endl;
+            return false;
+        }
+        mTracer.build(mTrianglePositions);
+        report("bvh", start);
+
+        buildCharts();
+        if (!mAtlas.fit(0.7)) {
+            std::cerr << "ERROR::BAKE::CHARTS_DONT_FIT " << mAtlas.charts().size() << " charts in "
+                      << mResolution << "x" << mResolution << std::endl;
+            return false;
+        }
+        std::cout << "bake: " << mAtlas.charts().size() << " charts at " << mAtlas.density() << " texels per unit"
+                  << std::endl;
+        assignCoords(scene, out);
+        report("charts", start);
+
+        rasterize(scene);
+        out.resolution = mResolution;
+        shadeTexels(out.lightmap);
+        for (int pass = 0; pass < 2; pass++) {
+            mAtlas.dilate(out.lightmap, mTexelCovered);
+        }
+        report("lightmap", start);
+
+        bakeProbes(out);
+        report("probes", start);
+        bakeSHProbes(scene, out);
+        report("spherical harmonics", start);
+        return true;
+    }
+
+private:
+    // quantised endpoints of an edge, smaller endpoint first
+    struct EdgeKey {
+        int v[6];
+
+        bool operator==(const EdgeKey& other) const {
+            return std::equal(v, v + 6, other.v);
+        }
+    };
+
+    struct EdgeHash {
+        size_t operator()(const EdgeKey& key) const {
+            size_t hash = 0;
+            for (int i = 0; i < 6; i++) {
+                hash = hash * 1000003u ^ static_cast<size_t>(static_cast<unsigned int>(key.v[i]));
+            }
+            return hash;
+        }
+    };
+
+    unsigned int mResolution;
+    int mMaxProbesPerAxis;
+    unsigned int mSHRays;
+
+    DirLight mDirLight;
+    std::vector<PointLight> mPointLights;
+    std::vector<float> mPointRanges;
+
+    // every triangle in the scene, three positions each, and where it came from
+    std::vector<glm::vec3> mTrianglePositions;
+    std::vector<unsigned int> mTriangleMesh;
+    std::vector<unsigned int> mTriangleFirstIndex;
+    // lightmap coordinates of each triangle's corners, filled in once the charts are packed
+    std::vector<glm::vec2> mTriangleCoords;
+    glm::vec3 mSceneMin;
+    glm::vec3 mSceneMax;
+    RayTracer mTracer;
+
+    ChartAtlas mAtlas;
+
+    // world position and normal of every texel a triangle covers
+    std::vector<glm::vec3> mTexelPositions;
+    std::vector<glm::vec3> mTexelNormals;
+    std::vector<unsigned char> mTexelCovered;
+
+    static void report(const char* stage, std::chrono::high_resolution_clock::time_point start) {
+        auto now = std::chrono::high_resolution_clock::now();
+        std::cout << "bake: " << stage << " done at " << std::chrono::duration<double>(now - start).count()
+                  << " s" << std::endl;
+    }
+
+    void flatten(const BakeScene& scene) {
+        mTrianglePositions.clear();
+        mTriangleMesh.clear();
+        mTriangleFirstIndex.clear();
+        mSceneMin = glm::vec3(FLT_MAX);
+        mSceneMax = glm::vec3(-FLT_MAX);
+        for (size_t m = 0; m < scene.meshes.size(); m++) {
+            const BakeScene::MeshData& mesh = scene.meshes[m];
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                for (int corner = 0; corner < 3; corner++) {
+                    glm::vec3 position = mesh.positions[mesh.indices[i + corner]];
+                    mTrianglePositions.push_back(position);
+                    mSceneMin = glm::min(mSceneMin, position);
+                    mSceneMax = glm::max(mSceneMax, position);
+                }
+                mTriangleMesh.push_back(static_cast<unsigned int>(m));
+                mTriangleFirstIndex.push_back(static_cast<unsigned int>(i));
+            }
+        }
+    }
+
+    glm::vec3 faceNormal(unsigned int triangle) const {
+        const glm::vec3* p = &mTrianglePositions[3 * triangle];
+        return glm::cross(p[1] - p[0], p[2] - p[0]);
+    }
+
+    EdgeKey edgeKey(const glm::vec3& a, const glm::vec3& b) const {
+        // snap to a thousandth of the scene size so split vertices at the same spot match
+        float scale = 1000.0f / std::max(glm::length(mSceneMax - mSceneMin), 1.0e-6f);
+        glm::vec3 qa = glm::floor((a - mSceneMin) * scale + 0.5f);
+        glm::vec3 qb = glm::floor((b - mSceneMin) * scale + 0.5f);
+        EdgeKey key;
+        for (int i = 0; i < 3; i++) {
+            key.v[i] = static_cast<int>(qa[i]);
+            key.v[i + 3] = static_cast<int>(qb[i]);
+        }
+        if (!std::lexicographical_compare(key.v, key.v + 3, key.v + 3, key.v + 6)) {
+            std::swap_ranges(key.v, key.v + 3, key.v + 3);
+        }
+        return key;
+    }
+
+    // A chart only takes triangles in the normal cone of one axis and sign, so it is a height
+    // field over the plane it is projected on, nothing in it folds over or lies edge on. Vertices
+    // don't join triangles, assignCoords() copies the ones shared between charts.
+    void buildCharts() {
+        size_t triangleCount = mTriangleMesh.size();
+        std::vector<unsigned int> parent(triangleCount);
+        std::vector<glm::vec3> normals(triangleCount);
+        std::vector<int> facings(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++) {
+            parent[t] = static_cast<unsigned int>(t);
+            normals[t] = faceNormal(static_cast<unsigned int>(t));
+            facings[t] = ChartAtlas::facing(normals[t]);
+        }
+
+        // neighbours across an edge join when they face the same way and bend less than about
+        // 25 degrees, so flat areas unwrap as one
+        std::unordered_map<EdgeKey, unsigned int, EdgeHash> edges;
+        edges.reserve(triangleCount * 3);
+        for (size_t t = 0; t < triangleCount; t++) {
+            const glm::vec3* p = &mTrianglePositions[3 * t];
+            for (int corner = 0; corner < 3; corner++) {
+                EdgeKey key = edgeKey(p[corner], p[(corner + 1) % 3]);
+                auto it = edges.find(key);
+                if (it == edges.end()) {
+                    edges.emplace(key, static_cast<unsigned int>(t));
+                    continue;
+                }
+                unsigned int other = it->second;
+                float lengths = glm::length(normals[t]) * glm::length(normals[other]);
+                if (facings[t] == facings[other] && glm::dot(normals[t], normals[other]) > 0.9f * lengths) {
+                    ChartAtlas::join(parent, static_cast<unsigned int>(t), other);
+                }
+                it->second = static_cast<unsigned int>(t);
+            }
+        }
+
+        // every triangle in a chart faces the same way, the first one picks its axis
+        mAtlas.clear();
+        std::vector<Chart>& charts = mAtlas.charts();
+        std::vector<int> chartOf(triangleCount, -1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            unsigned int root = ChartAtlas::findRoot(parent, static_cast<unsigned int>(t));
+            if (chartOf[root] < 0) {
+                chartOf[root] = static_cast<int>(charts.size());
+                mAtlas.add(0, facings[t] / 2);
+            }
+            Chart& chart = charts[chartOf[root]];
+            chart.triangles.push_back(static_cast<unsigned int>(t));
+            for (int corner = 0; corner < 3; corner++) {
+                ChartAtlas::grow(chart, mTrianglePositions[3 * t + corner]);
+            }
+        }
+    }
+
+    // a vertex keeps the coordinates of the first chart that reaches it and is copied once for
+    // every other chart it is on, those triangles' corners are pointed at the copy
+    void assignCoords(const BakeScene& scene, LightmapBake& out) {
+        size_t meshCount = scene.meshes.size();
+        out.meshCoords.resize(meshCount);
+        out.meshSeamSources.assign(meshCount, std::vector<uint32_t>());
+        out.meshIndices.resize(meshCount);
+        std::vector<std::vector<int>> vertexChart(meshCount);
+        // (vertex << 32 | chart) to the copy made for it, per mesh
+        std::vector<std::unordered_map<uint64_t, uint32_t>> copies(meshCount);
+        for (size_t m = 0; m < meshCount; m++) {
+            out.meshCoords[m].assign(scene.meshes[m].positions.size(), glm::vec2(-1.0f));
+            out.meshIndices[m].assign(scene.meshes[m].indices.begin(), scene.meshes[m].indices.end());
+            vertexChart[m].assign(scene.meshes[m].positions.size(), -1);
+        }
+        mTriangleCoords.resize(mTrianglePositions.size());
+        float size = static_cast<float>(mResolution);
+        const std::vector<Chart>& charts = mAtlas.charts();
+        for (size_t c = 0; c < charts.size(); c++) {
+            const Chart& chart = charts[c];
+            for (unsigned int triangle : chart.triangles) {
+                unsigned int m = mTriangleMesh[triangle];
+                for (int corner = 0; corner < 3; corner++) {
+                    unsigned int first = mTriangleFirstIndex[triangle] + corner;
+                    unsigned int vertex = scene.meshes[m].indices[first];
+                    glm::vec2 coords = mAtlas.texel(chart, mTrianglePositions[3 * triangle + corner]) / size;
+                    mTriangleCoords[3 * triangle + corner] = coords;
+                    if (vertexChart[m][vertex] < 0) {
+                        vertexChart[m][vertex] = static_cast<int>(c);
+                        out.meshCoords[m][vertex] = coords;
+                    } else if (vertexChart[m][vertex] != static_cast<int>(c)) {
+                        uint64_t key = static_cast<uint64_t>(vertex) << 32 | c;
+                        auto copy = copies[m].emplace(key, static_cast<uint32_t>(out.meshCoords[m].size()));
+                        if (copy.second) {
+                            out.meshCoords[m].push_back(coords);
+                            out.meshSeamSources[m].push_back(vertex);
+                        }
+                        out.meshIndices[m][first] = copy.first->second;
+                    }
+                }
+            }
+        }
+        size_t seamVertices = 0;
+        for (const std::vector<uint32_t>& sources : out.meshSeamSources) {
+            seamVertices += sources.size();
+        }
+        std::cout << "bake: " << seamVertices << " vertices copied along chart seams" << std::endl;
+    }
+
+    // find the world position and normal under every texel centre, packed charts don't share
+    // texels so each one can be rasterised on its own thread
+    void rasterize(const BakeScene& scene) {
+        size_t texelCount = static_cast<size_t>(mResolution) * mResolution;
+        mTexelPositions.assign(texelCount, glm::vec3(0.0f));
+        mTexelNormals.assign(texelCount, glm::vec3(0.0f));
+        mTexelCovered.assign(texelCount, 0);
+
+        const std::vector<Chart>& charts = mAtlas.charts();
+        ThreadPool::instance().parallelFor(charts.size(), 64, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                const Chart& chart = charts[c];
+                for (unsigned int triangle : chart.triangles) {
+                    rasterizeTriangle(scene, chart, triangle);
+                }
+            }
+        });
+    }
+
+    void rasterizeTriangle(const BakeScene& scene, const Chart& chart, unsigned int triangle) {
+        const BakeScene::MeshData& mesh = scene.meshes[mTriangleMesh[triangle]];
+        const unsigned int* indices = &mesh.indices[mTriangleFirstIndex[triangle]];
+        const glm::vec3* world = &mTrianglePositions[3 * triangle];
+        glm::vec2 texel[3];
+        for (int corner = 0; corner < 3; corner++) {
+            texel[corner] = mAtlas.texel(chart, world[corner]);
+        }
+        glm::vec3 faceNorm = faceNormal(triangle);
+
+        auto store = [&](int x, int y, const glm::vec3& weights) {
+            size_t index = static_cast<size_t>(y) * mResolution + x;
+            glm::vec3 normal = mesh.normals[indices[0]] * weights.x + mesh.normals[indices[1]] * weights.y +
+                               mesh.normals[indices[2]] * weights.z;
+            if (glm::dot(normal, normal) < 1.0e-12f) {
+                normal = faceNorm;
+            }
+            mTexelPositions[index] = world[0] * weights.x + world[1] * weights.y + world[2] * weights.z;
+            mTexelNormals[index] = glm::normalize(normal);
+            mTexelCovered[index] = 1;
+        };
+
+        float area = ChartAtlas::cross(texel[1] - texel[0], texel[2] - texel[0]);
+        if (std::abs(area) > 1.0e-12f) {
+            glm::vec2 low = glm::min(texel[0], glm::min(texel[1], texel[2]));
+            glm::vec2 high = glm::max(texel[0], glm::max(texel[1], texel[2]));
+            int minX = std::max(static_cast<int>(std::floor(low.x)), chart.x);
+            int minY = std::max(static_cast<int>(std::floor(low.y)), chart.y);
+            int maxX = std::min(static_cast<int>(std::ceil(high.x)), chart.x + chart.width - 1);
+            int maxY = std::min(static_cast<int>(std::ceil(high.y)), chart.y + chart.height - 1);
+            for (int y = minY; y <= maxY; y++) {
+                for (int x = minX; x <= maxX; x++) {
+                    glm::vec2 centre(x + 0.5f, y + 0.5f);
+                    glm::vec3 weights(ChartAtlas::cross(texel[2] - texel[1], centre - texel[1]),
+                                      ChartAtlas::cross(texel[0] - texel[2], centre - texel[2]),
+                                      ChartAtlas::cross(texel[1] - texel[0], centre - texel[0]));
+                    weights /= area;
+                    if (weights.x >= -1.0e-4f && weights.y >= -1.0e-4f && weights.z >= -1.0e-4f) {
+                        store(x, y, weights);
+                    }
+                }
+            }
+        }
+
+        // triangles thinner than a texel may miss every centre, give them the texel they sit in
+        glm::vec2 centroid = (texel[0] + texel[1] + texel[2]) / 3.0f;
+        int x = std::min(std::max(static_cast<int>(centroid.x), chart.x), chart.x + chart.width - 1);
+        int y = std::min(std::max(static_cast<int>(centroid.y), chart.y), chart.y + chart.height - 1);
+        if (!mTexelCovered[static_cast<size_t>(y) * mResolution + x]) {
+            store(x, y, glm::vec3(1.0f / 3.0f));
+        }
+    }
+
+    // ambient plus diffuse irradiance at position for a surface facing normal
+    glm::vec3 irradiance(const glm::vec3& position, const glm::vec3& normal, float bias) const {
+        glm::vec3 origin = position + normal * bias;
+        float sceneSize = glm::length(mSceneMax - mSceneMin);
+
+        glm::vec3 result = mDirLight.lightProp.ambient;
+        glm::vec3 toSun = glm::normalize(-mDirLight.direction);
+        float sunFacing = glm::dot(normal, toSun);
+        if (sunFacing > 0.0f && !mTracer.occluded(origin, toSun, 2.0f * sceneSize)) {
+            result += mDirLight.lightProp.diffuse * sunFacing;
+        }
+
+        for (size_t i = 0; i < mPointLights.size(); i++) {
+            const PointLight& light = mPointLights[i];
+            glm::vec3 toLight = light.position - position;
+            float distance = glm::length(toLight);
+            if (distance > mPointRanges[i] || distance < 1.0e-6f) {
+                continue;
+            }
+            const Attenuation& a = light.attenuation;
+            float attenuation = 1.0f / (a.constant + a.linear * distance + a.quadratic * distance * distance);
+            result += light.lightProp.ambient * attenuation;
+            glm::vec3 direction = toLight / distance;
+            float lightFacing = glm::dot(normal, direction);
+            if (lightFacing > 0.0f && !mTracer.occluded(origin, direction, std::max(distance - bias, 0.0f))) {
+                result += light.lightProp.diffuse * lightFacing * attenuation;
+            }
+        }
+        return result;
+    }
+
+    void shadeTexels(std::vector<glm::vec3>& lightmap) const {
+        lightmap.assign(mTexelCovered.size(), glm::vec3(0.0f));
+        // a texel's worth of offset keeps interpolated positions from shadowing themselves
+        float bias = 1.0f / mAtlas.density();
+        ThreadPool::instance().parallelFor(mResolution, 8, [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++) {
+                for (size_t x = 0; x < mResolution; x++) {
+                    size_t index = y * mResolution + x;
+                    if (mTexelCovered[index]) {
+                        lightmap[index] = irradiance(mTexelPositions[index], mTexelNormals[index], bias);
+                    }
+                }
+            }
+        });
+    }
+
+    void bakeProbes(LightmapBake& out) const {
+        // pad the bounds a little so flat scenes still get a volume
+        glm::vec3 extent = glm::max(mSceneMax - mSceneMin, glm::vec3(1.0e-3f));
+        float largest = std::max(extent.x, std::max(extent.y, extent.z));
+        float spacing = largest / (mMaxProbesPerAxis - 1);
+        for (int i = 0; i < 3; i++) {
+            int count = static_cast<int>(std::ceil(extent[i] / spacing)) + 1;
+            out.probeCount[i] = std::min(std::max(count, 2), mMaxProbesPerAxis);
+        }
+        out.probeMin = mSceneMin;
+        out.probeMax = mSceneMin + extent;
+
+        const glm::vec3 directions[6] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+                                          glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+                                          glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+        size_t probeCount = static_cast<size_t>(out.probeCount.x) * out.probeCount.y * out.probeCount.z;
+        out.probes.assign(probeCount * 6, glm::vec3(0.0f));
+        ThreadPool::instance().parallelFor(probeCount, 16, [&](size_t begin, size_t end) {
+            for (size_t probe = begin; probe < end; probe++) {
+                glm::vec3 position = probePosition(out, probe);
+                for (int face = 0; face < 6; face++) {
+                    out.probes[probe * 6 + face] = irradiance(position, directions[face], 0.0f);
+                }
+            }
+        });
+    }
+
+    static glm::vec3 probePosition(const LightmapBake& out, size_t probe) {
+        glm::ivec3 count = out.probeCount;
+        glm::vec3 cell(static_cast<float>(probe % count.x),
+                       static_cast<float>(probe / count.x % count.y),
+                       static_cast<float>(probe / (static_cast<size_t>(count.x) * count.y)));
+        return out.probeMin + cell / (glm::vec3(count.x, count.y, count.z) - 1.0f) * (out.probeMax - out.probeMin);
+    }
+
+    // the nine real L2 basis functions, in the order shAmbient.glsl expects
+    static void shBasis(const glm::vec3& d, float* basis) {
+        basis[0] = 0.282095f;
+        basis[1] = 0.488603f * d.y;
+        basis[2] = 0.488603f * d.z;
+        basis[3] = 0.488603f * d.x;
+        basis[4] = 1.092548f * d.x * d.y;
+        basis[5] = 1.092548f * d.y * d.z;
+        basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+        basis[7] = 1.092548f * d.x * d.z;
+        basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+    }
+
+    // light leaving the surface a ray hit, black when it hit the back of a face
+    glm::vec3 hitRadiance(const BakeScene& scene, const LightmapBake& out, const RayTracer::Hit& hit,
+                          const glm::vec3& direction) const {
+        if (glm::dot(faceNormal(hit.triangle), direction) > 0.0f) {
+            return glm::vec3(0.0f);
+        }
+        const glm::vec2* coords = &mTriangleCoords[3 * hit.triangle];
+        glm::vec2 uv = coords[0] * (1.0f - hit.u - hit.v) + coords[1] * hit.u + coords[2] * hit.v;
+        int last = static_cast<int>(mResolution) - 1;
+        int x = std::min(std::max(static_cast<int>(uv.x * mResolution), 0), last);
+        int y = std::min(std::max(static_cast<int>(uv.y * mResolution), 0), last);
+        return out.lightmap[static_cast<size_t>(y) * mResolution + x] * scene.meshes[mTriangleMesh[hit.triangle]].albedo;
+    }
+
+    // Monte Carlo projection over evenly spread directions, one probe per task. The radiance
+    // coefficients are then convolved with the clamped cosine, bands scaled by 1, 2/3 and 1/4.
+    void bakeSHProbes(const BakeScene& scene, LightmapBake& out) const {
+        std::vector<glm::vec3> directions(mSHRays);
+        const float goldenAngle = 2.399963f;
+        for (unsigned int i = 0; i < mSHRays; i++) {
+            float z = 1.0f - (2.0f * i + 1.0f) / mSHRays;
+            float radius = std::sqrt(std::max(1.0f - z * z, 0.0f));
+            directions[i] = glm::vec3(radius * std::cos(goldenAngle * i), radius * std::sin(goldenAngle * i), z);
+        }
+        const float bandScale[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+        const float weight = 4.0f * 3.14159265f / mSHRays;
+        float maxDistance = 2.0f * glm::length(mSceneMax - mSceneMin);
+        glm::vec3 sky = mDirLight.lightProp.ambient;
+
+        size_t probeCount = static_cast<size_t>(out.probeCount.x) * out.probeCount.y * out.probeCount.z;
+        out.shProbes.assign(probeCount * 9, glm::vec3(0.0f));
+        ThreadPool::instance().parallelFor(probeCount, 4, [&](size_t begin, size_t end) {
+            for (size_t probe = begin; probe < end; probe++) {
+                glm::vec3 position = probePosition(out, probe);
+                glm::vec3* coefficients = &out.shProbes[probe * 9];
+                for (const glm::vec3& direction : directions) {
+                    RayTracer::Hit hit;
+                    glm::vec3 radiance = mTracer.intersect(position, direction, maxDistance, hit) ?
+                        hitRadiance(scene, out, hit, direction) : sky;
+                    float basis[9];
+                    shBasis(direction, basis);
+                    for (int i = 0; i < 9; i++) {
+                        coefficients[i] += radiance * (basis[i] * weight);
+                    }
+                }
+                for (int i = 0; i < 9; i++) {
+                    coefficients[i] *= bandScale[i];
+                }
+            }
+        });
+    }
+};
+
+#endif /* lightmapBaker_h */
@@ -0,0 +1,133 @@
+//
+//  lights.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-20.
+//
+
+#ifndef lights_h
+#define lights_h
+
+#include <string>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#include "shader.h"
+
+// GLM
+#include <glm/glm.hpp>
+
+// CPU side mirrors of the light structs in lighting.glsl
+
+struct LightProperties {
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+};
+
+struct Attenuation {
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+struct DirLight {
+    glm::vec3 direction;
+    LightProperties lightProp;
+};
+
+struct PointLight {
+    glm::vec3 position;
+    Attenuation attenuation;
+    LightProperties lightProp;
+};
+
+struct SpotLight {
+    glm::vec3 position;
+    glm::vec3 direction;
+    float cutoff;
+    float outerCutoff;
+    Attenuation attenuation;
+    LightProperties lightProp;
+};
+
+// Distance past which the light's brightest channel is attenuated below 5/256, i.e. it
+// can no longer visibly change a pixel. Lights without linear or quadratic falloff never end.
+inline float lightRange(const Attenuation& attenuation, const LightProperties& lightProp) {
+    float brightest = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        brightest = std::max(brightest, lightProp.ambient[i]);
+        brightest = std::max(brightest, lightProp.diffuse[i]);
+        brightest = std::max(brightest, lightProp.specular[i]);
+    }
+    float target = brightest * (256.0f / 5.0f);
+    if (target <= attenuation.constant) {
+        return 0.0f;
+    }
+    if (attenuation.quadratic > 0.0f) {
+        float l = attenuation.linear;
+        float q = attenuation.quadratic;
+        return (-l + std::sqrt(l * l - 4.0f * q * (attenuation.constant - target))) / (2.0f * q);
+    }
+    if (attenuation.linear > 0.0f) {
+        return (target - attenuation.constant) / attenuation.linear;
+    }
+    return FLT_MAX;
+}
+
+// A point light packed into five vec4s for buffer textures and instance buffers, range in
+// position.w and attenuation spread over the w components of the colours. shadow.x is the
+// light's first tile in the shadow atlas, -1 if it has none.
+struct PackedPointLight {
+    glm::vec4 positionRange;
+    glm::vec4 ambientConstant;
+    glm::vec4 diffuseLinear;
+    glm::vec4 specularQuadratic;
+    glm::vec4 shadow;
+};
+
+inline PackedPointLight packPointLight(const PointLight& light, float range, int shadowTile = -1) {
+    PackedPointLight packed;
+    packed.positionRange = glm::vec4(light.position, range);
+    packed.ambientConstant = glm::vec4(light.lightProp.ambient, light.attenuation.constant);
+    packed.diffuseLinear = glm::vec4(light.lightProp.diffuse, light.attenuation.linear);
+    packed.specularQuadratic = glm::vec4(light.lightProp.specular, light.attenuation.quadratic);
+    packed.shadow = glm::vec4(static_cast<float>(shadowTile), 0.0f, 0.0f, 0.0f);
+    return packed;
+}
+
+// upload a light to the matching uniform struct called name
+inline void setLight(const Shader& shader, const std::string& name, const LightProperties& lightProp) {
+    shader.setVec3(name + ".ambient", lightProp.ambient);
+    shader.setVec3(name + ".diffuse", lightProp.diffuse);
+    shader.setVec3(name + ".specular", lightProp.specular);
+}
+
+inline void setLight(const Shader& shader, const std::string& name, const Attenuation& attenuation) {
+    shader.setFloat(name + ".constant", attenuation.constant);
+    shader.setFloat(name + ".linear", attenuation.linear);
+    shader.setFloat(name + ".quadratic", attenuation.quadratic);
+}
+
+inline void setLight(const Shader& shader, const std::string& name, const DirLight& light) {
+    shader.setVec3(name + ".direction", light.direction);
+    setLight(shader, name + ".lightProp", light.lightProp);
+}
+
+inline void setLight(const Shader& shader, const std::string& name, const PointLight& light) {
+    shader.setVec3(name + ".position", light.position);
+    setLight(shader, name + ".attenuation", light.attenuation);
+    setLight(shader, name + ".lightProp", light.lightProp);
+}
+
+inline void setLight(const Shader& shader, const std::string& name, const SpotLight& light) {
+    shader.setVec3(name + ".position", light.position);
+    shader.setVec3(name + ".direction", light.direction);
+    shader.setFloat(name + ".cutoff", light.cutoff);
+    shader.setFloat(name + ".outerCutoff", light.outerCutoff);
+    setLight(shader, name + ".attenuation", light.attenuation);
+    setLight(shader, name + ".lightProp", light.lightProp);
+}
+
+#endif /* lights_h */
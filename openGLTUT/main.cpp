@@ -16,11 +16,37 @@
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "gpuTimer.h"
+#include "lights.h"
+#include "clusteredLighting.h"
+#include "deferredRenderer.h"
+#include "cascadedShadows.h"
+#include "lightManager.h"
+#include "shadowAtlas.h"
+#include "lightmapBaker.h"
+#include "bakedLighting.h"
+#include "sampleCounter.h"
+#include "bvh.h"
+#include "frustum.h"
+#include "rayTracer.h"
+#include "occlusionCuller.h"
+#include "hiZCuller.h"
+#include "occlusionQueries.h"
+#include "pvs.h"
+#include "pvsValidator.h"
+#include "hlod.h"
+#include "hlodProxies.h"
 
 #include <string>
 #include <fstream>
 #include <streambuf>
 #include <cmath>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -49,6 +75,44 @@ float lastY = SCR_HEIGHT / 2.0f;
 // lighting
 glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
 
+const std::string SHADER_DIR = "/Users/davanb/Documents/School/Learning/openGLTUT/openGLTUT/";
+//const std::string MODEL_PATH = "/Users/davanb/Documents/School/Learning/nanosuit/nanosuit.obj";
+const std::string MODEL_PATH = "/Users/davanb/Documents/School/Learning/sponza_obj/sponza.obj";
+
+// forward (clustered) or deferred shading, M switches between them
+enum class RenderPath {
+    FORWARD,
+    DEFERRED
+};
+RenderPath renderPath = RenderPath::FORWARD;
+// static lights come from a bake, only the forward path reads it
+bool bakedLighting = false;
+// deferred lights are shaded at 1 / lightingScale resolution, L cycles 1, 2 and 4 and P
+// compares the current scale against full resolution
+int lightingScale = 1;
+bool compareLighting = false;
+// meshes hidden behind the scene's big opaque surfaces aren't drawn, O toggles it on the CPU
+// and H against last frame's depth on the GPU. V outlines the meshes they hid.
+bool occlusionCulling = false;
+bool hiZCulling = false;
+bool showOccluded = false;
+// Q queries the boxes of big meshes with hardware occlusion queries, C switches between the CPU
+// skipping them and conditional rendering
+bool queryCulling = false;
+bool conditionalRendering = false;
+// only meshes in the potentially visible set of the camera's cell are considered, K toggles it.
+// The set is loaded the first frame it's on, if there's none it turns itself back off.
+bool pvsCulling = false;
+// B checks what the set leaves out against occlusion queries of the whole frame while it's on
+bool pvsCheck = false;
+// meshes smaller on screen than their material bucket's threshold are skipped, T toggles it
+bool detailCulling = false;
+// Z lays down the forward path's opaque depth first so the expensive shading runs once per pixel
+bool depthPrepass = false;
+// distant groups of meshes are drawn as one simplified proxy each, J toggles it. Like the PVS the
+// proxies are loaded the first frame it's on.
+bool hlodCulling = false;
+
 
 // callback to resize the viewport to match the new dimentions after window resize.
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
@@ -106,6 +170,65 @@ void scroll_callabck(GLFWwindow* window, double xOffest, double yOffset) {
     camera.processMouseScroll(yOffset);
 }
 
+// single key presses, held keys are handled in processInput
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+        if (bakedLighting) {
+            std::cout << "the deferred path doesn't support baked lighting" << std::endl;
+            return;
+        }
+        renderPath = renderPath == RenderPath::FORWARD ? RenderPath::DEFERRED : RenderPath::FORWARD;
+        std::cout << "render path: " << (renderPath == RenderPath::FORWARD ? "forward" : "deferred") << std::endl;
+    }
+    if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        lightingScale = lightingScale == 4 ? 1 : lightingScale * 2;
+        std::cout << "deferred lighting at 1/" << lightingScale << " resolution" << std::endl;
+    }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        compareLighting = true;
+    }
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        occlusionCulling = !occlusionCulling;
+        std::cout << "occlusion culling " << (occlusionCulling ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+        hiZCulling = !hiZCulling;
+        std::cout << "hi-z occlusion culling " << (hiZCulling ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+        showOccluded = !showOccluded;
+    }
+    if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
+        queryCulling = !queryCulling;
+        std::cout << "occlusion queries " << (queryCulling ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+        pvsCulling = !pvsCulling;
+        std::cout << "potentially visible sets " << (pvsCulling ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        pvsCheck = !pvsCheck;
+        std::cout << "pvs check against the render " << (pvsCheck ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        detailCulling = !detailCulling;
+        std::cout << "detail culling " << (detailCulling ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_J && action == GLFW_PRESS) {
+        hlodCulling = !hlodCulling;
+        std::cout << "hlod proxies " << (hlodCulling ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
+        depthPrepass = !depthPrepass;
+        std::cout << "depth pre-pass " << (depthPrepass ? "on" : "off") << std::endl;
+    }
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        conditionalRendering = !conditionalRendering;
+        std::cout << "occlusion query results used by " << (conditionalRendering ? "conditional rendering" : "the CPU")
+                  << std::endl;
+    }
+}
+
 GLFWwindow* initGLFW() {
     // init and configure glfw
     if (glfwInit() != GL_TRUE) {
@@ -129,6 +252,7 @@ GLFWwindow* initGLFW() {
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callabck);
+    glfwSetKeyCallback(window, key_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     
     // glad, load all openGL functions pointers into memory
@@ -141,8 +265,615 @@ GLFWwindow* initGLFW() {
     return window;
 }
 
+// text as a whole number, all of it, false if it isn't one
+bool parseWholeNumber(const char* text, size_t& value) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || std::strchr(text, '-') != nullptr) {
+        return false;
+    }
+    value = static_cast<size_t>(parsed);
+    return true;
+}
+
+// value of a "--flag N" command line argument, or defaultValue if it isn't there or isn't a
+// whole number
+size_t argValue(int argc, const char* argv[], const std::string& flag, size_t defaultValue) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (flag == argv[i]) {
+            const char* text = argv[i + 1];
+            size_t value = 0;
+            if (!parseWholeNumber(text, value)) {
+                std::cerr << "usage: " << flag << " N, N a whole number, not \"" << text << "\", using "
+                          << defaultValue << std::endl;
+                return defaultValue;
+            }
+            return value;
+        }
+    }
+    return defaultValue;
+}
+
+// every "--flag name=N" command line argument in order, the flag can be given more than once.
+// Ones without a name or a whole number after the last '=' are reported and left out.
+std::vector<std::pair<std::string, size_t>> argNamedValues(int argc, const char* argv[], const std::string& flag) {
+    std::vector<std::pair<std::string, size_t>> values;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (flag != argv[i]) {
+            continue;
+        }
+        std::string text = argv[i + 1];
+        size_t split = text.rfind('=');
+        size_t value = 0;
+        if (split == std::string::npos || split == 0 || !parseWholeNumber(text.c_str() + split + 1, value)) {
+            std::cerr << "usage: " << flag << " name=N, N a whole number, not \"" << text << "\", ignored"
+                      << std::endl;
+            continue;
+        }
+        values.push_back(std::make_pair(text.substr(0, split), value));
+    }
+    return values;
+}
+
+// the scene shared by the renderer and the baker
+glm::mat4 sceneModelMatrix() {
+    glm::mat4 modelMat = glm::mat4(1.0f);
+    modelMat = glm::translate(modelMat, glm::vec3(0.0, -1.75f, 0.0f));
+    modelMat = glm::scale(modelMat, glm::vec3(0.2f, 0.2f, 0.2f));
+    return modelMat;
+}
+
+DirLight sceneDirLight() {
+    DirLight dirLight = { glm::vec3(-0.2f, -1.0f, -0.3f),
+                          { glm::vec3(0.05f), glm::vec3(0.4f), glm::vec3(0.5f) } };
+    return dirLight;
+}
+
+// point lights that never move, these are the ones a bake covers
+std::vector<PointLight> sceneStaticLights() {
+    return {
+        { glm::vec3( 0.7f,  0.2f,  2.0f), { 1.0f, 0.09f, 0.032f },
+          { glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f) } },
+        { glm::vec3( 2.3f, -3.3f, -4.0f), { 1.0f, 0.09f, 0.032f },
+          { glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f) } }
+    };
+}
+
+// bake the static lights into a lightmap and probe grid next to the model, needs no window or GPU
+bool runBake(unsigned int resolution) {
+    BakeScene scene;
+    if (!scene.load(MODEL_PATH, sceneModelMatrix())) {
+        return false;
+    }
+    LightmapBaker baker(resolution);
+    LightmapBake bake;
+    if (!baker.bake(scene, sceneDirLight(), sceneStaticLights(), bake)) {
+        return false;
+    }
+    if (!bake.save(MODEL_PATH + ".bake")) {
+        return false;
+    }
+    std::cout << "wrote " << MODEL_PATH << ".bake" << std::endl;
+    return true;
+}
+
+// precompute the scene's potentially visible sets with cells cells along its longest axis
+bool runPvsBuild(int cells, unsigned int rays) {
+    BakeScene scene;
+    if (!scene.load(MODEL_PATH, sceneModelMatrix())) {
+        return false;
+    }
+    PvsBuilder builder(cells, rays);
+    PotentiallyVisibleSets pvs;
+    if (!builder.build(scene, pvs) || !pvs.save(MODEL_PATH + ".pvs")) {
+        return false;
+    }
+    std::cout << "wrote " << MODEL_PATH << ".pvs" << std::endl;
+    return true;
+}
+
+// Merges the scene's meshes into proxies for clusters cells to its longest side, with colours in
+// an atlas atlasSize texels square, and reports the draw calls they save at a distance when
+// they replace clusters below pixels on screen. Meshes are counted as the chunks Model splits
+// them into with the same limits.
+bool runHlodBuild(int cells, unsigned int atlasSize, float pixels, size_t maxChunkTriangles, float maxChunkExtent) {
+    BakeScene scene;
+    // proxies are drawn with the model's matrix like its own meshes
+    if (!scene.load(MODEL_PATH, glm::mat4(1.0f))) {
+        return false;
+    }
+    HlodBuilder builder(cells, 16, atlasSize);
+    HlodSet set;
+    if (!builder.build(scene, set) || !set.save(MODEL_PATH + ".hlod")) {
+        return false;
+    }
+    std::cout << "wrote " << MODEL_PATH << ".hlod" << std::endl;
+    HlodBuilder::reportDrawCalls(scene, set, maxChunkTriangles, maxChunkExtent, pixels, static_cast<float>(SCR_HEIGHT),
+                                 glm::radians(45.0f));
+    return true;
+}
+
+// Ray casts the view from cameras random places in cells with a set, a pixel per ray, and
+// reports every mesh such a render shows that the cell's set is missing. False if any were.
+// This only checks the build's sampling, the ray caster is the one that built the sets; B or
+// --pvs-check in the viewer checks them against what the GPU draws.
+bool runPvsValidation(size_t cameras) {
+    BakeScene scene;
+    PotentiallyVisibleSets pvs;
+    if (!scene.load(MODEL_PATH, sceneModelMatrix()) || !pvs.load(MODEL_PATH + ".pvs")) {
+        return false;
+    }
+    if (pvs.meshCount != scene.meshes.size()) {
+        std::cerr << "the pvs was built for " << pvs.meshCount << " meshes, the scene has " << scene.meshes.size()
+                  << std::endl;
+        return false;
+    }
+    std::vector<int> cells;
+    for (size_t cell = 0; cell < pvs.cellTotal(); cell++) {
+        if (pvs.hasSet(static_cast<int>(cell))) {
+            cells.push_back(static_cast<int>(cell));
+        }
+    }
+    if (cells.empty()) {
+        std::cerr << "the pvs has no cells with a set" << std::endl;
+        return false;
+    }
+    SceneVisibility visibility(scene);
+    float sceneSize = glm::length(glm::vec3(pvs.cellCount) * pvs.cellSize);
+    const int width = 160;
+    const int height = 90;
+    float tanHalfFov = std::tan(glm::radians(22.5f));
+    float aspect = static_cast<float>(SCR_WIDTH) / SCR_HEIGHT;
+    
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    size_t seenTotal = 0;
+    size_t setTotal = 0;
+    size_t missing = 0;
+    for (size_t c = 0; c < cameras; c++) {
+        int cell = cells[random() % cells.size()];
+        glm::ivec3 coords(cell % pvs.cellCount.x, (cell / pvs.cellCount.x) % pvs.cellCount.y,
+                          cell / (pvs.cellCount.x * pvs.cellCount.y));
+        glm::vec3 eye = pvs.min + (glm::vec3(coords) + glm::vec3(unit(random), unit(random), unit(random))) * pvs.cellSize;
+        float yaw = glm::radians(360.0f * unit(random));
+        float pitch = glm::radians(60.0f * (unit(random) - 0.5f));
+        glm::vec3 front(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch));
+        glm::vec3 right = glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f)));
+        glm::vec3 up = glm::cross(right, front);
+        
+        std::vector<unsigned char> seen(scene.meshes.size(), 0);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                float ndcX = (x + 0.5f) / width * 2.0f - 1.0f;
+                float ndcY = (y + 0.5f) / height * 2.0f - 1.0f;
+                glm::vec3 direction = glm::normalize(front + right * (ndcX * tanHalfFov * aspect) + up * (ndcY * tanHalfFov));
+                visibility.trace(eye, direction, sceneSize, seen);
+            }
+        }
+        const unsigned char* set = pvs.visibleFrom(eye);
+        setTotal += pvs.visibleCount(eye);
+        for (size_t m = 0; m < seen.size(); m++) {
+            seenTotal += seen[m];
+            if (seen[m] && !set[m]) {
+                if (missing < 20) {
+                    std::cout << "camera " << c << " in cell " << cell << " sees mesh " << m
+                              << ", which isn't in the cell's set" << std::endl;
+                }
+                missing++;
+            }
+        }
+    }
+    std::cout << cameras << " cameras: " << static_cast<double>(seenTotal) / cameras << " meshes seen and "
+              << static_cast<double>(setTotal) / cameras << " in the set on average, " << missing
+              << " seen but missing from the set" << std::endl;
+    return missing == 0;
+}
+
+// scatter count small coloured point lights through sponza's interior
+void addBenchmarkLights(std::vector<PointLight>& lights, size_t count) {
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> x(-350.0f, 330.0f);
+    std::uniform_real_distribution<float> y(0.0f, 200.0f);
+    std::uniform_real_distribution<float> z(-200.0f, 210.0f);
+    std::uniform_real_distribution<float> colour(0.2f, 1.0f);
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 rgb(colour(random), colour(random), colour(random));
+        // steep falloff keeps each light's range to a few units
+        PointLight light = { glm::vec3(x(random), y(random), z(random)), { 1.0f, 0.7f, 1.8f },
+                             { glm::vec3(0.0f), rgb, rgb } };
+        lights.push_back(light);
+    }
+}
+
+// time LightManager::cull on count random lights, a tenth of them spot lights, without a window
+void runCullBenchmark(size_t count) {
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    LightManager lights;
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 where(position(random), position(random), position(random));
+        if (i % 10 == 0) {
+            SpotLight light = { where, glm::vec3(direction(random), direction(random), direction(random)) + glm::vec3(0.01f),
+                                glm::cos(glm::radians(12.5f)), glm::cos(glm::radians(15.0f)), { 1.0f, 0.09f, 0.032f },
+                                { glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(1.0f) } };
+            lights.addSpotLight(light);
+        } else {
+            PointLight light = { where, { 1.0f, 0.7f, 1.8f }, { glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(1.0f) } };
+            lights.addPointLight(light);
+        }
+    }
+    
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), static_cast<float>(SCR_WIDTH) / SCR_HEIGHT, 0.1f, 5000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const int runs = 200;
+    double total = 0.0;
+    double best = 1.0e9;
+    for (int run = 0; run < runs; run++) {
+        lights.cull(projection * view);
+        total += lights.cullMs();
+        best = std::min(best, lights.cullMs());
+    }
+    std::cout << "culled " << count << " lights: " << total / runs << " ms average, " << best << " ms best, "
+              << lights.visiblePointIndices().size() << " point and " << lights.visibleSpotIndices().size()
+              << " spot lights visible" << std::endl;
+}
+
+// milliseconds fn takes to run once
+template <typename Fn>
+double timeMs(const Fn& fn) {
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// build and query the scene's hierarchies queries times each, without a window
+bool runBvhBenchmark(size_t queries) {
+    BakeScene scene;
+    if (!scene.load(MODEL_PATH, sceneModelMatrix())) {
+        return false;
+    }
+    std::vector<glm::vec3> triangles;
+    std::vector<glm::vec3> triangleMin;
+    std::vector<glm::vec3> triangleMax;
+    std::vector<glm::vec3> meshMin;
+    std::vector<glm::vec3> meshMax;
+    glm::vec3 sceneMin(FLT_MAX);
+    glm::vec3 sceneMax(-FLT_MAX);
+    for (const BakeScene::MeshData& mesh : scene.meshes) {
+        glm::vec3 lo(FLT_MAX);
+        glm::vec3 hi(-FLT_MAX);
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            glm::vec3 a = mesh.positions[mesh.indices[i]];
+            glm::vec3 b = mesh.positions[mesh.indices[i + 1]];
+            glm::vec3 c = mesh.positions[mesh.indices[i + 2]];
+            triangles.insert(triangles.end(), { a, b, c });
+            triangleMin.push_back(glm::min(glm::min(a, b), c));
+            triangleMax.push_back(glm::max(glm::max(a, b), c));
+            lo = glm::min(lo, triangleMin.back());
+            hi = glm::max(hi, triangleMax.back());
+        }
+        meshMin.push_back(lo);
+        meshMax.push_back(hi);
+        sceneMin = glm::min(sceneMin, lo);
+        sceneMax = glm::max(sceneMax, hi);
+    }
+    
+    // builds
+    Bvh triangleTree;
+    triangleTree.build(triangleMin, triangleMax, false);
+    double serialMs = triangleTree.buildMs();
+    triangleTree.build(triangleMin, triangleMax, true);
+    std::cout << triangleMin.size() << " triangles: " << triangleTree.nodes().size() << " nodes, serial build "
+              << serialMs << " ms, parallel build " << triangleTree.buildMs() << " ms on "
+              << ThreadPool::instance().threadCount() << " threads" << std::endl;
+    Bvh meshTree;
+    meshTree.build(meshMin, meshMax);
+    double refitMs = timeMs([&]() { meshTree.refit(meshMin, meshMax); });
+    std::cout << meshMin.size() << " meshes: " << meshTree.nodes().size() << " nodes, build " << meshTree.buildMs()
+              << " ms, refit " << refitMs << " ms" << std::endl;
+    
+    // closest hit rays between random points in the scene, on one thread and on all of them
+    RayTracer tracer;
+    tracer.build(triangles);
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    auto randomPoint = [&]() {
+        return sceneMin + (sceneMax - sceneMin) * glm::vec3(unit(random), unit(random), unit(random));
+    };
+    std::vector<glm::vec3> origins(queries);
+    std::vector<glm::vec3> directions(queries);
+    for (size_t i = 0; i < queries; i++) {
+        origins[i] = randomPoint();
+        directions[i] = glm::normalize(randomPoint() - origins[i] + glm::vec3(1.0e-4f));
+    }
+    float sceneSize = glm::length(sceneMax - sceneMin);
+    size_t hits = 0;
+    double singleMs = timeMs([&]() {
+        for (size_t i = 0; i < queries; i++) {
+            RayTracer::Hit hit;
+            hits += tracer.intersect(origins[i], directions[i], sceneSize, hit) ? 1 : 0;
+        }
+    });
+    double parallelMs = timeMs([&]() {
+        ThreadPool::instance().parallelFor(queries, 256, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                RayTracer::Hit hit;
+                tracer.intersect(origins[i], directions[i], sceneSize, hit);
+            }
+        });
+    });
+    std::cout << "rays: " << queries / std::max(singleMs, 1.0e-3) / 1000.0 << " M/s on one thread, "
+              << queries / std::max(parallelMs, 1.0e-3) / 1000.0 << " M/s on all, " << hits << " hits" << std::endl;
+    
+    // mesh frustum and overlap queries against the flat lists they replace
+    BoxList boxes;
+    boxes.resize(meshMin.size());
+    for (size_t i = 0; i < meshMin.size(); i++) {
+        boxes.set(i, meshMin[i], meshMax[i]);
+    }
+    std::vector<unsigned char> visible(meshMin.size());
+    std::vector<unsigned int> items;
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), static_cast<float>(SCR_WIDTH) / SCR_HEIGHT, 0.1f, 5000.0f);
+    double flatMs = 0.0;
+    double treeMs = 0.0;
+    for (size_t i = 0; i < queries; i++) {
+        glm::vec4 planes[6];
+        extractFrustumPlanes(projection * glm::lookAt(origins[i], origins[i] + directions[i], glm::vec3(0.0f, 1.0f, 0.0f)), planes);
+        flatMs += timeMs([&]() { cullBoxes(planes, boxes, visible.data()); });
+        items.clear();
+        treeMs += timeMs([&]() { meshTree.frustum(planes, items); });
+    }
+    std::cout << "mesh frustum query: flat " << 1000.0 * flatMs / queries << " us, hierarchy "
+              << 1000.0 * treeMs / queries << " us" << std::endl;
+    glm::vec3 queryExtent = (sceneMax - sceneMin) * 0.05f;
+    flatMs = 0.0;
+    treeMs = 0.0;
+    for (size_t i = 0; i < queries; i++) {
+        glm::vec3 lo = origins[i] - queryExtent;
+        glm::vec3 hi = origins[i] + queryExtent;
+        items.clear();
+        flatMs += timeMs([&]() {
+            for (size_t m = 0; m < meshMin.size(); m++) {
+                if (meshMin[m].x <= hi.x && meshMax[m].x >= lo.x && meshMin[m].y <= hi.y && meshMax[m].y >= lo.y &&
+                    meshMin[m].z <= hi.z && meshMax[m].z >= lo.z) {
+                    items.push_back(static_cast<unsigned int>(m));
+                }
+            }
+        });
+        items.clear();
+        treeMs += timeMs([&]() { meshTree.overlap(lo, hi, items); });
+    }
+    std::cout << "mesh box overlap query: flat " << 1000.0 * flatMs / queries << " us, hierarchy "
+              << 1000.0 * treeMs / queries << " us" << std::endl;
+    return true;
+}
+
+// Software occlusion culling from cameras random places in the scene, without a window. Besides
+// timing it checks the culler never hides something visible: rays from the eye to every vertex
+// of an occluded mesh that is in the frustum must hit an opaque triangle first.
+bool runOcclusionBenchmark(size_t cameras) {
+    BakeScene scene;
+    if (!scene.load(MODEL_PATH, sceneModelMatrix())) {
+        return false;
+    }
+    std::vector<glm::vec3> occluders;
+    BoxList boxes;
+    boxes.resize(scene.meshes.size());
+    glm::vec3 sceneMin(FLT_MAX);
+    glm::vec3 sceneMax(-FLT_MAX);
+    for (size_t m = 0; m < scene.meshes.size(); m++) {
+        const BakeScene::MeshData& mesh = scene.meshes[m];
+        glm::vec3 lo(FLT_MAX);
+        glm::vec3 hi(-FLT_MAX);
+        for (const glm::vec3& position : mesh.positions) {
+            lo = glm::min(lo, position);
+            hi = glm::max(hi, position);
+        }
+        boxes.set(m, lo, hi);
+        sceneMin = glm::min(sceneMin, lo);
+        sceneMax = glm::max(sceneMax, hi);
+        // cut out or see through surfaces don't hide what's behind them
+        if (mesh.bucket == MaterialBucket::OPAQUE) {
+            for (unsigned int index : mesh.indices) {
+                occluders.push_back(mesh.positions[index]);
+            }
+        }
+    }
+    OcclusionCuller culler;
+    culler.setOccluders(occluders);
+    RayTracer tracer;
+    tracer.build(occluders);
+    std::cout << occluders.size() / 3 << " opaque triangles, " << culler.occluderTriangles() << " kept as occluders"
+              << std::endl;
+    
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), static_cast<float>(SCR_WIDTH) / SCR_HEIGHT, 0.1f, 5000.0f);
+    std::vector<unsigned char> visible(boxes.size());
+    size_t inFrustum = 0;
+    size_t occluded = 0;
+    size_t wrong = 0;
+    double renderMs = 0.0;
+    double testMs = 0.0;
+    for (size_t c = 0; c < cameras; c++) {
+        // eye height in the lower half of the scene, looking roughly level
+        glm::vec3 eye = sceneMin + (sceneMax - sceneMin) * glm::vec3(unit(random), 0.05f + 0.4f * unit(random), unit(random));
+        float yaw = glm::radians(360.0f * unit(random));
+        float pitch = glm::radians(30.0f * (unit(random) - 0.5f));
+        glm::vec3 front(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch));
+        glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + front, glm::vec3(0.0f, 1.0f, 0.0f));
+        
+        glm::vec4 planes[6];
+        extractFrustumPlanes(viewProjection, planes);
+        inFrustum += cullBoxes(planes, boxes, visible.data());
+        std::vector<unsigned char> frustumVisible = visible;
+        culler.render(viewProjection);
+        occluded += culler.testBoxes(boxes, visible.data());
+        renderMs += culler.renderMs();
+        testMs += culler.testMs();
+        
+        for (size_t m = 0; m < boxes.size(); m++) {
+            if (!frustumVisible[m] || visible[m]) {
+                continue;
+            }
+            for (const glm::vec3& position : scene.meshes[m].positions) {
+                glm::vec4 clip = viewProjection * glm::vec4(position, 1.0f);
+                if (std::abs(clip.x) > clip.w || std::abs(clip.y) > clip.w || std::abs(clip.z) > clip.w) {
+                    continue;
+                }
+                glm::vec3 toVertex = position - eye;
+                float distance = glm::length(toVertex);
+                // stop a little short so the vertex's own triangles don't count
+                if (!tracer.occluded(eye, toVertex / distance, distance * 0.99f)) {
+                    wrong++;
+                    break;
+                }
+            }
+        }
+    }
+    std::cout << cameras << " cameras, " << culler.width() << " x " << culler.height() << " depth buffer on "
+              << ThreadPool::instance().threadCount() << " threads: render " << renderMs / cameras << " ms, test "
+              << testMs / cameras << " ms per frame, " << occluded << " of " << inFrustum
+              << " meshes in the frustum occluded, " << wrong << " occluded meshes had a vertex in view" << std::endl;
+    return true;
+}
+
+// Times the vertex stage on its own: the whole model drawn draws times with rasterization
+// off, with the matrices combined on the CPU and with them rebuilt per vertex as before, so
+// fragment work and fill rate can't hide the difference
+void runVertexBenchmark(Model& model, size_t draws, const std::vector<std::string>& defines) {
+    std::vector<std::string> perVertexDefines = defines;
+    perVertexDefines.push_back("PER_VERTEX_MATRICES");
+    Shader combined((SHADER_DIR + "vertexShader.vert").c_str(), (SHADER_DIR + "fragmentShader.frag").c_str(), defines);
+    Shader perVertex((SHADER_DIR + "vertexShader.vert").c_str(), (SHADER_DIR + "fragmentShader.frag").c_str(),
+                     perVertexDefines);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), static_cast<float>(SCR_WIDTH) / SCR_HEIGHT, 0.1f, 5000.0f);
+    glm::mat4 view = camera.GetViewMatrix();
+    glm::mat4 modelMat = sceneModelMatrix();
+    
+    double ms[2];
+    Shader* programs[2] = { &combined, &perVertex };
+    glEnable(GL_RASTERIZER_DISCARD);
+    for (int i = 0; i < 2; i++) {
+        Shader& program = *programs[i];
+        program.use();
+        program.setMat4("model", modelMat);
+        program.setMat4("view", view);
+        program.setMat4("projection", projection);
+        program.setMat4("mvp", projection * view * modelMat);
+        program.setMat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(modelMat))));
+        GpuTimer timer;
+        for (size_t draw = 0; draw < draws; draw++) {
+            timer.begin();
+            model.draw(program);
+            timer.end();
+        }
+        glFinish();
+        ms[i] = timer.averageMs();
+    }
+    glDisable(GL_RASTERIZER_DISCARD);
+    size_t vertices = 0;
+    for (const Mesh& mesh : model.meshes()) {
+        vertices += mesh.mIndicies.size();
+    }
+    std::cout << "vertex stage, " << vertices << " vertices per draw: " << ms[0]
+              << " ms with matrices from the CPU, " << ms[1] << " ms rebuilt per vertex" << std::endl;
+}
+
 int main(int argc, const char * argv[]) {
     
+    // --cull-benchmark N times light culling on N lights and exits
+    size_t cullBenchmark = argValue(argc, argv, "--cull-benchmark", 0);
+    if (cullBenchmark > 0) {
+        runCullBenchmark(cullBenchmark);
+        return 0;
+    }
+    
+    // --bvh-benchmark N times hierarchy builds and N of each query on the scene and exits
+    size_t bvhBenchmark = argValue(argc, argv, "--bvh-benchmark", 0);
+    if (bvhBenchmark > 0) {
+        return runBvhBenchmark(bvhBenchmark) ? 0 : 1;
+    }
+    
+    // --occlusion-benchmark N times and checks software occlusion culling from N cameras and exits
+    size_t occlusionBenchmark = argValue(argc, argv, "--occlusion-benchmark", 0);
+    if (occlusionBenchmark > 0) {
+        return runOcclusionBenchmark(occlusionBenchmark) ? 0 : 1;
+    }
+    
+    // --pvs N builds potentially visible sets for cells N to the scene's longest side, from
+    // --pvs-rays rays each, and exits. --pvs-validate N checks them from N cameras.
+    size_t pvsCells = argValue(argc, argv, "--pvs", 0);
+    if (pvsCells > 0) {
+        return runPvsBuild(static_cast<int>(pvsCells), static_cast<unsigned int>(argValue(argc, argv, "--pvs-rays", 4096)))
+            ? 0 : 1;
+    }
+    size_t pvsValidation = argValue(argc, argv, "--pvs-validate", 0);
+    if (pvsValidation > 0) {
+        return runPvsValidation(pvsValidation) ? 0 : 1;
+    }
+    
+    // meshes with more than --split-triangles triangles or wider than --split-extent in the
+    // model's own units are split into chunks that are culled on their own, 0 turns either off
+    size_t splitTriangles = argValue(argc, argv, "--split-triangles", 4096);
+    size_t splitExtent = argValue(argc, argv, "--split-extent", 600);
+    
+    // --hlod N builds hlod proxies for clusters N to the scene's longest side with a --hlod-atlas
+    // texels square atlas and exits. Proxies replace their meshes below --hlod-pixels across.
+    size_t hlodCells = argValue(argc, argv, "--hlod", 0);
+    size_t hlodPixels = argValue(argc, argv, "--hlod-pixels", 64);
+    if (hlodCells > 0) {
+        return runHlodBuild(static_cast<int>(hlodCells),
+                            static_cast<unsigned int>(argValue(argc, argv, "--hlod-atlas", 1024)),
+                            static_cast<float>(hlodPixels), splitTriangles, static_cast<float>(splitExtent)) ? 0 : 1;
+    }
+    
+    // --bake N bakes the static lights at N x N texels and exits
+    size_t bakeResolution = argValue(argc, argv, "--bake", 0);
+    if (bakeResolution > 0) {
+        return runBake(static_cast<unsigned int>(bakeResolution)) ? 0 : 1;
+    }
+    // --lighting-scale N starts the deferred path with lighting at 1/N resolution
+    lightingScale = static_cast<int>(argValue(argc, argv, "--lighting-scale", 1));
+    // --baked 1 lights the static lights from the bake instead of evaluating them every frame
+    bakedLighting = argValue(argc, argv, "--baked", 0) != 0;
+    // --sh-ambient 1 takes ambient light from the bake's spherical harmonics probes instead of
+    // every light's ambient term. The lightmap already holds the ambient when --baked is on.
+    bool shAmbient = !bakedLighting && argValue(argc, argv, "--sh-ambient", 0) != 0;
+    // --occlusion-culling 1 starts with occlusion culling on
+    occlusionCulling = argValue(argc, argv, "--occlusion-culling", 0) != 0;
+    // --hiz-culling 1 starts with hi-z occlusion culling on
+    hiZCulling = argValue(argc, argv, "--hiz-culling", 0) != 0;
+    // --query-culling 1 starts with occlusion queries on, 2 with conditional rendering
+    size_t queryMode = argValue(argc, argv, "--query-culling", 0);
+    queryCulling = queryMode != 0;
+    conditionalRendering = queryMode == 2;
+    // --pvs-culling 1 starts with the potentially visible sets from --pvs on
+    pvsCulling = argValue(argc, argv, "--pvs-culling", 0) != 0;
+    // --pvs-check 1 starts with the set checked against the render
+    pvsCheck = argValue(argc, argv, "--pvs-check", 0) != 0;
+    // --detail-culling 1 starts with meshes smaller than --detail-pixels across skipped. Alpha
+    // tested and blended meshes have their own thresholds, 0 keeps all of them.
+    detailCulling = argValue(argc, argv, "--detail-culling", 0) != 0;
+    size_t detailPixels = argValue(argc, argv, "--detail-pixels", 2);
+    size_t alphaTestedDetailPixels = argValue(argc, argv, "--detail-pixels-alpha-tested", detailPixels);
+    size_t blendedDetailPixels = argValue(argc, argv, "--detail-pixels-blended", detailPixels);
+    // --detail-category name=N gives meshes whose material name contains name a threshold of
+    // their own in place of their bucket's, 0 never skips them. It can be given more than once.
+    std::vector<std::pair<std::string, size_t>> detailCategories = argNamedValues(argc, argv, "--detail-category");
+    // --depth-prepass 1 starts with the forward path's depth pre-pass on
+    depthPrepass = argValue(argc, argv, "--depth-prepass", 0) != 0;
+    // --hlod-culling 1 starts with the proxies from --hlod on
+    hlodCulling = argValue(argc, argv, "--hlod-culling", 0) != 0;
+    std::vector<std::string> shaderDefines = { shaderInputsDefine<Vertex>(), "CLUSTERED_LIGHTING", "ATLAS_SHADOWS" };
+    shaderDefines.push_back(bakedLighting ? "BAKED_LIGHTING" : "DIR_SHADOWS");
+    if (shAmbient) {
+        shaderDefines.push_back("SH_AMBIENT");
+    }
+    
     // init GLFW and load OpenGL functions into memory
     GLFWwindow* window = initGLFW();
     if (window == nullptr) {
@@ -150,14 +881,146 @@ int main(int argc, const char * argv[]) {
     }
     
     // initialize our shaders
-    Shader shader("/Users/davanb/Documents/School/Learning/openGLTUT/openGLTUT/vertexShader.vert",
-                  "/Users/davanb/Documents/School/Learning/openGLTUT/openGLTUT/fragmentShader.frag");
+    Shader shader((SHADER_DIR + "vertexShader.vert").c_str(), (SHADER_DIR + "fragmentShader.frag").c_str(),
+                  shaderDefines);
+    
+    // the opaque program above never discards, alpha masked and translucent materials get their own
+    std::vector<std::string> alphaTestDefines = shaderDefines;
+    alphaTestDefines.push_back("ALPHA_TEST");
+    Shader alphaTestShader((SHADER_DIR + "vertexShader.vert").c_str(), (SHADER_DIR + "fragmentShader.frag").c_str(),
+                           alphaTestDefines);
+    std::vector<std::string> blendedDefines = shaderDefines;
+    blendedDefines.push_back("BLENDED");
+    Shader blendedShader((SHADER_DIR + "vertexShader.vert").c_str(), (SHADER_DIR + "fragmentShader.frag").c_str(),
+                         blendedDefines);
+    
+    Shader lampShader((SHADER_DIR + "vertexShader.vert").c_str(), (SHADER_DIR + "lightSourceShader.frag").c_str(),
+                      { shaderInputsDefine<Vertex>() });
+    Shader depthShader((SHADER_DIR + "depthPrepass.vert").c_str(), (SHADER_DIR + "shadowDepth.frag").c_str(),
+                       { shaderInputsDefine<PositionVertex>() });
+    
+    // recompile the shaders whenever their source files are saved
+    shader.enableHotReload();
+    alphaTestShader.enableHotReload();
+    blendedShader.enableHotReload();
+    lampShader.enableHotReload();
+    depthShader.enableHotReload();
+    
+    Model model(MODEL_PATH, splitTriangles, static_cast<float>(splitExtent));
+    // --vertex-benchmark N times N draws of the model's vertex stage both ways and exits
+    size_t vertexBenchmark = argValue(argc, argv, "--vertex-benchmark", 0);
+    if (vertexBenchmark > 0) {
+        runVertexBenchmark(model, vertexBenchmark, shaderDefines);
+        glfwTerminate();
+        return 0;
+    }
+    // the scene never moves, so its opaque triangles are handed to the occlusion culler once
+    OcclusionCuller occlusionCuller;
+    std::vector<glm::vec3> occluders;
+    model.worldTriangles(sceneModelMatrix(), MaterialBucket::OPAQUE, occluders);
+    occlusionCuller.setOccluders(occluders);
+    model.setDetailThreshold(MaterialBucket::OPAQUE, static_cast<float>(detailPixels));
+    model.setDetailThreshold(MaterialBucket::ALPHA_TESTED, static_cast<float>(alphaTestedDetailPixels));
+    model.setDetailThreshold(MaterialBucket::BLENDED, static_cast<float>(blendedDetailPixels));
+    for (const auto& category : detailCategories) {
+        size_t meshes = model.setDetailCategory(category.first, static_cast<float>(category.second));
+        std::cout << "detail category \"" << category.first << "\": " << meshes << " meshes, "
+                  << (category.second > 0 ? std::to_string(category.second) + " pixels" : std::string("never skipped"))
+                  << std::endl;
+    }
     
-    Shader lampShader("/Users/davanb/Documents/School/Learning/openGLTUT/openGLTUT/vertexShader.vert",
-                          "/Users/davanb/Documents/School/Learning/openGLTUT/openGLTUT/lightSourceShader.frag");
+    // loaded on demand by the render loop, from the command line or the first K or J
+    PotentiallyVisibleSets pvs;
+    bool pvsLoaded = false;
+    auto loadPvs = [&]() {
+        pvsLoaded = pvs.load(MODEL_PATH + ".pvs");
+        if (pvsLoaded && pvs.meshCount != model.meshes().size()) {
+            std::cerr << "the pvs doesn't match the model, build it again with --pvs" << std::endl;
+            pvsLoaded = false;
+        }
+        if (!pvsLoaded) {
+            std::cerr << "no usable pvs, run with --pvs 32 first. Potentially visible sets off" << std::endl;
+        }
+        return pvsLoaded;
+    };
+    
+    HlodProxies proxies;
+    auto loadProxies = [&]() {
+        if (!proxies.load(MODEL_PATH + ".hlod", model)) {
+            std::cerr << "no usable hlod proxies, run with --hlod 8 first. Hlod proxies off" << std::endl;
+            return false;
+        }
+        return true;
+    };
     
-//    Model model("/Users/davanb/Documents/School/Learning/nanosuit/nanosuit.obj");
-    Model model("/Users/davanb/Documents/School/Learning/sponza_obj/sponza.obj");
+    BakedLighting baked;
+    if ((bakedLighting || shAmbient) && !baked.load(MODEL_PATH + ".bake", model)) {
+        std::cerr << "no usable bake, run with --bake 2048 first" << std::endl;
+        return 1;
+    }
+    
+    // scene lights
+    DirLight dirLight = sceneDirLight();
+    
+    // baked static lights aren't evaluated at runtime
+    std::vector<PointLight> pointLights;
+    if (!bakedLighting) {
+        pointLights = sceneStaticLights();
+    }
+    size_t firstDynamicLight = pointLights.size();
+    // --lights N adds N small coloured lights through the building as a benchmark scene
+    addBenchmarkLights(pointLights, argValue(argc, argv, "--lights", 0));
+    
+    SpotLight spotLight = { camera.mPosition, camera.mFront,
+                            glm::cos(glm::radians(12.5f)), glm::cos(glm::radians(15.0f)),
+                            { 1.0f, 0.09f, 0.032f },
+                            { glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(1.0f) } };
+    
+    // only the lights that survive frustum culling are handed to the renderers
+    LightManager lights;
+    for (const PointLight& light : pointLights) {
+        lights.addPointLight(light);
+    }
+    size_t flashlight = lights.addSpotLight(spotLight);
+    
+    ClusteredLighting clusters;
+    
+    int framebufferWidth;
+    int framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    DeferredRenderer deferred(SHADER_DIR, framebufferWidth, framebufferHeight);
+    deferred.enableHotReload();
+    
+    // --cascades N picks the number of shadow cascades, --stagger-cascades 1 updates the distant
+    // ones every other frame, --shadow-cache 0 re-renders static casters every frame
+    CascadedShadowMap shadows(SHADER_DIR, static_cast<unsigned int>(argValue(argc, argv, "--cascades", 4)));
+    shadows.setStaggerDistantCascades(argValue(argc, argv, "--stagger-cascades", 0) != 0);
+    shadows.setCacheStatic(argValue(argc, argv, "--shadow-cache", 1) != 0);
+    shadows.enableHotReload();
+    
+    // point and spot light shadows, tiles for the visible lights are found every frame
+    ShadowAtlas atlas(SHADER_DIR);
+    atlas.enableHotReload();
+    HiZCuller hiZ(SHADER_DIR);
+    hiZ.enableHotReload();
+    // --query-triangles N queries meshes of at least N triangles
+    OcclusionQueries queries(SHADER_DIR, argValue(argc, argv, "--query-triangles", 2048));
+    queries.enableHotReload();
+    PvsValidator pvsValidator(SHADER_DIR);
+    pvsValidator.enableHotReload();
+    std::vector<int> pointShadowTiles;
+    
+    GpuTimer frameTimer;
+    // samples written by the forward path per material bucket
+    SampleCounter forwardBucketSamples[MATERIAL_BUCKET_COUNT];
+    // last reported deferred frame time at each lighting scale, for side by side numbers
+    double lightingScaleMs[3] = { 0.0, 0.0, 0.0 };
+    int timedLightingScale = lightingScale;
+    // last average forward frame without and with the depth pre-pass
+    double prepassMs[2] = { 0.0, 0.0 };
+    bool timedDepthPrepass = depthPrepass;
+    float lastTimingReport = 0.0f;
+    unsigned int framesSinceReport = 0;
     
     // render loop
     while (!glfwWindowShouldClose(window)) {
@@ -168,59 +1031,299 @@ int main(int argc, const char * argv[]) {
         // check if esc key was pressed
         processInput(window);
         
+        // pick up any shader edits, this is a single atomic load when nothing changed
+        shader.reloadIfChanged();
+        alphaTestShader.reloadIfChanged();
+        blendedShader.reloadIfChanged();
+        lampShader.reloadIfChanged();
+        depthShader.reloadIfChanged();
+        deferred.reloadIfChanged();
+        shadows.reloadIfChanged();
+        atlas.reloadIfChanged();
+        hiZ.reloadIfChanged();
+        queries.reloadIfChanged();
+        pvsValidator.reloadIfChanged();
+        
         // clear whatever colour was currently displayed
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
-        shader.use();
-        shader.setFloat("alpha", currentAlpha);
-        shader.setVec3("viewPos", camera.mPosition);
-        shader.setFloat("material.shininess", 32.0f);
-        
-        shader.setVec3("dirLight.direction", glm::vec3(-0.2f, -1.0f, -0.3f));
-        shader.setVec3("dirLight.lightProp.ambient", glm::vec3(0.05f, 0.05f, 0.05f));
-        shader.setVec3("dirLight.lightProp.diffuse", glm::vec3(0.4f, 0.4f, 0.4f));
-        shader.setVec3("dirLight.lightProp.specular", glm::vec3(0.5f, 0.5f, 0.5f));
-        
-        shader.setVec3("pointLights[0].position", glm::vec3( 0.7f,  0.2f,  2.0f));
-        shader.setVec3("pointLights[0].lightProp.ambient", glm::vec3(0.05f, 0.05f, 0.05f));
-        shader.setVec3("pointLights[0].lightProp.diffuse", glm::vec3(0.8f, 0.8f, 0.8f));
-        shader.setVec3("pointLights[0].lightProp.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-        shader.setFloat("pointLights[0].attenuation.constant", 1.0f);
-        shader.setFloat("pointLights[0].attenuation.linear", 0.09);
-        shader.setFloat("pointLights[0].attenuation.quadratic", 0.032);
-        
-        shader.setVec3("pointLights[1].position", glm::vec3( 2.3f, -3.3f, -4.0f));
-        shader.setVec3("pointLights[1].lightProp.ambient", glm::vec3(0.05f, 0.05f, 0.05f));
-        shader.setVec3("pointLights[1].lightProp.diffuse", glm::vec3(0.8f, 0.8f, 0.8f));
-        shader.setVec3("pointLights[1].lightProp.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-        shader.setFloat("pointLights[1].attenuation.constant", 1.0f);
-        shader.setFloat("pointLights[1].attenuation.linear", 0.09);
-        shader.setFloat("pointLights[1].attenuation.quadratic", 0.032);
-        
-        shader.setVec3("spotLight.position", camera.mPosition);
-        shader.setVec3("spotLight.direction", camera.mFront);
-        shader.setVec3("spotLight.lightProp.ambient", glm::vec3(0.0f, 0.0f, 0.0f));
-        shader.setVec3("spotLight.lightProp.diffuse", glm::vec3(1.0f, 1.0f, 1.0f));
-        shader.setVec3("spotLight.lightProp.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-        shader.setFloat("spotLight.attenuation.constant", 1.0f);
-        shader.setFloat("spotLight.attenuation.linear", 0.09);
-        shader.setFloat("spotLight.attenuation.quadratic", 0.032);
-        shader.setFloat("spotLight.cutoff", glm::cos(glm::radians(12.5f)));
-        shader.setFloat("spotLight.outerCutoff", glm::cos(glm::radians(15.0f)));
-
         glm::mat4 projection = glm::perspective<float>(camera.mZoom,
                                                        static_cast<float>(SCR_WIDTH) / static_cast<float>(SCR_HEIGHT),
                                                        0.1f, 5000.0f);
-        shader.setMat4("projection", projection);
         glm::mat4 view = camera.GetViewMatrix();
-        shader.setMat4("view", view);
+        glm::mat4 modelMat = sceneModelMatrix();
+        
+        lights.setSpotTransform(flashlight, camera.mPosition, camera.mFront);
+        const SpotLight& spotLight = lights.spotLights()[flashlight];
+        
+        // bob the benchmark lights so their clusters change every frame
+        for (size_t i = firstDynamicLight; i < pointLights.size(); i++) {
+            glm::vec3 position = pointLights[i].position;
+            position.y += 2.0f * std::sin(currentFrame + i);
+            lights.setPointPosition(i, position);
+        }
+        lights.cull(projection * view);
+        // meshes outside the view aren't drawn by either path, the shadow passes ignore this.
+        // Sizes on screen are measured against the framebuffer as it is now, it changes with the
+        // window and on high DPI displays isn't SCR_HEIGHT to begin with.
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        model.setViewportHeight(static_cast<float>(framebufferHeight));
+        model.setDetailCulling(detailCulling);
+        if (pvsCulling && !pvsLoaded && !loadPvs()) {
+            pvsCulling = false;
+        }
+        if (hlodCulling && !proxies.loaded() && !loadProxies()) {
+            hlodCulling = false;
+        }
+        model.setProxyThreshold(hlodCulling && proxies.loaded() ? static_cast<float>(hlodPixels) : 0.0f);
+        model.cull(projection * view, modelMat, pvsCulling && pvsLoaded ? pvs.visibleFrom(camera.mPosition) : nullptr);
+        if (occlusionCulling) {
+            occlusionCuller.render(projection * view);
+            model.cullOccluded(occlusionCuller);
+        }
+        // first phase, what last frame's depth hides. The render paths give the rest a second
+        // chance against this frame's depth
+        if (hiZCulling) {
+            model.cullOccluded(hiZ);
+        }
+        // whatever query results came in since last frame, queries still running don't hold it up
+        queries.setConditional(conditionalRendering);
+        if (queryCulling) {
+            queries.collect();
+            model.cullOccluded(queries);
+        }
+        model.setDrawConditions(queryCulling && conditionalRendering ? queries.conditions() : std::vector<unsigned int>());
+        const std::vector<PointLight>& visibleLights = lights.visiblePointLights();
         
-        // render model
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, glm::vec3(0.0, -1.75f, 0.0f));
-        modelMat = glm::scale(modelMat, glm::vec3(0.2f, 0.2f, 0.2f));
-        shader.setMat4("model" ,modelMat);
-        model.draw(shader);
+        // shadows are timed on their own, GPU timers can't nest
+        // sponza never moves so it is a static caster, nothing in the scene is dynamic yet
+        std::vector<ShadowCaster> staticCasters = { { &model, modelMat } };
+        // the sun's shadows are in the bake already
+        if (!bakedLighting) {
+            shadows.render(staticCasters, {}, dirLight, view, projection, 0.1f);
+        }
+        atlas.update(lights, staticCasters, view, projection, framebufferHeight);
+        pointShadowTiles.resize(visibleLights.size());
+        for (size_t i = 0; i < visibleLights.size(); i++) {
+            pointShadowTiles[i] = atlas.pointTile(lights.visiblePointIndices()[i]);
+        }
+        int spotShadowTile = atlas.spotTile(flashlight);
+        
+        // don't average frames from two lighting scales or pre-pass modes together
+        if (lightingScale != timedLightingScale || depthPrepass != timedDepthPrepass) {
+            frameTimer.reset();
+            timedLightingScale = lightingScale;
+            timedDepthPrepass = depthPrepass;
+        }
+        
+        frameTimer.begin();
+        if (renderPath == RenderPath::DEFERRED) {
+            deferred.resize(framebufferWidth, framebufferHeight);
+            deferred.setLightingScale(lightingScale);
+            if (compareLighting) {
+                deferred.requestComparison();
+                compareLighting = false;
+            }
+            deferred.render(model, modelMat, view, projection, camera.mPosition, dirLight, spotLight, visibleLights,
+                            shadows, atlas, pointShadowTiles, spotShadowTile, hiZCulling ? &hiZ : nullptr,
+                            queryCulling ? &queries : nullptr);
+        } else {
+            glViewport(0, 0, framebufferWidth, framebufferHeight);
+            clusters.update(visibleLights, view, projection, 0.1f, 5000.0f, pointShadowTiles);
+            
+            // every bucket's program gets the same uniforms
+            auto setUpForward = [&](Shader& program) {
+                program.use();
+                program.setFloat("alpha", currentAlpha);
+                program.setVec3("viewPos", camera.mPosition);
+                program.setFloat("material.shininess", 32.0f);
+                setLight(program, "dirLight", dirLight);
+                setLight(program, "spotLight", spotLight);
+                
+                clusters.bind(program, 10, framebufferWidth, framebufferHeight);
+                if (baked.loaded()) {
+                    baked.bind(program, 8, 9, 7);
+                }
+                if (!bakedLighting) {
+                    shadows.bind(program, 13, view);
+                }
+                atlas.bind(program, 14, 15);
+                program.setInt("spotShadowTile", spotShadowTile);
+                
+                // the vertex shader only gets matrices that are already combined
+                program.setMat4("model" ,modelMat);
+                program.setMat4("mvp", projection * view * modelMat);
+                program.setMat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(modelMat))));
+            };
+            
+            glm::vec3 modelEye = glm::vec3(glm::inverse(modelMat) * glm::vec4(camera.mPosition, 1.0f));
+            if (depthPrepass) {
+                depthShader.use();
+                depthShader.setMat4("mvp", projection * view * modelMat);
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                model.drawDepth(MaterialBucket::OPAQUE, modelEye);
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                // only the nearest surface passes, depth is already there
+                glDepthFunc(GL_EQUAL);
+                glDepthMask(GL_FALSE);
+            }
+            
+            // render model, opaque first so the others are depth tested against it
+            SampleCounter& opaqueSamples = forwardBucketSamples[static_cast<int>(MaterialBucket::OPAQUE)];
+            opaqueSamples.begin();
+            setUpForward(shader);
+            model.draw(shader, MaterialBucket::OPAQUE);
+            opaqueSamples.end();
+            glDepthMask(GL_TRUE);
+            glDepthFunc(GL_LESS);
+            
+            SampleCounter& alphaTestedSamples = forwardBucketSamples[static_cast<int>(MaterialBucket::ALPHA_TESTED)];
+            alphaTestedSamples.begin();
+            if (model.bucketSize(MaterialBucket::ALPHA_TESTED) > 0) {
+                setUpForward(alphaTestShader);
+                model.draw(alphaTestShader, MaterialBucket::ALPHA_TESTED);
+            }
+            alphaTestedSamples.end();
+            
+            // second hi-z phase, draw what this frame's depth shows of the meshes hidden so far
+            if (hiZCulling) {
+                hiZ.build(0, framebufferWidth, framebufferHeight, projection * view);
+                glViewport(0, 0, framebufferWidth, framebufferHeight);
+                if (model.revealOccluded(hiZ) > 0) {
+                    setUpForward(shader);
+                    model.draw(shader, MaterialBucket::OPAQUE);
+                    if (model.bucketSize(MaterialBucket::ALPHA_TESTED) > 0) {
+                        setUpForward(alphaTestShader);
+                        model.draw(alphaTestShader, MaterialBucket::ALPHA_TESTED);
+                    }
+                }
+                model.finishOcclusion();
+            }
+            if (queryCulling) {
+                queries.issue(model, projection * view, camera.mPosition);
+            }
+            
+            // translucent meshes last, back to front, without writing depth
+            SampleCounter& blendedSamples = forwardBucketSamples[static_cast<int>(MaterialBucket::BLENDED)];
+            blendedSamples.begin();
+            if (model.bucketSize(MaterialBucket::BLENDED) > 0) {
+                setUpForward(blendedShader);
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                glDepthMask(GL_FALSE);
+                model.drawBlended(blendedShader, modelEye);
+                glDepthMask(GL_TRUE);
+                glDisable(GL_BLEND);
+            }
+            blendedSamples.end();
+        }
+        frameTimer.end();
+        if (showOccluded) {
+            hiZ.drawBoxes(model.worldBounds(), model.occluded().data(), projection * view, glm::vec3(1.0f, 0.0f, 0.0f));
+        }
+        // after everything that needs the frame's depth, the check replaces it
+        if (pvsCheck && pvsCulling) {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, framebufferWidth, framebufferHeight);
+            pvsValidator.check(model, projection * view * modelMat);
+        }
+        
+        // report the average GPU time of the frame and uniform traffic once a second
+        framesSinceReport++;
+        if (currentFrame - lastTimingReport >= 1.0f) {
+            Shader::UniformStats& stats = Shader::uniformStats();
+            std::cout << (renderPath == RenderPath::FORWARD ? "forward" : "deferred") << " frame: "
+                      << frameTimer.averageMs() << " ms GPU, "
+                      << "light culling: " << lights.cullMs() << " ms CPU, " << visibleLights.size()
+                      << " of " << pointLights.size() << " lights visible, "
+                      << "mesh culling: " << model.cullMs() << " ms CPU, " << model.culledMeshes() << " of "
+                      << model.chunks().size() - model.proxyCount() << " meshes culled, " << model.rejectedMeshes()
+                      << " more outside the pvs, " << model.smallMeshes() << " below the detail threshold ("
+                      << model.smallTriangles() << " triangles), " << model.proxiedMeshes()
+                      << " drawn as hlod proxies, "
+                      << "occlusion culling: " << (occlusionCulling ? occlusionCuller.renderMs() + occlusionCuller.testMs() : 0.0)
+                      << " ms CPU, hi-z test " << (hiZCulling ? hiZ.testMs() : 0.0) << " ms CPU, "
+                      << model.occludedMeshes() << " occluded (" << model.revealedMeshes()
+                      << " revealed by the second hi-z phase), "
+                      << model.drawCalls() << " drawn, "
+                      << "light assignment: " << clusters.assignmentMs() << " ms CPU ("
+                      << clusters.indexCount() << " refs), "
+                      << "uniform uploads per frame: " << stats.issued / framesSinceReport << " issued, "
+                      << stats.skipped / framesSinceReport << " skipped" << std::endl;
+            std::cout << "mesh splitting: " << model.meshes().size() << " meshes as "
+                      << model.chunks().size() - model.proxyCount() << " chunks, " << model.drawnTriangles() << " triangles drawn, "
+                      << model.unsplitTriangles() << " if no mesh were split" << std::endl;
+            if (hlodCulling) {
+                std::cout << "hlod: " << model.proxiesDrawn() << " of " << model.proxyCount()
+                          << " proxies drawn in place of " << model.proxiedMeshes() << " chunks, "
+                          << model.drawCalls() << " draw calls instead of "
+                          << model.drawCalls() + model.proxiedMeshes() - model.proxiesDrawn() << std::endl;
+            }
+            std::cout << "shadow cascades:";
+            for (unsigned int i = 0; i < shadows.cascadeCount(); i++) {
+                std::cout << " [" << i << "] " << shadows.cascadeMs(i) << " ms GPU, "
+                          << shadows.casterDraws(i) << " casters";
+            }
+            std::cout << ", draws per frame: " << shadows.issuedDrawsPerFrame() << " issued, "
+                      << shadows.skippedDrawsPerFrame() << " skipped by the static cache" << std::endl;
+            shadows.resetStats();
+            if (queryCulling) {
+                std::cout << "occlusion queries: " << queries.largeMeshes() << " big meshes, "
+                          << 100.0 * queries.skipRate() << "% of them in view skipped by "
+                          << (conditionalRendering ? "the GPU" : "the CPU") << ", latency "
+                          << queries.latencyFrames() << " frames (" << queries.latencyMs() << " ms), "
+                          << queries.queriesInFlight() << " in flight of " << queries.queryObjects()
+                          << " query objects" << std::endl;
+                queries.resetStats();
+            }
+            if (renderPath == RenderPath::FORWARD) {
+                prepassMs[depthPrepass ? 1 : 0] = frameTimer.averageMs();
+                std::cout << "forward frame without a depth pre-pass " << prepassMs[0] << " ms, with one "
+                          << prepassMs[1] << " ms GPU, " << prepassMs[0] - prepassMs[1] << " ms saved" << std::endl;
+            }
+            if (renderPath == RenderPath::DEFERRED) {
+                int scaleIndex = lightingScale == 1 ? 0 : (lightingScale == 2 ? 1 : 2);
+                lightingScaleMs[scaleIndex] = frameTimer.averageMs();
+                std::cout << "deferred frame by lighting resolution: full " << lightingScaleMs[0] << " ms, half "
+                          << lightingScaleMs[1] << " ms, quarter " << lightingScaleMs[2] << " ms GPU" << std::endl;
+            }
+            // share of the scene's shaded samples each bucket wrote, the opaque program keeps early
+            // depth rejection so its share should dominate
+            double bucketSamples[MATERIAL_BUCKET_COUNT];
+            double totalSamples = 0.0;
+            for (int i = 0; i < MATERIAL_BUCKET_COUNT; i++) {
+                SampleCounter& counter = renderPath == RenderPath::FORWARD
+                    ? forwardBucketSamples[i] : deferred.bucketSamples(static_cast<MaterialBucket>(i));
+                bucketSamples[i] = counter.average();
+                totalSamples += bucketSamples[i];
+                counter.reset();
+            }
+            totalSamples = std::max(totalSamples, 1.0);
+            std::cout << "samples written per frame: opaque " << bucketSamples[0] << " ("
+                      << 100.0 * bucketSamples[0] / totalSamples << "%), alpha tested " << bucketSamples[1] << " ("
+                      << 100.0 * bucketSamples[1] / totalSamples << "%), blended " << bucketSamples[2] << " ("
+                      << 100.0 * bucketSamples[2] / totalSamples << "%)" << std::endl;
+            std::cout << "shadow atlas: " << atlas.shadowedLights() << " lights, "
+                      << atlas.occupancy() * 100.0f << "% occupied, " << atlas.tilesRendered() << " tiles rendered, "
+                      << atlas.tilesReused() << " reused, " << atlas.casterDraws() << " caster draws, "
+                      << atlas.evictions() << " evictions" << std::endl;
+            if (pvsCheck && pvsCulling) {
+                std::cout << "pvs check: " << pvsValidator.missingChunks() << " of " << pvsValidator.testedChunks()
+                          << " chunks outside the pvs visible over " << pvsValidator.frames() << " frames, "
+                          << pvsValidator.missingSamples() << " samples";
+                if (pvsValidator.missingChunks() > 0) {
+                    std::cout << ", worst mesh " << pvsValidator.worstMesh() << " with "
+                              << pvsValidator.worstSamples() << " samples in a frame";
+                }
+                std::cout << std::endl;
+            }
+            pvsValidator.reset();
+            frameTimer.reset();
+            stats.issued = 0;
+            stats.skipped = 0;
+            framesSinceReport = 0;
+            lastTimingReport = currentFrame;
+        }
         
         // poll events and swap buffers
         glfwPollEvents();
@@ -0,0 +1,42 @@
+//
+//  materialBucket.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-30.
+//
+
+#ifndef materialBucket_h
+#define materialBucket_h
+
+#include <cstddef>
+
+// how a mesh's material treats the alpha channel of its diffuse texture. Each bucket is drawn
+// with its own program so only the alpha tested one has a discard that turns off early depth
+// rejection.
+enum class MaterialBucket {
+    OPAQUE,
+    ALPHA_TESTED,
+    BLENDED
+};
+const int MATERIAL_BUCKET_COUNT = 3;
+
+// Looks at every texel's alpha. Masks such as leaves and chains are almost all fully in or
+// fully out with a soft fringe, translucent textures have most of their cut texels in between.
+inline MaterialBucket classifyAlpha(const unsigned char* rgba, int width, int height) {
+    size_t texels = static_cast<size_t>(width) * height;
+    size_t cut = 0;
+    size_t partial = 0;
+    for (size_t i = 0; i < texels; i++) {
+        unsigned char alpha = rgba[4 * i + 3];
+        if (alpha < 250) {
+            cut++;
+            partial += alpha > 10 ? 1 : 0;
+        }
+    }
+    if (cut == 0) {
+        return MaterialBucket::OPAQUE;
+    }
+    return partial * 2 > cut ? MaterialBucket::BLENDED : MaterialBucket::ALPHA_TESTED;
+}
+
+#endif /* materialBucket_h */
@@ -14,6 +14,8 @@
 #include <glad/glad.h>
 
 #include "shader.h"
+#include "vertexLayout.h"
+#include "materialBucket.h"
 
 // GLM
 #include <glm/glm.hpp>
@@ -31,6 +33,38 @@ struct Vertex {
     glm::vec2 texCoords;
     glm::vec3 tangent;
     glm::vec3 bitangent;
+    // coordinates into the baked lightmap, -1 when the vertex has none
+    glm::vec2 lightmapCoords;
+};
+
+template <>
+struct VertexFormat<Vertex> {
+    typedef VertexLayout<Vertex,
+        VertexAttribute<0, glm::vec3, offsetof(Vertex, position)>,
+        VertexAttribute<1, glm::vec3, offsetof(Vertex, normal)>,
+        VertexAttribute<2, glm::vec2, offsetof(Vertex, texCoords)>,
+        VertexAttribute<3, glm::vec3, offsetof(Vertex, tangent)>,
+        VertexAttribute<4, glm::vec3, offsetof(Vertex, bitangent)>,
+        VertexAttribute<5, glm::vec2, offsetof(Vertex, lightmapCoords)>> Layout;
+    
+    static std::string shaderInputs() {
+        return Layout::shaderInputs({ "aPos", "aNormal", "aTexCoods", "aTangent", "aBitangent", "aLightmapCoords" });
+    }
+};
+
+// position only vertices for passes that don't shade, e.g. depth and shadow passes
+struct PositionVertex {
+    glm::vec3 position;
+};
+
+template <>
+struct VertexFormat<PositionVertex> {
+    typedef VertexLayout<PositionVertex,
+        VertexAttribute<0, glm::vec3, offsetof(PositionVertex, position)>> Layout;
+    
+    static std::string shaderInputs() {
+        return Layout::shaderInputs({ "aPos" });
+    }
 };
 
 struct Texture {
@@ -39,15 +73,36 @@ struct Texture {
     std::string path;
 };
 
-class Mesh {
+// A mesh built from any vertex struct that has a VertexFormat specialisation.
+template <typename VertexType>
+class BasicMesh {
 public:
-    std::vector<Vertex> mVerticies;
+    typedef typename VertexFormat<VertexType>::Layout Layout;
+    
+    std::vector<VertexType> mVerticies;
     std::vector<unsigned int> mIndicies;
     std::vector<Texture> mTextures;
     
-    Mesh(const std::vector<Vertex>& verticies, const std::vector<unsigned int>& indicies,
-         const std::vector<Texture>& textures)
-        : mVerticies(verticies), mIndicies(indicies), mTextures(textures) {
+    // object space bounding box
+    glm::vec3 mBoundsMin;
+    glm::vec3 mBoundsMax;
+    
+    MaterialBucket mBucket;
+    
+    BasicMesh(const std::vector<VertexType>& verticies, const std::vector<unsigned int>& indicies,
+         const std::vector<Texture>& textures, MaterialBucket bucket = MaterialBucket::OPAQUE)
+        : mVerticies(verticies), mIndicies(indicies), mTextures(textures),
+          mBoundsMin(0.0f), mBoundsMax(0.0f), mBucket(bucket) {
+        calcBounds();
+        setUpMesh();
+    }
+    
+    // for loaders that found the bounds while converting the vertices
+    BasicMesh(const std::vector<VertexType>& verticies, const std::vector<unsigned int>& indicies,
+         const std::vector<Texture>& textures, MaterialBucket bucket, const glm::vec3& boundsMin,
+         const glm::vec3& boundsMax)
+        : mVerticies(verticies), mIndicies(indicies), mTextures(textures),
+          mBoundsMin(boundsMin), mBoundsMax(boundsMax), mBucket(bucket) {
         setUpMesh();
     }
     
@@ -56,6 +111,11 @@ public:
     }
     
     void draw(const Shader& shader) const {
+        draw(shader, 0, mIndicies.size());
+    }
+    
+    // only indexCount indices from firstIndex, e.g. one MeshChunk
+    void draw(const Shader& shader, size_t firstIndex, size_t indexCount) const {
         unsigned int diffuseNbr = 1;
         unsigned int specularNbr = 1;
         unsigned int normalNbr = 1;
@@ -93,14 +153,53 @@ public:
                 name = textureHeight;
             }
             
-            shader.setFloat(("material." + name + number).c_str(), i);
+            shader.setInt("material." + name + number, static_cast<int>(i));
             glBindTexture(GL_TEXTURE_2D, mTextures[i].id);
         }
         glActiveTexture(GL_TEXTURE0);
         
         // draw mesh
         glBindVertexArray(mVao);
-        glDrawElements(GL_TRIANGLES, mIndicies.size(), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indexCount), GL_UNSIGNED_INT,
+                       (void*)(firstIndex * sizeof(unsigned int)));
+        glBindVertexArray(0);
+    }
+    
+    // upload mVerticies again after they were edited in place, positions must not change
+    void updateVertices() const {
+        glBindBuffer(GL_ARRAY_BUFFER, mVbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, mVerticies.size() * sizeof(VertexType), &mVerticies[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    
+    // upload mVerticies and mIndicies again after vertices were appended or indices rewritten,
+    // vertices already there must not move
+    void updateGeometry() const {
+        glBindVertexArray(mVao);
+        glBindBuffer(GL_ARRAY_BUFFER, mVbo);
+        glBufferData(GL_ARRAY_BUFFER, mVerticies.size() * sizeof(VertexType), &mVerticies[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEbo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndicies.size() * sizeof(unsigned int), &mIndicies[0], GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        
+        std::vector<PositionVertex> positions(mVerticies.size());
+        for (size_t i = 0; i < mVerticies.size(); i++) {
+            positions[i].position = mVerticies[i].position;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, mPositionVbo);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(PositionVertex), &positions[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    
+    // draw from the position only stream, for depth and shadow passes that bind no material
+    void drawPositions() const {
+        drawPositions(0, mIndicies.size());
+    }
+    
+    void drawPositions(size_t firstIndex, size_t indexCount) const {
+        glBindVertexArray(mPositionVao);
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indexCount), GL_UNSIGNED_INT,
+                       (void*)(firstIndex * sizeof(unsigned int)));
         glBindVertexArray(0);
     }
     
@@ -108,6 +207,20 @@ private:
     unsigned int mVao;
     unsigned int mVbo;
     unsigned int mEbo;
+    unsigned int mPositionVao;
+    unsigned int mPositionVbo;
+    
+    void calcBounds() {
+        if (mVerticies.empty()) {
+            return;
+        }
+        mBoundsMin = mVerticies[0].position;
+        mBoundsMax = mVerticies[0].position;
+        for (const VertexType& vertex : mVerticies) {
+            mBoundsMin = glm::min(mBoundsMin, vertex.position);
+            mBoundsMax = glm::max(mBoundsMax, vertex.position);
+        }
+    }
     
     void setUpMesh() {
         glGenVertexArrays(1, &mVao);
@@ -117,30 +230,32 @@ private:
         glBindVertexArray(mVao);
         glBindBuffer(GL_ARRAY_BUFFER, mVbo);
         
-        glBufferData(GL_ARRAY_BUFFER, mVerticies.size() * sizeof(Vertex), &mVerticies[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, mVerticies.size() * sizeof(VertexType), &mVerticies[0], GL_STATIC_DRAW);
         
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEbo);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndicies.size() * sizeof(unsigned int), &mIndicies[0], GL_STATIC_DRAW);
         
-        // vertex positions
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        glEnableVertexAttribArray(0);
-        // vertex normals
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-        glEnableVertexAttribArray(1);
-        // vertex texture coordinates
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoords));
-        glEnableVertexAttribArray(2);
-        // vertex tangents
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tangent));
-        glEnableVertexAttribArray(3);
-        // vertex bitangent
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, bitangent));
-        glEnableVertexAttribArray(4);
+        // vertex attributes, generated from the layout
+        Layout::enable();
+        
+        // a second, tightly packed copy of just the positions so depth only passes fetch
+        // 12 bytes per vertex instead of the whole vertex. It shares the index buffer.
+        std::vector<PositionVertex> positions(mVerticies.size());
+        for (size_t i = 0; i < mVerticies.size(); i++) {
+            positions[i].position = mVerticies[i].position;
+        }
+        glGenVertexArrays(1, &mPositionVao);
+        glGenBuffers(1, &mPositionVbo);
+        glBindVertexArray(mPositionVao);
+        glBindBuffer(GL_ARRAY_BUFFER, mPositionVbo);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(PositionVertex), &positions[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEbo);
+        VertexFormat<PositionVertex>::Layout::enable();
         
         glBindVertexArray(0);
     }
 };
 
+typedef BasicMesh<Vertex> Mesh;
 
 #endif /* mesh_h */
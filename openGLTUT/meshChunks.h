@@ -0,0 +1,105 @@
+//
+//  meshChunks.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-08-02.
+//
+
+#ifndef meshChunks_h
+#define meshChunks_h
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cfloat>
+
+// A piece of a mesh that is culled and drawn on its own: indexCount indices from firstIndex
+// in the mesh's index buffer, with the object space bounds of the triangles they make.
+struct MeshChunk {
+    size_t mesh;
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+// Reorders the triangles in indices so spatially close ones are next to each other and cuts
+// them into chunks of mesh meshIndex with at most maxTriangles each and at most maxExtent
+// across on every axis, 0 means no limit. A range over the limits is halved at the median
+// centroid along its longest axis, like building a k-d tree whose leaves are the chunks.
+// Ranges whose centroids all coincide can't be halved and are kept whole.
+template <typename VertexType>
+std::vector<MeshChunk> splitMesh(size_t meshIndex, const std::vector<VertexType>& vertices,
+                                 std::vector<unsigned int>& indices, size_t maxTriangles, float maxExtent) {
+    std::vector<MeshChunk> chunks;
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return chunks;
+    }
+    std::vector<glm::vec3> centroids(triangleCount);
+    std::vector<unsigned int> order(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+        centroids[t] = (vertices[indices[3 * t]].position + vertices[indices[3 * t + 1]].position +
+                        vertices[indices[3 * t + 2]].position) / 3.0f;
+        order[t] = static_cast<unsigned int>(t);
+    }
+
+    // depth first with the lower half on top, so the chunks come out in order along the ranges
+    std::vector<std::pair<size_t, size_t>> stack;
+    stack.push_back(std::make_pair(static_cast<size_t>(0), triangleCount));
+    while (!stack.empty()) {
+        size_t begin = stack.back().first;
+        size_t end = stack.back().second;
+        stack.pop_back();
+
+        glm::vec3 boundsMin(FLT_MAX);
+        glm::vec3 boundsMax(-FLT_MAX);
+        glm::vec3 centroidMin(FLT_MAX);
+        glm::vec3 centroidMax(-FLT_MAX);
+        for (size_t i = begin; i < end; i++) {
+            for (int k = 0; k < 3; k++) {
+                const glm::vec3& position = vertices[indices[3 * order[i] + k]].position;
+                boundsMin = glm::min(boundsMin, position);
+                boundsMax = glm::max(boundsMax, position);
+            }
+            centroidMin = glm::min(centroidMin, centroids[order[i]]);
+            centroidMax = glm::max(centroidMax, centroids[order[i]]);
+        }
+        glm::vec3 extent = boundsMax - boundsMin;
+        glm::vec3 spread = centroidMax - centroidMin;
+        int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+        bool tooMany = maxTriangles > 0 && end - begin > maxTriangles;
+        bool tooBig = maxExtent > 0.0f && std::max(std::max(extent.x, extent.y), extent.z) > maxExtent;
+        if ((!tooMany && !tooBig) || end - begin < 2 || spread[axis] <= 0.0f) {
+            MeshChunk chunk;
+            chunk.mesh = meshIndex;
+            chunk.firstIndex = static_cast<unsigned int>(3 * begin);
+            chunk.indexCount = static_cast<unsigned int>(3 * (end - begin));
+            chunk.boundsMin = boundsMin;
+            chunk.boundsMax = boundsMax;
+            chunks.push_back(chunk);
+            continue;
+        }
+        size_t middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                         [&](unsigned int a, unsigned int b) { return centroids[a][axis] < centroids[b][axis]; });
+        stack.push_back(std::make_pair(middle, end));
+        stack.push_back(std::make_pair(begin, middle));
+    }
+
+    if (chunks.size() > 1) {
+        std::vector<unsigned int> reordered(indices.size());
+        for (size_t i = 0; i < triangleCount; i++) {
+            for (int k = 0; k < 3; k++) {
+                reordered[3 * i + k] = indices[3 * order[i] + k];
+            }
+        }
+        indices.swap(reordered);
+    }
+    return chunks;
+}
+
+#endif /* meshChunks_h */
@@ -14,25 +14,599 @@
 
 #include "shader.h"
 #include "mesh.h"
+#include "meshChunks.h"
+#include "frustum.h"
+#include "bvh.h"
+#include "threadPool.h"
 
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cstdint>
 
 #include "stb_image.h"
 
+// Meshes are culled and drawn as chunks, a mesh bigger than the limits given at load is split
+// into several (see splitMesh()) that share its buffers and material. Everything indexed per
+// mesh below, e.g. visible() and worldBounds(), is indexed by chunk.
+//
+// The draw calls skip meshes that the last cull() found outside the view frustum or too small
+// to matter, or that cullOccluded() found hidden, until then every mesh is drawn. Between
+// revealOccluded() and finishOcclusion() they draw only the meshes revealed. Meshes given a
+// query by setDrawConditions() are drawn conditionally on it, the GPU skips them if it passed
+// no samples. Passes that need meshes outside the view, e.g. shadows, use meshes().
+//
+// Proxies added by addProxy() get a chunk each after the model's own, they are drawn instead of
+// a group of meshes far enough away and culled like any other chunk. Detail culling falls back
+// to them too, see cullSmall().
 class Model {
 public:
-    Model(const std::string& path) {
+    Model(const std::string& path, size_t maxChunkTriangles = 0, float maxChunkExtent = 0.0f)
+        : mMaxChunkTriangles(maxChunkTriangles), mMaxChunkExtent(maxChunkExtent),
+          mCulledModelMat(0.0f), mCulledCount(0), mRejectedCount(0), mOccludedCount(0), mRevealedCount(0), mCullMs(0.0),
+          mDetailCulling(false), mViewportHeight(0.0f), mSmallCount(0), mSmallTriangles(0), mProxyPixels(0.0f),
+          mProxiesDrawn(0), mProxiedCount(0) {
+        std::fill(mDetailPixels, mDetailPixels + MATERIAL_BUCKET_COUNT, 0.0f);
         loadModel(path);
+        mVisible.assign(mChunks.size(), 1);
+        mOccluded.assign(mChunks.size(), 0);
     }
     
     void draw(const Shader& shader) const {
-        for (const Mesh& m : mMeshes) {
-            m.draw(shader);
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            if (mVisible[i]) {
+                drawChunk(i, shader);
+            }
+        }
+    }
+    
+    // only the meshes whose material falls in bucket
+    void draw(const Shader& shader, MaterialBucket bucket) const {
+        for (size_t index : mBuckets[static_cast<int>(bucket)]) {
+            if (mVisible[index]) {
+                drawChunk(index, shader);
+            }
+        }
+    }
+    
+    // the blended bucket, furthest mesh first. eye is the camera position in model space
+    void drawBlended(const Shader& shader, const glm::vec3& eye) const {
+        std::vector<size_t> order;
+        for (size_t index : mBuckets[static_cast<int>(MaterialBucket::BLENDED)]) {
+            if (mVisible[index]) {
+                order.push_back(index);
+            }
+        }
+        std::vector<float> distances(mChunks.size(), 0.0f);
+        for (size_t index : order) {
+            glm::vec3 centre = (mChunks[index].boundsMin + mChunks[index].boundsMax) * 0.5f;
+            distances[index] = glm::dot(centre - eye, centre - eye);
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return distances[a] > distances[b]; });
+        for (size_t index : order) {
+            drawChunk(index, shader);
+        }
+    }
+    
+    // depth only from the position stream, nearest mesh first so later ones fail the depth test
+    // early. eye is the camera position in model space
+    void drawDepth(MaterialBucket bucket, const glm::vec3& eye) const {
+        std::vector<size_t> order;
+        for (size_t index : mBuckets[static_cast<int>(bucket)]) {
+            if (mVisible[index]) {
+                order.push_back(index);
+            }
+        }
+        std::vector<float> distances(mChunks.size(), 0.0f);
+        for (size_t index : order) {
+            glm::vec3 centre = (mChunks[index].boundsMin + mChunks[index].boundsMax) * 0.5f;
+            distances[index] = glm::dot(centre - eye, centre - eye);
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return distances[a] < distances[b]; });
+        for (size_t index : order) {
+            const MeshChunk& chunk = mChunks[index];
+            beginCondition(index);
+            chunkMesh(index).drawPositions(chunk.firstIndex, chunk.indexCount);
+            endCondition(index);
+        }
+    }
+    
+    size_t bucketSize(MaterialBucket bucket) const {
+        return mBuckets[static_cast<int>(bucket)].size();
+    }
+    
+    // Tests every mesh's bounds, placed in the world by modelMat, against the frustum of
+    // viewProjection. World bounds are only recomputed when modelMat changes. Meshes whose
+    // candidates flag is 0, e.g. outside the camera's potentially visible set, are skipped, and
+    // so are the ones smaller on screen than their bucket's detail threshold. candidates are
+    // indexed by the unsplit meshes of meshes(), a proxy is a candidate if any of its meshes is.
+    // Proxies small enough on screen are drawn instead of their meshes.
+    void cull(const glm::mat4& viewProjection, const glm::mat4& modelMat, const unsigned char* candidates = nullptr) {
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        if (modelMat != mCulledModelMat || mWorldBounds.size() != mChunks.size()) {
+            updateWorldBounds(modelMat);
+        }
+        glm::vec4 planes[6];
+        extractFrustumPlanes(viewProjection, planes);
+        if (!mChunks.empty()) {
+            cullBoxes(planes, mWorldBounds, &mVisible[0]);
+        }
+        // only the model's own chunks, proxies come after them and aren't meshes
+        size_t meshChunks = mChunks.size() - mProxyMeshes.size();
+        mCulledCount = meshChunks - static_cast<size_t>(std::count(mVisible.begin(), mVisible.begin() + meshChunks, 1));
+        mRejectedCount = 0;
+        mRejected.assign(mChunks.size(), 0);
+        if (candidates != nullptr) {
+            for (size_t i = 0; i < mChunks.size(); i++) {
+                if (mVisible[i] && !isCandidate(i, candidates)) {
+                    mVisible[i] = 0;
+                    if (i < meshChunks) {
+                        mRejected[i] = 1;
+                        mRejectedCount++;
+                    }
+                }
+            }
+        }
+        swapProxies(viewProjection);
+        cullSmall(viewProjection);
+        mOccludedCount = 0;
+        mRevealedCount = 0;
+        std::fill(mOccluded.begin(), mOccluded.end(), 0);
+        
+        auto end = std::chrono::high_resolution_clock::now();
+        mCullMs = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    
+    // After cull(), also skips the meshes an occlusion culler hides, OcclusionCuller or
+    // HiZCuller. Call it every frame after cull() or not at all.
+    template <typename Culler>
+    void cullOccluded(Culler& culler) {
+        if (mChunks.empty()) {
+            return;
+        }
+        std::vector<unsigned char> before = mVisible;
+        mOccludedCount += culler.testBoxes(mWorldBounds, &mVisible[0]);
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            mOccluded[i] = mOccluded[i] || (before[i] && !mVisible[i]);
+        }
+    }
+    
+    // Second chance for the meshes cullOccluded() hid, against a culler that now knows more,
+    // e.g. a HiZCuller rebuilt from this frame's depth. Until finishOcclusion() only the ones it
+    // finds visible are drawn, returns how many that is.
+    template <typename Culler>
+    size_t revealOccluded(Culler& culler) {
+        mDrawn = mVisible;
+        mVisible = mOccluded;
+        size_t revealed = 0;
+        if (!mChunks.empty()) {
+            size_t candidates = std::count(mOccluded.begin(), mOccluded.end(), 1);
+            revealed = candidates - culler.testBoxes(mWorldBounds, &mVisible[0]);
+        }
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            mOccluded[i] = mOccluded[i] && !mVisible[i];
+        }
+        mOccludedCount -= revealed;
+        mRevealedCount += revealed;
+        return revealed;
+    }
+    
+    // back to drawing everything visible after revealOccluded()
+    void finishOcclusion() {
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            mVisible[i] = mVisible[i] || mDrawn[i];
+        }
+    }
+    
+    // world bounds of the last cull(), which meshes will be drawn and which of them occlusion
+    // culling hid
+    const BoxList& worldBounds() const {
+        return mWorldBounds;
+    }
+    
+    const std::vector<unsigned char>& visible() const {
+        return mVisible;
+    }
+    
+    const std::vector<unsigned char>& occluded() const {
+        return mOccluded;
+    }
+    
+    // a finished GL_ANY_SAMPLES_PASSED query per mesh, or 0 to draw it unconditionally. Empty
+    // turns conditional rendering off.
+    void setDrawConditions(const std::vector<unsigned int>& queries) {
+        mConditions = queries;
+    }
+    
+    // every triangle of the meshes in bucket placed in the world by modelMat, three positions
+    // each, e.g. as occluders. Proxies are left out, their meshes are there already.
+    void worldTriangles(const glm::mat4& modelMat, MaterialBucket bucket, std::vector<glm::vec3>& triangles) const {
+        for (size_t index : mBuckets[static_cast<int>(bucket)]) {
+            const MeshChunk& chunk = mChunks[index];
+            if (chunk.mesh >= mMeshes.size()) {
+                continue;
+            }
+            const Mesh& mesh = mMeshes[chunk.mesh];
+            for (unsigned int i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; i++) {
+                triangles.push_back(glm::vec3(modelMat * glm::vec4(mesh.mVerticies[mesh.mIndicies[i]].position, 1.0f)));
+            }
+        }
+    }
+    
+    // Meshes in bucket whose bounds cover fewer than pixels across on screen are skipped by
+    // cull(), 0 keeps every one of them. The default for meshes in no detail category.
+    void setDetailThreshold(MaterialBucket bucket, float pixels) {
+        mDetailPixels[static_cast<int>(bucket)] = pixels;
+    }
+    
+    // Meshes whose material name contains name are a detail category of their own, with pixels
+    // as their threshold in place of their bucket's, so 0 opts e.g. a landmark out on its own.
+    // A mesh is in the first category it matches, setting a name again only changes its
+    // threshold. Returns how many meshes the category has.
+    size_t setDetailCategory(const std::string& name, float pixels) {
+        size_t category = 0;
+        while (category < mDetailCategories.size() && mDetailCategories[category].name != name) {
+            category++;
+        }
+        if (category == mDetailCategories.size()) {
+            mDetailCategories.push_back({ name, pixels });
+            for (size_t mesh = 0; mesh < mMeshes.size(); mesh++) {
+                if (mMeshCategories[mesh] < 0 && mMaterialNames[mesh].find(name) != std::string::npos) {
+                    mMeshCategories[mesh] = static_cast<int>(category);
+                }
+            }
+        }
+        mDetailCategories[category].pixels = pixels;
+        return static_cast<size_t>(std::count(mMeshCategories.begin(), mMeshCategories.end(),
+                                              static_cast<int>(category)));
+    }
+    
+    void setDetailCulling(bool enabled) {
+        mDetailCulling = enabled;
+    }
+    
+    // height in pixels of the viewport cull() measures meshes on for detail culling and proxies
+    void setViewportHeight(float height) {
+        mViewportHeight = height;
+    }
+    
+    // Adds a simplified mesh that stands in for memberMeshes, indices into meshes(), e.g. from
+    // HlodProxies. It is drawn in their place once it covers fewer than the proxy threshold's
+    // pixels on screen and never otherwise.
+    void addProxy(const Mesh& proxy, const std::vector<size_t>& memberMeshes) {
+        MeshChunk chunk;
+        chunk.mesh = mMeshes.size() + mProxyMeshes.size();
+        chunk.firstIndex = 0;
+        chunk.indexCount = static_cast<unsigned int>(proxy.mIndicies.size());
+        chunk.boundsMin = proxy.mBoundsMin;
+        chunk.boundsMax = proxy.mBoundsMax;
+        mProxyMeshes.push_back(proxy);
+        
+        std::vector<unsigned char> member(mMeshes.size(), 0);
+        for (size_t mesh : memberMeshes) {
+            if (mesh < mMeshes.size()) {
+                member[mesh] = 1;
+            }
+        }
+        std::vector<size_t> memberChunks;
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            if (mChunks[i].mesh < mMeshes.size() && member[mChunks[i].mesh]) {
+                memberChunks.push_back(i);
+            }
         }
+        mProxyChunks.push_back(mChunks.size());
+        mProxyMembers.push_back(memberChunks);
+        mProxyInView.push_back(0);
+        mBuckets[static_cast<int>(proxy.mBucket)].push_back(mChunks.size());
+        mChunks.push_back(chunk);
+        mVisible.push_back(0);
+        mOccluded.push_back(0);
+    }
+    
+    // proxies are drawn below this many pixels across, 0 never draws them
+    void setProxyThreshold(float pixels) {
+        mProxyPixels = pixels;
+    }
+    
+    size_t proxyCount() const {
+        return mProxyMeshes.size();
+    }
+    
+    // proxies the last cull() drew and the chunks they were drawn in place of
+    size_t proxiesDrawn() const {
+        return mProxiesDrawn;
+    }
+    
+    size_t proxiedMeshes() const {
+        return mProxiedCount;
+    }
+    
+    // one per chunk that will be drawn
+    size_t drawCalls() const {
+        return static_cast<size_t>(std::count(mVisible.begin(), mVisible.end(), 1));
+    }
+    
+    // results of the last cull(), cullOccluded() and revealOccluded(). Culled meshes are the
+    // model's own chunks outside the frustum, the ones a proxy stood in for are proxiedMeshes().
+    size_t culledMeshes() const {
+        return mCulledCount;
+    }
+    
+    // meshes in the frustum the candidates of cull() left out
+    size_t rejectedMeshes() const {
+        return mRejectedCount;
+    }
+    
+    // per chunk, 1 for the ones rejectedMeshes() counts
+    const std::vector<unsigned char>& rejected() const {
+        return mRejected;
+    }
+    
+    // meshes in the frustum below their detail threshold and the triangles they had
+    size_t smallMeshes() const {
+        return mSmallCount;
+    }
+    
+    size_t smallTriangles() const {
+        return mSmallTriangles;
+    }
+    
+    size_t occludedMeshes() const {
+        return mOccludedCount;
+    }
+    
+    size_t revealedMeshes() const {
+        return mRevealedCount;
+    }
+    
+    double cullMs() const {
+        return mCullMs;
+    }
+    
+    // hierarchy over the world bounds of the last cull(), items are mesh indices. For picking
+    // and overlap queries, the frustum test itself stays a flat batch test because with a few
+    // hundred meshes that is faster than walking the tree (see --bvh-benchmark)
+    const Bvh& hierarchy() const {
+        return mHierarchy;
+    }
+    
+    // Triangles of the meshes that will be drawn, and how many there would be if no mesh had
+    // been split, i.e. if every mesh with a chunk drawn were drawn whole
+    size_t drawnTriangles() const {
+        size_t triangles = 0;
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            triangles += mVisible[i] ? mChunks[i].indexCount / 3 : 0;
+        }
+        return triangles;
+    }
+    
+    size_t unsplitTriangles() const {
+        std::vector<unsigned char> drawn(mMeshes.size(), 0);
+        size_t triangles = 0;
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            if (mChunks[i].mesh < mMeshes.size()) {
+                drawn[mChunks[i].mesh] |= mVisible[i];
+            }
+            else if (mVisible[i]) {
+                triangles += mChunks[i].indexCount / 3;
+            }
+        }
+        for (size_t m = 0; m < mMeshes.size(); m++) {
+            triangles += drawn[m] ? mMeshes[m].mIndicies.size() / 3 : 0;
+        }
+        return triangles;
+    }
+    
+    // the meshes as loaded, before splitting, without proxies
+    const std::vector<Mesh>& meshes() const {
+        return mMeshes;
+    }
+    
+    const std::vector<MeshChunk>& chunks() const {
+        return mChunks;
+    }
+    
+    // one chunk's positions with the bound program, culled or not, e.g. for checking culling
+    void drawChunkPositions(size_t index) const {
+        const MeshChunk& chunk = mChunks[index];
+        chunkMesh(index).drawPositions(chunk.firstIndex, chunk.indexCount);
+    }
+    
+    // Hand one mesh its baked lightmap coordinates, one per vertex after the mesh's own are
+    // followed by copies of seamSources. indices are the mesh's triangles in load order pointing
+    // at the copies, splitMesh() moved triangles but kept their corners so each one is found by
+    // the vertices its corners copy.
+    void setLightmapCoords(size_t meshIndex, const std::vector<glm::vec2>& coords,
+                           const std::vector<uint32_t>& seamSources, const std::vector<uint32_t>& indices) {
+        Mesh& mesh = mMeshes[meshIndex];
+        size_t ownCount = mesh.mVerticies.size();
+        for (uint32_t source : seamSources) {
+            mesh.mVerticies.push_back(mesh.mVerticies[source]);
+        }
+        for (size_t i = 0; i < mesh.mVerticies.size() && i < coords.size(); i++) {
+            mesh.mVerticies[i].lightmapCoords = coords[i];
+        }
+        if (seamSources.empty()) {
+            mesh.updateVertices();
+            return;
+        }
+        
+        auto own = [&](uint32_t index) {
+            return index < ownCount ? index : seamSources[index - ownCount];
+        };
+        std::unordered_map<TriangleKey, size_t, TriangleHash> baked;
+        baked.reserve(indices.size() / 3);
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            baked.emplace(TriangleKey{ { own(indices[i]), own(indices[i + 1]), own(indices[i + 2]) } }, i);
+        }
+        for (size_t i = 0; i + 2 < mesh.mIndicies.size(); i += 3) {
+            auto it = baked.find(TriangleKey{ { mesh.mIndicies[i], mesh.mIndicies[i + 1], mesh.mIndicies[i + 2] } });
+            if (it != baked.end()) {
+                std::copy(indices.begin() + it->second, indices.begin() + it->second + 3, mesh.mIndicies.begin() + i);
+            }
+        }
+        mesh.updateGeometry();
     }
 private:
+    // a triangle's three vertex indices, corners in order
+    struct TriangleKey {
+        unsigned int v[3];
+        
+        bool operator==(const TriangleKey& other) const {
+            return v[0] == other.v[0] && v[1] == other.v[1] && v[2] == other.v[2];
+        }
+    };
+    
+    struct TriangleHash {
+        size_t operator()(const TriangleKey& key) const {
+            return (static_cast<size_t>(key.v[0]) * 1000003u ^ key.v[1]) * 1000003u ^ key.v[2];
+        }
+    };
+    
+    void drawChunk(size_t index, const Shader& shader) const {
+        const MeshChunk& chunk = mChunks[index];
+        beginCondition(index);
+        chunkMesh(index).draw(shader, chunk.firstIndex, chunk.indexCount);
+        endCondition(index);
+    }
+    
+    // proxies are numbered after the loaded meshes
+    const Mesh& chunkMesh(size_t index) const {
+        size_t mesh = mChunks[index].mesh;
+        return mesh < mMeshes.size() ? mMeshes[mesh] : mProxyMeshes[mesh - mMeshes.size()];
+    }
+    
+    // the chunk's category threshold if its mesh has one, otherwise its bucket's
+    float detailThreshold(size_t index) const {
+        size_t mesh = mChunks[index].mesh;
+        if (mesh < mMeshes.size() && mMeshCategories[mesh] >= 0) {
+            return mDetailCategories[mMeshCategories[mesh]].pixels;
+        }
+        return mDetailPixels[static_cast<int>(chunkMesh(index).mBucket)];
+    }
+    
+    bool isCandidate(size_t index, const unsigned char* candidates) const {
+        size_t mesh = mChunks[index].mesh;
+        if (mesh < mMeshes.size()) {
+            return candidates[mesh] != 0;
+        }
+        for (size_t member : mProxyMembers[mesh - mMeshes.size()]) {
+            if (candidates[mChunks[member].mesh]) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // never waits, a query that hasn't finished draws the mesh
+    void beginCondition(size_t index) const {
+        if (index < mConditions.size() && mConditions[index] != 0) {
+            glBeginConditionalRender(mConditions[index], GL_QUERY_NO_WAIT);
+        }
+    }
+    
+    void endCondition(size_t index) const {
+        if (index < mConditions.size() && mConditions[index] != 0) {
+            glEndConditionalRender();
+        }
+    }
+    
+    // Pixels across the bounding sphere of chunk index covers on screen. The sphere is measured
+    // at its nearest depth, which is never smaller than what it covers. The matrix's w row
+    // gives view depth and the length of its y row the vertical scale of the projection, so
+    // the camera's zoom is taken into account. FLT_MAX when the camera is inside or right
+    // next to it.
+    float projectedSize(size_t index, const glm::mat4& viewProjection) const {
+        glm::vec4 depthRow(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+        glm::vec3 yRow(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]);
+        float pixelsPerUnit = glm::length(yRow) * mViewportHeight * 0.5f;
+        glm::vec3 centre(mWorldBounds.centreX[index], mWorldBounds.centreY[index], mWorldBounds.centreZ[index]);
+        glm::vec3 extent(mWorldBounds.extentX[index], mWorldBounds.extentY[index], mWorldBounds.extentZ[index]);
+        float radius = glm::length(extent);
+        float nearest = glm::dot(depthRow, glm::vec4(centre, 1.0f)) - radius;
+        if (nearest <= 0.0f) {
+            return FLT_MAX;
+        }
+        return 2.0f * radius * pixelsPerUnit / nearest;
+    }
+    
+    // Visible proxies under the proxy threshold hide their visible members, the rest are hidden.
+    // Members out of view or rejected stay hidden either way.
+    void swapProxies(const glm::mat4& viewProjection) {
+        mProxiesDrawn = 0;
+        mProxiedCount = 0;
+        for (size_t p = 0; p < mProxyChunks.size(); p++) {
+            size_t index = mProxyChunks[p];
+            mProxyInView[p] = mVisible[index];
+            if (!mVisible[index]) {
+                continue;
+            }
+            if (mProxyPixels <= 0.0f || mViewportHeight <= 0.0f || projectedSize(index, viewProjection) >= mProxyPixels) {
+                mVisible[index] = 0;
+                continue;
+            }
+            mProxiesDrawn++;
+            for (size_t member : mProxyMembers[p]) {
+                mProxiedCount += mVisible[member];
+                mVisible[member] = 0;
+            }
+        }
+    }
+    
+    // Hides visible meshes whose bounding sphere is smaller than their detail threshold on
+    // screen, their category's or else their bucket's. Meshes have no LOD chain of their own,
+    // the only coarser level is an HLOD proxy, so while proxies are on a proxy in view whose
+    // visible members are all this small is drawn in their place rather than letting the whole
+    // cluster drop out. It can't stand in for some of them, it covers all of them.
+    void cullSmall(const glm::mat4& viewProjection) {
+        mSmallCount = 0;
+        mSmallTriangles = 0;
+        if (!mDetailCulling || mViewportHeight <= 0.0f) {
+            return;
+        }
+        std::vector<unsigned char> small(mChunks.size(), 0);
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            float threshold = detailThreshold(i);
+            if (mVisible[i] && threshold > 0.0f) {
+                small[i] = projectedSize(i, viewProjection) < threshold;
+            }
+        }
+        for (size_t p = 0; p < mProxyChunks.size() && mProxyPixels > 0.0f; p++) {
+            if (mVisible[mProxyChunks[p]] || !mProxyInView[p]) {
+                continue;
+            }
+            size_t shown = 0;
+            bool allSmall = true;
+            for (size_t member : mProxyMembers[p]) {
+                if (mVisible[member]) {
+                    shown++;
+                    allSmall = allSmall && small[member];
+                }
+            }
+            if (shown == 0 || !allSmall) {
+                continue;
+            }
+            mVisible[mProxyChunks[p]] = 1;
+            mProxiesDrawn++;
+            mProxiedCount += shown;
+            for (size_t member : mProxyMembers[p]) {
+                mVisible[member] = 0;
+                small[member] = 0;
+            }
+        }
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            if (small[i]) {
+                mVisible[i] = 0;
+                mSmallCount++;
+                mSmallTriangles += mChunks[i].indexCount / 3;
+            }
+        }
+    }
+    
     void loadModel(const std::string& path) {
         Assimp::Importer importer;
         const aiScene* scene = importer.ReadFile(path,
@@ -45,6 +619,14 @@ private:
         mDirectory = path.substr(0, path.find_last_of('/'));
         
         processNode(scene->mRootNode, scene);
+        
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            mBuckets[static_cast<int>(mMeshes[mChunks[i].mesh].mBucket)].push_back(i);
+        }
+        std::cout << "split " << mMeshes.size() << " meshes into " << mChunks.size() << " chunks, material buckets: "
+                  << bucketSize(MaterialBucket::OPAQUE) << " opaque, "
+                  << bucketSize(MaterialBucket::ALPHA_TESTED) << " alpha tested, "
+                  << bucketSize(MaterialBucket::BLENDED) << " blended chunks" << std::endl;
     }
     
     void processNode(aiNode* node, const aiScene* scene) {
@@ -61,35 +643,52 @@ private:
         }
     }
     
+    // world space boxes around every mesh, an object space box transformed as centre and extent.
+    // The hierarchy is built the first time and refit when the model moves after that.
+    void updateWorldBounds(const glm::mat4& modelMat) {
+        glm::mat3 absolute(glm::abs(glm::vec3(modelMat[0])), glm::abs(glm::vec3(modelMat[1])),
+                           glm::abs(glm::vec3(modelMat[2])));
+        mWorldBounds.resize(mChunks.size());
+        std::vector<glm::vec3> mins(mChunks.size());
+        std::vector<glm::vec3> maxs(mChunks.size());
+        for (size_t i = 0; i < mChunks.size(); i++) {
+            glm::vec3 centre = (mChunks[i].boundsMin + mChunks[i].boundsMax) * 0.5f;
+            glm::vec3 extent = (mChunks[i].boundsMax - mChunks[i].boundsMin) * 0.5f;
+            centre = glm::vec3(modelMat * glm::vec4(centre, 1.0f));
+            extent = absolute * extent;
+            mins[i] = centre - extent;
+            maxs[i] = centre + extent;
+            mWorldBounds.set(i, mins[i], maxs[i]);
+        }
+        if (mHierarchy.itemCount() == mChunks.size() && !mChunks.empty()) {
+            mHierarchy.refit(mins, maxs);
+        } else {
+            mHierarchy.build(mins, maxs);
+        }
+        mCulledModelMat = modelMat;
+    }
+    
     Mesh processMesh(aiMesh* mesh, const aiScene* scene) {
-        std::vector<Vertex> vertices;
+        std::vector<Vertex> vertices(mesh->mNumVertices);
         std::vector<unsigned int> indices;
         std::vector<Texture> textures;
         
-        for(unsigned int i = 0; i < mesh->mNumVertices; i++) {
-            Vertex vertex;
-            // positions
-            glm::vec3 vector(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
-            vertex.position = vector;
-            // normals
-            vector = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
-            vertex.normal = vector;
-            // texture coordinates
-            if (mesh->mTextureCoords[0]) {
-                glm::vec2 vec(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
-                vertex.texCoords = vec;
-            }
-            else {
-                vertex.texCoords = glm::vec2(0.0f, 0.0f);
-            }
-            // tangents
-            vector = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
-            vertex.tangent = vector;
-            // bitangent
-            vector = glm::vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
-            vertex.bitangent = vector;
-            vertices.push_back(vertex);
+        // vertices are converted in chunks across the thread pool, each chunk keeps the bounds
+        // of what it converted so the mesh needs no second pass over its positions
+        const size_t grain = 4096;
+        size_t chunkCount = (vertices.size() + grain - 1) / grain;
+        std::vector<glm::vec3> chunkMin(chunkCount, glm::vec3(FLT_MAX));
+        std::vector<glm::vec3> chunkMax(chunkCount, glm::vec3(-FLT_MAX));
+        ThreadPool::instance().parallelFor(vertices.size(), grain, [&](size_t begin, size_t end) {
+            convertVertices(mesh, vertices, begin, end, chunkMin[begin / grain], chunkMax[begin / grain]);
+        });
+        glm::vec3 boundsMin(vertices.empty() ? 0.0f : FLT_MAX);
+        glm::vec3 boundsMax(vertices.empty() ? 0.0f : -FLT_MAX);
+        for (size_t i = 0; i < chunkCount; i++) {
+            boundsMin = glm::min(boundsMin, chunkMin[i]);
+            boundsMax = glm::max(boundsMax, chunkMax[i]);
         }
+        
         // process each of the meshes faces and get vertex indices
         for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
             aiFace face = mesh->mFaces[i];
@@ -97,6 +696,9 @@ private:
                 indices.push_back(face.mIndices[j]);
             }
         }
+        // reorders indices before they are uploaded, the mesh is pushed next so it gets this index
+        std::vector<MeshChunk> chunks = splitMesh(mMeshes.size(), vertices, indices, mMaxChunkTriangles, mMaxChunkExtent);
+        mChunks.insert(mChunks.end(), chunks.begin(), chunks.end());
         // process material
         // 1. Diffuse maps
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -119,11 +721,63 @@ private:
                                                                  aiTextureType_AMBIENT,
                                                                  TextureType::HEIGHT);
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+        // the name picks the mesh's detail category, if any
+        aiString materialName;
+        material->Get(AI_MATKEY_NAME, materialName);
+        mMaterialNames.push_back(materialName.C_Str());
+        mMeshCategories.push_back(-1);
         
-        return Mesh(vertices, indices, textures);
+        return Mesh(vertices, indices, textures, classifyMaterial(material, diffuseMaps), boundsMin, boundsMax);
         
     }
     
+    // converts vertices [begin, end) of mesh, growing boundsMin and boundsMax around them
+    static void convertVertices(const aiMesh* mesh, std::vector<Vertex>& vertices, size_t begin, size_t end,
+                                glm::vec3& boundsMin, glm::vec3& boundsMax) {
+        for (size_t i = begin; i < end; i++) {
+            Vertex vertex;
+            // positions
+            glm::vec3 vector(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            vertex.position = vector;
+            // normals
+            vector = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+            vertex.normal = vector;
+            // texture coordinates
+            if (mesh->mTextureCoords[0]) {
+                glm::vec2 vec(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
+                vertex.texCoords = vec;
+            }
+            else {
+                vertex.texCoords = glm::vec2(0.0f, 0.0f);
+            }
+            // tangents
+            vector = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+            vertex.tangent = vector;
+            // bitangent
+            vector = glm::vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+            vertex.bitangent = vector;
+            // filled in if a bake is loaded
+            vertex.lightmapCoords = glm::vec2(-1.0f);
+            vertices[i] = vertex;
+            boundsMin = glm::min(boundsMin, vertex.position);
+            boundsMax = glm::max(boundsMax, vertex.position);
+        }
+    }
+    
+    // a material whose opacity is below one blends, otherwise its first diffuse texture decides.
+    // Zero is ignored, some importers read an obj's "Tr 0" as opacity.
+    MaterialBucket classifyMaterial(aiMaterial* material, const std::vector<Texture>& diffuseMaps) const {
+        float opacity = 1.0f;
+        if (material->Get(AI_MATKEY_OPACITY, opacity) == AI_SUCCESS && opacity > 0.0f && opacity < 1.0f) {
+            return MaterialBucket::BLENDED;
+        }
+        if (diffuseMaps.empty()) {
+            return MaterialBucket::OPAQUE;
+        }
+        const auto it = mTextureBuckets.find(diffuseMaps[0].id);
+        return it == mTextureBuckets.end() ? MaterialBucket::OPAQUE : it->second;
+    }
+    
     unsigned int textureFromFile(const char* path, const std::string& directory) {
         std::string fileName = std::string(path);
         fileName = directory + '/' + fileName;
@@ -150,6 +804,7 @@ private:
             }
             else if (nrComponents == 4) {
                 format = GL_RGBA;
+                mTextureBuckets[textureID] = classifyAlpha(data, width, height);
             }
             
             glBindTexture(GL_TEXTURE_2D, textureID);
@@ -196,7 +851,54 @@ private:
     }
 
     std::vector<Mesh> mMeshes;
+    std::vector<MeshChunk> mChunks;
+    size_t mMaxChunkTriangles;
+    float mMaxChunkExtent;
     std::unordered_map<std::string, Texture> mLoadedTextures;
+    // textures with an alpha channel, by texture id
+    std::unordered_map<unsigned int, MaterialBucket> mTextureBuckets;
+    // chunk indices by MaterialBucket
+    std::vector<size_t> mBuckets[MATERIAL_BUCKET_COUNT];
+    
+    // culling, mVisible is 1 for meshes the last cull() and cullOccluded() kept and mOccluded
+    // for the ones occlusion culling hid. mDrawn keeps mVisible while revealOccluded() swaps it.
+    BoxList mWorldBounds;
+    Bvh mHierarchy;
+    glm::mat4 mCulledModelMat;
+    std::vector<unsigned char> mVisible;
+    std::vector<unsigned char> mOccluded;
+    std::vector<unsigned char> mDrawn;
+    std::vector<unsigned int> mConditions;
+    size_t mCulledCount;
+    size_t mRejectedCount;
+    std::vector<unsigned char> mRejected;
+    size_t mOccludedCount;
+    size_t mRevealedCount;
+    double mCullMs;
+    // detail culling, thresholds in pixels by MaterialBucket
+    float mDetailPixels[MATERIAL_BUCKET_COUNT];
+    // named categories that override the bucket thresholds, per loaded mesh its material's name
+    // and index into mDetailCategories, -1 for none
+    struct DetailCategory {
+        std::string name;
+        float pixels;
+    };
+    std::vector<DetailCategory> mDetailCategories;
+    std::vector<std::string> mMaterialNames;
+    std::vector<int> mMeshCategories;
+    bool mDetailCulling;
+    float mViewportHeight;
+    size_t mSmallCount;
+    size_t mSmallTriangles;
+    // HLOD proxies, each with its chunk and the chunks of the meshes it stands in for
+    std::vector<Mesh> mProxyMeshes;
+    std::vector<size_t> mProxyChunks;
+    std::vector<std::vector<size_t>> mProxyMembers;
+    // whether each proxy passed the frustum and candidate tests in the last cull()
+    std::vector<unsigned char> mProxyInView;
+    float mProxyPixels;
+    size_t mProxiesDrawn;
+    size_t mProxiedCount;
     std::string mDirectory;
 };
 
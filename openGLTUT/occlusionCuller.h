@@ -0,0 +1,414 @@
+//
+//  occlusionCuller.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-30.
+//
+
+#ifndef occlusionCuller_h
+#define occlusionCuller_h
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <chrono>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "frustum.h"
+#include "threadPool.h"
+
+// Software occlusion culling, entirely on the CPU.
+// 1. setOccluders() keeps the largest triangles of the geometry that may hide others, up to a
+//    budget. Dropping small triangles only ever makes culling less aggressive, never wrong.
+// 2. render() transforms and clips them against the near plane, bins them into screen tiles
+//    and rasterises every tile as a job of its own into a small depth buffer, four pixels per
+//    SSE2 instruction. Depth is 1 / w, which interpolates linearly in screen space, larger
+//    is nearer and 0 is empty.
+// 3. testBoxes() projects each box and calls it occluded if every pixel under its screen
+//    rectangle holds an occluder nearer than the box's nearest corner.
+// Occluders are drawn double sided, like the renderer draws them.
+class OcclusionCuller {
+public:
+    OcclusionCuller(int width = 256, int height = 128, size_t triangleBudget = 16384)
+        : mWidth(roundUp(std::max(width, 1), TILE_WIDTH)), mHeight(roundUp(std::max(height, 1), TILE_HEIGHT)),
+          mTilesX(mWidth / TILE_WIDTH), mTilesY(mHeight / TILE_HEIGHT), mTriangleBudget(triangleBudget),
+          mDepth(static_cast<size_t>(mWidth) * mHeight, 0.0f), mViewProjection(1.0f),
+          mRasterizedTriangles(0), mRenderMs(0.0), mTestMs(0.0) {
+    }
+
+    // world space occluder triangles, every three positions are one
+    void setOccluders(const std::vector<glm::vec3>& triangles) {
+        size_t count = triangles.size() / 3;
+        std::vector<std::pair<float, size_t>> areas;
+        areas.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            float area = glm::length(glm::cross(triangles[3 * i + 1] - triangles[3 * i],
+                                                triangles[3 * i + 2] - triangles[3 * i]));
+            if (area > 0.0f) {
+                areas.push_back(std::make_pair(area, i));
+            }
+        }
+        if (areas.size() > mTriangleBudget) {
+            std::nth_element(areas.begin(), areas.begin() + mTriangleBudget, areas.end(),
+                             [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) {
+                                 return a.first > b.first;
+                             });
+            areas.resize(mTriangleBudget);
+        }
+        // back in their original order, neighbouring triangles tend to land in the same tiles
+        std::sort(areas.begin(), areas.end(),
+                  [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.second < b.second; });
+        mOccluders.clear();
+        for (const std::pair<float, size_t>& kept : areas) {
+            mOccluders.insert(mOccluders.end(), &triangles[3 * kept.second], &triangles[3 * kept.second] + 3);
+        }
+    }
+
+    // rasterise the occluders as seen through viewProjection
+    void render(const glm::mat4& viewProjection) {
+        auto start = std::chrono::high_resolution_clock::now();
+        mViewProjection = viewProjection;
+        std::fill(mDepth.begin(), mDepth.end(), 0.0f);
+
+        size_t count = mOccluders.size() / 3;
+        mChunks.resize((count + SETUP_GRAIN - 1) / SETUP_GRAIN);
+        ThreadPool::instance().parallelFor(count, SETUP_GRAIN, [&](size_t begin, size_t end) {
+            Chunk& chunk = mChunks[begin / SETUP_GRAIN];
+            chunk.triangles.clear();
+            chunk.bins.resize(mTilesX * mTilesY);
+            for (std::vector<unsigned int>& bin : chunk.bins) {
+                bin.clear();
+            }
+            for (size_t i = begin; i < end; i++) {
+                setUpTriangle(i, chunk);
+            }
+        });
+        mRasterizedTriangles = 0;
+        for (const Chunk& chunk : mChunks) {
+            mRasterizedTriangles += chunk.triangles.size();
+        }
+        ThreadPool::instance().parallelFor(mTilesX * mTilesY, 1, [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; tile++) {
+                rasterizeTile(static_cast<int>(tile));
+            }
+        });
+
+        auto end = std::chrono::high_resolution_clock::now();
+        mRenderMs = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    // true if the box is hidden by the occluders of the last render()
+    bool occluded(const glm::vec3& min, const glm::vec3& max) const {
+        float minX = FLT_MAX;
+        float minY = FLT_MAX;
+        float maxX = -FLT_MAX;
+        float maxY = -FLT_MAX;
+        float nearest = 0.0f;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec4 clip = mViewProjection * glm::vec4((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y,
+                                                         (corner & 4) ? max.z : min.z, 1.0f);
+            // boxes reaching past the near plane are next to the camera
+            if (clip.z + clip.w <= 0.0f || clip.w <= 0.0f) {
+                return false;
+            }
+            float invW = 1.0f / clip.w;
+            glm::vec2 screen = toScreen(clip);
+            minX = std::min(minX, screen.x);
+            minY = std::min(minY, screen.y);
+            maxX = std::max(maxX, screen.x);
+            maxY = std::max(maxY, screen.y);
+            nearest = std::max(nearest, invW);
+        }
+        // Coverage is decided at pixel centres, so a covered pixel can still show the box past an
+        // occluder's edge. Half a pixel more each way reaches the uncovered neighbour in that case.
+        int x0 = std::max(static_cast<int>(std::floor(minX - 0.5f)), 0);
+        int y0 = std::max(static_cast<int>(std::floor(minY - 0.5f)), 0);
+        int x1 = std::min(static_cast<int>(std::floor(maxX + 0.5f)), mWidth - 1);
+        int y1 = std::min(static_cast<int>(std::floor(maxY + 0.5f)), mHeight - 1);
+        if (x0 > x1 || y0 > y1) {
+            // off screen, that's for frustum culling to decide
+            return false;
+        }
+        // whole groups of four are tested, the extra pixels only make this more conservative
+        x0 &= ~3;
+#if defined(__SSE2__)
+        const __m128 boxDepth = _mm_set1_ps(nearest);
+        for (int y = y0; y <= y1; y++) {
+            const float* row = &mDepth[static_cast<size_t>(y) * mWidth];
+            for (int x = x0; x <= x1; x += 4) {
+                if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), boxDepth)) != 0) {
+                    return false;
+                }
+            }
+        }
+#else
+        int xEnd = std::min((x1 | 3), mWidth - 1);
+        for (int y = y0; y <= y1; y++) {
+            const float* row = &mDepth[static_cast<size_t>(y) * mWidth];
+            for (int x = x0; x <= xEnd; x++) {
+                if (row[x] <= nearest) {
+                    return false;
+                }
+            }
+        }
+#endif
+        return true;
+    }
+
+    // Clears visible[i] for every box that is visible going in but occluded, boxes already
+    // hidden aren't tested. Returns the number of boxes it hid.
+    size_t testBoxes(const BoxList& boxes, unsigned char* visible) {
+        auto start = std::chrono::high_resolution_clock::now();
+        const size_t grain = 64;
+        std::vector<size_t> hidden((boxes.size() + grain - 1) / grain, 0);
+        ThreadPool::instance().parallelFor(boxes.size(), grain, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                if (!visible[i]) {
+                    continue;
+                }
+                glm::vec3 centre(boxes.centreX[i], boxes.centreY[i], boxes.centreZ[i]);
+                glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+                if (occluded(centre - extent, centre + extent)) {
+                    visible[i] = 0;
+                    hidden[begin / grain]++;
+                }
+            }
+        });
+        size_t total = 0;
+        for (size_t count : hidden) {
+            total += count;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        mTestMs = std::chrono::duration<double, std::milli>(end - start).count();
+        return total;
+    }
+
+    int width() const {
+        return mWidth;
+    }
+
+    int height() const {
+        return mHeight;
+    }
+
+    // 1 / w of the nearest occluder per pixel, rows from the bottom of the screen up
+    const std::vector<float>& depth() const {
+        return mDepth;
+    }
+
+    size_t occluderTriangles() const {
+        return mOccluders.size() / 3;
+    }
+
+    // triangles the last render() rasterised after clipping
+    size_t rasterizedTriangles() const {
+        return mRasterizedTriangles;
+    }
+
+    // CPU milliseconds of the last render() and testBoxes()
+    double renderMs() const {
+        return mRenderMs;
+    }
+
+    double testMs() const {
+        return mTestMs;
+    }
+
+private:
+    static const int TILE_WIDTH = 32;
+    static const int TILE_HEIGHT = 16;
+    static const size_t SETUP_GRAIN = 1024;
+
+    // a screen space triangle ready to rasterise, inside is where all three edges are >= 0
+    struct Triangle {
+        float edgeA[3];
+        float edgeB[3];
+        float edgeC[3];
+        // depth = depthC + depthA * x + depthB * y
+        float depthA;
+        float depthB;
+        float depthC;
+        int minX;
+        int minY;
+        int maxX;
+        int maxY;
+    };
+
+    // the triangles set up by one job and, per tile, which of them touch it
+    struct Chunk {
+        std::vector<Triangle> triangles;
+        std::vector<std::vector<unsigned int>> bins;
+    };
+
+    int mWidth;
+    int mHeight;
+    int mTilesX;
+    int mTilesY;
+    size_t mTriangleBudget;
+    std::vector<glm::vec3> mOccluders;
+    std::vector<float> mDepth;
+    std::vector<Chunk> mChunks;
+    glm::mat4 mViewProjection;
+    size_t mRasterizedTriangles;
+    double mRenderMs;
+    double mTestMs;
+
+    static int roundUp(int value, int multiple) {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    glm::vec2 toScreen(const glm::vec4& clip) const {
+        return glm::vec2((clip.x / clip.w * 0.5f + 0.5f) * mWidth, (clip.y / clip.w * 0.5f + 0.5f) * mHeight);
+    }
+
+    // clips occluder i against the near plane (z >= -w) and sets up what is left
+    void setUpTriangle(size_t i, Chunk& chunk) const {
+        glm::vec4 clip[3];
+        float distance[3];
+        int inside = 0;
+        for (int k = 0; k < 3; k++) {
+            clip[k] = mViewProjection * glm::vec4(mOccluders[3 * i + k], 1.0f);
+            distance[k] = clip[k].z + clip[k].w;
+            inside += distance[k] >= 0.0f ? 1 : 0;
+        }
+        if (inside == 0) {
+            return;
+        }
+        if (inside == 3) {
+            addTriangle(clip[0], clip[1], clip[2], chunk);
+            return;
+        }
+        glm::vec4 polygon[4];
+        int corners = 0;
+        for (int k = 0; k < 3; k++) {
+            int next = (k + 1) % 3;
+            if (distance[k] >= 0.0f) {
+                polygon[corners++] = clip[k];
+            }
+            if ((distance[k] >= 0.0f) != (distance[next] >= 0.0f)) {
+                float t = distance[k] / (distance[k] - distance[next]);
+                polygon[corners++] = clip[k] + (clip[next] - clip[k]) * t;
+            }
+        }
+        for (int k = 1; k + 1 < corners; k++) {
+            addTriangle(polygon[0], polygon[k], polygon[k + 1], chunk);
+        }
+    }
+
+    void addTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c, Chunk& chunk) const {
+        // right on the near plane w can still be 0
+        if (a.w <= 0.0f || b.w <= 0.0f || c.w <= 0.0f) {
+            return;
+        }
+        glm::vec2 p[3] = { toScreen(a), toScreen(b), toScreen(c) };
+        float z[3] = { 1.0f / a.w, 1.0f / b.w, 1.0f / c.w };
+        float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+        if (std::abs(area) < 1.0e-8f) {
+            return;
+        }
+        // double sided, turn clockwise triangles around
+        if (area < 0.0f) {
+            std::swap(p[1], p[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        Triangle triangle;
+        triangle.minX = std::max(static_cast<int>(std::floor(std::min(std::min(p[0].x, p[1].x), p[2].x))), 0);
+        triangle.minY = std::max(static_cast<int>(std::floor(std::min(std::min(p[0].y, p[1].y), p[2].y))), 0);
+        triangle.maxX = std::min(static_cast<int>(std::ceil(std::max(std::max(p[0].x, p[1].x), p[2].x))), mWidth - 1);
+        triangle.maxY = std::min(static_cast<int>(std::ceil(std::max(std::max(p[0].y, p[1].y), p[2].y))), mHeight - 1);
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+            return;
+        }
+        for (int k = 0; k < 3; k++) {
+            const glm::vec2& from = p[k];
+            const glm::vec2& to = p[(k + 1) % 3];
+            triangle.edgeA[k] = from.y - to.y;
+            triangle.edgeB[k] = to.x - from.x;
+            // in double, vertices far off screen make the two products large and close together
+            triangle.edgeC[k] = static_cast<float>(-(static_cast<double>(triangle.edgeA[k]) * from.x +
+                                                     static_cast<double>(triangle.edgeB[k]) * from.y));
+        }
+        triangle.depthA = ((z[1] - z[0]) * (p[2].y - p[0].y) - (z[2] - z[0]) * (p[1].y - p[0].y)) / area;
+        triangle.depthB = ((z[2] - z[0]) * (p[1].x - p[0].x) - (z[1] - z[0]) * (p[2].x - p[0].x)) / area;
+        triangle.depthC = z[0] - triangle.depthA * p[0].x - triangle.depthB * p[0].y;
+
+        unsigned int index = static_cast<unsigned int>(chunk.triangles.size());
+        chunk.triangles.push_back(triangle);
+        for (int ty = triangle.minY / TILE_HEIGHT; ty <= triangle.maxY / TILE_HEIGHT; ty++) {
+            for (int tx = triangle.minX / TILE_WIDTH; tx <= triangle.maxX / TILE_WIDTH; tx++) {
+                chunk.bins[ty * mTilesX + tx].push_back(index);
+            }
+        }
+    }
+
+    // every triangle binned to the tile, in the order they were set up
+    void rasterizeTile(int tile) {
+        int tileX = (tile % mTilesX) * TILE_WIDTH;
+        int tileY = (tile / mTilesX) * TILE_HEIGHT;
+        for (const Chunk& chunk : mChunks) {
+            for (unsigned int index : chunk.bins[tile]) {
+                const Triangle& triangle = chunk.triangles[index];
+                int x0 = std::max(triangle.minX, tileX) & ~3;
+                int x1 = std::min(triangle.maxX, tileX + TILE_WIDTH - 1);
+                int y0 = std::max(triangle.minY, tileY);
+                int y1 = std::min(triangle.maxY, tileY + TILE_HEIGHT - 1);
+                for (int y = y0; y <= y1; y++) {
+                    rasterizeRow(triangle, y, x0, x1);
+                }
+            }
+        }
+    }
+
+    // pixels x0 to x1 of row y, x0 is a multiple of four
+    void rasterizeRow(const Triangle& triangle, int y, int x0, int x1) {
+        float* row = &mDepth[static_cast<size_t>(y) * mWidth];
+        float py = y + 0.5f;
+#if defined(__SSE2__)
+        __m128 edgeRow[3];
+        __m128 edgeA[3];
+        for (int k = 0; k < 3; k++) {
+            edgeRow[k] = _mm_set1_ps(triangle.edgeB[k] * py + triangle.edgeC[k]);
+            edgeA[k] = _mm_set1_ps(triangle.edgeA[k]);
+        }
+        const __m128 depthRow = _mm_set1_ps(triangle.depthB * py + triangle.depthC);
+        const __m128 depthA = _mm_set1_ps(triangle.depthA);
+        const __m128 zero = _mm_setzero_ps();
+        for (int x = x0; x <= x1; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[0], px), edgeRow[0]), zero);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[1], px), edgeRow[1]), zero));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[2], px), edgeRow[2]), zero));
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+            __m128 depth = _mm_add_ps(_mm_mul_ps(depthA, px), depthRow);
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 nearer = _mm_max_ps(old, depth);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+        }
+#else
+        int xEnd = x1 | 3;
+        for (int x = x0; x <= xEnd; x++) {
+            float px = x + 0.5f;
+            bool inside = true;
+            for (int k = 0; k < 3 && inside; k++) {
+                inside = triangle.edgeA[k] * px + triangle.edgeB[k] * py + triangle.edgeC[k] >= 0.0f;
+            }
+            if (inside) {
+                row[x] = std::max(row[x], triangle.depthA * px + triangle.depthB * py + triangle.depthC);
+            }
+        }
+#endif
+    }
+};
+
+#endif /* occlusionCuller_h */
@@ -0,0 +1,307 @@
+//
+//  occlusionQueries.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-08-01.
+//
+
+#ifndef occlusionQueries_h
+#define occlusionQueries_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "shader.h"
+#include "model.h"
+
+// Hardware occlusion queries for a model's big meshes, the ones with enough triangles that
+// drawing a box first is cheap in comparison. issue() draws the box of every big mesh in the
+// frustum inside a GL_ANY_SAMPLES_PASSED query against whatever depth is bound, collect()
+// picks up the finished ones without ever waiting. A mesh has at most one query in flight.
+//
+// Results are used the frame after they arrive, so a mesh coming into view can be missing for
+// the frames its query takes. Either the CPU skips hidden meshes through testBoxes(), or with
+// setConditional(true) the GPU does through conditions() and glBeginConditionalRender.
+class OcclusionQueries {
+public:
+    OcclusionQueries(const std::string& shaderDirectory, size_t minTriangles = 2048)
+        : mBoxShader((shaderDirectory + "queryBox.vert").c_str(), (shaderDirectory + "debugBoxes.frag").c_str()),
+          mMinTriangles(minTriangles), mConditional(false), mFrame(0),
+          mLargeCount(0), mCandidates(0), mSkipped(0), mResults(0), mLatencyFrames(0), mLatencyMs(0.0) {
+        const glm::vec3 corners[8] = {
+            glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(1.0f, -1.0f, -1.0f),
+            glm::vec3(-1.0f, 1.0f, -1.0f), glm::vec3(1.0f, 1.0f, -1.0f),
+            glm::vec3(-1.0f, -1.0f, 1.0f), glm::vec3(1.0f, -1.0f, 1.0f),
+            glm::vec3(-1.0f, 1.0f, 1.0f), glm::vec3(1.0f, 1.0f, 1.0f)
+        };
+        // two triangles per face, winding doesn't matter since nothing is culled
+        const unsigned int indices[36] = {
+            0, 1, 3, 0, 3, 2,   4, 6, 7, 4, 7, 5,
+            0, 2, 6, 0, 6, 4,   1, 5, 7, 1, 7, 3,
+            0, 4, 5, 0, 5, 1,   2, 3, 7, 2, 7, 6
+        };
+        glGenVertexArrays(1, &mCubeVao);
+        glGenBuffers(1, &mCubeVbo);
+        glGenBuffers(1, &mCubeEbo);
+        glBindVertexArray(mCubeVao);
+        glBindBuffer(GL_ARRAY_BUFFER, mCubeVbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mCubeEbo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    ~OcclusionQueries() {
+        if (!mAllQueries.empty()) {
+            glDeleteQueries(static_cast<GLsizei>(mAllQueries.size()), mAllQueries.data());
+        }
+        glDeleteVertexArrays(1, &mCubeVao);
+        glDeleteBuffers(1, &mCubeVbo);
+        glDeleteBuffers(1, &mCubeEbo);
+    }
+
+    OcclusionQueries(const OcclusionQueries&) = delete;
+    OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+    void enableHotReload() {
+        mBoxShader.enableHotReload();
+    }
+
+    void reloadIfChanged() {
+        mBoxShader.reloadIfChanged();
+    }
+
+    void setConditional(bool conditional) {
+        mConditional = conditional;
+    }
+
+    bool conditional() const {
+        return mConditional;
+    }
+
+    // reads every query that has finished, call once at the start of a frame
+    void collect() {
+        mFrame++;
+        size_t kept = 0;
+        for (size_t i = 0; i < mPending.size(); i++) {
+            const Pending& pending = mPending[i];
+            int available = 0;
+            glGetQueryObjectiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                mPending[kept++] = pending;
+                continue;
+            }
+            GLuint passed = 0;
+            glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT, &passed);
+            mHidden[pending.mesh] = passed == 0 ? 1 : 0;
+            release(mCurrent[pending.mesh]);
+            mCurrent[pending.mesh] = pending.query;
+            mInFlight[pending.mesh] = 0;
+
+            mResults++;
+            mLatencyFrames += mFrame - pending.frame;
+            mLatencyMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() -
+                                                                    pending.issued).count();
+        }
+        mPending.resize(kept);
+    }
+
+    // Same contract as the other occlusion cullers: clears visible[i] for big meshes whose last
+    // query passed no samples and returns how many it hid. In conditional mode the GPU does the
+    // skipping, so this only counts what it will skip and hides nothing.
+    size_t testBoxes(const BoxList& boxes, unsigned char* visible) {
+        size_t hidden = 0;
+        for (size_t i = 0; i < boxes.size() && i < mHidden.size(); i++) {
+            if (!visible[i] || !mLarge[i]) {
+                continue;
+            }
+            mCandidates++;
+            if (mHidden[i]) {
+                mSkipped++;
+                if (!mConditional) {
+                    visible[i] = 0;
+                    hidden++;
+                }
+            }
+        }
+        return hidden;
+    }
+
+    // per mesh, the finished query conditional rendering should wait on, for
+    // Model::setDrawConditions()
+    const std::vector<unsigned int>& conditions() const {
+        return mCurrent;
+    }
+
+    // Queries the box of every big mesh in the model's frustum that has none in flight, against
+    // the depth buffer bound now. Call after the frame's opaque meshes are drawn and outside any
+    // other occlusion query. eye is the camera's world position.
+    void issue(const Model& model, const glm::mat4& viewProjection, const glm::vec3& eye) {
+        const BoxList& boxes = model.worldBounds();
+        if (mLarge.size() != boxes.size()) {
+            setMeshes(model);
+        }
+        const std::vector<unsigned char>& visible = model.visible();
+        const std::vector<unsigned char>& occluded = model.occluded();
+
+        mBoxShader.use();
+        mBoxShader.setMat4("viewProjection", viewProjection);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glEnable(GL_DEPTH_TEST);
+        glBindVertexArray(mCubeVao);
+        for (size_t i = 0; i < boxes.size(); i++) {
+            if (!mLarge[i]) {
+                continue;
+            }
+            // out of view, forget the result so it isn't hidden by it when it comes back
+            if (!visible[i] && !occluded[i]) {
+                mHidden[i] = 0;
+                release(mCurrent[i]);
+                mCurrent[i] = 0;
+                continue;
+            }
+            if (mInFlight[i]) {
+                continue;
+            }
+            glm::vec3 centre(boxes.centreX[i], boxes.centreY[i], boxes.centreZ[i]);
+            glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+            // from inside, the near plane cuts the box's front faces away
+            glm::vec3 offset = glm::abs(eye - centre) - extent;
+            if (offset.x <= NEAR_MARGIN && offset.y <= NEAR_MARGIN && offset.z <= NEAR_MARGIN) {
+                mHidden[i] = 0;
+                continue;
+            }
+            Pending pending;
+            pending.mesh = i;
+            pending.query = acquire();
+            pending.frame = mFrame;
+            pending.issued = std::chrono::high_resolution_clock::now();
+            mBoxShader.setVec3("boxCentre", centre);
+            mBoxShader.setVec3("boxExtent", extent);
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, pending.query);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            mInFlight[i] = 1;
+            mPending.push_back(pending);
+        }
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+    // big meshes in the frustum per frame and the share of them skipped since resetStats()
+    double skipRate() const {
+        return mCandidates == 0 ? 0.0 : static_cast<double>(mSkipped) / mCandidates;
+    }
+
+    // frames and milliseconds from issuing a query to reading its result
+    double latencyFrames() const {
+        return mResults == 0 ? 0.0 : static_cast<double>(mLatencyFrames) / mResults;
+    }
+
+    double latencyMs() const {
+        return mResults == 0 ? 0.0 : mLatencyMs / mResults;
+    }
+
+    size_t largeMeshes() const {
+        return mLargeCount;
+    }
+
+    size_t queriesInFlight() const {
+        return mPending.size();
+    }
+
+    // every query object ever made, in use or pooled
+    size_t queryObjects() const {
+        return mAllQueries.size();
+    }
+
+    void resetStats() {
+        mCandidates = 0;
+        mSkipped = 0;
+        mResults = 0;
+        mLatencyFrames = 0;
+        mLatencyMs = 0.0;
+    }
+
+private:
+    // a box grown by this much counts as containing the camera, so it covers the near plane
+    static constexpr float NEAR_MARGIN = 0.2f;
+
+    struct Pending {
+        size_t mesh;
+        unsigned int query;
+        unsigned long long frame;
+        std::chrono::high_resolution_clock::time_point issued;
+    };
+
+    Shader mBoxShader;
+    unsigned int mCubeVao;
+    unsigned int mCubeVbo;
+    unsigned int mCubeEbo;
+    size_t mMinTriangles;
+    bool mConditional;
+    unsigned long long mFrame;
+
+    // per mesh: big enough to query, last result passed no samples, a query in flight and the
+    // finished query the result came from
+    std::vector<unsigned char> mLarge;
+    std::vector<unsigned char> mHidden;
+    std::vector<unsigned char> mInFlight;
+    std::vector<unsigned int> mCurrent;
+    size_t mLargeCount;
+    std::vector<Pending> mPending;
+
+    // query objects are pooled, they are only ever made and never deleted before the end
+    std::vector<unsigned int> mFreeQueries;
+    std::vector<unsigned int> mAllQueries;
+
+    size_t mCandidates;
+    size_t mSkipped;
+    size_t mResults;
+    unsigned long long mLatencyFrames;
+    double mLatencyMs;
+
+    void setMeshes(const Model& model) {
+        const std::vector<MeshChunk>& chunks = model.chunks();
+        mLarge.assign(chunks.size(), 0);
+        mHidden.assign(chunks.size(), 0);
+        mInFlight.assign(chunks.size(), 0);
+        mCurrent.assign(chunks.size(), 0);
+        mLargeCount = 0;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            mLarge[i] = chunks[i].indexCount / 3 >= mMinTriangles ? 1 : 0;
+            mLargeCount += mLarge[i];
+        }
+    }
+
+    unsigned int acquire() {
+        if (mFreeQueries.empty()) {
+            unsigned int query = 0;
+            glGenQueries(1, &query);
+            mAllQueries.push_back(query);
+            return query;
+        }
+        unsigned int query = mFreeQueries.back();
+        mFreeQueries.pop_back();
+        return query;
+    }
+
+    void release(unsigned int query) {
+        if (query != 0) {
+            mFreeQueries.push_back(query);
+        }
+    }
+};
+
+#endif /* occlusionQueries_h */
@@ -0,0 +1,394 @@
+//
+//  pvs.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-08-01.
+//
+
+#ifndef pvs_h
+#define pvs_h
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+
+#include "lightmapBaker.h"
+#include "rayTracer.h"
+#include "threadPool.h"
+#include "binaryIO.h"
+
+// Potentially visible sets: the scene's bounds cut into a grid of cells, and for every cell
+// the camera can stand in a bitset of the meshes that can be seen from anywhere inside it.
+// Cells without a set, and positions outside the grid, can see everything.
+//
+// Bitsets hold one bit per mesh in Model's mesh order and are stored with runs of zero bytes
+// squeezed into a zero followed by the run length, as most of them are mostly empty.
+// The file is a magic number and version followed by the fields in order.
+struct PotentiallyVisibleSets {
+    glm::ivec3 cellCount;
+    glm::vec3 min;
+    glm::vec3 cellSize;
+    uint32_t meshCount;
+    // cell c's compressed set is data[offsets[c], offsets[c + 1]), empty if it has none
+    std::vector<uint32_t> offsets;
+    std::vector<unsigned char> data;
+
+    PotentiallyVisibleSets()
+        : cellCount(0, 0, 0), min(0.0f), cellSize(1.0f), meshCount(0), mCachedCell(-1) {
+    }
+
+    // cell of a world position, x fastest, or -1 outside the grid
+    int cellAt(const glm::vec3& position) const {
+        glm::ivec3 cell = glm::ivec3(glm::floor((position - min) / cellSize));
+        if (cell.x < 0 || cell.y < 0 || cell.z < 0 || cell.x >= cellCount.x || cell.y >= cellCount.y ||
+            cell.z >= cellCount.z) {
+            return -1;
+        }
+        return (cell.z * cellCount.y + cell.y) * cellCount.x + cell.x;
+    }
+
+    size_t cellTotal() const {
+        return static_cast<size_t>(cellCount.x) * cellCount.y * cellCount.z;
+    }
+
+    bool hasSet(int cell) const {
+        return cell >= 0 && offsets[cell + 1] > offsets[cell];
+    }
+
+    // one flag per mesh for the cell position is in, or nullptr if it can see everything.
+    // Points into a cache that stays valid until the next call.
+    const unsigned char* visibleFrom(const glm::vec3& position) {
+        int cell = cellAt(position);
+        if (!hasSet(cell)) {
+            return nullptr;
+        }
+        if (cell != mCachedCell) {
+            std::vector<unsigned char> bits;
+            expand(&data[offsets[cell]], &data[0] + offsets[cell + 1], bits);
+            mCachedFlags.assign(meshCount, 0);
+            for (uint32_t mesh = 0; mesh < meshCount; mesh++) {
+                mCachedFlags[mesh] = (bits[mesh >> 3] >> (mesh & 7)) & 1;
+            }
+            mCachedCell = cell;
+        }
+        return mCachedFlags.data();
+    }
+
+    // meshes in the set of the cell position is in, meshCount if it can see everything
+    size_t visibleCount(const glm::vec3& position) {
+        const unsigned char* flags = visibleFrom(position);
+        return flags == nullptr ? meshCount : static_cast<size_t>(std::count(flags, flags + meshCount, 1));
+    }
+
+    // appends a cell's set, flags has one entry per mesh. Cells are added in order.
+    void addCell(const std::vector<unsigned char>& flags) {
+        if (offsets.empty()) {
+            offsets.push_back(0);
+        }
+        if (!flags.empty()) {
+            std::vector<unsigned char> bits((meshCount + 7) / 8, 0);
+            for (uint32_t mesh = 0; mesh < meshCount; mesh++) {
+                bits[mesh >> 3] |= flags[mesh] ? 1 << (mesh & 7) : 0;
+            }
+            squeeze(bits, data);
+        }
+        offsets.push_back(static_cast<uint32_t>(data.size()));
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR::PVS::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        const uint32_t header[2] = { MAGIC, VERSION };
+        writeBinary(file, header);
+        writeBinary(file, cellCount);
+        writeBinary(file, min);
+        writeBinary(file, cellSize);
+        writeBinary(file, meshCount);
+        writeBinaryArray(file, offsets);
+        writeBinaryArray(file, data);
+        return static_cast<bool>(file);
+    }
+
+    bool load(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        if (!file || !readBinary(file, magic) || !readBinary(file, version) || magic != MAGIC || version != VERSION) {
+            std::cerr << "ERROR::PVS::NOT_A_PVS_FILE " << path << std::endl;
+            return false;
+        }
+        readBinary(file, cellCount);
+        readBinary(file, min);
+        readBinary(file, cellSize);
+        readBinary(file, meshCount);
+        readBinaryArray(file, offsets);
+        readBinaryArray(file, data);
+        if (!file || offsets.empty() || !validGrid(cellCount.x, cellCount.y, cellCount.z, offsets.size() - 1) ||
+            !validOffsets(offsets, data.size()) || !(cellSize.x > 0.0f && cellSize.y > 0.0f && cellSize.z > 0.0f) ||
+            !std::isfinite(min.x + min.y + min.z + cellSize.x + cellSize.y + cellSize.z)) {
+            std::cerr << "ERROR::PVS::CORRUPT " << path << std::endl;
+            return false;
+        }
+        mCachedCell = -1;
+        return true;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x53565650; // "PVVS"
+    static const uint32_t VERSION = 1;
+
+    int mCachedCell;
+    std::vector<unsigned char> mCachedFlags;
+
+    static void squeeze(const std::vector<unsigned char>& bits, std::vector<unsigned char>& out) {
+        for (size_t i = 0; i < bits.size(); i++) {
+            out.push_back(bits[i]);
+            if (bits[i] != 0) {
+                continue;
+            }
+            unsigned char run = 1;
+            while (i + 1 < bits.size() && bits[i + 1] == 0 && run < 255) {
+                run++;
+                i++;
+            }
+            out.push_back(run);
+        }
+    }
+
+    void expand(const unsigned char* begin, const unsigned char* end, std::vector<unsigned char>& bits) const {
+        bits.clear();
+        for (const unsigned char* byte = begin; byte < end; byte++) {
+            if (*byte != 0) {
+                bits.push_back(*byte);
+            } else if (byte + 1 < end) {
+                byte++;
+                bits.insert(bits.end(), *byte, 0);
+            }
+        }
+        bits.resize((meshCount + 7) / 8, 0);
+    }
+};
+
+// Scene visibility from the CPU ray caster, shared by the PVS builder and its validation.
+// Opaque triangles stop rays, alpha tested and blended ones are seen but let rays through.
+class SceneVisibility {
+public:
+    SceneVisibility(const BakeScene& scene) {
+        std::vector<glm::vec3> opaque;
+        std::vector<glm::vec3> seeThrough;
+        for (size_t m = 0; m < scene.meshes.size(); m++) {
+            const BakeScene::MeshData& mesh = scene.meshes[m];
+            bool blocks = mesh.bucket == MaterialBucket::OPAQUE;
+            std::vector<glm::vec3>& triangles = blocks ? opaque : seeThrough;
+            std::vector<unsigned int>& owners = blocks ? mOpaqueMesh : mSeeThroughMesh;
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                for (int k = 0; k < 3; k++) {
+                    triangles.push_back(mesh.positions[mesh.indices[i + k]]);
+                }
+                owners.push_back(static_cast<unsigned int>(m));
+            }
+        }
+        mOpaque.build(opaque);
+        mSeeThrough.build(seeThrough);
+    }
+
+    // flags every mesh the ray sees before it hits something opaque
+    void trace(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+               std::vector<unsigned char>& seen) const {
+        RayTracer::Hit hit;
+        float distance = maxDistance;
+        if (mOpaque.intersect(origin, direction, maxDistance, hit)) {
+            seen[mOpaqueMesh[hit.triangle]] = 1;
+            distance = hit.distance;
+        }
+        mSeeThrough.forEachHit(origin, direction, distance, [&](const RayTracer::Hit& through) {
+            seen[mSeeThroughMesh[through.triangle]] = 1;
+        });
+    }
+
+    // true if the first opaque surface below position within maxDistance is a floor
+    bool floorBelow(const glm::vec3& position, float maxDistance) const {
+        RayTracer::Hit hit;
+        if (!mOpaque.intersect(position, glm::vec3(0.0f, -1.0f, 0.0f), maxDistance, hit)) {
+            return false;
+        }
+        glm::vec3 normal = mOpaque.triangleNormal(hit.triangle);
+        // either winding, the renderer draws both sides
+        return std::abs(glm::normalize(normal).y) > 0.7f;
+    }
+
+private:
+    RayTracer mOpaque;
+    RayTracer mSeeThrough;
+    std::vector<unsigned int> mOpaqueMesh;
+    std::vector<unsigned int> mSeeThroughMesh;
+};
+
+// Offline PVS build. Cells with a floor at most eyeHeight below them are where the camera
+// can be, every other cell gets no set. From each of those, rays leave random points in the
+// cell in random directions, then for every mesh still unseen more rays aim at random points
+// on its triangles, which finds small meshes through doorways that random rays miss.
+// Sampling can still miss thin gaps, so to stay conservative a cell's set is the union of
+// what it and its neighbours saw, plus every mesh its bounds touch.
+class PvsBuilder {
+public:
+    PvsBuilder(int cellsAlongLongestAxis = 32, unsigned int raysPerCell = 4096, unsigned int raysPerMesh = 32,
+               float eyeHeight = 2.0f)
+        : mCells(std::max(cellsAlongLongestAxis, 1)), mRays(raysPerCell), mMeshRays(raysPerMesh),
+          mEyeHeight(eyeHeight) {
+    }
+
+    bool build(const BakeScene& scene, PotentiallyVisibleSets& pvs) const {
+        glm::vec3 sceneMin(FLT_MAX);
+        glm::vec3 sceneMax(-FLT_MAX);
+        std::vector<glm::vec3> meshMin(scene.meshes.size(), glm::vec3(FLT_MAX));
+        std::vector<glm::vec3> meshMax(scene.meshes.size(), glm::vec3(-FLT_MAX));
+        for (size_t m = 0; m < scene.meshes.size(); m++) {
+            for (const glm::vec3& position : scene.meshes[m].positions) {
+                meshMin[m] = glm::min(meshMin[m], position);
+                meshMax[m] = glm::max(meshMax[m], position);
+            }
+            sceneMin = glm::min(sceneMin, meshMin[m]);
+            sceneMax = glm::max(sceneMax, meshMax[m]);
+        }
+        if (scene.meshes.empty() || sceneMin.x > sceneMax.x) {
+            std::cerr << "ERROR::PVS::EMPTY_SCENE" << std::endl;
+            return false;
+        }
+
+        glm::vec3 extent = sceneMax - sceneMin;
+        float size = std::max(std::max(extent.x, extent.y), extent.z) / mCells;
+        pvs = PotentiallyVisibleSets();
+        pvs.min = sceneMin;
+        pvs.cellSize = glm::vec3(size);
+        pvs.cellCount = glm::max(glm::ivec3(glm::ceil(extent / size)), glm::ivec3(1));
+        pvs.meshCount = static_cast<uint32_t>(scene.meshes.size());
+        size_t cellTotal = pvs.cellTotal();
+        float sceneSize = glm::length(extent);
+
+        SceneVisibility visibility(scene);
+        std::vector<std::vector<unsigned char>> seen(cellTotal);
+        std::vector<unsigned char> walkable(cellTotal, 0);
+        ThreadPool::instance().parallelFor(cellTotal, 1, [&](size_t begin, size_t end) {
+            for (size_t cell = begin; cell < end; cell++) {
+                glm::vec3 lo = cellMin(pvs, cell);
+                std::mt19937 random(static_cast<unsigned int>(cell) * 7919u + 17u);
+                std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+                for (int probe = 0; probe < FLOOR_PROBES && !walkable[cell]; probe++) {
+                    glm::vec3 top = lo + glm::vec3(unit(random), 1.0f, unit(random)) * size;
+                    walkable[cell] = visibility.floorBelow(top, size + mEyeHeight) ? 1 : 0;
+                }
+                if (!walkable[cell]) {
+                    continue;
+                }
+                seen[cell].assign(scene.meshes.size(), 0);
+                for (unsigned int ray = 0; ray < mRays; ray++) {
+                    glm::vec3 origin = lo + glm::vec3(unit(random), unit(random), unit(random)) * size;
+                    // uniform on the sphere
+                    float z = 2.0f * unit(random) - 1.0f;
+                    float angle = 6.2831853f * unit(random);
+                    float r = std::sqrt(std::max(1.0f - z * z, 0.0f));
+                    glm::vec3 direction(r * std::cos(angle), r * std::sin(angle), z);
+                    visibility.trace(origin, direction, sceneSize, seen[cell]);
+                }
+                for (size_t m = 0; m < scene.meshes.size(); m++) {
+                    const BakeScene::MeshData& mesh = scene.meshes[m];
+                    size_t triangles = mesh.indices.size() / 3;
+                    for (unsigned int ray = 0; ray < mMeshRays && !seen[cell][m] && triangles > 0; ray++) {
+                        size_t triangle = std::min(static_cast<size_t>(unit(random) * triangles), triangles - 1);
+                        float u = unit(random);
+                        float v = unit(random);
+                        if (u + v > 1.0f) {
+                            u = 1.0f - u;
+                            v = 1.0f - v;
+                        }
+                        const glm::vec3& a = mesh.positions[mesh.indices[triangle * 3]];
+                        const glm::vec3& b = mesh.positions[mesh.indices[triangle * 3 + 1]];
+                        const glm::vec3& c = mesh.positions[mesh.indices[triangle * 3 + 2]];
+                        glm::vec3 target = a + (b - a) * u + (c - a) * v;
+                        glm::vec3 origin = lo + glm::vec3(unit(random), unit(random), unit(random)) * size;
+                        glm::vec3 toTarget = target - origin;
+                        float distance = glm::length(toTarget);
+                        if (distance > 0.0f) {
+                            // a little past the target so grazing hits on it still count
+                            visibility.trace(origin, toTarget / distance, distance * 1.01f, seen[cell]);
+                        }
+                    }
+                }
+            }
+        });
+
+        size_t setSizes = 0;
+        size_t sets = 0;
+        for (size_t cell = 0; cell < cellTotal; cell++) {
+            std::vector<unsigned char> flags;
+            if (walkable[cell]) {
+                flags = seen[cell];
+                glm::ivec3 c = cellCoords(pvs, cell);
+                for (int dz = -1; dz <= 1; dz++) {
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            glm::ivec3 n = c + glm::ivec3(dx, dy, dz);
+                            if (n.x < 0 || n.y < 0 || n.z < 0 || n.x >= pvs.cellCount.x || n.y >= pvs.cellCount.y ||
+                                n.z >= pvs.cellCount.z) {
+                                continue;
+                            }
+                            const std::vector<unsigned char>& other = seen[(n.z * pvs.cellCount.y + n.y) * pvs.cellCount.x + n.x];
+                            for (size_t m = 0; m < other.size(); m++) {
+                                flags[m] |= other[m];
+                            }
+                        }
+                    }
+                }
+                glm::vec3 lo = cellMin(pvs, cell);
+                glm::vec3 hi = lo + glm::vec3(size);
+                for (size_t m = 0; m < scene.meshes.size(); m++) {
+                    if (meshMin[m].x <= hi.x && meshMax[m].x >= lo.x && meshMin[m].y <= hi.y && meshMax[m].y >= lo.y &&
+                        meshMin[m].z <= hi.z && meshMax[m].z >= lo.z) {
+                        flags[m] = 1;
+                    }
+                }
+                setSizes += std::count(flags.begin(), flags.end(), 1);
+                sets++;
+            }
+            pvs.addCell(flags);
+        }
+        std::cout << "pvs: " << pvs.cellCount.x << " x " << pvs.cellCount.y << " x " << pvs.cellCount.z << " cells of "
+                  << size << ", " << sets << " walkable, " << (sets == 0 ? 0 : setSizes / sets) << " of "
+                  << scene.meshes.size() << " meshes per set on average, " << pvs.data.size() << " bytes compressed"
+                  << std::endl;
+        return true;
+    }
+
+private:
+    static const int FLOOR_PROBES = 9;
+
+    int mCells;
+    unsigned int mRays;
+    unsigned int mMeshRays;
+    float mEyeHeight;
+
+    static glm::ivec3 cellCoords(const PotentiallyVisibleSets& pvs, size_t cell) {
+        int index = static_cast<int>(cell);
+        return glm::ivec3(index % pvs.cellCount.x, (index / pvs.cellCount.x) % pvs.cellCount.y,
+                          index / (pvs.cellCount.x * pvs.cellCount.y));
+    }
+
+    static glm::vec3 cellMin(const PotentiallyVisibleSets& pvs, size_t cell) {
+        return pvs.min + glm::vec3(cellCoords(pvs, cell)) * pvs.cellSize;
+    }
+};
+
+#endif /* pvs_h */
@@ -0,0 +1,166 @@
+//
+//  pvsValidator.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-08-02.
+//
+
+#ifndef pvsValidator_h
+#define pvsValidator_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "shader.h"
+#include "model.h"
+
+// Checks potentially visible sets against the render instead of the ray caster that built them.
+// check() lays down the depth of every opaque chunk of the model, in the set or not, then draws
+// each chunk the set rejected in the frustum again inside a GL_SAMPLES_PASSED query with
+// GL_LEQUAL. Both passes use one program, so a chunk's samples pass exactly where it is the
+// nearest surface, i.e. where the frame would have shown it without the set.
+//
+// Alpha tested and blended meshes don't hide anything here and are tested without their
+// alpha, so the check only ever errs towards reporting a mesh.
+class PvsValidator {
+public:
+    PvsValidator(const std::string& shaderDirectory)
+        : mDepthShader((shaderDirectory + "depthPrepass.vert").c_str(), (shaderDirectory + "shadowDepth.frag").c_str(),
+                       { shaderInputsDefine<PositionVertex>() }),
+          mFrames(0), mTested(0), mMissing(0), mMissingSamples(0), mWorstMesh(0), mWorstSamples(0) {
+    }
+
+    ~PvsValidator() {
+        if (!mQueries.empty()) {
+            glDeleteQueries(static_cast<GLsizei>(mQueries.size()), mQueries.data());
+        }
+    }
+
+    PvsValidator(const PvsValidator&) = delete;
+    PvsValidator& operator=(const PvsValidator&) = delete;
+
+    void enableHotReload() {
+        mDepthShader.enableHotReload();
+    }
+
+    void reloadIfChanged() {
+        mDepthShader.reloadIfChanged();
+    }
+
+    // Tests what the model's last cull() rejected against the framebuffer bound now, clearing
+    // its depth. Call outside any other sample query. Waits for the results, so it costs a
+    // stall every frame it runs.
+    void check(const Model& model, const glm::mat4& mvp) {
+        const std::vector<MeshChunk>& chunks = model.chunks();
+        const std::vector<Mesh>& meshes = model.meshes();
+        const std::vector<unsigned char>& rejected = model.rejected();
+        mFrames++;
+        // proxies stand in for meshes, the meshes themselves are what the set is about
+        std::vector<size_t> tested;
+        for (size_t i = 0; i < rejected.size(); i++) {
+            if (rejected[i] && chunks[i].mesh < meshes.size()) {
+                tested.push_back(i);
+            }
+        }
+        if (tested.empty()) {
+            return;
+        }
+        if (mQueries.size() < tested.size()) {
+            size_t old = mQueries.size();
+            mQueries.resize(tested.size());
+            glGenQueries(static_cast<GLsizei>(mQueries.size() - old), &mQueries[old]);
+        }
+
+        mDepthShader.use();
+        mDepthShader.setMat4("mvp", mvp);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (chunks[i].mesh < meshes.size() && meshes[chunks[i].mesh].mBucket == MaterialBucket::OPAQUE) {
+                model.drawChunkPositions(i);
+            }
+        }
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+        for (size_t t = 0; t < tested.size(); t++) {
+            glBeginQuery(GL_SAMPLES_PASSED, mQueries[t]);
+            model.drawChunkPositions(tested[t]);
+            glEndQuery(GL_SAMPLES_PASSED);
+        }
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        for (size_t t = 0; t < tested.size(); t++) {
+            GLuint samples = 0;
+            glGetQueryObjectuiv(mQueries[t], GL_QUERY_RESULT, &samples);
+            mTested++;
+            if (samples == 0) {
+                continue;
+            }
+            mMissing++;
+            mMissingSamples += samples;
+            if (samples > mWorstSamples) {
+                mWorstSamples = samples;
+                mWorstMesh = chunks[tested[t]].mesh;
+            }
+        }
+    }
+
+    // totals since the last reset(), chunks are counted once per frame they're tested
+    size_t frames() const {
+        return mFrames;
+    }
+
+    size_t testedChunks() const {
+        return mTested;
+    }
+
+    // rejected chunks the render would have shown and the samples they'd have covered
+    size_t missingChunks() const {
+        return mMissing;
+    }
+
+    uint64_t missingSamples() const {
+        return mMissingSamples;
+    }
+
+    // the mesh of the missing chunk that covered the most samples in one frame
+    size_t worstMesh() const {
+        return mWorstMesh;
+    }
+
+    GLuint worstSamples() const {
+        return mWorstSamples;
+    }
+
+    void reset() {
+        mFrames = 0;
+        mTested = 0;
+        mMissing = 0;
+        mMissingSamples = 0;
+        mWorstMesh = 0;
+        mWorstSamples = 0;
+    }
+
+private:
+    Shader mDepthShader;
+    std::vector<GLuint> mQueries;
+    size_t mFrames;
+    size_t mTested;
+    size_t mMissing;
+    uint64_t mMissingSamples;
+    size_t mWorstMesh;
+    GLuint mWorstSamples;
+};
+
+#endif /* pvsValidator_h */
@@ -0,0 +1,11 @@
+#version 330 core
+// a mesh's bounding box for an occlusion query, the unit cube scaled into place
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 viewProjection;
+uniform vec3 boxCentre;
+uniform vec3 boxExtent;
+
+void main() {
+    gl_Position = viewProjection * vec4(boxCentre + aPos * boxExtent, 1.0);
+}
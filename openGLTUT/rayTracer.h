@@ -0,0 +1,132 @@
+//
+//  rayTracer.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-28.
+//
+
+#ifndef rayTracer_h
+#define rayTracer_h
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+
+#include "bvh.h"
+
+// CPU ray caster over a static triangle soup, for baking and visibility tools. Needs no GL.
+// Triangles are kept in a Bvh over their bounds. Queries are read only and safe to run from
+// many threads at once.
+class RayTracer {
+public:
+    struct Hit {
+        float distance;
+        unsigned int triangle;
+        // barycentric weights of the second and third vertex
+        float u;
+        float v;
+    };
+
+    RayTracer() {
+    }
+
+    // every three positions are a triangle
+    void build(const std::vector<glm::vec3>& trianglePositions) {
+        mVertices = trianglePositions;
+        size_t triangleCount = mVertices.size() / 3;
+        std::vector<glm::vec3> mins(triangleCount);
+        std::vector<glm::vec3> maxs(triangleCount);
+        for (size_t i = 0; i < triangleCount; i++) {
+            mins[i] = glm::min(glm::min(mVertices[3 * i], mVertices[3 * i + 1]), mVertices[3 * i + 2]);
+            maxs[i] = glm::max(glm::max(mVertices[3 * i], mVertices[3 * i + 1]), mVertices[3 * i + 2]);
+        }
+        mBvh.build(mins, maxs);
+    }
+
+    size_t triangleCount() const {
+        return mBvh.itemCount();
+    }
+
+    const Bvh& hierarchy() const {
+        return mBvh;
+    }
+
+    // closest hit along the ray within maxDistance, direction must be normalised
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Hit& hit) const {
+        hit.distance = maxDistance;
+        // hitsTriangle shortens hit.distance itself, which is the distance the walk reads
+        return mBvh.raycast(origin, direction, hit.distance, [&](unsigned int triangle, float&) {
+            return hitsTriangle(triangle, origin, direction, hit);
+        });
+    }
+
+    // true if anything blocks the segment, stops at the first hit
+    bool occluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const {
+        Hit hit;
+        hit.distance = maxDistance;
+        return mBvh.raycast(origin, direction, hit.distance, [&](unsigned int triangle, float&) {
+            return hitsTriangle(triangle, origin, direction, hit);
+        }, true);
+    }
+
+    // calls fn(hit) for every triangle the ray crosses within maxDistance, in no particular order
+    template <typename Fn>
+    void forEachHit(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, const Fn& fn) const {
+        float distance = maxDistance;
+        mBvh.raycast(origin, direction, distance, [&](unsigned int triangle, float&) {
+            Hit hit;
+            hit.distance = maxDistance;
+            if (hitsTriangle(triangle, origin, direction, hit)) {
+                fn(hit);
+            }
+            // never a hit as far as the walk is concerned, so it keeps going to maxDistance
+            return false;
+        });
+    }
+
+    // the unnormalised geometric normal of a triangle
+    glm::vec3 triangleNormal(unsigned int triangle) const {
+        const glm::vec3& a = mVertices[3 * triangle];
+        return glm::cross(mVertices[3 * triangle + 1] - a, mVertices[3 * triangle + 2] - a);
+    }
+
+private:
+    std::vector<glm::vec3> mVertices;
+    Bvh mBvh;
+
+    // Moller-Trumbore
+    bool hitsTriangle(unsigned int triangle, const glm::vec3& origin, const glm::vec3& direction, Hit& hit) const {
+        const glm::vec3& a = mVertices[3 * triangle];
+        glm::vec3 edge1 = mVertices[3 * triangle + 1] - a;
+        glm::vec3 edge2 = mVertices[3 * triangle + 2] - a;
+        glm::vec3 p = glm::cross(direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (std::abs(determinant) < 1.0e-12f) {
+            return false;
+        }
+        float inverse = 1.0f / determinant;
+        glm::vec3 s = origin - a;
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f) {
+            return false;
+        }
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f) {
+            return false;
+        }
+        float t = glm::dot(edge2, q) * inverse;
+        if (t <= 0.0f || t >= hit.distance) {
+            return false;
+        }
+        hit.distance = t;
+        hit.triangle = triangle;
+        hit.u = u;
+        hit.v = v;
+        return true;
+    }
+};
+
+#endif /* rayTracer_h */
@@ -0,0 +1,76 @@
+//
+//  sampleCounter.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-29.
+//
+
+#ifndef sampleCounter_h
+#define sampleCounter_h
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+// Counts the samples that pass the depth test between begin() and end() with GL_SAMPLES_PASSED
+// queries, read back the same non-stalling way GpuTimer does. Fragments that are discarded or
+// fail the depth test aren't counted. Unlike timer queries these may overlap a GpuTimer.
+class SampleCounter {
+public:
+    SampleCounter()
+        : mFrame(0), mSamples(0), mTotal(0) {
+        glGenQueries(QUERY_COUNT, mQueries);
+    }
+
+    ~SampleCounter() {
+        glDeleteQueries(QUERY_COUNT, mQueries);
+    }
+
+    SampleCounter(const SampleCounter&) = delete;
+    SampleCounter& operator=(const SampleCounter&) = delete;
+
+    void begin() {
+        glBeginQuery(GL_SAMPLES_PASSED, mQueries[mFrame % QUERY_COUNT]);
+    }
+
+    void end() {
+        glEndQuery(GL_SAMPLES_PASSED);
+        mFrame++;
+        collect();
+    }
+
+    // average samples per measurement since the last reset()
+    double average() const {
+        return mSamples == 0 ? 0.0 : static_cast<double>(mTotal) / mSamples;
+    }
+
+    void reset() {
+        mSamples = 0;
+        mTotal = 0;
+    }
+
+private:
+    static const unsigned int QUERY_COUNT = 4;
+    unsigned int mQueries[QUERY_COUNT];
+    unsigned int mFrame;
+    unsigned int mSamples;
+    uint64_t mTotal;
+
+    void collect() {
+        if (mFrame < QUERY_COUNT) {
+            return;
+        }
+        unsigned int query = mQueries[mFrame % QUERY_COUNT];
+        int available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return;
+        }
+        GLuint64 passed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &passed);
+        mTotal += passed;
+        mSamples++;
+    }
+};
+
+#endif /* sampleCounter_h */
@@ -0,0 +1,41 @@
+// Ambient light from the L2 spherical harmonics probes baked by lightmapBaker.h, evaluated once
+// per fragment in place of every light's own ambient term. Needs lighting.glsl included first.
+
+// 27 coefficients per probe packed into seven RGBA texels, stored as seven slabs of
+// shProbeCount.z layers each so hardware filtering blends neighbouring probes
+uniform sampler3D shProbes;
+uniform vec3 shProbeCount;
+uniform vec3 shProbeMin;
+uniform vec3 shProbeMax;
+
+vec3 calcSHAmbient(vec3 worldPos, vec3 norm, Surface surface) {
+    vec3 grid = clamp((worldPos - shProbeMin) / (shProbeMax - shProbeMin), 0.0, 1.0) * (shProbeCount - 1.0);
+    // probe centres in texels, z stays inside one slab so slabs never filter into each other
+    vec3 size = vec3(shProbeCount.xy, shProbeCount.z * 7.0);
+    float coefficients[28];
+    for (int i = 0; i < 7; i++) {
+        vec4 texel = texture(shProbes, (grid + vec3(0.5, 0.5, 0.5 + float(i) * shProbeCount.z)) / size);
+        coefficients[4 * i] = texel.r;
+        coefficients[4 * i + 1] = texel.g;
+        coefficients[4 * i + 2] = texel.b;
+        coefficients[4 * i + 3] = texel.a;
+    }
+
+    // same basis order as LightmapBaker::shBasis
+    float basis[9];
+    basis[0] = 0.282095;
+    basis[1] = 0.488603 * norm.y;
+    basis[2] = 0.488603 * norm.z;
+    basis[3] = 0.488603 * norm.x;
+    basis[4] = 1.092548 * norm.x * norm.y;
+    basis[5] = 1.092548 * norm.y * norm.z;
+    basis[6] = 0.315392 * (3.0 * norm.z * norm.z - 1.0);
+    basis[7] = 1.092548 * norm.x * norm.z;
+    basis[8] = 0.546274 * (norm.x * norm.x - norm.y * norm.y);
+
+    vec3 irradiance = vec3(0.0);
+    for (int i = 0; i < 9; i++) {
+        irradiance += vec3(coefficients[3 * i], coefficients[3 * i + 1], coefficients[3 * i + 2]) * basis[i];
+    }
+    return max(irradiance, 0.0) * surface.albedo;
+}
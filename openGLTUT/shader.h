@@ -17,83 +17,311 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+
+#include "fileWatcher.h"
+#include "shaderPreprocessor.h"
 
 class Shader {
 public:
     // shader program ID
     unsigned int programID;
     
-    // constructor reads and compiles the shaders
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath) {
-        // 1. Read the source files from disk
-        std::ifstream vertexShader(vertexPath);
-        std::ifstream fragmentShader(fragmentPath);
-        if(!fragmentShader.is_open() || !vertexShader.is_open()){
+    // constructor reads, preprocesses and compiles the shaders. Each define is injected
+    // as "#define <define>", e.g. "NR_POINT_LIGHTS 4". Vertex outputs named in feedbackVaryings
+    // are captured interleaved by transform feedback and never stripped as unused.
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const std::vector<std::string>& defines = {},
+           const std::vector<std::string>& feedbackVaryings = {})
+        : mVertexPath(vertexPath), mFragmentPath(fragmentPath), mDefines(defines),
+          mFeedbackVaryings(feedbackVaryings), mReloadPending(false) {
+        // 1. Read the source files from disk and resolve includes
+        if (!preprocess(mVertexSource, mFragmentSource)) {
             std::cerr << "Cannot find fragment shader file" << std::endl;
         }
         
-        std::string vertexShaderSrc(std::istreambuf_iterator<char>(vertexShader), (std::istreambuf_iterator<char>()));
-        const char* vertexShaderSrcPtr = vertexShaderSrc.c_str();
-        
-        std::string fragmentShaderSrc(std::istreambuf_iterator<char>(fragmentShader), (std::istreambuf_iterator<char>()));
-        const char* fragmentShaderSrcPtr = fragmentShaderSrc.c_str();
-        
-        // 2. Compile the shader source code
-        
-        // compile the vertex shader code
-        unsigned int vertextShaderID = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertextShaderID, 1, &vertexShaderSrcPtr, NULL);
-        glCompileShader(vertextShaderID);
-        checkCompileErrors(vertextShaderID, false);
-        
-        // compile the fragment shader code
-        unsigned int fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShaderID, 1, &fragmentShaderSrcPtr, NULL);
-        glCompileShader(fragmentShaderID);
-        checkCompileErrors(fragmentShaderID, false);
-        
-        // 3. Link the shader program
-        programID = glCreateProgram();
-        glAttachShader(programID, vertextShaderID);
-        glAttachShader(programID, fragmentShaderID);
-        glLinkProgram(programID);
-        checkCompileErrors(programID, true);
-        
-        // cleanup shaders now that they are linked to program
-        glDeleteShader(vertextShaderID);
-        glDeleteShader(fragmentShaderID);
+        // 2. Compile and link the program
+        programID = buildProgram(mVertexSource, mFragmentSource);
     }
+        
+    // the file watcher calls back into this object, so it must stay put
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
     
     // activate the shader
     void use() {
         glUseProgram(programID);
     }
     
-    // utility functions
+    // start watching the source files and everything they include, edits get picked up by
+    // reloadIfChanged(). Includes added after this call are not watched.
+    void enableHotReload() {
+        if (mWatcher) {
+            return;
+        }
+        std::vector<std::string> files = mVertexSource.files;
+        files.insert(files.end(), mFragmentSource.files.begin(), mFragmentSource.files.end());
+        mWatcher.reset(new FileWatcher(files, [this]() {
+            // runs on the watcher thread, only touches the disk and the staged sources
+            ShaderSource vertexSource;
+            ShaderSource fragmentSource;
+            if (!preprocess(vertexSource, fragmentSource)) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mStagedMutex);
+            mStagedVertexSource = std::move(vertexSource);
+            mStagedFragmentSource = std::move(fragmentSource);
+            mReloadPending.store(true, std::memory_order_release);
+        }));
+    }
+
+    // the preprocessed sources of the current program
+    const ShaderSource& vertexSource() const {
+        return mVertexSource;
+    }
+
+    const ShaderSource& fragmentSource() const {
+        return mFragmentSource;
+    }
+
+    // writes the preprocessed sources next to each other in directory for inspection
+    void dumpPreprocessed(const std::string& directory) const {
+        std::ofstream(directory + "/" + fileNameOf(mVertexPath) + ".pre") << mVertexSource.source;
+        std::ofstream(directory + "/" + fileNameOf(mFragmentPath) + ".pre") << mFragmentSource.source;
+    }
+
+    // call once per frame on the render thread. Compiles the staged sources and swaps the
+    // program in only if compiling and linking succeeded, otherwise the old one stays bound.
+    // Returns true if the program changed.
+    bool reloadIfChanged() {
+        if (!mReloadPending.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        ShaderSource vertexSource;
+        ShaderSource fragmentSource;
+        {
+            std::lock_guard<std::mutex> lock(mStagedMutex);
+            vertexSource = std::move(mStagedVertexSource);
+            fragmentSource = std::move(mStagedFragmentSource);
+            mReloadPending.store(false, std::memory_order_relaxed);
+        }
+
+        unsigned int newProgramID = buildProgram(vertexSource, fragmentSource);
+        if (newProgramID == 0) {
+            std::cerr << "Shader reload failed, keeping previous program" << std::endl;
+            return false;
+        }
+
+        int currentProgram = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+        bool wasBound = static_cast<unsigned int>(currentProgram) == programID;
+        glDeleteProgram(programID);
+        programID = newProgramID;
+        mVertexSource = std::move(vertexSource);
+        mFragmentSource = std::move(fragmentSource);
+        if (wasBound) {
+            glUseProgram(programID);
+        }
+
+        // keep the location cache warm by resolving every known name against the new program,
+        // the new program starts with default values so every shadowed value is stale
+        for (auto& entry : mUniforms) {
+            entry.second.location = glGetUniformLocation(programID, entry.first.c_str());
+            entry.second.hasValue = false;
+        }
+        std::cout << "Reloaded shader " << mFragmentPath << std::endl;
+        return true;
+    }
+
+    // utility functions, each one skips the GL call if the uniform already holds the value
     void setBool(const std::string& name, bool value) const {
-        glUniform1i(glGetUniformLocation(programID, name.c_str()), static_cast<int>(value));
+        int intValue = static_cast<int>(value);
+        UniformSlot& slot = getUniform(name);
+        if (needsUpload(slot, &intValue, sizeof(intValue))) {
+            glUniform1i(slot.location, intValue);
+        }
     }
     
     void setInt(const std::string& name, int value) const {
-        glUniform1i(glGetUniformLocation(programID, name.c_str()), value);
+        UniformSlot& slot = getUniform(name);
+        if (needsUpload(slot, &value, sizeof(value))) {
+            glUniform1i(slot.location, value);
+        }
     }
     
     void setFloat(const std::string& name, float value) const {
-        glUniform1f(glGetUniformLocation(programID, name.c_str()), value);
+        UniformSlot& slot = getUniform(name);
+        if (needsUpload(slot, &value, sizeof(value))) {
+            glUniform1f(slot.location, value);
+        }
     }
     
     void setMat4(const std::string& name, const glm::mat4& matrix) const {
-        unsigned int loc = glGetUniformLocation(programID, name.c_str());
-        glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(matrix));
+        UniformSlot& slot = getUniform(name);
+        if (needsUpload(slot, glm::value_ptr(matrix), sizeof(glm::mat4))) {
+            glUniformMatrix4fv(slot.location, 1, GL_FALSE, glm::value_ptr(matrix));
+        }
+    }
+
+    void setMat3(const std::string& name, const glm::mat3& matrix) const {
+        UniformSlot& slot = getUniform(name);
+        if (needsUpload(slot, glm::value_ptr(matrix), sizeof(glm::mat3))) {
+            glUniformMatrix3fv(slot.location, 1, GL_FALSE, glm::value_ptr(matrix));
+        }
+    }
+
+    void setVec2(const std::string& name, glm::vec2 vec2) const {
+        UniformSlot& slot = getUniform(name);
+        if (needsUpload(slot, glm::value_ptr(vec2), sizeof(glm::vec2))) {
+            glUniform2fv(slot.location, 1, glm::value_ptr(vec2));
+        }
     }
     
     void setVec3(const std::string& name, glm::vec3 vec3) const {
-        unsigned int loc = glGetUniformLocation(programID, name.c_str());
-        glUniform3fv(loc, 1, glm::value_ptr(vec3));
+        UniformSlot& slot = getUniform(name);
+        if (needsUpload(slot, glm::value_ptr(vec3), sizeof(glm::vec3))) {
+            glUniform3fv(slot.location, 1, glm::value_ptr(vec3));
+        }
+    }
+
+    void setVec4(const std::string& name, glm::vec4 vec4) const {
+        UniformSlot& slot = getUniform(name);
+        if (needsUpload(slot, glm::value_ptr(vec4), sizeof(glm::vec4))) {
+            glUniform4fv(slot.location, 1, glm::value_ptr(vec4));
+        }
+    }
+
+    // uniform uploads issued and skipped by every shader since the caller last reset them. The
+    // viewer does that once per report, about a second, and divides by the frames in between.
+    struct UniformStats {
+        unsigned int issued;
+        unsigned int skipped;
+    };
+
+    static UniformStats& uniformStats() {
+        static UniformStats stats = { 0, 0 };
+        return stats;
     }
 
 private:
-    void checkCompileErrors(unsigned int shaderID, bool isProgram) {
+    std::string mVertexPath;
+    std::string mFragmentPath;
+    std::vector<std::string> mDefines;
+    std::vector<std::string> mFeedbackVaryings;
+
+    // preprocessed sources of the current program
+    ShaderPreprocessor mPreprocessor;
+    ShaderSource mVertexSource;
+    ShaderSource mFragmentSource;
+
+    // location of a uniform in the current program and the last value uploaded to it.
+    // Uniform values are per program state so switching programs never invalidates this.
+    struct UniformSlot {
+        int location;
+        bool hasValue;
+        unsigned char value[sizeof(glm::mat4)];
+    };
+
+    // uniform name -> slot for the current program
+    mutable std::unordered_map<std::string, UniformSlot> mUniforms;
+
+    // sources read by the watcher thread waiting to be compiled on the render thread
+    std::mutex mStagedMutex;
+    ShaderSource mStagedVertexSource;
+    ShaderSource mStagedFragmentSource;
+    std::atomic<bool> mReloadPending;
+    // last so it is destroyed first, its thread is joined before anything the callback touches
+    std::unique_ptr<FileWatcher> mWatcher;
+
+    UniformSlot& getUniform(const std::string& name) const {
+        const auto it = mUniforms.find(name);
+        if (it != mUniforms.end()) {
+            return it->second;
+        }
+        UniformSlot slot;
+        slot.location = glGetUniformLocation(programID, name.c_str());
+        slot.hasValue = false;
+        return mUniforms.emplace(name, slot).first->second;
+    }
+
+    // compares against the shadowed value bit for bit, records the new one if it differs
+    bool needsUpload(UniformSlot& slot, const void* value, size_t size) const {
+        if (slot.hasValue && std::memcmp(slot.value, value, size) == 0) {
+            uniformStats().skipped++;
+            return false;
+        }
+        std::memcpy(slot.value, value, size);
+        slot.hasValue = true;
+        uniformStats().issued++;
+        return true;
+    }
+
+    bool preprocess(ShaderSource& vertexSource, ShaderSource& fragmentSource) {
+        vertexSource = mPreprocessor.load(mVertexPath, mDefines);
+        fragmentSource = mPreprocessor.load(mFragmentPath, mDefines);
+        if (vertexSource.source.empty() || fragmentSource.source.empty()) {
+            return false;
+        }
+        // both stages are known here so anything the other stage can't see can go, except what
+        // transform feedback captures
+        ShaderPreprocessor::stripUnused(vertexSource, fragmentSource, mFeedbackVaryings);
+        return true;
+    }
+
+    static std::string fileNameOf(const std::string& path) {
+        size_t slash = path.find_last_of('/');
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+
+    // compiles and links a program, returns 0 if any stage failed
+    unsigned int buildProgram(const ShaderSource& vertexSource, const ShaderSource& fragmentSource) {
+        const char* vertexShaderSrcPtr = vertexSource.source.c_str();
+        const char* fragmentShaderSrcPtr = fragmentSource.source.c_str();
+
+        // compile the vertex shader code
+        unsigned int vertextShaderID = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertextShaderID, 1, &vertexShaderSrcPtr, NULL);
+        glCompileShader(vertextShaderID);
+        bool success = checkCompileErrors(vertextShaderID, false, &vertexSource);
+
+        // compile the fragment shader code
+        unsigned int fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragmentShaderID, 1, &fragmentShaderSrcPtr, NULL);
+        glCompileShader(fragmentShaderID);
+        success = checkCompileErrors(fragmentShaderID, false, &fragmentSource) && success;
+
+        // link the shader program
+        unsigned int newProgramID = glCreateProgram();
+        glAttachShader(newProgramID, vertextShaderID);
+        glAttachShader(newProgramID, fragmentShaderID);
+        if (!mFeedbackVaryings.empty()) {
+            std::vector<const char*> varyings;
+            for (const std::string& varying : mFeedbackVaryings) {
+                varyings.push_back(varying.c_str());
+            }
+            glTransformFeedbackVaryings(newProgramID, static_cast<GLsizei>(varyings.size()), varyings.data(),
+                                        GL_INTERLEAVED_ATTRIBS);
+        }
+        glLinkProgram(newProgramID);
+        success = checkCompileErrors(newProgramID, true, nullptr) && success;
+
+        // cleanup shaders now that they are linked to program
+        glDeleteShader(vertextShaderID);
+        glDeleteShader(fragmentShaderID);
+
+        if (!success) {
+            glDeleteProgram(newProgramID);
+            return 0;
+        }
+        return newProgramID;
+    }
+
+    bool checkCompileErrors(unsigned int shaderID, bool isProgram, const ShaderSource* source) {
         int success;
         int errorBuffSize = 2048;
         char infoLog[errorBuffSize];
@@ -101,7 +329,7 @@ private:
         if (isProgram) {
             glGetProgramiv(shaderID, GL_LINK_STATUS, &success);
             if (success != GL_TRUE) {
-                glGetProgramInfoLog(programID, errorBuffSize, &errorBuffSize, infoLog);
+                glGetProgramInfoLog(shaderID, errorBuffSize, &errorBuffSize, infoLog);
                 std::cerr << "ERROR SHADER PROGRAM LINKING FAILED" << std::endl << infoLog << std::endl;
             }
         }
@@ -110,8 +338,13 @@ private:
             if (success != GL_TRUE) {
                 glGetShaderInfoLog(shaderID, errorBuffSize, &errorBuffSize, infoLog);
                 std::cerr << "ERROR SHADER COMPILATION FAILED" << std::endl << infoLog << std::endl;
+                // errors are reported as <source string>:<line>, list which file is which
+                for (size_t i = 0; i < source->files.size(); i++) {
+                    std::cerr << "  " << i << " = " << source->files[i] << std::endl;
+                }
             }
         }
+        return success == GL_TRUE;
     }
 };
 
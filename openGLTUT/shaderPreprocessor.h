@@ -0,0 +1,228 @@
+//
+//  shaderPreprocessor.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-16.
+//
+
+#ifndef shaderPreprocessor_h
+#define shaderPreprocessor_h
+
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <regex>
+
+#include "fileWatcher.h"
+
+// A preprocessed shader stage ready to be handed to glShaderSource.
+struct ShaderSource {
+    std::string source;
+    // every file that went into the source, index i is source string number i in #line
+    // directives so compile errors can be traced back to the right file
+    std::vector<std::string> files;
+};
+
+// Runs before compilation:
+//  - resolves #include "file" relative to the including file, each file is included once
+//  - injects #define lines straight after #version
+//  - strips vertex outputs the fragment stage never reads and uniforms nothing references
+// Resolved stages are cached per path and define set until one of their files changes.
+class ShaderPreprocessor {
+public:
+    ShaderSource load(const std::string& path, const std::vector<std::string>& defines) {
+        std::string key = path;
+        for (const std::string& define : defines) {
+            key += '\n' + define;
+        }
+
+        const auto it = mCache.find(key);
+        if (it != mCache.end() && isFresh(it->second)) {
+            return it->second.result;
+        }
+
+        CacheEntry entry;
+        std::set<std::string> included;
+        std::ostringstream out;
+        if (!expand(path, out, entry.result.files, included, defines)) {
+            entry.result.source.clear();
+            return entry.result;
+        }
+        entry.result.source = out.str();
+        for (const std::string& file : entry.result.files) {
+            entry.modifiedTimes.push_back(FileWatcher::modifiedTime(file));
+        }
+        mCache[key] = entry;
+        return entry.result;
+    }
+
+    // Removes vertex outputs that have no matching fragment input and aren't named in keep,
+    // e.g. transform feedback varyings, then any uniform in either stage that is no longer
+    // referenced. An output is only removed when every line mentioning it is its declaration
+    // or a whole statement writing to it, anything else leaves it in place.
+    static void stripUnused(ShaderSource& vertex, ShaderSource& fragment, const std::vector<std::string>& keep = {}) {
+        std::set<std::string> used(keep.begin(), keep.end());
+        const std::regex inputDecl(R"((?:^|\n)\s*(?:flat\s+|smooth\s+|noperspective\s+)?in\s+\w+\s+(\w+)\s*;)");
+        for (std::sregex_iterator it(fragment.source.begin(), fragment.source.end(), inputDecl), end; it != end; ++it) {
+            used.insert((*it)[1]);
+        }
+
+        const std::regex outputDecl(R"((?:^|\n)\s*(?:flat\s+|smooth\s+|noperspective\s+)?out\s+\w+\s+(\w+)\s*;)");
+        std::vector<std::string> unusedOutputs;
+        for (std::sregex_iterator it(vertex.source.begin(), vertex.source.end(), outputDecl), end; it != end; ++it) {
+            if (used.find((*it)[1]) == used.end()) {
+                unusedOutputs.push_back((*it)[1]);
+            }
+        }
+        for (const std::string& name : unusedOutputs) {
+            removeOutput(vertex.source, name);
+        }
+
+        stripUnusedUniforms(vertex.source);
+        stripUnusedUniforms(fragment.source);
+    }
+
+private:
+    struct CacheEntry {
+        ShaderSource result;
+        std::vector<long long> modifiedTimes;
+    };
+    std::unordered_map<std::string, CacheEntry> mCache;
+
+    bool expand(const std::string& path, std::ostringstream& out, std::vector<std::string>& files,
+                std::set<std::string>& included, const std::vector<std::string>& defines) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            std::cerr << "Cannot open shader file " << path << std::endl;
+            return false;
+        }
+        included.insert(path);
+        size_t fileIndex = files.size();
+        files.push_back(path);
+
+        const std::regex includeDirective(R"(^\s*#\s*include\s+\"([^\"]+)\"\s*$)");
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        std::string line;
+        unsigned int lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber++;
+            std::smatch match;
+            if (std::regex_match(line, match, includeDirective)) {
+                std::string includePath = directory + match[1].str();
+                if (included.find(includePath) == included.end()) {
+                    out << "#line 1 " << files.size() << '\n';
+                    if (!expand(includePath, out, files, included, defines)) {
+                        return false;
+                    }
+                }
+                out << "#line " << lineNumber + 1 << ' ' << fileIndex << '\n';
+                continue;
+            }
+            out << line << '\n';
+            if (fileIndex == 0 && line.compare(0, 8, "#version") == 0) {
+                for (const std::string& define : defines) {
+                    out << "#define " << define << '\n';
+                }
+                out << "#line " << lineNumber + 1 << " 0\n";
+            }
+        }
+        return true;
+    }
+
+    static void stripUnusedUniforms(std::string& source) {
+        const std::regex uniformDecl(R"((?:^|\n)\s*uniform\s+\w+\s+(\w+)\s*(?:\[[^\]]*\])?\s*;)");
+        bool removed = true;
+        while (removed) {
+            removed = false;
+            std::vector<std::string> names;
+            for (std::sregex_iterator it(source.begin(), source.end(), uniformDecl), end; it != end; ++it) {
+                names.push_back((*it)[1]);
+            }
+            for (const std::string& name : names) {
+                const std::regex word("\\b" + name + "\\b");
+                auto uses = std::distance(std::sregex_iterator(source.begin(), source.end(), word), std::sregex_iterator());
+                if (uses <= 1) {
+                    std::string before = source;
+                    removeLines(source, std::regex(R"(^\s*uniform\s+\w+\s+)" + name + R"(\s*(?:\[[^\]]*\])?\s*;.*$)"));
+                    removed = removed || source != before;
+                }
+            }
+        }
+    }
+
+    // Blanks the declaration of output name and the statements writing to it, whole, a swizzle
+    // or an element, if those are the only lines that mention it. Each write has to be on a
+    // line of its own after the end of the previous statement, so that removing it can't leave
+    // half a statement or an if without its body behind. Returns false, changing nothing, if
+    // any mention doesn't fit.
+    static bool removeOutput(std::string& source, const std::string& name) {
+        const std::regex declaration(R"(^\s*(?:flat\s+|smooth\s+|noperspective\s+)?out\s+\w+\s+)" + name +
+                                     R"(\s*;\s*$)");
+        const std::regex write(R"(^\s*)" + name + R"((?:\.[xyzwrgbastpq]+|\[[^\];]*\])?\s*[-+*/]?=[^=][^;]*;\s*$)");
+        const std::regex word("\\b" + name + "\\b");
+        std::vector<std::string> lines;
+        std::istringstream in(source);
+        std::string line;
+        while (std::getline(in, line)) {
+            lines.push_back(line);
+        }
+        std::vector<size_t> removed;
+        bool statementEnded = true;
+        for (size_t i = 0; i < lines.size(); i++) {
+            std::string code = lines[i].substr(0, lines[i].find("//"));
+            auto uses = std::distance(std::sregex_iterator(code.begin(), code.end(), word), std::sregex_iterator());
+            if (uses > 0) {
+                if (uses > 1 || !(std::regex_match(code, declaration) || (statementEnded && std::regex_match(code, write)))) {
+                    return false;
+                }
+                removed.push_back(i);
+            }
+            size_t last = code.find_last_not_of(" \t\r");
+            size_t first = code.find_first_not_of(" \t");
+            if (last != std::string::npos && code[first] != '#') {
+                statementEnded = code[last] == ';' || code[last] == '{' || code[last] == '}';
+            }
+        }
+        std::ostringstream out;
+        size_t next = 0;
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (next < removed.size() && removed[next] == i) {
+                next++;
+            } else {
+                out << lines[i];
+            }
+            out << '\n';
+        }
+        source = out.str();
+        return true;
+    }
+
+    // blanks matching lines instead of erasing them so #line numbering stays right
+    static void removeLines(std::string& source, const std::regex& pattern) {
+        std::istringstream in(source);
+        std::ostringstream out;
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!std::regex_match(line, pattern)) {
+                out << line;
+            }
+            out << '\n';
+        }
+        source = out.str();
+    }
+
+    static bool isFresh(const CacheEntry& entry) {
+        for (size_t i = 0; i < entry.result.files.size(); i++) {
+            if (FileWatcher::modifiedTime(entry.result.files[i]) != entry.modifiedTimes[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif /* shaderPreprocessor_h */
@@ -0,0 +1,60 @@
+// Point and spot light shadows from the shared atlas rendered by shadowAtlas.h.
+
+uniform sampler2DShadow shadowAtlas;
+uniform samplerBuffer shadowTiles;  // 6 texels per tile: atlas rect, normal offset, light matrix columns
+uniform float shadowAtlasTexel;     // 1 / atlas size
+
+// 1 where worldPos is lit through the given tile, 0 where it is in shadow
+float sampleShadowTile(int tile, vec3 worldPos, vec3 norm, vec3 lightPos) {
+    int base = tile * 6;
+    vec4 rect = texelFetch(shadowTiles, base);
+    float normalOffset = texelFetch(shadowTiles, base + 1).x;
+    mat4 lightMatrix = mat4(texelFetch(shadowTiles, base + 2), texelFetch(shadowTiles, base + 3),
+                            texelFetch(shadowTiles, base + 4), texelFetch(shadowTiles, base + 5));
+
+    // texels grow with distance from the light, so does the offset that hides acne
+    vec3 offsetPos = worldPos + norm * normalOffset * length(worldPos - lightPos);
+    vec4 clip = lightMatrix * vec4(offsetPos, 1.0);
+    vec3 coords = clip.xyz / clip.w * 0.5 + 0.5;
+    if (clip.w <= 0.0 || any(lessThan(coords, vec3(0.0))) || any(greaterThan(coords, vec3(1.0)))) {
+        return 1.0;
+    }
+
+    // 2x2 taps of the hardware comparison, clamped so neighbouring tiles never bleed in
+    vec2 uv = rect.xy + coords.xy * rect.zw;
+    vec2 lo = rect.xy + vec2(shadowAtlasTexel);
+    vec2 hi = rect.xy + rect.zw - vec2(shadowAtlasTexel);
+    float lit = 0.0;
+    for (int x = 0; x < 2; x++) {
+        for (int y = 0; y < 2; y++) {
+            vec2 tap = uv + (vec2(x, y) - 0.5) * shadowAtlasTexel;
+            lit += texture(shadowAtlas, vec3(clamp(tap, lo, hi), coords.z));
+        }
+    }
+    return lit * 0.25;
+}
+
+float calcSpotShadow(int tile, vec3 worldPos, vec3 norm, vec3 lightPos) {
+    if (tile < 0) {
+        return 1.0;
+    }
+    return sampleShadowTile(tile, worldPos, norm, lightPos);
+}
+
+// point lights have six tiles in +X, -X, +Y, -Y, +Z, -Z order, one per cube face
+float calcPointShadow(int firstTile, vec3 worldPos, vec3 norm, vec3 lightPos) {
+    if (firstTile < 0) {
+        return 1.0;
+    }
+    vec3 toFrag = worldPos - lightPos;
+    vec3 size = abs(toFrag);
+    int face;
+    if (size.x >= size.y && size.x >= size.z) {
+        face = toFrag.x > 0.0 ? 0 : 1;
+    } else if (size.y >= size.z) {
+        face = toFrag.y > 0.0 ? 2 : 3;
+    } else {
+        face = toFrag.z > 0.0 ? 4 : 5;
+    }
+    return sampleShadowTile(firstTile + face, worldPos, norm, lightPos);
+}
@@ -0,0 +1,663 @@
+//
+//  shadowAtlas.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-27.
+//
+
+#ifndef shadowAtlas_h
+#define shadowAtlas_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#include "shader.h"
+#include "lights.h"
+#include "lightManager.h"
+#include "cascadedShadows.h"
+#include "frustum.h"
+
+// Buddy allocator for power of two tiles in a square atlas. Every node of the quadtree is free,
+// split into four children or handed out whole. Released tiles merge back with their siblings.
+class AtlasQuadtree {
+public:
+    AtlasQuadtree(int size, int minTile)
+        : mSize(size), mMinTile(minTile), mUsedArea(0) {
+        mLevels = 1;
+        while ((size >> (mLevels - 1)) > minTile) {
+            mLevels++;
+        }
+        size_t nodeCount = 0;
+        for (int level = 0; level < mLevels; level++) {
+            nodeCount += size_t(1) << (2 * level);
+        }
+        mState.assign(nodeCount, FREE);
+        mX.resize(nodeCount);
+        mY.resize(nodeCount);
+        mTileSize.resize(nodeCount);
+        mX[0] = 0;
+        mY[0] = 0;
+        mTileSize[0] = size;
+        for (size_t node = 0; 4 * node + 4 < nodeCount; node++) {
+            int half = mTileSize[node] / 2;
+            for (int k = 0; k < 4; k++) {
+                size_t child = 4 * node + 1 + k;
+                mX[child] = mX[node] + (k & 1) * half;
+                mY[child] = mY[node] + (k >> 1) * half;
+                mTileSize[child] = half;
+            }
+        }
+    }
+
+    // a node index for a tile of tileSize (rounded up to a power of two), or -1 if none is free
+    int allocate(int tileSize) {
+        int level = 0;
+        while (level + 1 < mLevels && (mSize >> (level + 1)) >= tileSize) {
+            level++;
+        }
+        // prefer holes in already split nodes before splitting free ones
+        int node = find(0, 0, level, false);
+        if (node < 0) {
+            node = find(0, 0, level, true);
+        }
+        if (node >= 0) {
+            mState[node] = USED;
+            mUsedArea += static_cast<long long>(mTileSize[node]) * mTileSize[node];
+        }
+        return node;
+    }
+
+    void release(int node) {
+        mState[node] = FREE;
+        mUsedArea -= static_cast<long long>(mTileSize[node]) * mTileSize[node];
+        while (node > 0) {
+            int parent = (node - 1) / 4;
+            for (int k = 0; k < 4; k++) {
+                if (mState[4 * parent + 1 + k] != FREE) {
+                    return;
+                }
+            }
+            mState[parent] = FREE;
+            node = parent;
+        }
+    }
+
+    int tileX(int node) const {
+        return mX[node];
+    }
+
+    int tileY(int node) const {
+        return mY[node];
+    }
+
+    int tileSize(int node) const {
+        return mTileSize[node];
+    }
+
+    // fraction of the atlas handed out
+    float occupancy() const {
+        return static_cast<float>(mUsedArea) / (static_cast<float>(mSize) * mSize);
+    }
+
+private:
+    enum NodeState : unsigned char {
+        FREE,
+        SPLIT,
+        USED
+    };
+
+    int mSize;
+    int mMinTile;
+    int mLevels;
+    long long mUsedArea;
+    std::vector<unsigned char> mState;
+    std::vector<int> mX;
+    std::vector<int> mY;
+    std::vector<int> mTileSize;
+
+    int find(int node, int depth, int level, bool allowSplit) {
+        if (depth == level) {
+            return mState[node] == FREE ? node : -1;
+        }
+        if (mState[node] == USED || (mState[node] == FREE && !allowSplit)) {
+            return -1;
+        }
+        bool splitHere = mState[node] == FREE;
+        mState[node] = SPLIT;
+        for (int k = 0; k < 4; k++) {
+            int found = find(4 * node + 1 + k, depth + 1, level, allowSplit);
+            if (found >= 0) {
+                return found;
+            }
+        }
+        if (splitHere) {
+            mState[node] = FREE;
+        }
+        return -1;
+    }
+};
+
+// Shadows for point and spot lights, all packed into one depth texture.
+// Every frame the most important visible lights (by how many pixels they cover on screen) get
+// tiles sized to that importance, one per spot light and one per cube face for point lights.
+// Tiles stay with their light between frames and are only re-rendered when the light moves,
+// changes size or the static casters change. When the atlas is full, the least recently used
+// lights that aren't needed this frame give up their tiles. Tile rectangles and light matrices
+// go to the shaders through a buffer texture, see shadowAtlas.glsl.
+class ShadowAtlas {
+public:
+    ShadowAtlas(const std::string& shaderDirectory, int size = 4096, int minTile = 64, int maxTile = 1024,
+                unsigned int maxShadowedLights = 16)
+        : mDepthShader((shaderDirectory + "shadowDepth.vert").c_str(), (shaderDirectory + "shadowDepth.frag").c_str(),
+                       { shaderInputsDefine<PositionVertex>() }),
+          mTiles(size, minTile), mSize(size), mMinTile(minTile), mMaxTile(maxTile),
+          mMaxShadowedLights(maxShadowedLights), mFrame(0), mRecordsDirty(true),
+          mTilesRendered(0), mTilesReused(0), mCasterDraws(0), mShadowedLights(0), mEvictions(0) {
+        // keep a few more lights than are shadowed at once so lights going in and out of view
+        // can find their tiles again
+        unsigned int blocks = maxShadowedLights * 2;
+        for (unsigned int i = 0; i < blocks; i++) {
+            mFreeBlocks.push_back(static_cast<int>(blocks - 1 - i));
+        }
+        mRecords.assign(blocks * FACES * RECORD_TEXELS, glm::vec4(0.0f));
+
+        glGenTextures(1, &mDepthTexture);
+        glBindTexture(GL_TEXTURE_2D, mDepthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &mFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mDepthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "ERROR FRAMEBUFFER INCOMPLETE: shadow atlas" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(1, &mRecordBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, mRecordBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, mRecords.size() * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+        glGenTextures(1, &mRecordTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, mRecordTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, mRecordBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ShadowAtlas(const ShadowAtlas&) = delete;
+    ShadowAtlas& operator=(const ShadowAtlas&) = delete;
+
+    ~ShadowAtlas() {
+        glDeleteFramebuffers(1, &mFramebuffer);
+        glDeleteTextures(1, &mDepthTexture);
+        glDeleteTextures(1, &mRecordTexture);
+        glDeleteBuffers(1, &mRecordBuffer);
+    }
+
+    void enableHotReload() {
+        mDepthShader.enableHotReload();
+    }
+
+    void reloadIfChanged() {
+        mDepthShader.reloadIfChanged();
+    }
+
+    // re-render every tile, e.g. after editing a static model in place
+    void invalidate() {
+        for (auto& entry : mEntries) {
+            entry.second.rendered = false;
+        }
+    }
+
+    // Pick this frame's shadowed lights from the visible ones in lights, find them tiles and
+    // render the tiles that are out of date. Leaves framebuffer 0 bound, the caller restores
+    // its own viewport.
+    void update(const LightManager& lights, const std::vector<ShadowCaster>& staticCasters,
+                const glm::mat4& view, const glm::mat4& projection, int screenHeight) {
+        mFrame++;
+        mTilesRendered = 0;
+        mTilesReused = 0;
+        mCasterDraws = 0;
+        if (staticCastersMoved(staticCasters)) {
+            invalidate();
+        }
+
+        std::vector<Candidate> candidates;
+        glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
+        for (unsigned int index : lights.visibleSpotIndices()) {
+            const SpotLight& light = lights.spotLights()[index];
+            addCandidate(candidates, true, index, light.position, lightRange(light.attenuation, light.lightProp),
+                         cameraPos, projection, screenHeight);
+        }
+        for (unsigned int index : lights.visiblePointIndices()) {
+            const PointLight& light = lights.pointLights()[index];
+            addCandidate(candidates, false, index, light.position, lightRange(light.attenuation, light.lightProp),
+                         cameraPos, projection, screenHeight);
+        }
+        size_t shadowed = std::min<size_t>(candidates.size(), mMaxShadowedLights);
+        std::partial_sort(candidates.begin(), candidates.begin() + shadowed, candidates.end(),
+                          [](const Candidate& a, const Candidate& b) { return a.pixels > b.pixels; });
+
+        mShadowedLights = 0;
+        for (size_t i = 0; i < shadowed; i++) {
+            const Candidate& candidate = candidates[i];
+            Entry* entry = acquire(candidate);
+            if (entry == nullptr) {
+                continue;
+            }
+            if (candidate.spot) {
+                const SpotLight& light = lights.spotLights()[candidate.light];
+                refresh(*entry, light.position, light.direction, candidate.range, light.outerCutoff);
+            } else {
+                const PointLight& light = lights.pointLights()[candidate.light];
+                refresh(*entry, light.position, glm::vec3(0.0f), candidate.range, 0.0f);
+            }
+            mShadowedLights++;
+        }
+
+        renderDirtyTiles();
+        if (mRecordsDirty) {
+            glBindBuffer(GL_TEXTURE_BUFFER, mRecordBuffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, mRecords.size() * sizeof(glm::vec4), &mRecords[0]);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            mRecordsDirty = false;
+        }
+    }
+
+    // first tile of a light this frame, -1 if it isn't shadowed
+    int pointTile(size_t lightIndex) const {
+        return tileOf(key(false, lightIndex));
+    }
+
+    int spotTile(size_t lightIndex) const {
+        return tileOf(key(true, lightIndex));
+    }
+
+    // bind the atlas and the tile records and set the uniforms shadowAtlas.glsl reads
+    void bind(const Shader& shader, unsigned int atlasUnit, unsigned int tilesUnit) const {
+        glActiveTexture(GL_TEXTURE0 + atlasUnit);
+        glBindTexture(GL_TEXTURE_2D, mDepthTexture);
+        glActiveTexture(GL_TEXTURE0 + tilesUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, mRecordTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        shader.setInt("shadowAtlas", static_cast<int>(atlasUnit));
+        shader.setInt("shadowTiles", static_cast<int>(tilesUnit));
+        shader.setFloat("shadowAtlasTexel", 1.0f / mSize);
+    }
+
+    // fraction of the atlas area holding tiles
+    float occupancy() const {
+        return mTiles.occupancy();
+    }
+
+    // tiles rendered and tiles reused unchanged in the last update()
+    unsigned int tilesRendered() const {
+        return mTilesRendered;
+    }
+
+    unsigned int tilesReused() const {
+        return mTilesReused;
+    }
+
+    // caster draws into the tiles rendered in the last update()
+    unsigned int casterDraws() const {
+        return mCasterDraws;
+    }
+
+    unsigned int shadowedLights() const {
+        return mShadowedLights;
+    }
+
+    // lights that lost their tiles to make room since the atlas was created
+    unsigned long long evictions() const {
+        return mEvictions;
+    }
+
+private:
+    static const int FACES = 6;
+    static const int RECORD_TEXELS = 6;
+
+    struct Candidate {
+        bool spot;
+        size_t light;
+        float range;
+        float pixels;
+    };
+
+    // tiles held by one light
+    struct Entry {
+        int block;
+        int nodes[FACES];
+        int faceCount;
+        int tileSize;
+        glm::vec3 position;
+        glm::vec3 direction;
+        float range;
+        float cutoff;
+        unsigned long long lastUsed;
+        bool rendered;
+    };
+
+    // world bounds of a static mesh
+    struct CasterBounds {
+        size_t caster;
+        const Mesh* mesh;
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    Shader mDepthShader;
+    AtlasQuadtree mTiles;
+    int mSize;
+    int mMinTile;
+    int mMaxTile;
+    unsigned int mMaxShadowedLights;
+    unsigned long long mFrame;
+
+    unsigned int mDepthTexture;
+    unsigned int mFramebuffer;
+    unsigned int mRecordBuffer;
+    unsigned int mRecordTexture;
+
+    std::unordered_map<unsigned long long, Entry> mEntries;
+    std::vector<int> mFreeBlocks;
+    // per tile: atlas rect, normal offset, light matrix columns
+    std::vector<glm::vec4> mRecords;
+    bool mRecordsDirty;
+
+    std::vector<ShadowCaster> mLastStatic;
+    std::vector<CasterBounds> mCasterBounds;
+
+    unsigned int mTilesRendered;
+    unsigned int mTilesReused;
+    unsigned int mCasterDraws;
+    unsigned int mShadowedLights;
+    unsigned long long mEvictions;
+
+    static unsigned long long key(bool spot, size_t lightIndex) {
+        return (static_cast<unsigned long long>(spot) << 32) | lightIndex;
+    }
+
+    int tileOf(unsigned long long lightKey) const {
+        auto found = mEntries.find(lightKey);
+        if (found == mEntries.end() || found->second.lastUsed != mFrame) {
+            return -1;
+        }
+        return found->second.block * FACES;
+    }
+
+    bool staticCastersMoved(const std::vector<ShadowCaster>& staticCasters) {
+        bool moved = staticCasters.size() != mLastStatic.size();
+        for (size_t i = 0; i < staticCasters.size() && !moved; i++) {
+            moved = staticCasters[i].model != mLastStatic[i].model ||
+                    staticCasters[i].modelMat != mLastStatic[i].modelMat;
+        }
+        if (!moved) {
+            return false;
+        }
+        mLastStatic = staticCasters;
+        mCasterBounds.clear();
+        for (size_t c = 0; c < staticCasters.size(); c++) {
+            for (const Mesh& mesh : staticCasters[c].model->meshes()) {
+                CasterBounds bounds = { c, &mesh, glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+                for (int corner = 0; corner < 8; corner++) {
+                    glm::vec3 p((corner & 1) ? mesh.mBoundsMax.x : mesh.mBoundsMin.x,
+                                (corner & 2) ? mesh.mBoundsMax.y : mesh.mBoundsMin.y,
+                                (corner & 4) ? mesh.mBoundsMax.z : mesh.mBoundsMin.z);
+                    glm::vec3 world = glm::vec3(staticCasters[c].modelMat * glm::vec4(p, 1.0f));
+                    bounds.min = glm::min(bounds.min, world);
+                    bounds.max = glm::max(bounds.max, world);
+                }
+                mCasterBounds.push_back(bounds);
+            }
+        }
+        return true;
+    }
+
+    // importance is the height in pixels of the light's range sphere on screen
+    static void addCandidate(std::vector<Candidate>& candidates, bool spot, size_t light, const glm::vec3& position,
+                             float range, const glm::vec3& cameraPos, const glm::mat4& projection, int screenHeight) {
+        if (range <= 0.0f || range == FLT_MAX) {
+            return;
+        }
+        float distance = glm::length(position - cameraPos);
+        float pixels = static_cast<float>(screenHeight);
+        if (distance > range) {
+            pixels = range / std::sqrt(distance * distance - range * range) * projection[1][1] * screenHeight;
+        }
+        Candidate candidate = { spot, light, range, pixels };
+        candidates.push_back(candidate);
+    }
+
+    int tileSizeFor(const Candidate& candidate) const {
+        // six cube faces share the sphere a spot light's one tile covers
+        float pixels = candidate.spot ? candidate.pixels : candidate.pixels * 0.5f;
+        int size = mMinTile;
+        while (size < mMaxTile && size < pixels) {
+            size *= 2;
+        }
+        return size;
+    }
+
+    // the light's entry with tiles of about the right size, nullptr if the atlas has no room
+    Entry* acquire(const Candidate& candidate) {
+        int wanted = tileSizeFor(candidate);
+        unsigned long long lightKey = key(candidate.spot, candidate.light);
+        auto found = mEntries.find(lightKey);
+        if (found != mEntries.end()) {
+            Entry& entry = found->second;
+            entry.lastUsed = mFrame;
+            // grow straight away, only shrink once the light needs less than half the tile
+            if (wanted > entry.tileSize || wanted * 2 < entry.tileSize) {
+                int nodes[FACES];
+                if (allocateTiles(nodes, entry.faceCount, wanted)) {
+                    releaseTiles(entry.nodes, entry.faceCount);
+                    std::copy(nodes, nodes + entry.faceCount, entry.nodes);
+                    entry.tileSize = wanted;
+                    entry.rendered = false;
+                }
+            }
+            return &entry;
+        }
+
+        while (mFreeBlocks.empty()) {
+            if (!evictLeastRecentlyUsed()) {
+                return nullptr;
+            }
+        }
+        Entry entry;
+        entry.faceCount = candidate.spot ? 1 : FACES;
+        entry.tileSize = wanted;
+        // fall back to smaller tiles rather than no shadow at all
+        while (!allocateTiles(entry.nodes, entry.faceCount, entry.tileSize)) {
+            if (entry.tileSize <= mMinTile) {
+                return nullptr;
+            }
+            entry.tileSize /= 2;
+        }
+        entry.block = mFreeBlocks.back();
+        mFreeBlocks.pop_back();
+        entry.position = glm::vec3(0.0f);
+        entry.direction = glm::vec3(0.0f);
+        entry.range = 0.0f;
+        entry.cutoff = 0.0f;
+        entry.lastUsed = mFrame;
+        entry.rendered = false;
+        return &(mEntries[lightKey] = entry);
+    }
+
+    // allocates count tiles of size, evicting old lights until they fit
+    bool allocateTiles(int* nodes, int count, int size) {
+        for (;;) {
+            int allocated = 0;
+            while (allocated < count && (nodes[allocated] = mTiles.allocate(size)) >= 0) {
+                allocated++;
+            }
+            if (allocated == count) {
+                return true;
+            }
+            releaseTiles(nodes, allocated);
+            if (!evictLeastRecentlyUsed()) {
+                return false;
+            }
+        }
+    }
+
+    void releaseTiles(const int* nodes, int count) {
+        for (int i = 0; i < count; i++) {
+            mTiles.release(nodes[i]);
+        }
+    }
+
+    bool evictLeastRecentlyUsed() {
+        auto oldest = mEntries.end();
+        for (auto it = mEntries.begin(); it != mEntries.end(); ++it) {
+            if (it->second.lastUsed < mFrame && (oldest == mEntries.end() || it->second.lastUsed < oldest->second.lastUsed)) {
+                oldest = it;
+            }
+        }
+        if (oldest == mEntries.end()) {
+            return false;
+        }
+        releaseTiles(oldest->second.nodes, oldest->second.faceCount);
+        mFreeBlocks.push_back(oldest->second.block);
+        mEntries.erase(oldest);
+        mEvictions++;
+        return true;
+    }
+
+    void refresh(Entry& entry, const glm::vec3& position, const glm::vec3& direction, float range, float cutoff) {
+        if (position != entry.position || direction != entry.direction || range != entry.range || cutoff != entry.cutoff) {
+            entry.position = position;
+            entry.direction = direction;
+            entry.range = range;
+            entry.cutoff = cutoff;
+            entry.rendered = false;
+        }
+    }
+
+    void renderDirtyTiles() {
+        bool bound = false;
+        for (auto& item : mEntries) {
+            Entry& entry = item.second;
+            if (entry.lastUsed != mFrame) {
+                continue;
+            }
+            if (entry.rendered) {
+                mTilesReused += entry.faceCount;
+                continue;
+            }
+            if (!bound) {
+                glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+                glEnable(GL_DEPTH_TEST);
+                glEnable(GL_SCISSOR_TEST);
+                glEnable(GL_POLYGON_OFFSET_FILL);
+                glPolygonOffset(2.0f, 4.0f);
+                mDepthShader.use();
+                bound = true;
+            }
+            renderEntry(entry);
+            entry.rendered = true;
+            mTilesRendered += entry.faceCount;
+        }
+        if (bound) {
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glDisable(GL_SCISSOR_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+    }
+
+    void renderEntry(const Entry& entry) {
+        // static meshes inside the light's range, each face then only draws the ones in its frustum
+        std::vector<const CasterBounds*> casters;
+        BoxList boxes;
+        for (const CasterBounds& bounds : mCasterBounds) {
+            glm::vec3 closest = glm::clamp(entry.position, bounds.min, bounds.max);
+            if (glm::length(closest - entry.position) <= entry.range) {
+                casters.push_back(&bounds);
+                boxes.resize(casters.size());
+                boxes.set(casters.size() - 1, bounds.min, bounds.max);
+            }
+        }
+        std::vector<unsigned char> inFace(casters.size(), 0);
+
+        static const glm::vec3 faceAxes[FACES] = {
+            glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+        };
+        float nearPlane = std::max(entry.range * 0.002f, 0.01f);
+        for (int face = 0; face < entry.faceCount; face++) {
+            glm::vec3 axis;
+            float fov;
+            if (entry.faceCount == 1) {
+                axis = glm::normalize(entry.direction);
+                // the outer cone plus a little so the penumbra edge isn't clipped
+                fov = std::min(2.0f * std::acos(std::max(entry.cutoff, 0.0f)) * 1.05f, glm::radians(120.0f));
+            } else {
+                axis = faceAxes[face];
+                fov = glm::radians(90.0f);
+            }
+            glm::vec3 up = std::abs(axis.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            glm::mat4 lightMatrix = glm::perspective(fov, 1.0f, nearPlane, entry.range) *
+                                    glm::lookAt(entry.position, entry.position + axis, up);
+
+            int node = entry.nodes[face];
+            int x = mTiles.tileX(node);
+            int y = mTiles.tileY(node);
+            int size = mTiles.tileSize(node);
+            glViewport(x, y, size, size);
+            glScissor(x, y, size, size);
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+            glm::vec4 planes[6];
+            extractFrustumPlanes(lightMatrix, planes);
+            if (!casters.empty()) {
+                cullBoxes(planes, boxes, &inFace[0]);
+            }
+            size_t currentCaster = mLastStatic.size();
+            for (size_t c = 0; c < casters.size(); c++) {
+                if (!inFace[c]) {
+                    continue;
+                }
+                const CasterBounds* bounds = casters[c];
+                mCasterDraws++;
+                if (bounds->caster != currentCaster) {
+                    currentCaster = bounds->caster;
+                    mDepthShader.setMat4("lightMvp", lightMatrix * mLastStatic[currentCaster].modelMat);
+                }
+                bounds->mesh->drawPositions();
+            }
+
+            // about one and a half texels at unit distance from the light
+            float normalOffset = 1.5f * 2.0f * std::tan(fov * 0.5f) / size;
+            glm::vec4* record = &mRecords[(entry.block * FACES + face) * RECORD_TEXELS];
+            record[0] = glm::vec4(x, y, size, size) / static_cast<float>(mSize);
+            record[1] = glm::vec4(normalOffset, 0.0f, 0.0f, 0.0f);
+            for (int column = 0; column < 4; column++) {
+                record[2 + column] = lightMatrix[column];
+            }
+        }
+        mRecordsDirty = true;
+    }
+};
+
+#endif /* shadowAtlas_h */
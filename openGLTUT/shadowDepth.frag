@@ -0,0 +1,5 @@
+#version 330 core
+// only depth is written
+
+void main() {
+}
@@ -0,0 +1,9 @@
+#version 330 core
+// depth only pass for shadow maps, fed from the meshes' position only stream
+VERTEX_INPUTS
+
+uniform mat4 lightMvp;
+
+void main() {
+    gl_Position = lightMvp * vec4(aPos, 1.0);
+}
@@ -0,0 +1,46 @@
+// Cascaded shadow lookup for the directional light, the maps are rendered by cascadedShadows.h.
+
+// must match CascadedShadowMap::MAX_CASCADES
+#define MAX_CASCADES 4
+
+uniform sampler2DArrayShadow shadowMap;
+uniform int cascadeCount;
+uniform mat4 cascadeView;
+uniform float shadowTexelSize;
+uniform float cascadeSplits[MAX_CASCADES];           // far view depth of each cascade
+uniform float cascadeTexelWorldSize[MAX_CASCADES];
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+
+// 1 where worldPos is fully lit, 0 where it is fully in shadow
+float calcDirShadow(vec3 worldPos, vec3 norm) {
+    float viewDepth = -(cascadeView * vec4(worldPos, 1.0)).z;
+    int cascade = cascadeCount;
+    for (int i = 0; i < cascadeCount; i++) {
+        if (viewDepth < cascadeSplits[i]) {
+            cascade = i;
+            break;
+        }
+    }
+    if (cascade == cascadeCount) {
+        return 1.0;
+    }
+
+    // push the lookup out along the normal by about a texel to avoid acne
+    vec3 offsetPos = worldPos + norm * cascadeTexelWorldSize[cascade] * 1.5;
+    vec4 lightPos = cascadeMatrices[cascade] * vec4(offsetPos, 1.0);
+    vec3 coords = lightPos.xyz * 0.5 + 0.5;
+    // a staggered cascade may not quite cover where the camera is now
+    if (any(lessThan(coords, vec3(0.0))) || any(greaterThan(coords, vec3(1.0)))) {
+        return 1.0;
+    }
+
+    // 3x3 taps of the hardware 2x2 comparison
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            vec2 uv = coords.xy + vec2(x, y) * shadowTexelSize;
+            lit += texture(shadowMap, vec4(uv, float(cascade), coords.z));
+        }
+    }
+    return lit / 9.0;
+}
@@ -0,0 +1,143 @@
+//
+//  threadPool.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-20.
+//
+
+#ifndef threadPool_h
+#define threadPool_h
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+// A fixed set of worker threads for splitting CPU work (light assignment, culling, loading)
+// across cores. parallelFor blocks until every chunk is done, the calling thread helps out.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int workerCount)
+        : mStop(false), mGeneration(0), mActiveWorkers(0), mJob(nullptr), mCount(0), mGrain(1), mNext(0) {
+        for (unsigned int i = 0; i < workerCount; i++) {
+            mWorkers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mWake.notify_all();
+        for (std::thread& worker : mWorkers) {
+            worker.join();
+        }
+    }
+
+    // shared pool with one thread per core, counting the caller
+    static ThreadPool& instance() {
+        unsigned int cores = std::thread::hardware_concurrency();
+        static ThreadPool pool(cores > 1 ? cores - 1 : 0);
+        return pool;
+    }
+
+    size_t threadCount() const {
+        return mWorkers.size() + 1;
+    }
+
+    // calls fn(begin, end) for chunks of at most grain items covering [0, count)
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+        if (count == 0) {
+            return;
+        }
+        grain = std::max<size_t>(grain, 1);
+        // small jobs, single core machines and jobs started from inside a job run inline
+        if (mWorkers.empty() || count <= grain || insideJob()) {
+            for (size_t begin = 0; begin < count; begin += grain) {
+                fn(begin, std::min(begin + grain, count));
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> dispatch(mDispatchMutex);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mJob = &fn;
+            mCount = count;
+            mGrain = grain;
+            mNext = 0;
+            mActiveWorkers = mWorkers.size();
+            mGeneration++;
+        }
+        mWake.notify_all();
+
+        runChunks();
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [this]() { return mActiveWorkers == 0; });
+        mJob = nullptr;
+    }
+
+private:
+    std::vector<std::thread> mWorkers;
+    std::mutex mDispatchMutex;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    bool mStop;
+    unsigned long long mGeneration;
+    size_t mActiveWorkers;
+
+    // the job currently being run
+    const std::function<void(size_t, size_t)>* mJob;
+    size_t mCount;
+    size_t mGrain;
+    std::atomic<size_t> mNext;
+
+    static bool& insideJob() {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    void runChunks() {
+        insideJob() = true;
+        for (;;) {
+            size_t begin = mNext.fetch_add(mGrain);
+            if (begin >= mCount) {
+                break;
+            }
+            (*mJob)(begin, std::min(begin + mGrain, mCount));
+        }
+        insideJob() = false;
+    }
+
+    void workerLoop() {
+        unsigned long long seenGeneration = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWake.wait(lock, [&]() { return mStop || mGeneration != seenGeneration; });
+                if (mStop) {
+                    return;
+                }
+                seenGeneration = mGeneration;
+            }
+            runChunks();
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (--mActiveWorkers == 0) {
+                    mDone.notify_one();
+                }
+            }
+        }
+    }
+};
+
+#endif /* threadPool_h */
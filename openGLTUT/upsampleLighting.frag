@@ -0,0 +1,55 @@
+#version 330 core
+// Joint bilateral upsample of lighting rendered at 1 / lightingScale resolution. Each pixel
+// blends the four nearest low resolution samples, weighted by distance as usual and by how
+// closely each sample's depth and normal match its own, so light doesn't bleed across edges.
+out vec4 FragColour;
+
+uniform sampler2D lowLight;     // lighting without albedo, see DEMODULATE_ALBEDO
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform int lightingScale;
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth <= 0.0) {
+        discard;
+    }
+    vec3 norm = texelFetch(gNormal, pixel, 0).xyz;
+
+    // low resolution sample i was shaded from G-buffer texel i * scale + scale / 2
+    ivec2 lowSize = textureSize(lowLight, 0);
+    vec2 lowPos = (vec2(pixel) - float(lightingScale / 2)) / float(lightingScale);
+    ivec2 base = ivec2(floor(lowPos));
+    vec2 f = lowPos - vec2(base);
+
+    vec3 light = vec3(0.0);
+    float totalWeight = 0.0;
+    vec3 closestLight = vec3(0.0);
+    float closestDepth = 1.0e30;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 tap = clamp(base + offset, ivec2(0), lowSize - 1);
+        ivec2 texel = min(tap * lightingScale + lightingScale / 2, textureSize(gDepth, 0) - 1);
+        float sampleDepth = texelFetch(gDepth, texel, 0).r;
+        vec3 sampleNorm = texelFetch(gNormal, texel, 0).xyz;
+        vec3 sampleLight = texelFetch(lowLight, tap, 0).rgb;
+
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float depthWeight = exp(-abs(sampleDepth - depth) / (0.02 * depth));
+        float normalWeight = pow(max(dot(norm, sampleNorm), 0.0), 16.0);
+        float weight = bilinear.x * bilinear.y * depthWeight * normalWeight;
+        light += sampleLight * weight;
+        totalWeight += weight;
+
+        float depthDifference = abs(sampleDepth - depth);
+        if (depthDifference < closestDepth) {
+            closestDepth = depthDifference;
+            closestLight = sampleLight;
+        }
+    }
+    // no sample is on the same surface, e.g. thin geometry, take the nearest in depth
+    light = totalWeight > 1.0e-4 ? light / totalWeight : closestLight;
+    FragColour = vec4(light * texelFetch(gAlbedo, pixel, 0).rgb, 1.0);
+}
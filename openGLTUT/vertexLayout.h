@@ -0,0 +1,112 @@
+//
+//  vertexLayout.h
+//  openGLTUT
+//
+//  Created by Davan Basran on 2018-07-18.
+//
+
+#ifndef vertexLayout_h
+#define vertexLayout_h
+
+#include <glad/glad.h>
+
+// GLM
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <string>
+#include <sstream>
+
+// maps a C++ attribute type to what glVertexAttribPointer and GLSL need to know about it
+template <typename T>
+struct AttributeTraits;
+
+template <>
+struct AttributeTraits<float> {
+    static const GLenum type = GL_FLOAT;
+    static const GLint components = 1;
+    static const char* glslType() { return "float"; }
+};
+
+template <>
+struct AttributeTraits<glm::vec2> {
+    static const GLenum type = GL_FLOAT;
+    static const GLint components = 2;
+    static const char* glslType() { return "vec2"; }
+};
+
+template <>
+struct AttributeTraits<glm::vec3> {
+    static const GLenum type = GL_FLOAT;
+    static const GLint components = 3;
+    static const char* glslType() { return "vec3"; }
+};
+
+template <>
+struct AttributeTraits<glm::vec4> {
+    static const GLenum type = GL_FLOAT;
+    static const GLint components = 4;
+    static const char* glslType() { return "vec4"; }
+};
+
+// One attribute of a vertex struct: where it lives in the struct and which shader location it
+// feeds. Offset is normally offsetof(VertexType, member). A non zero Divisor makes it a per
+// instance attribute.
+template <GLuint Location, typename T, size_t Offset, GLboolean Normalized = GL_FALSE, GLuint Divisor = 0>
+struct VertexAttribute {
+    static const GLuint location = Location;
+    static const size_t offset = Offset;
+
+    static void enable(GLsizei stride) {
+        glVertexAttribPointer(Location, AttributeTraits<T>::components, AttributeTraits<T>::type,
+                              Normalized, stride, reinterpret_cast<void*>(Offset));
+        glEnableVertexAttribArray(Location);
+        if (Divisor != 0) {
+            glVertexAttribDivisor(Location, Divisor);
+        }
+    }
+
+    static void declare(std::ostringstream& out, const char* name) {
+        out << " layout (location = " << Location << ") in " << AttributeTraits<T>::glslType()
+            << " " << name << ";";
+    }
+};
+
+// Describes how VertexType is laid out for the GPU. Everything is a template parameter so the
+// attribute setup unrolls into straight glVertexAttribPointer calls with no runtime branching.
+template <typename VertexType, typename... Attributes>
+struct VertexLayout {
+    static const GLsizei stride = sizeof(VertexType);
+    static const size_t attributeCount = sizeof...(Attributes);
+
+    // set up every attribute on the currently bound VAO and GL_ARRAY_BUFFER
+    static void enable() {
+        int expand[] = { 0, (Attributes::enable(stride), 0)... };
+        (void)expand;
+    }
+
+    // GLSL input declarations matching this layout on one line, names are given in attribute
+    // order
+    static std::string shaderInputs(const char* const (&names)[sizeof...(Attributes)]) {
+        std::ostringstream out;
+        size_t i = 0;
+        int expand[] = { 0, (Attributes::declare(out, names[i++]), 0)... };
+        (void)expand;
+        return out.str();
+    }
+};
+
+// Specialise for every vertex struct a mesh can be built from, with a Layout typedef and a
+// shaderInputs() naming its attributes the way the shaders read them.
+template <typename VertexType>
+struct VertexFormat;
+
+// "<macro> <input declarations>" for a Shader's defines. Vertex shaders declare their inputs
+// with a line reading just the macro, so they always match the layout the buffers are set up
+// with. Shaders fed from two streams, e.g. per vertex and per instance, use two macros.
+template <typename VertexType>
+std::string shaderInputsDefine(const char* macro = "VERTEX_INPUTS") {
+    return macro + VertexFormat<VertexType>::shaderInputs();
+}
+
+#endif /* vertexLayout_h */
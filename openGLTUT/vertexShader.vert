@@ -1,26 +1,39 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aTexCoods;
-layout (location = 3) in vec3 aTangents;
-layout (location = 4) in vec3 aBitangents;
+// declared from VertexFormat<Vertex>, see shaderInputsDefine()
+VERTEX_INPUTS
+#ifdef BAKED_LIGHTING
+out vec2 LightmapCoords;
+#endif
 
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
-out vec3 Tangents;
-out vec3 Bitangents;
 
+// computed once per draw on the CPU instead of once per vertex
 uniform mat4 model;
+uniform mat4 mvp;
+uniform mat3 normalMatrix;
+#ifdef PER_VERTEX_MATRICES
+// the old way, only built by --vertex-benchmark to compare against
 uniform mat4 view;
 uniform mat4 projection;
+#endif
+
+// the same as depthPrepass.vert so a pre-pass's depth compares equal
+invariant gl_Position;
 
 void main() {
+#ifdef PER_VERTEX_MATRICES
     gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    Normal = mat3(transpose(inverse(model))) * aNormal;
+#else
+    gl_Position = mvp * vec4(aPos, 1.0f);
+    Normal = normalMatrix * aNormal;
+#endif
     FragPos = vec3(model * vec4(aPos, 1.0));
     TexCoords = aTexCoods;
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    Tangents = vec3(model * vec4(aTangents, 1.0));
-    Bitangents = vec3(model * vec4(aBitangents, 1.0));
+#ifdef BAKED_LIGHTING
+    LightmapCoords = aLightmapCoords;
+#endif
 }